@@ -369,6 +369,26 @@
                       forKey:PPTCPSTREAMCONTROLLER_IP_DROP_BAD_CHECKSUMS];
     [defaultValues setObject:[NSNumber numberWithBool:NO]
                       forKey:PPTCPSTREAMCONTROLLER_TCP_DROP_BAD_CHECKSUMS];
+    [defaultValues
+        setObject:[NSNumber numberWithInt:DEFAULT_TCPSTREAM_MAX_STREAMS]
+           forKey:PPTCPSTREAMCONTROLLER_MAX_STREAMS];
+    [defaultValues
+        setObject:[NSNumber numberWithInt:DEFAULT_TCPSTREAM_MAX_PACKETS]
+           forKey:PPTCPSTREAMCONTROLLER_MAX_PACKETS];
+    [defaultValues
+        setObject:[NSNumber numberWithInt:DEFAULT_HOSTCACHE_CAPACITY]
+           forKey:PPHOSTCACHE_CAPACITY];
+    [defaultValues
+        setObject:[NSNumber numberWithDouble:DEFAULT_HOSTCACHE_POSITIVE_TTL]
+           forKey:PPHOSTCACHE_POSITIVE_TTL];
+    [defaultValues
+        setObject:[NSNumber numberWithDouble:DEFAULT_HOSTCACHE_NEGATIVE_TTL]
+           forKey:PPHOSTCACHE_NEGATIVE_TTL];
+    [defaultValues
+        setObject:[NSNumber numberWithInt:DEFAULT_HOSTCACHE_MAX_QUERIES]
+           forKey:PPHOSTCACHE_MAX_QUERIES];
+    [defaultValues setObject:DEFAULT_HOSTCACHE_DNS_SERVER
+                      forKey:PPHOSTCACHE_DNS_SERVER];
     [defaultValues setObject:@"en0" forKey:CAPTURE_SETUP_INTERFACE];
     [defaultValues
         setObject:[NSNumber numberWithFloat:DEFAULT_UI_UPDATE_FREQUENCY]
@@ -29,14 +29,21 @@
 @class NSObject;
 @protocol NSCoding;
 
+struct bpf_batch_prog;
+
 @interface PPBPFProgram : NSObject <NSCoding>
 {
     struct bpf_program m_program;
+    struct bpf_batch_prog* m_batch; /* NULL if not batchable */
 }
 
 - (id)initWithProgram:(struct bpf_program*)program;
 - (const struct bpf_program*)program;
 
+/* returns the program compiled for bpf_batch_filter, or NULL if the
+   program uses instructions the batch evaluator doesn't support */
+- (const struct bpf_batch_prog*)batchProgram;
+
 @end
 
 #endif
@@ -18,6 +18,7 @@
  */
 
 #include "PPBPFProgram.h"
+#include "bpf_batch.h"
 #import <Foundation/NSObject.h>
 #include <net/bpf.h>
 #include <stdlib.h>
@@ -45,6 +46,8 @@
             m_program.bf_insns,
             program->bf_insns,
             m_program.bf_len * sizeof(struct bpf_insn));
+
+        m_batch = bpf_batch_compile(m_program.bf_insns, m_program.bf_len);
     }
     return self;
 
@@ -58,6 +61,11 @@ err:
     return &m_program;
 }
 
+- (const struct bpf_batch_prog*)batchProgram
+{
+    return m_batch;
+}
+
 - (void)encodeWithCoder:(NSCoder*)encoder
 {
     [encoder encodeValueOfObjCType:@encode(unsigned int) at:&m_program.bf_len];
@@ -78,6 +86,8 @@ err:
         [decoder decodeArrayOfObjCType:@encode(struct bpf_insn)
                                  count:m_program.bf_len
                                     at:m_program.bf_insns];
+
+        m_batch = bpf_batch_compile(m_program.bf_insns, m_program.bf_len);
     }
     return self;
 
@@ -90,6 +100,7 @@ err:
 {
     if (m_program.bf_insns != NULL)
         free(m_program.bf_insns);
+    bpf_batch_free(m_batch);
     [super dealloc];
 }
 
@@ -0,0 +1,73 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PPPAYLOADSEARCH_H_
+#define PPPAYLOADSEARCH_H_
+
+#import <Foundation/NSObject.h>
+#include <stdint.h>
+
+/* number of packets a search thread claims at a time */
+#define PPPAYLOADSEARCH_CHUNK_SZ 256
+
+/* longest run of contiguous stream data a regular expression is matched
+   against, matches spanning more than this may be missed */
+#define PPPAYLOADSEARCH_REGEX_WINDOW (1024 * 1024)
+
+@class NSArray;
+@class NSRegularExpression;
+@class NSString;
+@class Packet;
+@class PPTCPStream;
+@class PPTaskGroup;
+
+struct payload_search;
+struct payload_search_job;
+
+@interface PPPayloadSearch : NSObject
+{
+    struct payload_search* m_literals;
+    NSRegularExpression* m_regex;
+}
+
+/* searchString is either a list of literal strings separated by `|', any of
+   which may match, or a regular expression written as /regex/ or /regex/i.
+   Returns nil, with an error pushed on the shared ErrorStack, if
+   searchString can't be compiled */
+- (id)initWithString:(NSString*)searchString;
+
+- (BOOL)matchesPacket:(Packet*)packet;
+
+/* searches every packet's data, and the reassembled payload of every stream
+   so that matches spanning several segments are found too, using a thread
+   per processor. results[i] is set to 1 for each packet i in packets that
+   matches; it may be read by other threads while the search is running.
+   A unit of progress is added to group for each packet and each stream
+   searched, and the search stops early once group is cancelled. */
+- (void)searchPackets:(NSArray*)packets
+              streams:(NSArray*)streams
+              results:(volatile uint8_t*)results
+                group:(PPTaskGroup*)group;
+
+- (void)searchStream:(PPTCPStream*)stream
+                 job:(struct payload_search_job*)job; /* private method */
+
+@end
+
+#endif
@@ -0,0 +1,600 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "PPPayloadSearch.h"
+#include "../../Shared/Decoding/Packet.h"
+#include "../../Shared/Decoding/TCPDecode.h"
+#include "../../Shared/ErrorStack.h"
+#include "../PPTaskGroup.h"
+#include "../TCPStreams/PPTCPStream.h"
+#include "payload_search.h"
+#include <CoreFoundation/CFDictionary.h>
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSData.h>
+#import <Foundation/NSRegularExpression.h>
+#import <Foundation/NSString.h>
+#import <Foundation/NSTextCheckingResult.h>
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PPPAYLOADSEARCH_MAX_THREADS 64
+
+struct payload_search_job
+{
+    PPPayloadSearch* search;
+    NSArray* packets;
+    NSArray* streams;
+    CFDictionaryRef indexes; /* Packet* -> index in packets + 1 */
+    volatile uint8_t* results;
+    PPTaskGroup* group;
+    volatile int64_t next_packet;
+    volatile int64_t next_stream;
+};
+
+/* one direction of a stream being scanned */
+struct stream_direction
+{
+    uint32_t next_seq_no;
+    unsigned int state; /* literal automaton state */
+    BOOL started;
+
+    /* regular expressions are run over contiguous runs of data, with the
+       index of the packet that each segment of the run came from */
+    uint8_t* run;
+    size_t run_len;
+    size_t run_cap;
+    size_t* seg_ends;
+    long* seg_packets;
+    size_t nsegs;
+    size_t segs_cap;
+};
+
+static struct payload_search* literals_compile(NSString* searchString);
+static void* search_thread(void* args);
+static void mark_packet(struct payload_search_job* job, long packetIndex);
+static long index_for_packet(struct payload_search_job* job, Packet* packet);
+static BOOL direction_append(
+    struct stream_direction* dir,
+    const uint8_t* data,
+    size_t len,
+    long packetIndex);
+static void direction_flush(
+    NSRegularExpression* regex,
+    struct payload_search_job* job,
+    struct stream_direction* dir);
+static void direction_mark_match(
+    struct payload_search_job* job,
+    const struct stream_direction* dir,
+    NSRange match);
+static void direction_free(struct stream_direction* dir);
+static NSString* latin1_string(const uint8_t* bytes, size_t length);
+static NSRange regex_first_match(
+    NSRegularExpression* regex,
+    const uint8_t* bytes,
+    size_t length,
+    NSUInteger location);
+
+@implementation PPPayloadSearch
+
+- (id)initWithString:(NSString*)searchString
+{
+    if ((self = [super init]) != nil)
+    {
+        NSRegularExpressionOptions options;
+        NSUInteger end;
+
+        m_literals = NULL;
+        m_regex = nil;
+
+        /* /regex/ or /regex/i */
+        options = 0;
+        end = 0;
+
+        if ([searchString length] > 2 && [searchString hasPrefix:@"/"])
+        {
+            if ([searchString hasSuffix:@"/"])
+            {
+                end = [searchString length] - 1;
+            }
+            else if (
+                [searchString length] > 3 && [searchString hasSuffix:@"/i"])
+            {
+                end = [searchString length] - 2;
+                options |= NSRegularExpressionCaseInsensitive;
+            }
+        }
+
+        if (end > 1)
+        {
+            NSError* error;
+
+            error = nil;
+
+            if ((m_regex = [[NSRegularExpression alloc]
+                     initWithPattern:[searchString
+                                         substringWithRange:NSMakeRange(
+                                                                1, end - 1)]
+                             options:options
+                               error:&error]) == nil)
+            {
+                [[ErrorStack sharedErrorStack]
+                    pushError:[NSString
+                                  stringWithFormat:
+                                      @"Invalid regular expression: %@",
+                                      [error localizedDescription]]
+                       lookup:Nil
+                         code:0
+                     severity:ERRS_ERROR];
+                goto err;
+            }
+        }
+        else if ((m_literals = literals_compile(searchString)) == NULL)
+        {
+            goto err;
+        }
+    }
+    return self;
+
+err:
+    [self release];
+    return nil;
+}
+
+- (BOOL)matchesPacket:(Packet*)packet
+{
+    NSData* data;
+    unsigned int state;
+    size_t end;
+
+    data = [packet packetData];
+
+    if (m_literals != NULL)
+    {
+        state = PAYLOAD_SEARCH_START;
+        return payload_search_scan(
+                   m_literals, &state, [data bytes], [data length], &end)
+                   ? YES
+                   : NO;
+    }
+
+    return (regex_first_match(m_regex, [data bytes], [data length], 0)
+                .location != NSNotFound)
+               ? YES
+               : NO;
+}
+
+- (void)searchPackets:(NSArray*)packets
+              streams:(NSArray*)streams
+              results:(volatile uint8_t*)results
+                group:(PPTaskGroup*)group
+{
+    struct payload_search_job job;
+    CFMutableDictionaryRef indexes;
+    pthread_t threads[PPPAYLOADSEARCH_MAX_THREADS];
+    long ncpus, nthreads;
+    NSUInteger i;
+
+    indexes = CFDictionaryCreateMutable(
+        kCFAllocatorDefault, [packets count], NULL, NULL);
+
+    /* the stream search needs to map each segment back to its packet */
+    for (i = 0; indexes != NULL && [streams count] > 0 && i < [packets count];
+         ++i)
+        CFDictionarySetValue(
+            indexes,
+            [packets objectAtIndex:i],
+            (const void*)(uintptr_t)(i + 1));
+
+    job.search = self;
+    job.packets = packets;
+    job.streams = (indexes != NULL) ? streams : nil;
+    job.indexes = indexes;
+    job.results = results;
+    job.group = group;
+    job.next_packet = 0;
+    job.next_stream = 0;
+
+    if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        ncpus = 1;
+
+    if (ncpus > PPPAYLOADSEARCH_MAX_THREADS)
+        ncpus = PPPAYLOADSEARCH_MAX_THREADS;
+
+    /* the calling thread does its share too */
+    for (nthreads = 0; nthreads < ncpus - 1; ++nthreads)
+    {
+        if (pthread_create(&threads[nthreads], NULL, search_thread, &job) != 0)
+            break;
+    }
+
+    (void)search_thread(&job);
+
+    for (i = 0; i < (NSUInteger)nthreads; ++i)
+        (void)pthread_join(threads[i], NULL);
+
+    if (indexes != NULL)
+        CFRelease(indexes);
+}
+
+- (void)searchStream:(PPTCPStream*)stream job:(struct payload_search_job*)job
+{
+    struct stream_direction dirs[2];
+    size_t i, end;
+    unsigned int d;
+
+    memset(dirs, 0, sizeof(dirs));
+
+    for (i = 0;
+         i < [stream packetsCount] && !PPTaskGroupIsCancelled(job->group);
+         ++i)
+    {
+        struct stream_direction* dir;
+        TCPDecode* segment;
+        NSData* payload;
+        const uint8_t* bytes;
+        long packetIndex;
+        uint32_t seq_no;
+        size_t offset, len;
+
+        segment = [stream segmentAtIndex:i];
+        payload = [segment payload];
+
+        if ((len = [payload length]) < 1)
+            continue;
+
+        dir = &dirs[[stream segmentIsClient:segment] ? 0 : 1];
+        seq_no = [segment seqNo] + ([segment synFlag] ? 1 : 0);
+        offset = 0;
+
+        if (!dir->started || TCP_SEQ_GT(seq_no, dir->next_seq_no))
+        {
+            /* data is missing, so nothing can match across the gap */
+            if (m_regex != nil)
+                direction_flush(m_regex, job, dir);
+            dir->state = PAYLOAD_SEARCH_START;
+            dir->started = YES;
+        }
+        else if (TCP_SEQ_GT(dir->next_seq_no, seq_no))
+        {
+            /* skip data we have already seen */
+            if ((offset = TCP_SEQNO_DIFF(dir->next_seq_no, seq_no)) >= len)
+                continue;
+        }
+
+        dir->next_seq_no = seq_no + len;
+        packetIndex = index_for_packet(job, [stream packetAtIndex:i]);
+        bytes = (const uint8_t*)[payload bytes] + offset;
+        len -= offset;
+
+        if (m_literals != NULL)
+        {
+            while (len > 0 &&
+                   payload_search_scan(m_literals, &dir->state, bytes, len, &end))
+            {
+                mark_packet(job, packetIndex);
+                bytes += end;
+                len -= end;
+            }
+        }
+        else
+        {
+            if (dir->run_len + len > PPPAYLOADSEARCH_REGEX_WINDOW)
+                direction_flush(m_regex, job, dir);
+
+            if (!direction_append(dir, bytes, len, packetIndex))
+                break;
+        }
+    }
+
+    for (d = 0; d < 2; ++d)
+    {
+        if (m_regex != nil && !PPTaskGroupIsCancelled(job->group))
+            direction_flush(m_regex, job, &dirs[d]);
+        direction_free(&dirs[d]);
+    }
+}
+
+- (void)dealloc
+{
+    payload_search_free(m_literals);
+    [m_regex release];
+    [super dealloc];
+}
+
+@end
+
+static void* search_thread(void* args)
+{
+    struct payload_search_job* job;
+    NSUInteger npackets, nstreams;
+    int64_t start;
+
+    job = args;
+    npackets = [job->packets count];
+    nstreams = [job->streams count];
+
+    /* packets are claimed a chunk at a time, then streams one at a time */
+    while (!PPTaskGroupIsCancelled(job->group) &&
+           (start = OSAtomicAdd64Barrier(
+                        PPPAYLOADSEARCH_CHUNK_SZ, &job->next_packet) -
+                    PPPAYLOADSEARCH_CHUNK_SZ) < (int64_t)npackets)
+    {
+        NSAutoreleasePool* autoreleasePool;
+        NSUInteger i, end;
+
+        autoreleasePool = [[NSAutoreleasePool alloc] init];
+        end = MIN(npackets, (NSUInteger)start + PPPAYLOADSEARCH_CHUNK_SZ);
+
+        for (i = start; i < end; ++i)
+        {
+            if ([job->search matchesPacket:[job->packets objectAtIndex:i]])
+                job->results[i] = 1;
+        }
+
+        PPTaskGroupAddProgress(job->group, end - start);
+        [autoreleasePool release];
+    }
+
+    while (!PPTaskGroupIsCancelled(job->group) &&
+           (start = OSAtomicIncrement64Barrier(&job->next_stream) - 1) <
+               (int64_t)nstreams)
+    {
+        NSAutoreleasePool* autoreleasePool;
+
+        autoreleasePool = [[NSAutoreleasePool alloc] init];
+        [job->search searchStream:[job->streams objectAtIndex:start] job:job];
+        PPTaskGroupAddProgress(job->group, 1);
+        [autoreleasePool release];
+    }
+
+    return NULL;
+}
+
+static void mark_packet(struct payload_search_job* job, long packetIndex)
+{
+    if (packetIndex >= 0)
+        job->results[packetIndex] = 1;
+}
+
+/* returns the index of packet in the packets being searched, or -1 */
+static long index_for_packet(struct payload_search_job* job, Packet* packet)
+{
+    const void* value;
+
+    if (packet == nil || job->indexes == NULL ||
+        !CFDictionaryGetValueIfPresent(job->indexes, packet, &value))
+        return -1;
+
+    return (long)(uintptr_t)value - 1;
+}
+
+/* matches the regular expression against the run of data accumulated so
+   far, marking the packet holding the last byte of each match. The run is
+   made into a string once, and all of its matches found in one pass */
+static void direction_flush(
+    NSRegularExpression* regex,
+    struct payload_search_job* job,
+    struct stream_direction* dir)
+{
+    NSString* string;
+
+    if (dir->run_len > 0 &&
+        (string = latin1_string(dir->run, dir->run_len)) != nil)
+    {
+        [regex enumerateMatchesInString:string
+                                options:0
+                                  range:NSMakeRange(0, dir->run_len)
+                             usingBlock:^(
+                                 NSTextCheckingResult* result,
+                                 NSMatchingFlags flags,
+                                 BOOL* stop) {
+                                 direction_mark_match(job, dir, [result range]);
+                             }];
+        [string release];
+    }
+
+    dir->run_len = 0;
+    dir->nsegs = 0;
+}
+
+/* marks the packet holding the last byte of match, a range of the run */
+static void direction_mark_match(
+    struct payload_search_job* job,
+    const struct stream_direction* dir,
+    NSRange match)
+{
+    size_t lo, hi, last;
+
+    if (match.length == 0)
+        return;
+
+    /* find the segment holding the last byte of the match */
+    last = NSMaxRange(match) - 1;
+    lo = 0;
+    hi = dir->nsegs - 1;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if (dir->seg_ends[mid] > last)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    mark_packet(job, dir->seg_packets[lo]);
+}
+
+static BOOL direction_append(
+    struct stream_direction* dir,
+    const uint8_t* data,
+    size_t len,
+    long packetIndex)
+{
+    if (dir->run_len + len > dir->run_cap)
+    {
+        size_t cap;
+        uint8_t* run;
+
+        cap = (dir->run_cap == 0) ? 64 * 1024 : dir->run_cap;
+
+        while (cap < dir->run_len + len)
+            cap *= 2;
+
+        if ((run = realloc(dir->run, cap)) == NULL)
+            return NO;
+
+        dir->run = run;
+        dir->run_cap = cap;
+    }
+
+    if (dir->nsegs == dir->segs_cap)
+    {
+        size_t cap;
+        size_t* ends;
+        long* packets;
+
+        cap = (dir->segs_cap == 0) ? 64 : dir->segs_cap * 2;
+
+        if ((ends = realloc(dir->seg_ends, cap * sizeof(*ends))) == NULL)
+            return NO;
+
+        dir->seg_ends = ends;
+
+        if ((packets = realloc(dir->seg_packets, cap * sizeof(*packets))) ==
+            NULL)
+            return NO;
+
+        dir->seg_packets = packets;
+        dir->segs_cap = cap;
+    }
+
+    memcpy(dir->run + dir->run_len, data, len);
+    dir->run_len += len;
+    dir->seg_ends[dir->nsegs] = dir->run_len;
+    dir->seg_packets[dir->nsegs] = packetIndex;
+    ++dir->nsegs;
+
+    return YES;
+}
+
+static void direction_free(struct stream_direction* dir)
+{
+    free(dir->run);
+    free(dir->seg_ends);
+    free(dir->seg_packets);
+}
+
+/* returns a string, which the caller must release, over the bytes without
+   copying them. They're treated as ISO Latin 1 so that every byte value is a
+   character */
+static NSString* latin1_string(const uint8_t* bytes, size_t length)
+{
+    return [[NSString alloc] initWithBytesNoCopy:(void*)bytes
+                                          length:length
+                                        encoding:NSISOLatin1StringEncoding
+                                    freeWhenDone:NO];
+}
+
+/* returns the range of the first match at or after location in the bytes */
+static NSRange regex_first_match(
+    NSRegularExpression* regex,
+    const uint8_t* bytes,
+    size_t length,
+    NSUInteger location)
+{
+    NSString* string;
+    NSRange match;
+
+    if ((string = latin1_string(bytes, length)) == nil)
+        return NSMakeRange(NSNotFound, 0);
+
+    match = [regex rangeOfFirstMatchInString:string
+                                     options:0
+                                       range:NSMakeRange(
+                                                 location, length - location)];
+    [string release];
+
+    return match;
+}
+
+/* compiles the `|' separated literals in searchString */
+static struct payload_search* literals_compile(NSString* searchString)
+{
+    struct payload_search* ps;
+    NSArray* components;
+    NSMutableArray* literals;
+    const uint8_t** patterns;
+    size_t* lengths;
+    NSUInteger i;
+
+    components = [searchString componentsSeparatedByString:@"|"];
+    literals = [NSMutableArray arrayWithCapacity:[components count]];
+
+    for (i = 0; i < [components count]; ++i)
+    {
+        NSData* literal;
+
+        literal = [[components objectAtIndex:i]
+            dataUsingEncoding:NSUTF8StringEncoding];
+
+        if ([literal length] > 0)
+            [literals addObject:literal];
+    }
+
+    if ([literals count] == 0)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Nothing to search for"
+                                          lookup:Nil
+                                            code:0
+                                        severity:ERRS_ERROR];
+        return NULL;
+    }
+
+    ps = NULL;
+    patterns = malloc([literals count] * sizeof(*patterns));
+    lengths = malloc([literals count] * sizeof(*lengths));
+
+    if (patterns != NULL && lengths != NULL)
+    {
+        for (i = 0; i < [literals count]; ++i)
+        {
+            patterns[i] = [[literals objectAtIndex:i] bytes];
+            lengths[i] = [[literals objectAtIndex:i] length];
+        }
+
+        ps = payload_search_compile(patterns, lengths, [literals count]);
+    }
+
+    free(patterns);
+    free(lengths);
+
+    if (ps == NULL)
+        [[ErrorStack sharedErrorStack] pushError:@"Search strings are too long"
+                                          lookup:Nil
+                                            code:0
+                                        severity:ERRS_ERROR];
+
+    return ps;
+}
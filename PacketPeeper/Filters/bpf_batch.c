@@ -0,0 +1,824 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+    Evaluates a filter program against a block of packets at once. Rather
+    than interpreting the program once per packet, every distinct packet
+    field the program reads is gathered for the whole block up front, and
+    the program is then walked once with a bitmask of the packets (lanes)
+    that reached each instruction. Since BPF only ever jumps forwards, a
+    single pass in instruction order visits everything. Loads and ALU
+    operations update A for the active lanes, and conditional jumps split
+    the lane mask between their two targets using vectorised compares.
+
+    A lane whose load falls outside the captured data drops out, which is
+    the same as bpf_filter2 returning 0 for that packet.
+*/
+
+#include "bpf_batch.h"
+#include <net/bpf.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BPF_BATCH_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BPF_BATCH_NEON 1
+#endif
+
+/* maximum number of distinct packet fields a program may read */
+#define BPF_BATCH_MAX_FIELDS 32
+
+enum bpf_batch_opcode
+{
+    BB_NOP, /* unreachable instruction */
+    BB_LD,  /* A = field */
+    BB_CHECK, /* lanes where field is out of bounds are rejected */
+    BB_LEN,
+    BB_IMM,
+    BB_ALU,
+    BB_NEG,
+    BB_JA,
+    BB_JMP,
+    BB_RET_K,
+    BB_RET_A
+};
+
+enum bpf_batch_cmp
+{
+    BB_JEQ,
+    BB_JGT,
+    BB_JGE,
+    BB_JSET
+};
+
+struct bpf_batch_op
+{
+    unsigned char opcode; /* enum bpf_batch_opcode */
+    unsigned char sub;    /* alu operation or enum bpf_batch_cmp */
+    unsigned short field;
+    unsigned int jt; /* absolute instruction indexes */
+    unsigned int jf;
+    uint32_t k;
+};
+
+/* a packet field is size bytes at offset off, or at (p[msh] & 0xf) * 4 + off
+   if ind is set, i.e. relative to an ldxb 4*([msh]&0xf) */
+struct bpf_batch_field
+{
+    uint64_t off;
+    uint32_t msh;
+    unsigned char size;
+    unsigned char ind;
+};
+
+typedef uint64_t (*bpf_batch_cmp_fptr)(
+    const uint32_t* A, uint32_t k, unsigned int cmp);
+typedef void (*bpf_batch_blend_fptr)(
+    uint32_t* A, const uint32_t* src, uint64_t mask);
+
+struct bpf_batch_prog
+{
+    struct bpf_batch_op* ops;
+    unsigned int len;
+    unsigned int nfields;
+    struct bpf_batch_field fields[BPF_BATCH_MAX_FIELDS];
+    bpf_batch_cmp_fptr cmp;
+    bpf_batch_blend_fptr blend;
+};
+
+/* state of the X register on entry to an instruction */
+enum xstate_kind
+{
+    XS_UNREACHED,
+    XS_CONST,
+    XS_MSH,
+    XS_CONFLICT
+};
+
+struct xstate
+{
+    enum xstate_kind kind;
+    uint32_t val;
+};
+
+static void xstate_merge(struct xstate* dst, const struct xstate* src);
+static int field_index(
+    struct bpf_batch_prog* prog,
+    const struct xstate* x,
+    uint32_t k,
+    unsigned int size,
+    int ind);
+static void gather_field(
+    const struct bpf_batch_field* field,
+    const u_char* const* pkts,
+    const u_int* buflens,
+    size_t n,
+    uint32_t* vals,
+    uint64_t* valid);
+static void eval_block(
+    const struct bpf_batch_prog* prog,
+    const u_char* const* pkts,
+    const u_int* wirelens,
+    const u_int* buflens,
+    size_t n,
+    uint8_t* results);
+
+static uint64_t
+cmp_scalar(const uint32_t* A, uint32_t k, unsigned int cmp);
+static void blend_scalar(uint32_t* A, const uint32_t* src, uint64_t mask);
+#if defined(BPF_BATCH_X86)
+static uint64_t cmp_avx2(const uint32_t* A, uint32_t k, unsigned int cmp);
+static void blend_avx2(uint32_t* A, const uint32_t* src, uint64_t mask);
+#elif defined(BPF_BATCH_NEON)
+static uint64_t cmp_neon(const uint32_t* A, uint32_t k, unsigned int cmp);
+#endif
+
+struct bpf_batch_prog*
+bpf_batch_compile(const struct bpf_insn* insns, unsigned int len)
+{
+    struct bpf_batch_prog* prog;
+    struct xstate* xs;
+    unsigned int pc;
+    int idx;
+
+    if (insns == NULL || len == 0 || len > BPF_MAXINSNS)
+        return NULL;
+
+    if ((prog = calloc(1, sizeof(*prog))) == NULL)
+        return NULL;
+
+    xs = NULL;
+
+    if ((prog->ops = calloc(len, sizeof(*prog->ops))) == NULL)
+        goto err;
+
+    if ((xs = calloc(len, sizeof(*xs))) == NULL)
+        goto err;
+
+    prog->len = len;
+    xs[0].kind = XS_CONST;
+    xs[0].val = 0;
+
+    for (pc = 0; pc < len; ++pc)
+    {
+        const struct bpf_insn* insn = &insns[pc];
+        struct bpf_batch_op* op = &prog->ops[pc];
+        struct xstate out;
+        unsigned int size;
+
+        if (xs[pc].kind == XS_UNREACHED)
+        {
+            op->opcode = BB_NOP;
+            continue;
+        }
+
+        out = xs[pc];
+        op->k = insn->k;
+        op->jt = pc + 1;
+
+        switch (insn->code)
+        {
+        case BPF_LD | BPF_W | BPF_ABS:
+        case BPF_LD | BPF_H | BPF_ABS:
+        case BPF_LD | BPF_B | BPF_ABS:
+        case BPF_LD | BPF_W | BPF_IND:
+        case BPF_LD | BPF_H | BPF_IND:
+        case BPF_LD | BPF_B | BPF_IND:
+            size = (BPF_SIZE(insn->code) == BPF_W)
+                       ? 4
+                       : ((BPF_SIZE(insn->code) == BPF_H) ? 2 : 1);
+            if ((idx = field_index(
+                     prog,
+                     &xs[pc],
+                     insn->k,
+                     size,
+                     BPF_MODE(insn->code) == BPF_IND)) == -1)
+                goto err;
+            op->opcode = BB_LD;
+            op->field = idx;
+            break;
+
+        case BPF_LDX | BPF_MSH | BPF_B:
+            /* the load itself can fail, so check the byte is present */
+            if ((idx = field_index(prog, &xs[pc], insn->k, 1, 0)) == -1)
+                goto err;
+            op->opcode = BB_CHECK;
+            op->field = idx;
+            out.kind = XS_MSH;
+            out.val = insn->k;
+            break;
+
+        case BPF_LDX | BPF_IMM:
+            op->opcode = BB_NOP;
+            out.kind = XS_CONST;
+            out.val = insn->k;
+            break;
+
+        case BPF_LD | BPF_W | BPF_LEN:
+            op->opcode = BB_LEN;
+            break;
+
+        case BPF_LD | BPF_IMM:
+            op->opcode = BB_IMM;
+            break;
+
+        case BPF_ALU | BPF_ADD | BPF_K:
+        case BPF_ALU | BPF_SUB | BPF_K:
+        case BPF_ALU | BPF_MUL | BPF_K:
+        case BPF_ALU | BPF_AND | BPF_K:
+        case BPF_ALU | BPF_OR | BPF_K:
+            op->opcode = BB_ALU;
+            op->sub = BPF_OP(insn->code);
+            break;
+
+        case BPF_ALU | BPF_LSH | BPF_K:
+        case BPF_ALU | BPF_RSH | BPF_K:
+            /* shifts of 32 or more are undefined in C */
+            if (insn->k >= 32)
+                goto err;
+            op->opcode = BB_ALU;
+            op->sub = BPF_OP(insn->code);
+            break;
+
+        case BPF_ALU | BPF_NEG:
+            op->opcode = BB_NEG;
+            break;
+
+        case BPF_JMP | BPF_JA:
+            if (insn->k >= len - pc - 1)
+                goto err;
+            op->opcode = BB_JA;
+            op->jt = pc + 1 + insn->k;
+            xstate_merge(&xs[op->jt], &out);
+            continue;
+
+        case BPF_JMP | BPF_JEQ | BPF_K:
+        case BPF_JMP | BPF_JGT | BPF_K:
+        case BPF_JMP | BPF_JGE | BPF_K:
+        case BPF_JMP | BPF_JSET | BPF_K:
+            if (insn->jt >= len - pc - 1 || insn->jf >= len - pc - 1)
+                goto err;
+            op->opcode = BB_JMP;
+            switch (BPF_OP(insn->code))
+            {
+            case BPF_JEQ:
+                op->sub = BB_JEQ;
+                break;
+            case BPF_JGT:
+                op->sub = BB_JGT;
+                break;
+            case BPF_JGE:
+                op->sub = BB_JGE;
+                break;
+            default:
+                op->sub = BB_JSET;
+                break;
+            }
+            op->jt = pc + 1 + insn->jt;
+            op->jf = pc + 1 + insn->jf;
+            xstate_merge(&xs[op->jt], &out);
+            xstate_merge(&xs[op->jf], &out);
+            continue;
+
+        case BPF_RET | BPF_K:
+            op->opcode = BB_RET_K;
+            continue;
+
+        case BPF_RET | BPF_A:
+            op->opcode = BB_RET_A;
+            continue;
+
+        default:
+            /* scratch memory, X operands, division etc. are left to
+               bpf_filter2 */
+            goto err;
+        }
+
+        /* falling off the end of the program */
+        if (pc + 1 >= len)
+            goto err;
+
+        xstate_merge(&xs[pc + 1], &out);
+    }
+
+    free(xs);
+
+#if defined(BPF_BATCH_X86)
+    if (__builtin_cpu_supports("avx2"))
+    {
+        prog->cmp = cmp_avx2;
+        prog->blend = blend_avx2;
+    }
+    else
+    {
+        prog->cmp = cmp_scalar;
+        prog->blend = blend_scalar;
+    }
+#elif defined(BPF_BATCH_NEON)
+    prog->cmp = cmp_neon;
+    prog->blend = blend_scalar;
+#else
+    prog->cmp = cmp_scalar;
+    prog->blend = blend_scalar;
+#endif
+
+    return prog;
+
+err:
+    free(xs);
+    bpf_batch_free(prog);
+    return NULL;
+}
+
+void bpf_batch_free(struct bpf_batch_prog* prog)
+{
+    if (prog == NULL)
+        return;
+
+    free(prog->ops);
+    free(prog);
+}
+
+void bpf_batch_filter(
+    const struct bpf_batch_prog* prog,
+    const u_char* const* pkts,
+    const u_int* wirelens,
+    const u_int* buflens,
+    size_t n,
+    uint8_t* results)
+{
+    size_t i;
+
+    for (i = 0; i < n; i += BPF_BATCH_LANES)
+    {
+        size_t nlanes = n - i;
+
+        if (nlanes > BPF_BATCH_LANES)
+            nlanes = BPF_BATCH_LANES;
+
+        eval_block(
+            prog,
+            &pkts[i],
+            &wirelens[i],
+            &buflens[i],
+            nlanes,
+            &results[i]);
+    }
+}
+
+static void xstate_merge(struct xstate* dst, const struct xstate* src)
+{
+    if (dst->kind == XS_UNREACHED)
+        *dst = *src;
+    else if (dst->kind != src->kind || dst->val != src->val)
+        dst->kind = XS_CONFLICT;
+}
+
+/* returns the index of the field read by a load of size bytes at k, adding
+   it if necessary, or -1 if the field's offset isn't known statically */
+static int field_index(
+    struct bpf_batch_prog* prog,
+    const struct xstate* x,
+    uint32_t k,
+    unsigned int size,
+    int ind)
+{
+    struct bpf_batch_field field;
+    unsigned int i;
+
+    memset(&field, 0, sizeof(field));
+    field.size = size;
+    field.off = k;
+
+    if (ind)
+    {
+        if (x->kind == XS_CONST)
+        {
+            field.off += x->val;
+        }
+        else if (x->kind == XS_MSH)
+        {
+            field.ind = 1;
+            field.msh = x->val;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < prog->nfields; ++i)
+    {
+        const struct bpf_batch_field* f = &prog->fields[i];
+
+        if (f->off == field.off && f->msh == field.msh &&
+            f->size == field.size && f->ind == field.ind)
+            return i;
+    }
+
+    if (prog->nfields == BPF_BATCH_MAX_FIELDS)
+        return -1;
+
+    prog->fields[prog->nfields] = field;
+    return prog->nfields++;
+}
+
+/* reads field from each of the n packets into vals, setting the
+   corresponding bit in valid for those packets where it lies within the
+   captured data. The bounds check is done in 64 bits, which is equivalent to
+   the overflow-safe comparisons in bpf_filter2. */
+static void gather_field(
+    const struct bpf_batch_field* field,
+    const u_char* const* pkts,
+    const u_int* buflens,
+    size_t n,
+    uint32_t* vals,
+    uint64_t* valid)
+{
+    uint64_t mask;
+    size_t i;
+
+    mask = 0;
+
+    for (i = 0; i < n; ++i)
+    {
+        const u_char* p = pkts[i];
+        uint64_t off = field->off;
+
+        vals[i] = 0;
+
+        if (field->ind)
+        {
+            if (field->msh >= buflens[i])
+                continue;
+            off += (uint64_t)((p[field->msh] & 0xf) << 2);
+        }
+
+        if (off + field->size > buflens[i])
+            continue;
+
+        switch (field->size)
+        {
+        case 4:
+            vals[i] = ((uint32_t)p[off] << 24) | ((uint32_t)p[off + 1] << 16) |
+                      ((uint32_t)p[off + 2] << 8) | (uint32_t)p[off + 3];
+            break;
+        case 2:
+            vals[i] = ((uint32_t)p[off] << 8) | (uint32_t)p[off + 1];
+            break;
+        default:
+            vals[i] = p[off];
+            break;
+        }
+
+        mask |= (uint64_t)1 << i;
+    }
+
+    for (; i < BPF_BATCH_LANES; ++i)
+        vals[i] = 0;
+
+    *valid = mask;
+}
+
+static void eval_block(
+    const struct bpf_batch_prog* prog,
+    const u_char* const* pkts,
+    const u_int* wirelens,
+    const u_int* buflens,
+    size_t n,
+    uint8_t* results)
+{
+    uint32_t vals[BPF_BATCH_MAX_FIELDS][BPF_BATCH_LANES];
+    uint64_t valid[BPF_BATCH_MAX_FIELDS];
+    uint64_t active[BPF_MAXINSNS];
+    uint32_t A[BPF_BATCH_LANES];
+    uint32_t tmp[BPF_BATCH_LANES];
+    uint64_t gathered; /* a bit per field already in vals */
+    uint64_t accepted;
+    unsigned int pc;
+    unsigned int i;
+
+    /* Fields are gathered when a load of them is first reached, rather than
+       all up front, so those only read on paths no packet in the block
+       takes, such as the IPv6 offsets in a block of IPv4 packets, are
+       never gathered */
+    gathered = 0;
+
+    memset(A, 0, sizeof(A));
+    memset(active, 0, prog->len * sizeof(active[0]));
+    active[0] = (n == BPF_BATCH_LANES) ? ~(uint64_t)0
+                                       : (((uint64_t)1 << n) - 1);
+    accepted = 0;
+
+    for (pc = 0; pc < prog->len; ++pc)
+    {
+        const struct bpf_batch_op* op = &prog->ops[pc];
+        uint64_t m = active[pc];
+        uint64_t c;
+
+        if (m == 0)
+            continue;
+
+        switch (op->opcode)
+        {
+        case BB_NOP:
+            active[pc + 1] |= m;
+            break;
+
+        case BB_LD:
+            if ((gathered & ((uint64_t)1 << op->field)) == 0)
+            {
+                gather_field(
+                    &prog->fields[op->field],
+                    pkts,
+                    buflens,
+                    n,
+                    vals[op->field],
+                    &valid[op->field]);
+                gathered |= (uint64_t)1 << op->field;
+            }
+            m &= valid[op->field];
+            prog->blend(A, vals[op->field], m);
+            active[pc + 1] |= m;
+            break;
+
+        case BB_CHECK:
+            if ((gathered & ((uint64_t)1 << op->field)) == 0)
+            {
+                gather_field(
+                    &prog->fields[op->field],
+                    pkts,
+                    buflens,
+                    n,
+                    vals[op->field],
+                    &valid[op->field]);
+                gathered |= (uint64_t)1 << op->field;
+            }
+            active[pc + 1] |= m & valid[op->field];
+            break;
+
+        case BB_LEN:
+            for (i = 0; i < BPF_BATCH_LANES; ++i)
+                tmp[i] = (i < n) ? wirelens[i] : 0;
+            prog->blend(A, tmp, m);
+            active[pc + 1] |= m;
+            break;
+
+        case BB_IMM:
+            for (i = 0; i < BPF_BATCH_LANES; ++i)
+                tmp[i] = op->k;
+            prog->blend(A, tmp, m);
+            active[pc + 1] |= m;
+            break;
+
+        case BB_ALU:
+            /* computed for every lane and blended in, so that the loops
+               are straight-line and vectorise */
+            switch (op->sub)
+            {
+            case BPF_ADD:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] + op->k;
+                break;
+            case BPF_SUB:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] - op->k;
+                break;
+            case BPF_MUL:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] * op->k;
+                break;
+            case BPF_AND:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] & op->k;
+                break;
+            case BPF_OR:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] | op->k;
+                break;
+            case BPF_LSH:
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] << op->k;
+                break;
+            default: /* BPF_RSH */
+                for (i = 0; i < BPF_BATCH_LANES; ++i)
+                    tmp[i] = A[i] >> op->k;
+                break;
+            }
+            prog->blend(A, tmp, m);
+            active[pc + 1] |= m;
+            break;
+
+        case BB_NEG:
+            for (i = 0; i < BPF_BATCH_LANES; ++i)
+                tmp[i] = -A[i];
+            prog->blend(A, tmp, m);
+            active[pc + 1] |= m;
+            break;
+
+        case BB_JA:
+            active[op->jt] |= m;
+            break;
+
+        case BB_JMP:
+            c = prog->cmp(A, op->k, op->sub);
+            active[op->jt] |= m & c;
+            active[op->jf] |= m & ~c;
+            break;
+
+        case BB_RET_K:
+            if (op->k != 0)
+                accepted |= m;
+            break;
+
+        case BB_RET_A:
+            accepted |= m & ~prog->cmp(A, 0, BB_JEQ);
+            break;
+        }
+    }
+
+    for (i = 0; i < n; ++i)
+        results[i] = (accepted >> i) & 1;
+}
+
+static uint64_t
+cmp_scalar(const uint32_t* A, uint32_t k, unsigned int cmp)
+{
+    uint64_t mask;
+    unsigned int i;
+
+    mask = 0;
+
+    switch (cmp)
+    {
+    case BB_JEQ:
+        for (i = 0; i < BPF_BATCH_LANES; ++i)
+            mask |= (uint64_t)(A[i] == k) << i;
+        break;
+    case BB_JGT:
+        for (i = 0; i < BPF_BATCH_LANES; ++i)
+            mask |= (uint64_t)(A[i] > k) << i;
+        break;
+    case BB_JGE:
+        for (i = 0; i < BPF_BATCH_LANES; ++i)
+            mask |= (uint64_t)(A[i] >= k) << i;
+        break;
+    default:
+        for (i = 0; i < BPF_BATCH_LANES; ++i)
+            mask |= (uint64_t)((A[i] & k) != 0) << i;
+        break;
+    }
+
+    return mask;
+}
+
+static void blend_scalar(uint32_t* A, const uint32_t* src, uint64_t mask)
+{
+    while (mask != 0)
+    {
+        unsigned int i = __builtin_ctzll(mask);
+
+        A[i] = src[i];
+        mask &= mask - 1;
+    }
+}
+
+#if defined(BPF_BATCH_X86)
+
+/* SSE/AVX2 only have signed 32 bit compares, so both sides are biased by
+   flipping the sign bit to get an unsigned ordering */
+__attribute__((target("avx2"))) static uint64_t
+cmp_avx2(const uint32_t* A, uint32_t k, unsigned int cmp)
+{
+    const __m256i bias = _mm256_set1_epi32((int)0x80000000);
+    const __m256i vk = _mm256_set1_epi32((int)k);
+    const __m256i vkb = _mm256_xor_si256(vk, bias);
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t mask;
+    unsigned int i;
+
+    mask = 0;
+
+    for (i = 0; i < BPF_BATCH_LANES; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)&A[i]);
+        __m256i r;
+        uint64_t bits;
+
+        switch (cmp)
+        {
+        case BB_JEQ:
+            r = _mm256_cmpeq_epi32(a, vk);
+            bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(r));
+            break;
+        case BB_JGT:
+            r = _mm256_cmpgt_epi32(_mm256_xor_si256(a, bias), vkb);
+            bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(r));
+            break;
+        case BB_JGE:
+            /* A >= k is !(k > A) */
+            r = _mm256_cmpgt_epi32(vkb, _mm256_xor_si256(a, bias));
+            bits = ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(r)) &
+                   0xff;
+            break;
+        default:
+            r = _mm256_cmpeq_epi32(_mm256_and_si256(a, vk), zero);
+            bits = ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(r)) &
+                   0xff;
+            break;
+        }
+
+        mask |= bits << i;
+    }
+
+    return mask;
+}
+
+__attribute__((target("avx2"))) static void
+blend_avx2(uint32_t* A, const uint32_t* src, uint64_t mask)
+{
+    const __m256i lanebits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    unsigned int i;
+
+    if (mask == ~(uint64_t)0)
+    {
+        memcpy(A, src, BPF_BATCH_LANES * sizeof(*A));
+        return;
+    }
+
+    for (i = 0; i < BPF_BATCH_LANES; i += 8)
+    {
+        __m256i m, a, s;
+        unsigned int bits = (mask >> i) & 0xff;
+
+        if (bits == 0)
+            continue;
+
+        m = _mm256_set1_epi32((int)bits);
+        m = _mm256_cmpeq_epi32(_mm256_and_si256(m, lanebits), lanebits);
+        a = _mm256_loadu_si256((const __m256i*)&A[i]);
+        s = _mm256_loadu_si256((const __m256i*)&src[i]);
+        _mm256_storeu_si256((__m256i*)&A[i], _mm256_blendv_epi8(a, s, m));
+    }
+}
+
+#elif defined(BPF_BATCH_NEON)
+
+static uint64_t cmp_neon(const uint32_t* A, uint32_t k, unsigned int cmp)
+{
+    static const uint32_t lanebits_init[4] = {1, 2, 4, 8};
+    const uint32x4_t lanebits = vld1q_u32(lanebits_init);
+    const uint32x4_t vk = vdupq_n_u32(k);
+    uint64_t mask;
+    unsigned int i;
+
+    mask = 0;
+
+    for (i = 0; i < BPF_BATCH_LANES; i += 4)
+    {
+        uint32x4_t a = vld1q_u32(&A[i]);
+        uint32x4_t r;
+
+        switch (cmp)
+        {
+        case BB_JEQ:
+            r = vceqq_u32(a, vk);
+            break;
+        case BB_JGT:
+            r = vcgtq_u32(a, vk);
+            break;
+        case BB_JGE:
+            r = vcgeq_u32(a, vk);
+            break;
+        default:
+            r = vtstq_u32(a, vk);
+            break;
+        }
+
+        mask |= (uint64_t)vaddvq_u32(vandq_u32(r, lanebits)) << i;
+    }
+
+    return mask;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PPBPF_BATCH_H_
+#define PPBPF_BATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* number of packets evaluated together by one pass over the program */
+#define BPF_BATCH_LANES 64
+
+struct bpf_insn;
+struct bpf_batch_prog;
+
+/* Compiles a filter program for batch evaluation. Only programs built from
+   fixed-offset loads (absolute loads, and indirect loads relative to a single
+   ldxb 4*([k]&0xf)), constant ALU operations, constant comparisons and
+   returns are understood; this covers what tcpdump generates for ethertype,
+   protocol, host, net and port expressions. Returns NULL for anything else,
+   in which case the caller should fall back to bpf_filter2 per packet. */
+struct bpf_batch_prog*
+bpf_batch_compile(const struct bpf_insn* insns, unsigned int len);
+
+void bpf_batch_free(struct bpf_batch_prog* prog);
+
+/* evaluates prog against n packets, setting results[i] to 1 if packet i is
+   accepted and 0 otherwise, i.e. the same as bpf_filter2(...) != 0 */
+void bpf_batch_filter(
+    const struct bpf_batch_prog* prog,
+    const u_char* const* pkts,
+    const u_int* wirelens,
+    const u_int* buflens,
+    size_t n,
+    uint8_t* results);
+
+#endif
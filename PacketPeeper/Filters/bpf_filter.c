@@ -175,21 +175,37 @@ m_xhalf(m, k, err)
 }
 #endif
 
+/*
+ * Count an execution of the current instruction, and n bytes of packet
+ * data loaded by it, when profiling.  prof is a constant NULL in
+ * bpf_filter2, so these compile away there.
+ */
+#define PROFILE_INSN() \
+	do { \
+		if (prof != NULL) \
+			++prof[pc - start].executions; \
+	} while (0)
+#define PROFILE_BYTES(n) \
+	do { \
+		if (prof != NULL) \
+			prof[pc - start].bytes += (n); \
+	} while (0)
+
 /*
  * Execute the filter program starting at pc on the packet p
  * wirelen is the length of the original packet
  * buflen is the amount of data present
+ * prof, if not NULL, has an entry per instruction, to which the number of
+ * times the instruction runs and the bytes of packet data it loads are added
  */
-u_int
-bpf_filter2(pc, p, wirelen, buflen)
-	register const struct bpf_insn *pc;
-	register u_char *p;
-	u_int wirelen;
-	register u_int buflen;
+static __inline __attribute__((__always_inline__)) u_int
+bpf_run(register const struct bpf_insn *pc, register u_char *p, u_int wirelen,
+    register u_int buflen, struct bpf_insn_profile *prof)
 {
 	register u_int32_t A = 0, X = 0;
 	register bpf_u_int32 k;
 	u_int32_t mem[BPF_MEMWORDS];
+	const struct bpf_insn *start;
 
 	if (pc == 0)
 		/*
@@ -197,9 +213,11 @@ bpf_filter2(pc, p, wirelen, buflen)
 		 */
 		return (u_int)-1;
 
+	start = pc;
 	--pc;
 	while (1) {
 		++pc;
+		PROFILE_INSN();
 		switch (pc->code) {
 
 		default:
@@ -230,6 +248,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(sizeof(int32_t));
 #ifdef BPF_ALIGN
 			if (((intptr_t)(p + k) & 3) != 0)
 				A = EXTRACT_LONG(&p[k]);
@@ -252,6 +271,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(sizeof(int16_t));
 			A = EXTRACT_SHORT(&p[k]);
 			continue;
 
@@ -271,6 +291,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(1);
 			A = p[k];
 			continue;
 
@@ -299,6 +320,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(sizeof(int32_t));
 #ifdef BPF_ALIGN
 			if (((intptr_t)(p + k) & 3) != 0)
 				A = EXTRACT_LONG(&p[k]);
@@ -324,6 +346,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(sizeof(int16_t));
 			A = EXTRACT_SHORT(&p[k]);
 			continue;
 
@@ -343,6 +366,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(1);
 			A = p[k];
 			continue;
 
@@ -362,6 +386,7 @@ bpf_filter2(pc, p, wirelen, buflen)
 				return 0;
 #endif
 			}
+			PROFILE_BYTES(1);
 			X = (p[pc->k] & 0xf) << 2;
 			continue;
 
@@ -506,6 +531,27 @@ bpf_filter2(pc, p, wirelen, buflen)
 	}
 }
 
+u_int
+bpf_filter2(pc, p, wirelen, buflen)
+	register const struct bpf_insn *pc;
+	register u_char *p;
+	u_int wirelen;
+	register u_int buflen;
+{
+	return bpf_run(pc, p, wirelen, buflen, NULL);
+}
+
+u_int
+bpf_filter2_profile(pc, p, wirelen, buflen, prof)
+	const struct bpf_insn *pc;
+	u_char *p;
+	u_int wirelen;
+	u_int buflen;
+	struct bpf_insn_profile *prof;
+{
+	return bpf_run(pc, p, wirelen, buflen, prof);
+}
+
 #ifdef _KERNEL
 /*
  * Return true if the 'fcode' is a valid filter program.
@@ -5,10 +5,27 @@
 
 struct bpf_insn;
 
+/* per instruction counts gathered by bpf_filter2_profile */
+struct bpf_insn_profile
+{
+    unsigned long long executions;
+    unsigned long long bytes; /* bytes of packet data loaded */
+};
+
 u_int bpf_filter2(
     register const struct bpf_insn* pc,
     register u_char* p,
     u_int wirelen,
     register u_int buflen);
 
+/* as bpf_filter2, but also adds to prof, which must have an entry for every
+   instruction in the program. This is slower than bpf_filter2, so shouldn't
+   be used to time programs */
+u_int bpf_filter2_profile(
+    const struct bpf_insn* pc,
+    u_char* p,
+    u_int wirelen,
+    u_int buflen,
+    struct bpf_insn_profile* prof);
+
 #endif
@@ -0,0 +1,215 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "payload_search.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    The automaton is stored as a full DFA (every state has a transition for
+    every byte value), so scanning is a single table lookup per byte. While
+    in the start state, bytes that can't begin a pattern are skipped, using
+    memchr when only one byte value can.
+*/
+
+struct payload_search
+{
+    uint32_t (*delta)[256]; /* delta[state][byte] = next state */
+    uint8_t* accept;        /* non-zero if a pattern ends in state */
+    unsigned int nstates;
+    int start_byte; /* the only byte leaving the start state, or -1 */
+    uint8_t starts[256]; /* non-zero if byte leaves the start state */
+};
+
+struct payload_search* payload_search_compile(
+    const uint8_t* const* patterns, const size_t* lengths, size_t npatterns)
+{
+    struct payload_search* ps;
+    uint32_t* fail;
+    uint32_t* queue;
+    size_t total, i, j;
+    unsigned int head, tail, s, b, nstarts;
+
+    if (npatterns == 0)
+        return NULL;
+
+    for (total = 1, i = 0; i < npatterns; ++i)
+    {
+        if (lengths[i] == 0 || lengths[i] >= PAYLOAD_SEARCH_MAX_STATES)
+            return NULL;
+        total += lengths[i];
+    }
+
+    if (total > PAYLOAD_SEARCH_MAX_STATES)
+        return NULL;
+
+    if ((ps = calloc(1, sizeof(*ps))) == NULL)
+        return NULL;
+
+    fail = NULL;
+    queue = NULL;
+
+    if ((ps->delta = calloc(total, sizeof(*ps->delta))) == NULL ||
+        (ps->accept = calloc(total, sizeof(*ps->accept))) == NULL ||
+        (fail = calloc(total, sizeof(*fail))) == NULL ||
+        (queue = malloc(total * sizeof(*queue))) == NULL)
+        goto err;
+
+    /* build the trie, a zero transition meaning `none yet' since nothing
+       can lead back to the start state */
+    ps->nstates = 1;
+
+    for (i = 0; i < npatterns; ++i)
+    {
+        s = 0;
+
+        for (j = 0; j < lengths[i]; ++j)
+        {
+            b = patterns[i][j];
+
+            if (ps->delta[s][b] == 0)
+                ps->delta[s][b] = ps->nstates++;
+
+            s = ps->delta[s][b];
+        }
+
+        ps->accept[s] = 1;
+    }
+
+    /* breadth first, fill in the missing transitions from the failure
+       links, turning the trie into a DFA */
+    head = 0;
+    tail = 0;
+
+    for (b = 0; b < 256; ++b)
+    {
+        if ((s = ps->delta[0][b]) != 0)
+        {
+            fail[s] = 0;
+            queue[tail++] = s;
+        }
+    }
+
+    while (head < tail)
+    {
+        unsigned int r = queue[head++];
+
+        /* a state accepts if any of its suffixes does */
+        if (ps->accept[fail[r]])
+            ps->accept[r] = 1;
+
+        for (b = 0; b < 256; ++b)
+        {
+            if ((s = ps->delta[r][b]) != 0)
+            {
+                fail[s] = ps->delta[fail[r]][b];
+                queue[tail++] = s;
+            }
+            else
+            {
+                ps->delta[r][b] = ps->delta[fail[r]][b];
+            }
+        }
+    }
+
+    nstarts = 0;
+    ps->start_byte = -1;
+
+    for (b = 0; b < 256; ++b)
+    {
+        if (ps->delta[0][b] != 0)
+        {
+            ps->starts[b] = 1;
+            ps->start_byte = b;
+            ++nstarts;
+        }
+    }
+
+    if (nstarts != 1)
+        ps->start_byte = -1;
+
+    free(fail);
+    free(queue);
+    return ps;
+
+err:
+    free(fail);
+    free(queue);
+    payload_search_free(ps);
+    return NULL;
+}
+
+void payload_search_free(struct payload_search* ps)
+{
+    if (ps == NULL)
+        return;
+
+    free(ps->delta);
+    free(ps->accept);
+    free(ps);
+}
+
+int payload_search_scan(
+    const struct payload_search* ps,
+    unsigned int* state,
+    const uint8_t* buf,
+    size_t len,
+    size_t* match_end)
+{
+    unsigned int s;
+    size_t i;
+
+    s = *state;
+    i = 0;
+
+    while (i < len)
+    {
+        if (s == 0)
+        {
+            /* skip ahead to the next byte which could start a match */
+            if (ps->start_byte != -1)
+            {
+                const uint8_t* p;
+
+                if ((p = memchr(buf + i, ps->start_byte, len - i)) == NULL)
+                    break;
+                i = p - buf;
+            }
+            else
+            {
+                while (i < len && !ps->starts[buf[i]])
+                    ++i;
+                if (i == len)
+                    break;
+            }
+        }
+
+        s = ps->delta[s][buf[i++]];
+
+        if (ps->accept[s])
+        {
+            *state = s;
+            *match_end = i;
+            return 1;
+        }
+    }
+
+    *state = s;
+    return 0;
+}
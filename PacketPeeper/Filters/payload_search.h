@@ -0,0 +1,54 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PPPAYLOAD_SEARCH_H_
+#define PPPAYLOAD_SEARCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* maximum combined length of all patterns in a set */
+#define PAYLOAD_SEARCH_MAX_STATES (16 * 1024)
+
+/* initial value for the state argument of payload_search_scan */
+#define PAYLOAD_SEARCH_START 0
+
+struct payload_search;
+
+/* builds an Aho-Corasick automaton matching any of the npatterns byte
+   strings. Returns NULL if a pattern is empty, the patterns are too long in
+   total, or memory runs out */
+struct payload_search* payload_search_compile(
+    const uint8_t* const* patterns, const size_t* lengths, size_t npatterns);
+
+void payload_search_free(struct payload_search* ps);
+
+/* scans len bytes of buf, carrying on from *state, which is updated so that
+   a pattern spanning several buffers (e.g. consecutive TCP segments) is
+   still found. Returns 1 and sets *match_end to the offset one past the end
+   of the first match if there is one, otherwise returns 0. The automaton is
+   never modified, so it may be shared between threads. */
+int payload_search_scan(
+    const struct payload_search* ps,
+    unsigned int* state,
+    const uint8_t* buf,
+    size_t len,
+    size_t* match_end);
+
+#endif
@@ -30,6 +30,22 @@
 #define HOSTCACHE_INPROG  3 /* lookup in progress */
 #define HOSTCACHE_ERROR   4 /* error occured */
 
+/* addresses are spread over this many independently locked shards */
+#define HOSTCACHE_SHARDS 16
+
+/* lookups waiting beyond this many are dropped, oldest first, to be asked for
+   again if they are still wanted */
+#define HOSTCACHE_MAX_WAITING 4096
+
+/* how long to wait before retrying a lookup which failed with an error
+   rather than a definite answer, in seconds */
+#define HOSTCACHE_ERROR_TTL 30.0
+
+/* Resolved names are kept for the positive TTL and failed lookups for the
+   negative TTL, after which the address is looked up again. Names are
+   still returned while being looked up again. Beyond the capacity, the
+   least recently used addresses are forgotten */
+
 @interface HostCache : NSObject
 {
 }
@@ -38,6 +54,11 @@
 + (void)releaseSharedHostCache;
 - (void)lookupComplete:(id)sender;
 - (void)flush;
+- (void)setCapacity:(NSUInteger)capacity; /* 0 for no limit */
+- (NSUInteger)capacity;
+- (void)setPositiveTTL:(NSTimeInterval)positive
+           negativeTTL:(NSTimeInterval)negative;
+- (NSUInteger)count;
 - (NSString*)hostWithAddressASync:(const struct in_addr*)addr
                        returnCode:(int*)code;
 - (NSString*)hostWithIp6AddressASync:(const struct in6_addr*)addr
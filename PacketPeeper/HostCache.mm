@@ -17,24 +17,33 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+
 #include "HostCache.hh"
+#include "../Shared/PacketPeeper.h"
 #include "async.hpp"
-
+#include "resolver.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <functional>
-#include <map>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 #include <utility>
 
-#include <iostream>
-
 #import <Foundation/NSArchiver.h>
+#import <Foundation/NSObjCRuntime.h>
 #import <Foundation/NSNotification.h>
-#import <Foundation/NSNull.h>
 #import <Foundation/NSString.h>
 #import <Foundation/NSThread.h>
+#import <Foundation/NSUserDefaults.h>
 
-#include <netdb.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -43,6 +52,22 @@ namespace
 {
     HostCache* sharedHostCache = nil;
 
+    typedef std::chrono::steady_clock clock_type;
+
+    // 64-bit FNV-1a
+    std::uint64_t hash_bytes(const void* data, std::size_t len)
+    {
+        const unsigned char* p;
+        std::uint64_t hash;
+
+        p = static_cast<const unsigned char*>(data);
+        hash = 14695981039346656037ull;
+        for (std::size_t i = 0; i < len; ++i)
+            hash = (hash ^ p[i]) * 1099511628211ull;
+
+        return hash;
+    }
+
     template<typename T>
     struct release_deleter
     {
@@ -52,136 +77,350 @@ namespace
         }
     };
 
-    struct ip_compare
+    // addresses are compared and hashed as plain bytes, so in_addr and
+    // in6_addr share one implementation
+    struct ip_hash
     {
-        bool operator()(const in_addr& a, const in_addr& b) const
+        template<typename AddrType>
+        std::size_t operator()(const AddrType& addr) const
         {
-            return a.s_addr < b.s_addr;
+            return hash_bytes(&addr, sizeof(addr));
         }
+    };
 
-        bool operator()(const in6_addr& a, const in6_addr& b) const
+    struct ip_equal
+    {
+        template<typename AddrType>
+        bool operator()(const AddrType& a, const AddrType& b) const
         {
-            return a.__u6_addr.__u6_addr32[0] < b.__u6_addr.__u6_addr32[0] &&
-                   a.__u6_addr.__u6_addr32[1] < b.__u6_addr.__u6_addr32[1] &&
-                   a.__u6_addr.__u6_addr32[2] < b.__u6_addr.__u6_addr32[2] &&
-                   a.__u6_addr.__u6_addr32[3] < b.__u6_addr.__u6_addr32[3];
+            return std::memcmp(&a, &b, sizeof(a)) == 0;
         }
     };
 
     typedef std::unique_ptr<NSString, release_deleter<NSString>> nsstring_ptr;
-    typedef std::pair<int, nsstring_ptr> cache_entry;
-    typedef std::map<in_addr, cache_entry, ip_compare> ip4_map;
-    typedef std::map<in6_addr, cache_entry, ip_compare> ip6_map;
 
-    // Needed because sockaddr_in/sockaddr_in6 still have pre-C89 style prefixes
-    // to their struct member names :l
-    void sockaddr_helper(sockaddr_in& sin, int family, const in_addr& addr)
+    // limits shared by every shard, changed without taking the shards' locks
+    struct cache_config
+    {
+        cache_config()
+            : shard_capacity(0), positive_ttl(0.0), negative_ttl(0.0)
+        {
+        }
+
+        std::atomic<std::size_t> shard_capacity; // 0 for no limit
+        std::atomic<double> positive_ttl;
+        std::atomic<double> negative_ttl;
+    };
+
+    template<typename AddrType>
+    struct cache_shard
+    {
+        typedef std::list<AddrType> lru_list;
+
+        struct cache_entry
+        {
+            int code;
+            nsstring_ptr name; // kept while a stale name is looked up again
+            clock_type::time_point expires;
+            typename lru_list::iterator lru;
+        };
+
+        typedef std::unordered_map<AddrType, cache_entry, ip_hash, ip_equal>
+            entry_map;
+
+        std::mutex mutex;
+        entry_map entries;
+        lru_list lru; // most recently used first
+    };
+
+    template<typename AddrType>
+    struct cache_table
+    {
+        typedef cache_shard<AddrType> shard_type;
+
+        shard_type& shard_for(const AddrType& addr)
+        {
+            // the top bits, as the shard's table buckets by the bottom ones
+            return shards[(ip_hash()(addr) >> 32) % shards.size()];
+        }
+
+        void clear()
+        {
+            for (auto& shard : shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.entries.clear();
+                shard.lru.clear();
+            }
+        }
+
+        std::size_t count()
+        {
+            std::size_t n = 0;
+
+            for (auto& shard : shards)
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                n += shard.entries.size();
+            }
+
+            return n;
+        }
+
+        std::array<shard_type, HOSTCACHE_SHARDS> shards;
+    };
+
+    clock_type::time_point expiry(double ttl)
+    {
+        return clock_type::now() +
+               std::chrono::duration_cast<clock_type::duration>(
+                   std::chrono::duration<double>(ttl));
+    }
+
+    template<typename AddrType>
+    peep::resolver::address resolver_address(int family, const AddrType& addr)
+    {
+        peep::resolver::address raddr;
+
+        std::memset(&raddr, 0, sizeof(raddr));
+        raddr.family = family;
+        std::memcpy(raddr.bytes, &addr, sizeof(addr));
+
+        return raddr;
+    }
+
+    // stores the result of a lookup, unless the address was evicted or
+    // flushed while it was being looked up
+    template<typename AddrType>
+    void store_result(
+        cache_shard<AddrType>& shard,
+        const cache_config& config,
+        const AddrType& addr,
+        int code,
+        NSString* name)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.entries.find(addr);
+
+        if (it == shard.entries.end() || it->second.code != HOSTCACHE_INPROG)
+        {
+            [name release];
+            return;
+        }
+
+        auto& entry = it->second;
+
+        switch (code)
+        {
+        case HOSTCACHE_SUCCESS:
+            entry.name = nsstring_ptr(name);
+            entry.expires = expiry(config.positive_ttl);
+            break;
+
+        case HOSTCACHE_NONAME:
+            entry.name.reset();
+            entry.expires = expiry(config.negative_ttl);
+            break;
+
+        default:
+            // keep any stale name, it's better than nothing
+            entry.expires = expiry(HOSTCACHE_ERROR_TTL);
+            break;
+        }
+
+        entry.code = (entry.name && code == HOSTCACHE_ERROR) ? HOSTCACHE_SUCCESS
+                                                             : code;
+    }
+
+    // lets the address be looked up again, when the resolver dropped the
+    // request or it couldn't be made
+    template<typename AddrType>
+    void forget_lookup(cache_shard<AddrType>& shard, const AddrType& addr)
     {
-        sin.sin_len = sizeof(sin);
-        sin.sin_family = family;
-        sin.sin_addr = addr;
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.entries.find(addr);
+
+        if (it == shard.entries.end() || it->second.code != HOSTCACHE_INPROG)
+            return;
+
+        it->second.code = it->second.name ? HOSTCACHE_SUCCESS : HOSTCACHE_ERROR;
+        it->second.expires = clock_type::now();
     }
 
-    void sockaddr_helper(sockaddr_in6& sin, int family, const in6_addr& addr)
+    // forgets least recently used addresses until the shard is within its
+    // capacity. Lookups in progress may be evicted too, their results are
+    // just dropped
+    template<typename AddrType>
+    void evict(cache_shard<AddrType>& shard, std::size_t capacity)
     {
-        sin.sin6_len = sizeof(sin);
-        sin.sin6_family = family;
-        sin.sin6_addr = addr;
+        while (capacity > 0 && shard.entries.size() > capacity)
+        {
+            shard.entries.erase(shard.lru.back());
+            shard.lru.pop_back();
+        }
     }
 
-    template<typename SockAddrType, typename AddrType, typename MapType>
+    template<typename AddrType>
     NSString* lookup(
-        HostCache* cache,
-        peep::async& async,
+        peep::resolver& resolver,
         const AddrType& addr,
         int family,
-        MapType& map,
-        std::mutex& mutex,
+        cache_table<AddrType>& table,
+        const cache_config& config,
         int* code)
     {
-        try
-        {
-            std::lock_guard<std::mutex> lock(mutex);
+        typedef cache_shard<AddrType> shard_type;
 
-            auto result = map.insert(std::make_pair(
-                addr, cache_entry(HOSTCACHE_ERROR, nsstring_ptr())));
+        shard_type& shard = table.shard_for(addr);
+        NSString* name = nil;
 
-            cache_entry& entry(result.first->second);
-
-            if (!result.second)
+        try
+        {
             {
-                // element already present (including if a lookup is in progress),
-                // so return immediately...
-                if (code != NULL)
-                    *code = entry.first;
-                return entry.second.get();
-            }
+                std::lock_guard<std::mutex> lock(shard.mutex);
 
-            // ...else the map now has ERROR (in case we throw) and a null
-            // string, so schedule a lookup and give it the cache_entry
-            // location to store the result in.
-
-            auto f = [cache, addr, family, &entry, &mutex]() {
-                int ret;
-                NSString* str;
-                SockAddrType sin; // sockaddr_in or sockaddr_in6
-                char host[NI_MAXHOST];
-
-                sockaddr_helper(sin, family, addr);
-
-                if ((ret = ::getnameinfo(
-                         reinterpret_cast<struct sockaddr*>(&sin),
-                         sizeof(sin),
-                         host,
-                         sizeof(host),
-                         NULL,
-                         0,
-                         NI_NAMEREQD)) != 0)
+                auto it = shard.entries.find(addr);
+
+                if (it != shard.entries.end())
                 {
-                    std::lock_guard<std::mutex> lock2(mutex);
-                    entry.first = (ret == EAI_NONAME) ? HOSTCACHE_NONAME
-                                                      : HOSTCACHE_ERROR;
+                    auto& entry = it->second;
+
+                    shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru);
+
+                    if (entry.code == HOSTCACHE_INPROG ||
+                        clock_type::now() < entry.expires)
+                    {
+                        // the name may be evicted once the lock is released
+                        name = [[entry.name.get() retain] autorelease];
+                        if (code != NULL)
+                            *code = (name != nil) ? HOSTCACHE_SUCCESS
+                                                  : entry.code;
+                        return name;
+                    }
+
+                    // expired, so look it up again below, returning any
+                    // stale name in the meantime
+                    name = [[entry.name.get() retain] autorelease];
                 }
-                else if (
-                    (str = [[NSString alloc] initWithUTF8String:host]) != nil)
+                else
                 {
-                    std::lock_guard<std::mutex> lock2(mutex);
-                    entry.first = HOSTCACHE_SUCCESS;
-                    entry.second =
-                        std::unique_ptr<NSString, release_deleter<NSString>>(
-                            str);
+                    shard.lru.push_front(addr);
+
+                    try
+                    {
+                        it = shard.entries
+                                 .insert(std::make_pair(
+                                     addr, typename shard_type::cache_entry()))
+                                 .first;
+                    }
+                    catch (...)
+                    {
+                        shard.lru.pop_front();
+                        throw;
+                    }
+
+                    it->second.lru = shard.lru.begin();
+                    evict(shard, config.shard_capacity);
                 }
 
-                [cache performSelectorOnMainThread:@selector(lookupComplete:)
-                                        withObject:nil
-                                     waitUntilDone:NO];
-            };
-
-            async.enqueue(f);
+                // in progress from here, though the request is only made once
+                // the lock is released, as the resolver may call straight
+                // back into this shard
+                it->second.code = HOSTCACHE_INPROG;
+                it->second.expires = clock_type::now();
+            }
 
-            // Async call dispatched so safe to mark as in-progress now
-            entry.first = HOSTCACHE_INPROG;
+            resolver.request(resolver_address(family, addr));
 
             if (code != NULL)
-                *code = HOSTCACHE_INPROG;
+                *code = (name != nil) ? HOSTCACHE_SUCCESS : HOSTCACHE_INPROG;
         }
         catch (const std::exception& e)
         {
+            forget_lookup(shard, addr);
+
             if (code != NULL)
-                *code = HOSTCACHE_ERROR;
+                *code = (name != nil) ? HOSTCACHE_SUCCESS : HOSTCACHE_ERROR;
+        }
+
+        return name;
+    }
+
+    template<typename AddrType>
+    void store_resolved(
+        cache_table<AddrType>& table,
+        const cache_config& config,
+        const peep::resolver::address& raddr,
+        peep::resolver::result result,
+        const std::string& host)
+    {
+        AddrType addr;
+        NSString* name;
+
+        std::memcpy(&addr, raddr.bytes, sizeof(addr));
+
+        cache_shard<AddrType>& shard = table.shard_for(addr);
+
+        switch (result)
+        {
+        case peep::resolver::success:
+            if ((name = [[NSString alloc] initWithUTF8String:host.c_str()]) !=
+                nil)
+            {
+                store_result(shard, config, addr, HOSTCACHE_SUCCESS, name);
+                break;
+            }
+            // fall through
+
+        case peep::resolver::error:
+            store_result<AddrType>(shard, config, addr, HOSTCACHE_ERROR, nil);
+            break;
+
+        case peep::resolver::noname:
+            store_result<AddrType>(shard, config, addr, HOSTCACHE_NONAME, nil);
+            break;
+
+        case peep::resolver::dropped:
+            forget_lookup(shard, addr);
+            break;
         }
+    }
 
-        return nil;
+    // called by the resolver, on its threads
+    void resolved(
+        HostCache* cache,
+        cache_table<in_addr>& ip4_addrs,
+        cache_table<in6_addr>& ip6_addrs,
+        const cache_config& config,
+        const peep::resolver::address& addr,
+        peep::resolver::result result,
+        const std::string& host)
+    {
+        if (addr.family == AF_INET6)
+            store_resolved(ip6_addrs, config, addr, result, host);
+        else
+            store_resolved(ip4_addrs, config, addr, result, host);
+
+        // nothing new to show for a dropped request
+        if (result != peep::resolver::dropped)
+            [cache performSelectorOnMainThread:@selector(lookupComplete:)
+                                    withObject:nil
+                                 waitUntilDone:NO];
     }
 }
 
 @implementation HostCache
 {
-    peep::async async_;
-    ip4_map ip4_addrs_;
-    ip6_map ip6_addrs_;
-    std::mutex ip4_mutex_;
-    std::mutex ip6_mutex_;
+    cache_config config_;
+    cache_table<in_addr> ip4_addrs_;
+    cache_table<in6_addr> ip6_addrs_;
+    // sized by init to the lookups the resolver keeps outstanding
+    std::unique_ptr<peep::async> async_;
+    // last, so that it is destroyed first, finishing the lookups which
+    // refer to the tables above, before async_ is
+    std::unique_ptr<peep::resolver> resolver_;
 }
 
 + (HostCache*)sharedHostCache
@@ -199,7 +438,64 @@ namespace
 
 - (id)init
 {
-    self = [super init];
+    NSUserDefaults* defaults;
+    NSInteger capacity, max_queries;
+    NSString* server;
+    peep::resolver::options opts;
+
+    if ((self = [super init]) != nil)
+    {
+        defaults = [NSUserDefaults standardUserDefaults];
+
+        capacity = [defaults integerForKey:PPHOSTCACHE_CAPACITY];
+        [self setCapacity:(capacity > 0) ? (NSUInteger)capacity : 0];
+        [self setPositiveTTL:[defaults doubleForKey:PPHOSTCACHE_POSITIVE_TTL]
+                 negativeTTL:[defaults doubleForKey:PPHOSTCACHE_NEGATIVE_TTL]];
+
+        if ((max_queries = [defaults integerForKey:PPHOSTCACHE_MAX_QUERIES]) >
+            0)
+            opts.max_outstanding = max_queries;
+        opts.max_waiting = HOSTCACHE_MAX_WAITING;
+        if ((server = [defaults stringForKey:PPHOSTCACHE_DNS_SERVER]) != nil)
+            opts.server = [server UTF8String];
+
+        HostCache* cache = self;
+        cache_table<in_addr>& ip4_addrs = ip4_addrs_;
+        cache_table<in6_addr>& ip6_addrs = ip6_addrs_;
+        const cache_config& config = config_;
+
+        auto f = [cache, &ip4_addrs, &ip6_addrs, &config](
+                     const peep::resolver::address& addr,
+                     peep::resolver::result result,
+                     const std::string& host) {
+            resolved(cache, ip4_addrs, ip6_addrs, config, addr, result, host);
+        };
+
+        try
+        {
+            // getnameinfo blocks the thread it runs on, so there is a thread
+            // for each lookup outstanding, and one more so that a drain()
+            // queued while another is returning doesn't wait for it
+            async_.reset(new peep::async(opts.max_outstanding + 1));
+
+            try
+            {
+                resolver_.reset(new peep::resolver(*async_, f, opts));
+            }
+            catch (const std::exception& e)
+            {
+                // carry on with the system's resolver
+                NSLog(@"%s", e.what());
+                opts.server.clear();
+                resolver_.reset(new peep::resolver(*async_, f, opts));
+            }
+        }
+        catch (const std::exception& e)
+        {
+            [self release];
+            return nil;
+        }
+    }
     return self;
 }
 
@@ -217,26 +513,47 @@ namespace
 
 - (NSString*)hostWithAddressASync:(const in_addr*)addr returnCode:(int*)code
 {
-    return lookup<struct sockaddr_in>(
-        self, async_, *addr, AF_INET, ip4_addrs_, ip4_mutex_, code);
+    return lookup(*resolver_, *addr, AF_INET, ip4_addrs_, config_, code);
 }
 
 - (NSString*)hostWithIp6AddressASync:(const in6_addr*)addr returnCode:(int*)code
 {
-    return lookup<struct sockaddr_in6>(
-        self, async_, *addr, AF_INET6, ip6_addrs_, ip6_mutex_, code);
+    return lookup(*resolver_, *addr, AF_INET6, ip6_addrs_, config_, code);
 }
 
 - (void)flush
 {
-    {
-        std::lock_guard<std::mutex> lock(ip4_mutex_);
-        ip4_addrs_.clear();
-    }
-    {
-        std::lock_guard<std::mutex> lock(ip6_mutex_);
-        ip6_addrs_.clear();
-    }
+    resolver_->clear();
+    ip4_addrs_.clear();
+    ip6_addrs_.clear();
+}
+
+- (void)setCapacity:(NSUInteger)capacity
+{
+    std::size_t n;
+
+    // rounded up, so a small capacity still leaves room in every shard
+    n = (capacity + HOSTCACHE_SHARDS - 1) / HOSTCACHE_SHARDS;
+    config_.shard_capacity = n;
+
+    // shrinking takes effect as addresses are added
+}
+
+- (NSUInteger)capacity
+{
+    return config_.shard_capacity * HOSTCACHE_SHARDS;
+}
+
+- (void)setPositiveTTL:(NSTimeInterval)positive
+           negativeTTL:(NSTimeInterval)negative
+{
+    config_.positive_ttl = (positive > 0.0) ? positive : 0.0;
+    config_.negative_ttl = (negative > 0.0) ? negative : 0.0;
+}
+
+- (NSUInteger)count
+{
+    return ip4_addrs_.count() + ip6_addrs_.count();
 }
 
 @end
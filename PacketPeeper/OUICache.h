@@ -20,23 +20,27 @@
 #ifndef _OUICACHE_H_
 #define _OUICACHE_H_
 
-#include "Cache.h"
+#import <Foundation/NSObject.h>
+#include <stdint.h>
 
-#define OC_HASHMASK     (OC_HASHTABLE_SZ - 1)
-#define OC_HASHTABLE_SZ 256
+#define OC_EMPTY_SLOT UINT32_MAX /* OUIs are only 24 bits */
 
-@interface OUICache : Cache
+@class NSString;
+
+/* maps the 24 bit OUI of an ethernet address to its manufacturer. The whole
+   table is loaded when the cache is created, into an open addressed hash
+   table of interned strings, so lookups never touch the disk and never
+   allocate */
+
+@interface OUICache : NSObject
 {
-    char* manufacturer;
-    size_t manufacturer_sz;
-    int fd;
-    unsigned int recsz;
-    unsigned int nrecs;
+    uint32_t* ouis;   /* OC_EMPTY_SLOT, or the OUI in each slot */
+    NSString** names; /* manufacturer of the OUI in each slot */
+    uint32_t mask;    /* number of slots - 1 */
 }
 
 + (OUICache*)sharedOUICache;
 + (void)releaseSharedOUICache;
-- (NSString*)readManufacturerForEthernetAddress:(void*)addr;
 - (NSString*)manufacturerForEthernetAddress:(void*)addr;
 
 @end
@@ -17,15 +17,17 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+
 #include "OUICache.h"
+#include "datfile.h"
 #import <Foundation/NSBundle.h>
-#import <Foundation/NSNull.h>
+#import <Foundation/NSDictionary.h>
 #import <Foundation/NSString.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
-#include <sys/uio.h>
 #include <unistd.h>
 
 #define OUICACHE_DATFILE_PATH                                         \
@@ -33,20 +35,7 @@
                                      ofType:@"oui"] UTF8String]
 #define OUICACHE_DATFILE_MAGIC 0x1C0D
 
-#define OUICACHE_RECORD_NULL  1
-#define OUICACHE_RECORD_FOUND 0
-
-static int read_oui(
-    int fd,
-    uint32_t oui,
-    unsigned int recsz,
-    unsigned int nrecs,
-    char* outbuf,
-    size_t outbuf_sz);
-
-static int oui_comp(const void* key_a, const void* key_b);
-
-static unsigned int oui_hash(const void* key);
+static uint32_t oui_hash(uint32_t oui);
 
 static OUICache* _sharedOUICache = nil;
 
@@ -83,151 +72,150 @@ struct datfile_rec
     _sharedOUICache = nil;
 }
 
+/* loads every record of the data file, which is a header followed by
+   fixed size records sorted by OUI, each the OUI, the length of the
+   manufacturer's name and the name itself */
 - (id)init
 {
+    NSMutableDictionary* interned;
+    NSString* name;
+    NSString* existing;
+    const uint8_t* base;
+    const uint8_t* rec;
+    const char* str;
     struct datfile_hdr hdr;
+    struct datfile_rec entry;
+    size_t len, nslots;
+    unsigned int i;
+    uint32_t slot;
 
-    if ((self = [super initWithKeySize:sizeof(uint32_t)
-                             hashSlots:OC_HASHTABLE_SZ
-                          hashFunction:oui_hash
-                    comparisonFunction:oui_comp]) != nil)
+    if ((self = [super init]) != nil)
     {
-        fd = -1;
-        manufacturer = NULL;
+        ouis = NULL;
+        names = NULL;
+        mask = 0;
+        base = NULL;
+        len = 0;
 
-        if ((fd = open(OUICACHE_DATFILE_PATH, O_RDONLY, 0)) == -1)
+        if ((base = map_datfile(OUICACHE_DATFILE_PATH, &len)) == NULL)
             goto err;
 
-        if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        if (len < DATFILE_HDR_SZ)
             goto err;
 
+        memcpy(&hdr, base, sizeof(hdr));
         hdr.recsz = ntohs(hdr.recsz);
         hdr.nrecs = ntohs(hdr.nrecs);
 
         if (hdr.magic != OUICACHE_DATFILE_MAGIC ||
-            hdr.recsz < DATFILE_RECHDR_SZ || hdr.nrecs < 1)
+            hdr.recsz < DATFILE_RECHDR_SZ || hdr.nrecs < 1 ||
+            len < DATFILE_HDR_SZ + (size_t)hdr.recsz * hdr.nrecs)
             goto err;
 
-        recsz = hdr.recsz;
-        nrecs = hdr.nrecs;
-
-        manufacturer_sz = recsz - 4;
+        /* at most half full, so probe sequences stay short */
+        for (nslots = 1; nslots < (size_t)hdr.nrecs * 2; nslots *= 2)
+            ;
 
-        if ((manufacturer = malloc(manufacturer_sz)) == NULL)
+        if ((ouis = malloc(nslots * sizeof(*ouis))) == NULL ||
+            (names = calloc(nslots, sizeof(*names))) == NULL)
             goto err;
+
+        memset(ouis, 0xff, nslots * sizeof(*ouis)); /* all OC_EMPTY_SLOT */
+        mask = nslots - 1;
+
+        /* many OUIs share a manufacturer, so keep one string for each */
+        interned = [[NSMutableDictionary alloc] init];
+
+        for (i = 0; i < hdr.nrecs; ++i)
+        {
+            rec = base + DATFILE_HDR_SZ + (size_t)hdr.recsz * i;
+
+            memcpy(&entry.oui, rec, sizeof(entry.oui));
+            memcpy(&entry.len, rec + sizeof(entry.oui), sizeof(entry.len));
+            entry.oui = ntohl(entry.oui) & 0xffffff;
+            entry.len = MIN(ntohs(entry.len), hdr.recsz - DATFILE_RECHDR_SZ);
+            str = (const char*)rec + DATFILE_RECHDR_SZ;
+
+            if ((name = [[NSString alloc]
+                     initWithBytes:str
+                            length:strnlen(str, entry.len)
+                          encoding:NSUTF8StringEncoding]) == nil)
+                continue;
+
+            if ((existing = [interned objectForKey:name]) != nil)
+            {
+                [name release];
+                name = [existing retain];
+            }
+            else
+            {
+                [interned setObject:name forKey:name];
+            }
+
+            for (slot = oui_hash(entry.oui) & mask;
+                 ouis[slot] != OC_EMPTY_SLOT && ouis[slot] != entry.oui;
+                 slot = (slot + 1) & mask)
+                ;
+
+            if (ouis[slot] == entry.oui)
+            {
+                [name release]; /* duplicate record, keep the first */
+                continue;
+            }
+
+            ouis[slot] = entry.oui;
+            names[slot] = name;
+        }
+
+        [interned release];
+        unmap_datfile(base, len);
     }
     return self;
 
 err:
+    if (base != NULL)
+        unmap_datfile(base, len);
     [self dealloc];
     return nil;
 }
 
-- (NSString*)readManufacturerForEthernetAddress:(void*)addr
-{
-    int ret;
-    uint32_t oui;
-    id str;
-
-    oui = ntohl(*(uint32_t*)addr) >> 8;
-
-    ret = read_oui(fd, oui, recsz, nrecs, manufacturer, manufacturer_sz);
-
-    if (ret == OUICACHE_RECORD_NULL)
-        str = [NSNull null];
-    else if (ret == OUICACHE_RECORD_FOUND)
-        str = [NSString stringWithUTF8String:manufacturer];
-    else
-        return nil;
-
-    return str;
-}
-
 - (NSString*)manufacturerForEthernetAddress:(void*)addr
 {
-    id str;
-    uint32_t oui;
+    const uint8_t* bytes;
+    uint32_t oui, slot;
 
-    oui = ntohl(*(uint32_t*)addr) >> 8;
-    str = [super objectForKey:&oui];
+    bytes = addr;
+    oui = ((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | bytes[2];
 
-    if (str == nil)
+    for (slot = oui_hash(oui) & mask; ouis[slot] != OC_EMPTY_SLOT;
+         slot = (slot + 1) & mask)
     {
-        /* str will be NSNull or the manufacturer name */
-        if ((str = [self readManufacturerForEthernetAddress:addr]) == nil)
-            return nil;
-
-        [super insertObject:str forKey:&oui];
+        if (ouis[slot] == oui)
+            return names[slot];
     }
 
-    return (str == [NSNull null]) ? nil : str;
+    return nil;
 }
 
 - (void)dealloc
 {
-    if (fd != -1)
-        close(fd);
-    if (manufacturer != NULL)
-        free(manufacturer);
-
-    [super dealloc];
-}
-
-@end
-
-static int read_oui(
-    int fd,
-    uint32_t oui,
-    unsigned int recsz,
-    unsigned int nrecs,
-    char* outbuf,
-    size_t outbuf_sz)
-{
-    unsigned int mid, left, right;
-    off_t offset;
-    struct datfile_rec entry;
-
-    left = 0;
-    right = nrecs;
+    uint32_t i;
 
-    do
+    if (names != NULL)
     {
-        if (right < left)
-            return OUICACHE_RECORD_NULL;
-
-        mid = (left + right) / 2;
-
-        offset = DATFILE_HDR_SZ + (recsz * mid);
-
-        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry))
-            return -1;
-
-        entry.oui = ntohl(entry.oui);
-
-        if (oui > entry.oui)
-            left = mid + 1;
-
-        if (oui < entry.oui)
-            right = mid - 1;
-
-    } while (oui != entry.oui);
-
-    entry.len = MIN(ntohs(entry.len), outbuf_sz - 1);
-
-    if (pread(fd, outbuf, entry.len, offset + DATFILE_RECHDR_SZ) != entry.len)
-        return -1;
-
-    outbuf[entry.len] = '\0';
+        for (i = 0; i <= mask; ++i)
+            [names[i] release];
+        free(names);
+    }
+    free(ouis);
 
-    return OUICACHE_RECORD_FOUND;
+    [super dealloc];
 }
 
-static int oui_comp(const void* key_a, const void* key_b)
-{
-    return (*(uint32_t*)key_a - *(uint32_t*)key_b);
-}
+@end
 
-static unsigned int oui_hash(const void* key)
+/* OUIs are allocated in runs, so mix the bits before masking */
+static uint32_t oui_hash(uint32_t oui)
 {
-    return (*(uint32_t*)key & OC_HASHMASK);
+    return (oui * 2654435761u) >> 8;
 }
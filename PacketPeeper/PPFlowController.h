@@ -0,0 +1,67 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _PPFLOWCONTROLLER_H_
+#define _PPFLOWCONTROLLER_H_
+
+#include "flow_tracker.h"
+#import <Foundation/NSObject.h>
+#include <stddef.h>
+
+/* UDP has no close to wait for, so flows idle for this long are assumed to
+   be over */
+#define PPFLOWCONTROLLER_IDLE_TIMEOUT 120.0
+
+@class NSArray;
+@class Packet;
+
+/* counts the packets and bytes of each UDP and ICMP flow, which the TCP
+   stream controller doesn't cover. ICMP flows are keyed by the identifier
+   queries share with their replies, in place of ports. Flow times are
+   capture times, in seconds since the reference date */
+@interface PPFlowController : NSObject
+{
+    struct flow_tracker* tracker;
+    BOOL expiresFlows;
+}
+
+- (void)addPacket:(Packet*)packet;
+- (void)addPacketArray:(NSArray*)packets;
+- (void)removePacket:(Packet*)packet;
+- (void)flush;
+
+/* whether flows idle for longer than PPFLOWCONTROLLER_IDLE_TIMEOUT are
+   forgotten, as they should be during live captures */
+- (void)setExpiresFlows:(BOOL)flag;
+- (BOOL)expiresFlows;
+
+- (size_t)numberOfFlows;
+- (unsigned long long)numberOfExpiredFlows;
+
+/* the flow the packet is part of, or NULL */
+- (const struct flow_stats*)flowForPacket:(Packet*)packet;
+
+/* calls fptr on every flow, from most to least recently active */
+- (void)enumerateFlowsUsingFunction:(flow_stats_fptr)fptr
+                            context:(void*)context;
+
+@end
+
+#endif
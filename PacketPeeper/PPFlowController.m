@@ -0,0 +1,206 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "PPFlowController.h"
+#include "../Shared/Decoding/ICMPDecode.h"
+#include "../Shared/Decoding/IPV4Decode.h"
+#include "../Shared/Decoding/IPV6Decode.h"
+#include "../Shared/Decoding/Packet.h"
+#include "../Shared/Decoding/UDPDecode.h"
+#include "flow_table.h"
+#include "flow_tracker.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSDate.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+
+static int packet_key(Packet* packet, struct flow_key* key);
+
+@implementation PPFlowController
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        if ((tracker = flow_tracker_create(0.0)) == NULL)
+        {
+            [super dealloc];
+            return nil;
+        }
+
+        expiresFlows = NO;
+    }
+    return self;
+}
+
+- (void)addPacket:(Packet*)packet
+{
+    struct flow_key key;
+    int endpoint;
+
+    if (packet == nil || (endpoint = packet_key(packet, &key)) == -1)
+        return;
+
+    (void)flow_tracker_add(
+        tracker,
+        &key,
+        endpoint,
+        [packet actualLength],
+        [[packet date] timeIntervalSinceReferenceDate]);
+}
+
+- (void)addPacketArray:(NSArray*)packets
+{
+    NSUInteger i;
+
+    for (i = 0; i < [packets count]; ++i)
+        [self addPacket:[packets objectAtIndex:i]];
+}
+
+- (void)removePacket:(Packet*)packet
+{
+    struct flow_key key;
+    int endpoint;
+
+    if (packet == nil || (endpoint = packet_key(packet, &key)) == -1)
+        return;
+
+    flow_tracker_remove(
+        tracker,
+        &key,
+        endpoint,
+        [packet actualLength],
+        [[packet date] timeIntervalSinceReferenceDate]);
+}
+
+- (void)flush
+{
+    flow_tracker_clear(tracker);
+}
+
+- (void)setExpiresFlows:(BOOL)flag
+{
+    expiresFlows = flag;
+    flow_tracker_set_idle_timeout(
+        tracker, flag ? PPFLOWCONTROLLER_IDLE_TIMEOUT : 0.0);
+}
+
+- (BOOL)expiresFlows
+{
+    return expiresFlows;
+}
+
+- (size_t)numberOfFlows
+{
+    return flow_tracker_count(tracker);
+}
+
+- (unsigned long long)numberOfExpiredFlows
+{
+    return tracker->expired;
+}
+
+- (const struct flow_stats*)flowForPacket:(Packet*)packet
+{
+    struct flow_key key;
+
+    if (packet_key(packet, &key) == -1)
+        return NULL;
+
+    return flow_tracker_find(tracker, &key);
+}
+
+- (void)enumerateFlowsUsingFunction:(flow_stats_fptr)fptr
+                            context:(void*)context
+{
+    flow_tracker_foreach(tracker, fptr, context);
+}
+
+- (void)dealloc
+{
+    flow_tracker_free(tracker);
+    [super dealloc];
+}
+
+@end
+
+/* sets up the key of the packet's flow, returning the endpoint of the key
+   which sent it, or -1 if it isn't UDP or ICMP */
+static int packet_key(Packet* packet, struct flow_key* key)
+{
+    IPV4Decode* ip;
+    IPV6Decode* ip6;
+    UDPDecode* udp;
+    ICMPDecode* icmp;
+    struct in_addr src, dst;
+    struct in6_addr src6, dst6;
+    uint16_t ident;
+
+    /* IPv4 is by far the common case, so is looked for first */
+    if ((ip = [packet decoderForClass:[IPV4Decode class]]) != nil)
+    {
+        src = [ip in_addrSrc];
+        dst = [ip in_addrDst];
+
+        if ((udp = [packet decoderForClass:[UDPDecode class]]) != nil)
+            return flow_key_init(
+                key,
+                IPPROTO_UDP,
+                &src,
+                &dst,
+                sizeof(struct in_addr),
+                [udp srcPort],
+                [udp dstPort]);
+
+        if ((icmp = [packet decoderForClass:[ICMPDecode class]]) != nil)
+        {
+            /* messages without an identifier share one flow per host pair */
+            ident = [icmp identifier];
+            return flow_key_init(
+                key,
+                IPPROTO_ICMP,
+                &src,
+                &dst,
+                sizeof(struct in_addr),
+                ident,
+                ident);
+        }
+
+        return -1;
+    }
+
+    if ((ip6 = [packet decoderForClass:[IPV6Decode class]]) != nil &&
+        (udp = [packet decoderForClass:[UDPDecode class]]) != nil)
+    {
+        src6 = [ip6 in6_addrSrc];
+        dst6 = [ip6 in6_addrDst];
+
+        return flow_key_init(
+            key,
+            IPPROTO_UDP,
+            &src6,
+            &dst6,
+            sizeof(struct in6_addr),
+            [udp srcPort],
+            [udp dstPort]);
+    }
+
+    return -1;
+}
@@ -0,0 +1,85 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _PPTASKGROUP_H_
+#define _PPTASKGROUP_H_
+
+#import <Foundation/NSObject.h>
+
+/* priority classes, tasks the user is waiting on run before background tasks
+   queued earlier */
+#define PPTASKGROUP_PRIORITY_UI         0
+#define PPTASKGROUP_PRIORITY_BACKGROUND 1
+
+@class PPTaskGroup;
+
+typedef void (^PPTaskBlock)(PPTaskGroup* group);
+
+struct task_group_state;
+
+/* tasks run on the application's shared thread pool, which are cancelled,
+   waited for and report progress together. Cancelling is cooperative: tasks
+   not yet started are skipped at once, running ones are expected to check
+   PPTaskGroupIsCancelled every so often and return early. Once isFinished
+   returns YES, or wait returns, everything written by the group's tasks can
+   be read by the caller */
+@interface PPTaskGroup : NSObject
+{
+    struct task_group_state* state;
+}
+
+- (id)initWithPriority:(int)priority;
+
+/* task is called, with the group, on one of the pool's threads inside an
+   autorelease pool of its own. The group is retained until it's called or
+   skipped. Returns NO, without queueing task, if the group is cancelled */
+- (BOOL)addTask:(PPTaskBlock)task;
+
+- (void)cancel;
+- (BOOL)isCancelled;
+
+/* whether every task added has returned or been skipped */
+- (BOOL)isFinished;
+
+/* blocks until finished; must not be called from the group's own tasks */
+- (void)wait;
+
+- (void)setProgressTotal:(unsigned long long)total;
+- (void)addProgress:(unsigned long long)units;
+
+/* the fraction of the total done so far, 0.0 until a total is set */
+- (double)progress;
+
+@end
+
+/* for tight loops, without the message send. A nil group is never
+   cancelled, and progress added to it goes nowhere */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BOOL PPTaskGroupIsCancelled(PPTaskGroup* group);
+void PPTaskGroupAddProgress(PPTaskGroup* group, unsigned long long units);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "PPTaskGroup.h"
+#include "async.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#import <Foundation/NSAutoreleasePool.h>
+
+namespace
+{
+    // Shared by every group, and never destroyed, as tasks may still be
+    // running when the application exits
+    peep::async& shared_pool()
+    {
+        static peep::async* pool = new peep::async();
+
+        return *pool;
+    }
+
+    enum task_state
+    {
+        task_queued,
+        task_running,
+        task_done
+    };
+
+    struct task_record
+    {
+        explicit task_record(PPTaskBlock block)
+            : state(task_queued), block(block)
+        {
+        }
+
+        std::atomic<int> state;
+        PPTaskBlock block;
+    };
+}
+
+struct task_group_state
+{
+    explicit task_group_state(peep::async::priority prio)
+        : prio(prio), cancelled(false), done(0), total(0), pending(0)
+    {
+    }
+
+    // marks a task as returned or skipped, with mutex held
+    void finish()
+    {
+        if (--pending == 0)
+            cv.notify_all();
+    }
+
+    const peep::async::priority prio;
+    std::atomic<bool> cancelled;
+    std::atomic<unsigned long long> done;
+    std::atomic<unsigned long long> total;
+
+    std::mutex mutex; // guards pending and tasks
+    std::condition_variable cv;
+    std::size_t pending; // tasks queued or running
+    std::vector<std::shared_ptr<task_record>> tasks; // ones cancel may skip
+};
+
+namespace
+{
+    // Called on the pool for each task added, even one cancel has skipped,
+    // so the block and the group it retained are always released
+    void run_task(PPTaskGroup* group,
+                  task_group_state* state,
+                  const std::shared_ptr<task_record>& record)
+    {
+        // returned or not, the task is finished once this goes out of scope
+        struct finisher
+        {
+            ~finisher()
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                record->state = task_done;
+                state->finish();
+            }
+
+            task_group_state* state;
+            task_record* record;
+        };
+
+        int expected = task_queued;
+
+        if (record->state.compare_exchange_strong(expected, task_running))
+        {
+            finisher finish = {state, record.get()};
+
+            if (!state->cancelled.load())
+            {
+                NSAutoreleasePool* autoreleasePool;
+
+                autoreleasePool = [[NSAutoreleasePool alloc] init];
+                record->block(group);
+                [autoreleasePool release];
+            }
+        }
+
+        [record->block release];
+        [group release];
+    }
+}
+
+@implementation PPTaskGroup
+
+- (id)init
+{
+    return [self initWithPriority:PPTASKGROUP_PRIORITY_BACKGROUND];
+}
+
+- (id)initWithPriority:(int)priority
+{
+    if ((self = [super init]) != nil)
+    {
+        state = new task_group_state(
+            (priority == PPTASKGROUP_PRIORITY_UI) ? peep::async::high
+                                                  : peep::async::low);
+    }
+    return self;
+}
+
+- (BOOL)addTask:(PPTaskBlock)task
+{
+    std::shared_ptr<task_record> record;
+    task_group_state* s;
+
+    s = state;
+
+    if (s->cancelled.load())
+        return NO;
+
+    record = std::make_shared<task_record>((PPTaskBlock)[task copy]);
+
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+
+        // forget the tasks which have finished, cancel has no use for them
+        s->tasks.erase(
+            std::remove_if(s->tasks.begin(),
+                           s->tasks.end(),
+                           [](const std::shared_ptr<task_record>& r) {
+                               return r->state.load() == task_done;
+                           }),
+            s->tasks.end());
+        s->tasks.push_back(record);
+        ++s->pending;
+    }
+
+    [self retain];
+
+    try
+    {
+        shared_pool().enqueue(
+            [self, s, record]() { run_task(self, s, record); }, s->prio);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        int expected = task_queued;
+
+        // unless cancel got to it first
+        if (record->state.compare_exchange_strong(expected, task_done))
+            s->finish();
+        s->tasks.erase(std::remove(s->tasks.begin(), s->tasks.end(), record),
+                       s->tasks.end());
+        [record->block release];
+        [self release];
+        return NO;
+    }
+
+    return YES;
+}
+
+- (void)cancel
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    state->cancelled = true;
+
+    // tasks still queued are finished now rather than when the pool gets
+    // round to them, which could be a while if it's busy
+    for (auto it = state->tasks.begin(); it != state->tasks.end(); ++it)
+    {
+        int expected = task_queued;
+
+        if ((*it)->state.compare_exchange_strong(expected, task_done))
+            state->finish();
+    }
+
+    state->tasks.clear();
+}
+
+- (BOOL)isCancelled
+{
+    return state->cancelled.load() ? YES : NO;
+}
+
+- (BOOL)isFinished
+{
+    std::lock_guard<std::mutex> lock(state->mutex);
+
+    return (state->pending == 0) ? YES : NO;
+}
+
+- (void)wait
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+
+    while (state->pending > 0)
+        state->cv.wait(lock);
+}
+
+- (void)setProgressTotal:(unsigned long long)total
+{
+    state->total = total;
+}
+
+- (void)addProgress:(unsigned long long)units
+{
+    state->done.fetch_add(units, std::memory_order_relaxed);
+}
+
+- (double)progress
+{
+    unsigned long long done, total;
+
+    done = state->done.load(std::memory_order_relaxed);
+    total = state->total.load(std::memory_order_relaxed);
+
+    if (total == 0)
+        return 0.0;
+
+    return (done < total) ? done / (double)total : 1.0;
+}
+
+- (void)dealloc
+{
+    delete state;
+    [super dealloc];
+}
+
+// defined in the implementation so they can get at state
+BOOL PPTaskGroupIsCancelled(PPTaskGroup* group)
+{
+    if (group == nil)
+        return NO;
+
+    return group->state->cancelled.load(std::memory_order_relaxed) ? YES : NO;
+}
+
+void PPTaskGroupAddProgress(PPTaskGroup* group, unsigned long long units)
+{
+    if (group != nil)
+        group->state->done.fetch_add(units, std::memory_order_relaxed);
+}
+
+@end
@@ -20,32 +20,29 @@
 #ifndef _PORTCACHE_H_
 #define _PORTCACHE_H_
 
-#include "Cache.h"
-#include <pthread.h>
+#import <Foundation/NSObject.h>
 #include <stdint.h>
 
-#define PC_HASHMASK     (PC_HASHTABLE_SZ - 1)
-#define PC_HASHTABLE_SZ 256
-#define PC_PROTO_TCP    0
-#define PC_PROTO_UDP    1
+#define PC_NPORTS    65536
+#define PC_PROTO_TCP 0
+#define PC_PROTO_UDP 1
 
-@interface PortCache : Cache
+@class NSString;
+
+/* maps TCP and UDP port numbers to service names. Both tables are loaded
+   when the cache is created, into flat arrays indexed by port, so a lookup
+   is a single array access */
+
+@interface PortCache : NSObject
 {
-    char* service_description;
-    size_t service_description_sz;
-    unsigned int tcp_recsz;
-    unsigned int udp_recsz;
-    int tcp_fd;
-    int udp_fd;
+    NSString** tcp_services; /* PC_NPORTS entries, nil if unassigned */
+    NSString** udp_services;
 }
 
 + (PortCache*)sharedPortCache;
 + (void)releaseSharedPortCache;
 - (NSString*)serviceWithTCPPort:(uint16_t)port;
 - (NSString*)serviceWithUDPPort:(uint16_t)port;
-- (NSString*)readServiceWithPort:(uint16_t)port
-                        protocol:(int)proto
-                       isUnified:(BOOL*)unified;
 - (NSString*)serviceWithPort:(uint16_t)port protocol:(int)proto;
 
 @end
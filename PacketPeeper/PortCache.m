@@ -17,15 +17,16 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+
 #include "PortCache.h"
+#include "datfile.h"
 #import <Foundation/NSBundle.h>
-#import <Foundation/NSNull.h>
+#import <Foundation/NSDictionary.h>
 #import <Foundation/NSString.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <netdb.h>
 #include <stdlib.h>
-#include <sys/socket.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -39,22 +40,11 @@
                                      ofType:@"port"] UTF8String]
 #define PORTCACHE_UDP_DATFILE_MAGIC 0x1B0D
 
-#define PORTCACHE_FLAG_HASEQUIVALENT 0x1
-
-#define PORTCACHE_RECORD_NULL  1
-#define PORTCACHE_RECORD_FOUND 0
-
-static int read_service(
-    int fd,
-    uint16_t port,
-    unsigned int recsz,
-    char* outbuf,
-    size_t outbuf_sz,
-    uint8_t* outflags);
-
-static int port_comp(const void* key_a, const void* key_b);
-
-static unsigned int port_hash(const void* key);
+static int load_services(
+    const char* path,
+    uint16_t magic,
+    NSString** services,
+    NSMutableDictionary* interned);
 
 static PortCache* _sharedPortCache = nil;
 
@@ -74,65 +64,6 @@ struct datfile_rec
     uint8_t flags;
 };
 
-@interface PPServicePair : NSObject
-{
-    id tcp;
-    id udp;
-}
-
-- (id)tcpService;
-- (id)udpService;
-- (void)setTCPService:(id)service;
-- (void)setUDPService:(id)service;
-
-@end
-
-@implementation PPServicePair
-
-- (id)init
-{
-    if ((self = [super init]) != nil)
-    {
-        tcp = nil;
-        udp = nil;
-    }
-
-    return self;
-}
-
-- (id)tcpService
-{
-    return tcp;
-}
-
-- (id)udpService
-{
-    return udp;
-}
-
-- (void)setTCPService:(id)service
-{
-    [service retain];
-    [tcp release];
-    tcp = service;
-}
-
-- (void)setUDPService:(id)service
-{
-    [service retain];
-    [udp release];
-    udp = service;
-}
-
-- (void)dealloc
-{
-    [tcp release];
-    [udp release];
-    [super dealloc];
-}
-
-@end
-
 @implementation PortCache
 
 + (PortCache*)sharedPortCache
@@ -151,209 +82,152 @@ struct datfile_rec
 
 - (id)init
 {
-    struct datfile_hdr hdr;
+    NSMutableDictionary* interned;
 
-    if ((self = [super initWithKeySize:sizeof(uint16_t)
-                             hashSlots:PC_HASHTABLE_SZ
-                          hashFunction:port_hash
-                    comparisonFunction:port_comp]) != nil)
+    if ((self = [super init]) != nil)
     {
-        tcp_fd = -1;
-        udp_fd = -1;
-        service_description = NULL;
-
-        if ((tcp_fd = open(PORTCACHE_TCP_DATFILE_PATH, O_RDONLY, 0)) == -1)
-            goto err;
+        interned = nil;
 
-        if (read(tcp_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        if ((tcp_services = calloc(PC_NPORTS, sizeof(*tcp_services))) ==
+                NULL ||
+            (udp_services = calloc(PC_NPORTS, sizeof(*udp_services))) == NULL)
             goto err;
 
-        hdr.recsz = ntohs(hdr.recsz);
-
-        if (hdr.magic != PORTCACHE_TCP_DATFILE_MAGIC ||
-            hdr.recsz < DATFILE_RECHDR_SZ)
-            goto err;
-
-        tcp_recsz = hdr.recsz;
-
-        if ((udp_fd = open(PORTCACHE_UDP_DATFILE_PATH, O_RDONLY, 0)) == -1)
+        /* services assigned to both protocols share one string, as do
+           different ports with the same name */
+        interned = [[NSMutableDictionary alloc] init];
+
+        if (load_services(
+                PORTCACHE_TCP_DATFILE_PATH,
+                PORTCACHE_TCP_DATFILE_MAGIC,
+                tcp_services,
+                interned) == -1 ||
+            load_services(
+                PORTCACHE_UDP_DATFILE_PATH,
+                PORTCACHE_UDP_DATFILE_MAGIC,
+                udp_services,
+                interned) == -1)
             goto err;
 
-        if (read(udp_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
-            goto err;
-
-        hdr.recsz = ntohs(hdr.recsz);
-
-        if (hdr.magic != PORTCACHE_UDP_DATFILE_MAGIC ||
-            hdr.recsz < DATFILE_RECHDR_SZ)
-            goto err;
-
-        udp_recsz = hdr.recsz;
-
-        service_description_sz = MAX(udp_recsz, tcp_recsz) - 2;
-
-        if ((service_description = malloc(service_description_sz)) == NULL)
-            goto err;
+        [interned release];
     }
     return self;
 
 err:
+    [interned release];
     [self dealloc];
     return nil;
 }
 
 - (NSString*)serviceWithTCPPort:(uint16_t)port
 {
-    return [self serviceWithPort:port protocol:PC_PROTO_TCP];
+    return tcp_services[port];
 }
 
 - (NSString*)serviceWithUDPPort:(uint16_t)port
 {
-    return [self serviceWithPort:port protocol:PC_PROTO_UDP];
+    return udp_services[port];
 }
 
-- (NSString*)readServiceWithPort:(uint16_t)port
-                        protocol:(int)proto
-                       isUnified:(BOOL*)unified
+- (NSString*)serviceWithPort:(uint16_t)port protocol:(int)proto
 {
-    int fd, ret;
-    uint16_t recsz;
-    uint8_t flags;
-    id str;
-
-    if (proto == PC_PROTO_TCP)
-    {
-        fd = tcp_fd;
-        recsz = tcp_recsz;
-    }
-    else
-    {
-        fd = udp_fd;
-        recsz = udp_recsz;
-    }
-
-    flags = 0;
-
-    ret = read_service(
-        fd, port, recsz, service_description, service_description_sz, &flags);
-
-    if (ret == PORTCACHE_RECORD_NULL)
-        str = [NSNull null];
-    else if (ret == PORTCACHE_RECORD_FOUND)
-        str = [NSString stringWithUTF8String:service_description];
-    else
-        return nil;
-
-    if (unified != NULL)
-        *unified = (flags & PORTCACHE_FLAG_HASEQUIVALENT) ? YES : NO;
-
-    return str;
+    return (proto == PC_PROTO_UDP) ? udp_services[port] : tcp_services[port];
 }
 
-- (NSString*)serviceWithPort:(uint16_t)port protocol:(int)proto
+- (void)dealloc
 {
-    PPServicePair* result;
-    BOOL unified;
-    id str;
-
-    result = [super objectForKey:&port];
+    unsigned int i;
 
-    if (result == nil ||
-        (proto == PC_PROTO_TCP && [result tcpService] == nil) ||
-        (proto == PC_PROTO_UDP && [result udpService] == nil))
+    if (tcp_services != NULL)
     {
-        /* str will be NSNull or the service name */
-        if ((str = [self readServiceWithPort:port
-                                    protocol:proto
-                                   isUnified:&unified]) == nil)
-            return nil;
-
-        /* only allocate/insert if needed */
-        if (result == nil)
-        {
-            if ((result = [[PPServicePair alloc] init]) == nil)
-                return nil;
-
-            [super insertObject:result forKey:&port];
-        }
-
-        if (proto == PC_PROTO_UDP)
-        {
-            [result setUDPService:str];
-            if (unified)
-                [result setTCPService:str];
-        }
-        else
-        {
-            [result setTCPService:str];
-            if (unified)
-                [result setUDPService:str];
-        }
+        for (i = 0; i < PC_NPORTS; ++i)
+            [tcp_services[i] release];
+        free(tcp_services);
     }
 
-    if (proto == PC_PROTO_UDP)
-        str = [result udpService];
-    else
-        str = [result tcpService];
-
-    return (str == [NSNull null]) ? nil : str;
-}
-
-- (void)dealloc
-{
-    if (tcp_fd != -1)
-        close(tcp_fd);
-    if (udp_fd != -1)
-        close(tcp_fd);
-    if (service_description != NULL)
-        free(service_description);
+    if (udp_services != NULL)
+    {
+        for (i = 0; i < PC_NPORTS; ++i)
+            [udp_services[i] release];
+        free(udp_services);
+    }
 
     [super dealloc];
 }
 
 @end
 
-static int read_service(
-    int fd,
-    uint16_t port,
-    unsigned int recsz,
-    char* outbuf,
-    size_t outbuf_sz,
-    uint8_t* outflags)
-{
+/* fills services, indexed by port, from a data file, which is a header
+   followed by a fixed size record for each port from 1 upwards, each the
+   length of the service name, some flags and the name itself. Returns 0 on
+   success or -1 on failure */
+static int load_services(
+    const char* path,
+    uint16_t magic,
+    NSString** services,
+    NSMutableDictionary* interned)
+{
+    const uint8_t* base;
+    const uint8_t* rec;
+    const char* str;
+    struct datfile_hdr hdr;
     struct datfile_rec entry;
+    NSString* name;
+    NSString* existing;
+    size_t len, nrecs, i;
 
-    if (port < 1)
+    if ((base = map_datfile(path, &len)) == NULL)
         return -1;
 
-    if (pread(fd, &entry, sizeof(entry), 4 + ((port - 1) * recsz)) !=
-        sizeof(entry))
-        return -1;
+    if (len < DATFILE_HDR_SZ)
+        goto err;
 
-    entry.len = ntohs(entry.len);
+    memcpy(&hdr, base, sizeof(hdr));
+    hdr.recsz = ntohs(hdr.recsz);
 
-    if (entry.len == 0)
-        return PORTCACHE_RECORD_NULL;
+    if (hdr.magic != magic || hdr.recsz < DATFILE_RECHDR_SZ)
+        goto err;
 
-    entry.len = MIN(entry.len, outbuf_sz - 1);
+    nrecs = MIN((len - DATFILE_HDR_SZ) / hdr.recsz, PC_NPORTS - 1);
 
-    if (pread(fd, outbuf, entry.len, 4 + ((port - 1) * recsz) + 3) != entry.len)
-        return -1;
+    for (i = 0; i < nrecs; ++i)
+    {
+        rec = base + DATFILE_HDR_SZ + hdr.recsz * i;
 
-    if (outflags != NULL)
-        *outflags = entry.flags;
+        memcpy(&entry.len, rec, sizeof(entry.len));
+        entry.len = ntohs(entry.len);
 
-    outbuf[entry.len] = '\0';
+        if (entry.len == 0)
+            continue;
 
-    return PORTCACHE_RECORD_FOUND;
-}
+        entry.len = MIN(entry.len, hdr.recsz - DATFILE_RECHDR_SZ);
+        str = (const char*)rec + DATFILE_RECHDR_SZ;
 
-static int port_comp(const void* key_a, const void* key_b)
-{
-    return (*(uint16_t*)key_a - *(uint16_t*)key_b);
-}
+        if ((name = [[NSString alloc]
+                 initWithBytes:str
+                        length:strnlen(str, entry.len)
+                      encoding:NSUTF8StringEncoding]) == nil)
+            continue;
 
-static unsigned int port_hash(const void* key)
-{
-    return (*(uint16_t*)key & PC_HASHMASK);
+        if ((existing = [interned objectForKey:name]) != nil)
+        {
+            [name release];
+            name = [existing retain];
+        }
+        else
+        {
+            [interned setObject:name forKey:name];
+        }
+
+        /* the first record is for port 1 */
+        [services[i + 1] release];
+        services[i + 1] = name;
+    }
+
+    unmap_datfile(base, len);
+    return 0;
+
+err:
+    unmap_datfile(base, len);
+    return -1;
 }
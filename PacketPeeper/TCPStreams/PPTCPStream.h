@@ -20,23 +20,31 @@
 #ifndef _PPTCPSTREAM_H_
 #define _PPTCPSTREAM_H_
 
+#include "tcp_metrics.h"
+#include "tcp_state.h"
 #import <Foundation/NSObject.h>
 #include <netinet/in.h>
 #include <stdint.h>
 #include <sys/types.h>
 
-#define PPSTREAM_SORT_SRC_IP_ADDRESS 1
-#define PPSTREAM_SORT_DST_IP_ADDRESS 2
-#define PPSTREAM_SORT_SRC_HOSTNAME   3
-#define PPSTREAM_SORT_DST_HOSTNAME   4
-#define PPSTREAM_SORT_SRC_PORT       5
-#define PPSTREAM_SORT_DST_PORT       6
-#define PPSTREAM_SORT_SRC_PORTNAME   7
-#define PPSTREAM_SORT_DST_PORTNAME   8
-#define PPSTREAM_SORT_BYTES_SENT     9
-#define PPSTREAM_SORT_BYTES_RECV     10
-#define PPSTREAM_SORT_BYTES_TOTAL    11
-#define PPSTREAM_SORT_STATUS         12
+#define PPSTREAM_SORT_SRC_IP_ADDRESS  1
+#define PPSTREAM_SORT_DST_IP_ADDRESS  2
+#define PPSTREAM_SORT_SRC_HOSTNAME    3
+#define PPSTREAM_SORT_DST_HOSTNAME    4
+#define PPSTREAM_SORT_SRC_PORT        5
+#define PPSTREAM_SORT_DST_PORT        6
+#define PPSTREAM_SORT_SRC_PORTNAME    7
+#define PPSTREAM_SORT_DST_PORTNAME    8
+#define PPSTREAM_SORT_BYTES_SENT      9
+#define PPSTREAM_SORT_BYTES_RECV      10
+#define PPSTREAM_SORT_BYTES_TOTAL     11
+#define PPSTREAM_SORT_STATUS          12
+#define PPSTREAM_SORT_HANDSHAKE_RTT   13
+#define PPSTREAM_SORT_RTT             14
+#define PPSTREAM_SORT_RETRANSMISSIONS 15
+#define PPSTREAM_SORT_ZERO_WINDOWS    16
+#define PPSTREAM_SORT_THROUGHPUT      17
+#define PPSTREAM_SORT_PEAK_THROUGHPUT 18
 
 #define PPTCPSTREAM_MSL \
     120.0 /* 2 minutes as per RFC 793 (usually 30 seconds though) */
@@ -44,17 +52,6 @@
 #define PPTCPSTREAM_QUEUE_MAX \
     (16 * 1024) /* maximum number of segments permitted on out of order queue */
 #define PPTCPSTREAM_REASSEMBLY_WINDOW_SZ (8 * 1024 * 1024)
-#define TCP_SEQ_EQ(s1, s2)               ((s1) == (s2))
-#define TCP_SEQ_GT(s1, s2)                                \
-    (((s1) > (s2) && (s1) - (s2) <= (UINT32_MAX / 2U)) || \
-     ((s2) > (s1) && (s2) - (s1) > (UINT32_MAX / 2U)))
-#define TCP_SEQ_LT(s1, s2) TCP_SEQ_GE(s2, s1)
-#define TCP_SEQ_GE(s1, s2) (TCP_SEQ_EQ(s1, s2) || TCP_SEQ_GT(s1, s2))
-#define TCP_SEQ_LE(s1, s2) (TCP_SEQ_EQ(s1, s2) || TCP_SEQ_LT(s1, s2))
-
-/* evaluates s1 - s2. pre-condition ==> TCP_SEQ_GT(s1, s2) == True */
-#define TCP_SEQNO_DIFF(s1, s2) \
-    ((s1) - (s2) <= (UINT32_MAX / 2U) ? (s1) - (s2) : ((s1) - (s2)) + UINT_MAX)
 
 /* calculates next sequence number expected after segment s */
 #define TCPDECODE_SEQNO_NEXT(s) \
@@ -66,35 +63,14 @@
 @class Packet;
 @class PPTCPStreamReassembler;
 
-enum segment_action
-{
-    SEGMENT_ACCEPT,
-    SEGMENT_REJECT,
-    SEGMENT_DISCARD
-};
+struct segment_queue;
 
-enum stream_status
+/* why a stream was summarised, see summarise: */
+enum stream_summary
 {
-    STATUS_UNINITIALISED,
-    STATUS_CLOSED,
-    STATUS_SYN_SENT,
-    STATUS_SIMULTANEOUS_OPEN,
-    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT,
-    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER,
-    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT_2,
-    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER_2,
-    STATUS_SYN_ACK_RECV,
-    STATUS_ESTABLISHED,
-    STATUS_FIN_WAIT_CLIENT_1,
-    STATUS_FIN_WAIT_SERVER_1,
-    STATUS_FIN_WAIT_CLIENT_2,
-    STATUS_FIN_WAIT_SERVER_2,
-    STATUS_CLOSING,
-    STATUS_ACK_WAIT_CLIENT, /* waiting for fin to be acked */
-    STATUS_ACK_WAIT_SERVER, /* waiting for fin to be acked */
-    STATUS_TIME_WAIT,
-    STATUS_SIMULTANEOUS_CLOSE,
-    STATUS_NELEMS
+    SUMMARY_NONE,
+    SUMMARY_EXPIRED, /* idle for longer than PPTCPSTREAM_MSL * 2 */
+    SUMMARY_EVICTED  /* dropped to keep within the stream controllers limits */
 };
 
 @interface PPTCPStream : NSObject
@@ -103,21 +79,34 @@ enum stream_status
     NSMutableArray* m_packets;
     NSMutableArray* m_serverSegments;
     NSMutableArray* m_clientSegments;
-    NSMutableArray*
-        m_clientQueue; /* queue for out of order packets set by server */
-    NSMutableArray*
-        m_serverQueue; /* queue for out of order packets sent by client */
+    /* queues for out of order segments, NULL once the connection closes */
+    struct segment_queue* m_clientQueue;
+    struct segment_queue* m_serverQueue;
     unsigned long long m_client_nbytes; /* nbytes sent by the `client' */
     unsigned long long m_server_nbytes; /* nbytes sent by the `server' */
     enum stream_status m_status;
-    /* first packets source ip/port, used to determine a packets direction */
-    struct in_addr m_client_srcip;
-    struct in_addr m_client_dstip;
+    /* first packets source ip/port, used to determine a packets direction.
+       IPv6 addresses are kept out of line so IPv4 streams stay small */
+    union
+    {
+        struct in_addr v4[2];  /* source, destination */
+        struct in6_addr* v6;   /* malloc'd source, destination pair */
+    } m_client_addr;
     uint16_t m_client_sport;
     uint16_t m_client_dport;
+    uint8_t m_client_family; /* AF_INET, AF_INET6 or 0 if not yet known */
     BOOL m_isValid;
     BOOL m_isDisplayed;
 
+    /* once summarised, only the first packet is kept, for the hostname and
+       port name columns */
+    enum stream_summary m_summary;
+    Packet* m_firstPacket;
+
+    /* RTT, retransmissions, etc. of every segment added so far. These
+       survive summarise: */
+    struct tcp_metrics m_metrics;
+
     /* variables used to record book-keeping info within a state. */
     uint32_t m_c_seq_no;
     uint32_t m_s_seq_no;
@@ -129,53 +118,22 @@ enum stream_status
 - (void)setClientSegment:(TCPDecode*)segment; /* private method */
 - (BOOL)segmentIsClient:(TCPDecode*)segment;
 - (BOOL)segmentIsServer:(TCPDecode*)segment;
+- (Packet*)firstPacket;  /* private method */
+- (id)firstPacketIP;      /* private method */
 - (void)incrementServerSegmentBytes:(TCPDecode*)segment; /* private method */
 - (void)incrementClientSegmentBytes:(TCPDecode*)segment; /* private method */
 
 - (BOOL)addPacket:(Packet*)packet;
-- (enum segment_action)addPacketUninitialised:
-    (TCPDecode*)segment;                                    /* private method */
-- (enum segment_action)addPacketClosed:(TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketSynSent:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketSimultaneousOpen:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketSimultaneousSynAckWaitClient:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketSimultaneousSynAckWaitServer:
-    (TCPDecode*)segment; /* private method */
-
-- (enum segment_action)addPacketSimultaneousSynAckWaitClient2:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketSimultaneousSynAckWaitServer2:
-    (TCPDecode*)segment; /* private method */
-
-- (enum segment_action)addPacketSynAckRecv:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketEstablished:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketFinWaitClient1:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketFinWaitServer1:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketFinWaitClient2:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketFinWaitServer2:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addSimultaneousClose:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketAckWaitClient:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketAckWaitServer:
-    (TCPDecode*)segment; /* private method */
-- (enum segment_action)addPacketTimeWait:
+- (enum segment_action)transitionWithSegment:
     (TCPDecode*)segment; /* private method */
 
 - (void)addSegment:(TCPDecode*)segment;       /* private method */
 - (void)addClientSegment:(TCPDecode*)segment; /* private method */
 - (void)addServerSegment:(TCPDecode*)segment; /* private method */
 
-- (void)addSegment:(TCPDecode*)segment toQueue:(NSMutableArray*)queue;
+- (void)addSegment:(TCPDecode*)segment toQueue:(struct segment_queue*)queue;
+- (void)processQueue:(struct segment_queue**)queue; /* private method */
+- (void)removeQueuedSegment:(TCPDecode*)segment;    /* private method */
 
 - (size_t)packetsCount;
 - (Packet*)packetAtIndex:(NSInteger)index;
@@ -199,10 +157,26 @@ enum stream_status
 - (unsigned long long)bytesSent;
 - (unsigned long)bytesReceived;
 - (unsigned long long)totalBytes;
+
+/* in seconds, or -1.0 if there are no samples */
+- (double)handshakeRTT;
+- (double)meanRTT;
+- (unsigned long)retransmissions;
+- (unsigned long)zeroWindows;
+/* in bytes per second */
+- (double)throughput;
+- (double)peakThroughput;
+
 - (BOOL)isValid;
 - (BOOL)isDisplayed;
 - (void)setDisplayed:(BOOL)isDisplayed;
 
+/* drops the streams packets and segments, keeping only what the streams
+   window needs to display it. The stream can't be added to or reassembled
+   afterwards */
+- (void)summarise:(enum stream_summary)reason;
+- (BOOL)isSummarised;
+
 - (NSComparisonResult)compare:(PPTCPStream*)stream atIndex:(unsigned int)index;
 
 - (void)removeAllPackets;
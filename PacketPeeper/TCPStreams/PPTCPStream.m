@@ -19,12 +19,15 @@
 
 #include "PPTCPStream.h"
 #include "../../Shared/Decoding/IPV4Decode.h"
+#include "../../Shared/Decoding/IPV6Decode.h"
 #include "../../Shared/Decoding/Packet.h"
 #include "../../Shared/Decoding/TCPDecode.h"
 #include "../../Shared/Decoding/strfuncs.h"
 #include "../Categories/NSMutableArrayExtensions.h"
 #include "../UI Classes/stream_compare.h"
 #include "PPTCPStreamReassembler.h"
+#include "segment_queue.h"
+#include "tcp_metrics.h"
 #import <Foundation/NSArray.h>
 #import <Foundation/NSDate.h>
 #import <Foundation/NSIndexSet.h>
@@ -33,8 +36,10 @@
 #include <netinet/tcp.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
-static SEL add_pkt_dispatch_table[STATUS_NELEMS];
+static void queued_segment_release(void* segment);
+static void segment_info_init(TCPDecode* segment, struct tcp_segment_info* info);
 
 @implementation PPTCPStream
 
@@ -49,47 +54,23 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
         m_serverSegments = [[NSMutableArray alloc] init];
         m_clientSegments = [[NSMutableArray alloc] init];
 
-        m_clientQueue = [[NSMutableArray alloc] init];
-        m_serverQueue = [[NSMutableArray alloc] init];
+        m_clientQueue = segment_queue_create();
+        m_serverQueue = segment_queue_create();
 
         m_client_nbytes = 0;
         m_server_nbytes = 0;
 
+        m_client_family = 0;
+
+        tcp_metrics_init(&m_metrics);
+
         m_isValid = NO;
         m_isDisplayed = NO;
 
-        [self setStatus:STATUS_UNINITIALISED];
+        m_summary = SUMMARY_NONE;
+        m_firstPacket = nil;
 
-        add_pkt_dispatch_table[STATUS_UNINITIALISED] =
-            @selector(addPacketUninitialised:);
-        add_pkt_dispatch_table[STATUS_CLOSED] = @selector(addPacketClosed:);
-        add_pkt_dispatch_table[STATUS_SYN_SENT] = @selector(addPacketSynSent:);
-        add_pkt_dispatch_table[STATUS_SIMULTANEOUS_OPEN] =
-            @selector(addPacketSimultaneousOpen:);
-        add_pkt_dispatch_table[STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT] =
-            @selector(addPacketSimultaneousSynAckWaitClient:);
-        add_pkt_dispatch_table[STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER] =
-            @selector(addPacketSimultaneousSynAckWaitServer:);
-        add_pkt_dispatch_table[STATUS_SYN_ACK_RECV] =
-            @selector(addPacketSynAckRecv:);
-        add_pkt_dispatch_table[STATUS_ESTABLISHED] =
-            @selector(addPacketEstablished:);
-        add_pkt_dispatch_table[STATUS_FIN_WAIT_CLIENT_1] =
-            @selector(addPacketFinWaitClient1:);
-        add_pkt_dispatch_table[STATUS_FIN_WAIT_SERVER_1] =
-            @selector(addPacketFinWaitServer1:);
-        add_pkt_dispatch_table[STATUS_FIN_WAIT_CLIENT_2] =
-            @selector(addPacketFinWaitClient2:);
-        add_pkt_dispatch_table[STATUS_FIN_WAIT_SERVER_2] =
-            @selector(addPacketFinWaitServer2:);
-        add_pkt_dispatch_table[STATUS_SIMULTANEOUS_CLOSE] =
-            @selector(addSimultaneousClose:);
-        add_pkt_dispatch_table[STATUS_ACK_WAIT_CLIENT] =
-            @selector(addPacketAckWaitClient:);
-        add_pkt_dispatch_table[STATUS_ACK_WAIT_SERVER] =
-            @selector(addPacketAckWaitServer:);
-        add_pkt_dispatch_table[STATUS_TIME_WAIT] =
-            @selector(addPacketTimeWait:);
+        [self setStatus:STATUS_UNINITIALISED];
     }
     return self;
 }
@@ -102,9 +83,13 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
                          (void*)self,
                          [self status],
                          m_isValid ? "yes" : "no",
-                         (unsigned long)[m_clientQueue count],
+                         (unsigned long)((m_clientQueue != NULL) ?
+                                             segment_queue_count(m_clientQueue) :
+                                             0),
                          (unsigned long)[m_clientSegments count],
-                         (unsigned long)[m_serverQueue count],
+                         (unsigned long)((m_serverQueue != NULL) ?
+                                             segment_queue_count(m_serverQueue) :
+                                             0),
                          (unsigned long)[m_serverSegments count]];
 }
 
@@ -126,26 +111,64 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     m_isValid = ((m_isValid || m_status == STATUS_ESTABLISHED) ? YES : NO);
     if (m_status == STATUS_CLOSED || m_status == STATUS_TIME_WAIT)
     {
-        [m_clientQueue release];
-        [m_serverQueue release];
-        m_clientQueue = nil;
-        m_serverQueue = nil;
+        segment_queue_free(m_clientQueue, queued_segment_release);
+        segment_queue_free(m_serverQueue, queued_segment_release);
+        m_clientQueue = NULL;
+        m_serverQueue = NULL;
     }
 }
 
 - (void)setClientSegment:(TCPDecode*)segment
 {
+    IPV4Decode* ip;
+    IPV6Decode* ip6;
+
     m_client_sport = [segment srcPort];
     m_client_dport = [segment dstPort];
-    m_client_srcip = [[segment ip] in_addrSrc];
-    m_client_dstip = [[segment ip] in_addrDst];
+
+    if ((ip = [segment ip]) != nil)
+    {
+        if (m_client_family == AF_INET6)
+            free(m_client_addr.v6);
+        m_client_family = AF_INET;
+        m_client_addr.v4[0] = [ip in_addrSrc];
+        m_client_addr.v4[1] = [ip in_addrDst];
+    }
+    else if ((ip6 = [segment ip6]) != nil)
+    {
+        if (m_client_family != AF_INET6)
+        {
+            if ((m_client_addr.v6 = malloc(2 * sizeof(struct in6_addr))) ==
+                NULL)
+            {
+                m_client_family = 0;
+                return;
+            }
+            m_client_family = AF_INET6;
+        }
+        m_client_addr.v6[0] = [ip6 in6_addrSrc];
+        m_client_addr.v6[1] = [ip6 in6_addrDst];
+    }
 }
 
 - (BOOL)segmentIsClient:(TCPDecode*)segment
 {
-    return (
-        [segment srcPort] == m_client_sport &&
-        [[segment ip] in_addrSrc].s_addr == m_client_srcip.s_addr);
+    struct in6_addr src;
+
+    if ([segment srcPort] != m_client_sport)
+        return NO;
+
+    if (m_client_family == AF_INET)
+        return (
+            [[segment ip] in_addrSrc].s_addr == m_client_addr.v4[0].s_addr);
+
+    if (m_client_family == AF_INET6)
+    {
+        src = [[segment ip6] in6_addrSrc];
+        return IN6_ARE_ADDR_EQUAL(&src, &m_client_addr.v6[0]);
+    }
+
+    return NO;
 }
 
 - (BOOL)segmentIsServer:(TCPDecode*)segment
@@ -226,10 +249,14 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
 - (BOOL)addPacket:(Packet*)packet
 {
     TCPDecode* segment;
+    struct tcp_segment_info info;
     enum segment_action action;
 
     /* addPacket methods work from the perspective of the client */
 
+    if (m_summary != SUMMARY_NONE)
+        return NO;
+
     /* incoming packet is too new to be part of this stream, discard */
     if ([m_packets count] > 0 &&
         [[packet date] timeIntervalSinceDate:[[m_packets lastObject] date]] >
@@ -239,22 +266,30 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     if ((segment = [packet decoderForClass:[TCPDecode class]]) == nil)
         return NO;
 
-    action = (enum segment_action)
-        [self performSelector:add_pkt_dispatch_table[m_status]
-                   withObject:segment];
-
-    if (action == SEGMENT_DISCARD)
-        return YES;
+    action = [self transitionWithSegment:segment];
 
     if (m_status == STATUS_CLOSED && action == SEGMENT_REJECT)
         return NO;
 
+    /* metrics count every segment as it arrives, including retransmissions
+       the state machine discards and segments held back on the queues */
+    if (m_status != STATUS_UNINITIALISED)
+    {
+        segment_info_init(segment, &info);
+        info.is_client = [self segmentIsClient:segment];
+        tcp_metrics_add(
+            &m_metrics, &info, [[packet date] timeIntervalSinceReferenceDate]);
+    }
+
+    if (action == SEGMENT_DISCARD)
+        return YES;
+
     if (action == SEGMENT_REJECT)
     {
         /* out of order */
         if ([self segmentIsClient:segment])
         {
-            /* we already know that TCP_SEQ_GT([segment seqNo], m_c_seq_no) due to checks in addPacketEstablished: */
+            /* we already know that TCP_SEQ_GT([segment seqNo], m_c_seq_no) due to checks in the state machine */
             if (TCP_SEQNO_DIFF([segment seqNo], m_c_seq_no) >
                 PPTCPSTREAM_REASSEMBLY_WINDOW_SZ)
                 return YES; /* discard */
@@ -262,7 +297,7 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
         }
         else
         { /* server segment */
-            /* we already know that TCP_SEQ_GT([segment seqNo], m_s_seq_no) due to checks in addPacketEstablished: */
+            /* we already know that TCP_SEQ_GT([segment seqNo], m_s_seq_no) due to checks in the state machine */
             if (TCP_SEQNO_DIFF([segment seqNo], m_s_seq_no) >
                 PPTCPSTREAM_REASSEMBLY_WINDOW_SZ)
                 return YES; /* discard */
@@ -288,24 +323,8 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
             }
         }
 
-        while ([m_clientQueue count] > 0)
-        {
-            action = (enum segment_action)
-                [self performSelector:add_pkt_dispatch_table[m_status]
-                           withObject:[m_clientQueue objectAtIndex:0]];
-            if (action != SEGMENT_ACCEPT)
-                break;
-            [m_clientQueue removeObjectAtIndex:0];
-        }
-        while ([m_serverQueue count] > 0)
-        {
-            action = (enum segment_action)
-                [self performSelector:add_pkt_dispatch_table[m_status]
-                           withObject:[m_serverQueue objectAtIndex:0]];
-            if (action != SEGMENT_ACCEPT)
-                break;
-            [m_serverQueue removeObjectAtIndex:0];
-        }
+        [self processQueue:&m_clientQueue];
+        [self processQueue:&m_serverQueue];
     }
 
     if (m_streamReassembler != nil)
@@ -314,467 +333,48 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     return YES;
 }
 
-- (enum segment_action)addPacketUninitialised:(TCPDecode*)segment
-{
-    if ([segment synFlag])
-    {
-        [self setClientSegment:segment];
-        [self addClientSegment:segment];
-        [self setStatus:STATUS_SYN_SENT];
-    }
-    else if (![segment rstFlag] && ![segment finFlag])
-    {
-        [self setClientSegment:segment];
-        [self addClientSegment:segment];
-        /* try to handle already open streams, next server segment
-		   will be accepted without a sequence number check (as we
-		   could only check using [segment ackNo], which isn't 100%
-		   reliable */
-        [self setStatus:STATUS_ESTABLISHED];
-    }
-
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketClosed:(TCPDecode*)segment
-{
-    /* this check isnt strictly needed, but without it we'd go
-	   to the uninitialised state in a new stream object */
-    if ([segment rstFlag] || [segment finFlag])
-        return SEGMENT_ACCEPT;
-
-    return SEGMENT_REJECT;
-}
-
-- (enum segment_action)addPacketSynSent:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment synFlag]) /* repeated syn */
-            [self addClientSegment:segment];
-    }
-    else
-    { /* server segment */
-        if ([segment synFlag] && [segment ackFlag])
-        { /* no isn available to verify */
-            if ([segment ackNo] == m_c_seq_no)
-            { /* syn/ack reply */
-                [self addServerSegment:segment];
-                [self setStatus:STATUS_SYN_ACK_RECV];
-            }
-        }
-        else if ([segment synFlag])
-        {
-            /* simultaneous open */
-            [self addServerSegment:segment];
-            [self setStatus:STATUS_SIMULTANEOUS_OPEN];
-        }
-
-        /* At some point I will add support for handing weird but technically valid
-		 * handshakes, e.g. things like breaking the syn/ack reply into multiple
-		 * packets. For now though, I don't care about this, Packet Peeper is not
-		 * supposed to be an IDS, and there are easier ways to fool it.
-		 */
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketSimultaneousOpen:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_s_seq_no)
-        {
-            [self addClientSegment:segment];
-            [self setStatus:STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER];
-        }
-    }
-    else
-    { /* server segment */
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_c_seq_no)
-        {
-            [self addClientSegment:segment];
-            [self setStatus:STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketSimultaneousSynAckWaitClient:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_s_seq_no)
-        {
-            [self addClientSegment:segment];
-            [self setStatus:STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER_2];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketSimultaneousSynAckWaitServer:(TCPDecode*)segment
+/* private method, runs segment through the state machine and applies the
+   transition it makes */
+- (enum segment_action)transitionWithSegment:(TCPDecode*)segment
 {
-    if ([self segmentIsServer:segment])
-    {
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_c_seq_no)
-        {
-            [self addServerSegment:segment];
-            [self setStatus:STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT_2];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketSimultaneousSynAckWaitClient2:
-    (TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_s_seq_no)
-        {
-            [self addClientSegment:segment];
-            [self setStatus:STATUS_ESTABLISHED];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
+    struct tcp_segment_info info;
+    struct tcp_state state;
+    struct tcp_transition transition;
 
-- (enum segment_action)addPacketSimultaneousSynAckWaitServer2:
-    (TCPDecode*)segment
-{
-    if ([self segmentIsServer:segment])
-    {
-        if ([segment synFlag] && [segment ackFlag] &&
-            [segment ackNo] == m_s_seq_no)
-        {
-            [self addServerSegment:segment];
-            [self setStatus:STATUS_ESTABLISHED];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketSynAckRecv:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no && [segment ackFlag] &&
-            [segment ackNo] == m_s_seq_no)
-        { /* ack reply */
-            [self addClientSegment:segment];
-            [self setStatus:STATUS_ESTABLISHED];
-        }
-    }
-    else
-    { /* server segment */
-        if ([segment synFlag] && [segment ackFlag])
-        {                                      /* no isn to verify */
-            if ([segment ackNo] == m_c_seq_no) /* repeated syn/ack reply */
-                [self addServerSegment:segment];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketEstablished:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no)
-        {
-            [self addClientSegment:segment];
-            if ([segment finFlag])
-                [self setStatus:STATUS_FIN_WAIT_SERVER_1];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_c_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_c_seq_no)
-                    [self addClientSegment:segment];
-                /* otherwise discard the segment; I suppose its possible that this could have a
-				   higher ack than seen before, but I would expect a TCP/IP stack to just throw
-				   something with a bad sequence number away */
-                return SEGMENT_DISCARD;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    else
-    { /* server segment */
-        if ([m_serverSegments count] < 1)
-        {
-            /* we're in the established state without seeing a 3-way handshake,
-			   so blindly accept whatever sever sequence number we see first */
-            m_s_seq_no = [segment seqNo];
-        }
+    segment_info_init(segment, &info);
+    info.is_client =
+        (m_status != STATUS_UNINITIALISED && [self segmentIsClient:segment]);
+    info.is_stale =
+        (m_status == STATUS_TIME_WAIT &&
+         [[segment date] timeIntervalSinceDate:[[m_packets lastObject] date]] >
+             (PPTCPSTREAM_MSL * 2));
 
-        if ([segment seqNo] == m_s_seq_no)
-        {
-            [self addServerSegment:segment];
-            if ([segment finFlag])
-                [self setStatus:STATUS_FIN_WAIT_CLIENT_1];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_s_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_s_seq_no)
-                    [self addServerSegment:segment];
-                /* otherwise discard the segment */
-                return SEGMENT_DISCARD;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
+    state.status = m_status;
+    state.c_seq_no = m_c_seq_no;
+    state.s_seq_no = m_s_seq_no;
+    state.has_server_segments = ([m_serverSegments count] > 0);
 
-- (enum segment_action)addPacketFinWaitClient1:(TCPDecode*)segment
-{
-    /* server sent fin, waiting for client fin */
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no && [segment ackFlag] &&
-            TCP_SEQ_GE([segment ackNo], m_s_seq_no))
-        {
-            if ([segment finFlag])
-            { /* fin,ack */
-                [self addClientSegment:segment];
-                [self setStatus:STATUS_ACK_WAIT_SERVER];
-            }
-            else
-            { /* ack only */
-                [self addClientSegment:segment];
-                [self setStatus:STATUS_FIN_WAIT_CLIENT_2];
-            }
-        }
-        else if ([segment seqNo] == m_c_seq_no)
-        {
-            /* we still need to accept data in this half-closed state */
-            [self addClientSegment:segment];
-            if ([segment finFlag]) /* simultaneous close */
-                [self setStatus:STATUS_SIMULTANEOUS_CLOSE];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_c_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_c_seq_no)
-                    [self addClientSegment:segment];
-                /* otherwise discard the segment */
-                return SEGMENT_ACCEPT;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    else
-    { /* server segment */
-        /* if the client is still sending data, we need to accept ack sent in reply */
-        if ([segment seqNo] == m_s_seq_no)
-            [self addServerSegment:segment];
-    }
-    return SEGMENT_ACCEPT;
-}
+    tcp_state_transition(&state, &info, &transition);
 
-- (enum segment_action)addPacketFinWaitServer1:(TCPDecode*)segment
-{
-    /* client sent fin, waiting for server fin */
-    if ([self segmentIsClient:segment])
+    switch (transition.add)
     {
-        /* if the server is still sending data, we need to accept ack sent in reply */
-        if ([segment seqNo] == m_c_seq_no)
-            [self addClientSegment:segment];
-    }
-    else
-    { /* server segment */
-        if ([segment seqNo] == m_s_seq_no && [segment ackFlag] &&
-            TCP_SEQ_GE([segment ackNo], m_c_seq_no))
-        {
-            if ([segment finFlag])
-            { /* fin,ack */
-                [self addServerSegment:segment];
-                [self setStatus:STATUS_ACK_WAIT_CLIENT];
-            }
-            else
-            { /* ack only */
-                [self addServerSegment:segment];
-                [self setStatus:STATUS_FIN_WAIT_SERVER_2];
-            }
-        }
-        else if ([segment seqNo] == m_s_seq_no)
-        {
-            /* we still need to accept data in this half-closed state */
-            [self addServerSegment:segment];
-            if ([segment finFlag]) /* simultaneous close */
-                [self setStatus:STATUS_SIMULTANEOUS_CLOSE];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_s_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_s_seq_no)
-                    [self addServerSegment:segment];
-                /* otherwise discard the segment */
-                return SEGMENT_ACCEPT;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addSimultaneousClose:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no)
-        {
-            [self addClientSegment:segment];
-            if ([segment ackFlag] && TCP_SEQ_GE([segment ackNo], m_s_seq_no))
-                [self setStatus:STATUS_ACK_WAIT_SERVER];
-        }
-    }
-    else
-    { /* server segment */
-        if ([segment seqNo] == m_s_seq_no)
-        {
-            [self addServerSegment:segment];
-            if ([segment ackFlag] && TCP_SEQ_GE([segment ackNo], m_c_seq_no))
-                [self setStatus:STATUS_ACK_WAIT_CLIENT];
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketFinWaitClient2:(TCPDecode*)segment
-{
-    /* server sent fin, client ack'ed fin, waiting for client fin */
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no)
-        {
-            [self addClientSegment:segment];
-            if ([segment finFlag])
-                [self setStatus:STATUS_ACK_WAIT_SERVER];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_c_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_c_seq_no)
-                    [self addClientSegment:segment];
-                /* otherwise discard the segment */
-                return SEGMENT_ACCEPT;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    else
-    { /* server segment */
-        /* if the client is still sending data, we need to accept ack sent in reply */
-        if ([segment seqNo] == m_s_seq_no)
-            [self addServerSegment:segment];
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketFinWaitServer2:(TCPDecode*)segment
-{
-    /* client sent fin, server ack'ed fin, waiting for server fin */
-    if ([self segmentIsClient:segment])
-    {
-        /* if the server is still sending data, we need to accept ack sent in reply */
-        if ([segment seqNo] == m_c_seq_no)
-            [self addClientSegment:segment];
-    }
-    else
-    { /* server segment */
-        if ([segment seqNo] == m_s_seq_no)
-        {
-            [self addServerSegment:segment];
-            if ([segment finFlag])
-                [self setStatus:STATUS_ACK_WAIT_CLIENT];
-        }
-        else
-        {
-            /* out of order */
-            if (TCP_SEQ_LT([segment seqNo], m_s_seq_no))
-            {
-                /* max segment size acts as a 'window size' here */
-                if (TCPDECODE_SEQNO_NEXT(segment) > m_s_seq_no)
-                    [self addServerSegment:segment];
-                /* otherwise discard the segment */
-                return SEGMENT_ACCEPT;
-            }
-            return SEGMENT_REJECT;
-        }
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketAckWaitClient:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no)
-            [self addClientSegment:segment];
-        if ([segment ackFlag] && TCP_SEQ_GE([segment ackNo], m_s_seq_no))
-            [self setStatus:STATUS_TIME_WAIT];
-    }
-    else
-    { /* server segment */
-        if ([segment seqNo] == m_s_seq_no)
-            [self addServerSegment:segment];
-    }
-    return SEGMENT_ACCEPT;
-}
-
-- (enum segment_action)addPacketAckWaitServer:(TCPDecode*)segment
-{
-    if ([self segmentIsClient:segment])
-    {
-        if ([segment seqNo] == m_c_seq_no)
-            [self addClientSegment:segment];
-    }
-    else
-    {
-        if ([segment seqNo] == m_s_seq_no)
-        {
-            [self addServerSegment:segment];
-            if ([segment ackFlag] && TCP_SEQ_GE([segment ackNo], m_c_seq_no))
-                [self setStatus:STATUS_TIME_WAIT];
-        }
+    case TCP_STATE_ADD_FIRST:
+        [self setClientSegment:segment];
+        /* fall through */
+    case TCP_STATE_ADD_CLIENT:
+        [self addClientSegment:segment];
+        break;
+    case TCP_STATE_ADD_SERVER:
+        [self addServerSegment:segment];
+        break;
+    case TCP_STATE_ADD_NONE:
+        break;
     }
-    return SEGMENT_ACCEPT;
-}
 
-- (enum segment_action)addPacketTimeWait:(TCPDecode*)segment
-{
-    /* Assume (no justification for you) that SO_REUSEADDR and SO_REUSEPORT are not the common case */
-    if ([[segment date] timeIntervalSinceDate:[[m_packets lastObject] date]] <=
-        (PPTCPSTREAM_MSL * 2))
-        return SEGMENT_ACCEPT;
+    if (transition.status != m_status)
+        [self setStatus:transition.status];
 
-    [self setStatus:STATUS_CLOSED];
-
-    return [self addPacketClosed:segment];
+    return transition.action;
 }
 
 - (void)addSegment:(TCPDecode*)segment
@@ -803,22 +403,64 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     [m_serverSegments addObject:segment];
 }
 
-- (void)addSegment:(TCPDecode*)segment toQueue:(NSMutableArray*)queue
+- (void)addSegment:(TCPDecode*)segment toQueue:(struct segment_queue*)queue
 {
-    TCPDecode* queueSegment;
-    NSUInteger i;
+    if (queue == NULL || segment_queue_count(queue) > PPTCPSTREAM_QUEUE_MAX)
+        return;
 
-    if ([queue count] > PPTCPSTREAM_QUEUE_MAX)
+    /* retransmissions of queued segments are left out */
+    if (segment_queue_insert(
+            queue, [segment seqNo], TCPDECODE_SEQNO_NEXT(segment), segment) !=
+        1)
         return;
 
-    for (i = [queue count]; i > 0; --i)
+    [segment retain];
+    [segment setBackPointer:self];
+}
+
+/* private method, feeds queued segments back into the state machine until
+   one is still out of order. queue points at m_clientQueue or
+   m_serverQueue, which the state machine may free */
+- (void)processQueue:(struct segment_queue**)queue
+{
+    TCPDecode* segment;
+    enum segment_action action;
+
+    while (*queue != NULL && (segment = segment_queue_pop(*queue)) != nil)
     {
-        queueSegment = [queue objectAtIndex:i - 1];
-        if (TCP_SEQ_GT([segment seqNo], [queueSegment seqNo]))
+        action = [self transitionWithSegment:segment];
+
+        if (action == SEGMENT_REJECT)
+        {
+            /* put it back, the queue keeps its reference */
+            if (*queue == NULL ||
+                segment_queue_insert(
+                    *queue,
+                    [segment seqNo],
+                    TCPDECODE_SEQNO_NEXT(segment),
+                    segment) != 1)
+                [segment release];
             break;
+        }
+
+        /* accepted, or discarded as a retransmission */
+        [segment release];
     }
-    [segment setBackPointer:self];
-    [queue insertObject:segment atIndex:i];
+}
+
+/* private method */
+- (void)removeQueuedSegment:(TCPDecode*)segment
+{
+    uint32_t seq, end;
+
+    seq = [segment seqNo];
+    end = TCPDECODE_SEQNO_NEXT(segment);
+
+    if ((m_clientQueue != NULL &&
+         segment_queue_remove(m_clientQueue, seq, end, segment)) ||
+        (m_serverQueue != NULL &&
+         segment_queue_remove(m_serverQueue, seq, end, segment)))
+        [segment release];
 }
 
 - (size_t)packetsCount
@@ -872,38 +514,69 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
 
 - (NSString*)addrTo
 {
-    return ipaddrstr(&m_client_dstip, sizeof(m_client_dstip));
+    if (m_client_family == AF_INET6)
+        return ipaddrstr(&m_client_addr.v6[1], sizeof(struct in6_addr));
+
+    return ipaddrstr(&m_client_addr.v4[1], sizeof(struct in_addr));
 }
 
 - (NSString*)addrFrom
 {
-    return ipaddrstr(&m_client_srcip, sizeof(m_client_srcip));
+    if (m_client_family == AF_INET6)
+        return ipaddrstr(&m_client_addr.v6[0], sizeof(struct in6_addr));
+
+    return ipaddrstr(&m_client_addr.v4[0], sizeof(struct in_addr));
 }
 
-- (NSString*)hostTo
+/* private method */
+- (Packet*)firstPacket
 {
+    if (m_summary != SUMMARY_NONE)
+        return m_firstPacket;
+
     if ([m_packets count] < 1)
+        return nil;
+
+    return [m_packets objectAtIndex:0];
+}
+
+/* private method, the IP decoder of the streams first packet */
+- (id)firstPacketIP
+{
+    Packet* packet;
+
+    packet = [self firstPacket];
+
+    if (m_client_family == AF_INET6)
+        return [packet decoderForClass:[IPV6Decode class]];
+
+    return [packet decoderForClass:[IPV4Decode class]];
+}
+
+- (NSString*)hostTo
+{
+    Packet* packet;
+
+    if ((packet = [self firstPacket]) == nil)
         return @"None";
 
-    if ([self segmentIsClient:[self segmentAtIndex:0]])
-        return [[[m_packets objectAtIndex:0] decoderForClass:[IPV4Decode class]]
-            to];
+    if ([self segmentIsClient:[packet decoderForClass:[TCPDecode class]]])
+        return [[self firstPacketIP] to];
     else
-        return [[[m_packets objectAtIndex:0] decoderForClass:[IPV4Decode class]]
-            from];
+        return [[self firstPacketIP] from];
 }
 
 - (NSString*)hostFrom
 {
-    if ([m_packets count] < 1)
+    Packet* packet;
+
+    if ((packet = [self firstPacket]) == nil)
         return @"None";
 
-    if ([self segmentIsClient:[self segmentAtIndex:0]])
-        return [[[m_packets objectAtIndex:0] decoderForClass:[IPV4Decode class]]
-            from];
+    if ([self segmentIsClient:[packet decoderForClass:[TCPDecode class]]])
+        return [[self firstPacketIP] from];
     else
-        return [[[m_packets objectAtIndex:0] decoderForClass:[IPV4Decode class]]
-            to];
+        return [[self firstPacketIP] to];
 }
 
 - (NSString*)status
@@ -951,6 +624,12 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
         break;
     }
 
+    if (m_summary == SUMMARY_EXPIRED)
+        return [NSString stringWithFormat:@"%@ (expired)", statusString];
+
+    if (m_summary == SUMMARY_EVICTED)
+        return [NSString stringWithFormat:@"%@ (evicted)", statusString];
+
     if ([m_packets count] > 0)
     {
         if (m_status == STATUS_TIME_WAIT &&
@@ -980,24 +659,30 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
 
 - (NSString*)srcPortName
 {
-    if ([m_packets count] < 1)
+    TCPDecode* segment;
+
+    if ((segment = [[self firstPacket] decoderForClass:[TCPDecode class]]) ==
+        nil)
         return @"None";
 
-    if ([self segmentIsClient:[self segmentAtIndex:0]])
-        return [[self segmentAtIndex:0] srcPortName];
+    if ([self segmentIsClient:segment])
+        return [segment srcPortName];
     else
-        return [[self segmentAtIndex:0] dstPortName];
+        return [segment dstPortName];
 }
 
 - (NSString*)dstPortName
 {
-    if ([m_packets count] < 1)
+    TCPDecode* segment;
+
+    if ((segment = [[self firstPacket] decoderForClass:[TCPDecode class]]) ==
+        nil)
         return @"None";
 
-    if ([self segmentIsClient:[self segmentAtIndex:0]])
-        return [[self segmentAtIndex:0] dstPortName];
+    if ([self segmentIsClient:segment])
+        return [segment dstPortName];
     else
-        return [[self segmentAtIndex:0] srcPortName];
+        return [segment srcPortName];
 }
 
 - (unsigned long long)bytesSent
@@ -1018,10 +703,41 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     return m_client_nbytes + m_server_nbytes;
 }
 
+- (double)handshakeRTT
+{
+    return tcp_metrics_handshake_rtt(&m_metrics);
+}
+
+- (double)meanRTT
+{
+    return tcp_metrics_rtt(&m_metrics);
+}
+
+- (unsigned long)retransmissions
+{
+    return tcp_metrics_retransmissions(&m_metrics);
+}
+
+- (unsigned long)zeroWindows
+{
+    return tcp_metrics_zero_windows(&m_metrics);
+}
+
+- (double)throughput
+{
+    return tcp_metrics_throughput(&m_metrics);
+}
+
+- (double)peakThroughput
+{
+    return tcp_metrics_peak_throughput(&m_metrics);
+}
+
 - (BOOL)isValid
 {
     return m_isValid &&
-           ([m_clientSegments count] > 0 || [m_serverSegments count] > 0);
+           (m_summary != SUMMARY_NONE || [m_clientSegments count] > 0 ||
+            [m_serverSegments count] > 0);
 }
 
 - (BOOL)isDisplayed
@@ -1034,6 +750,35 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     m_isDisplayed = isDisplayed;
 }
 
+- (void)summarise:(enum stream_summary)reason
+{
+    if (m_summary != SUMMARY_NONE || reason == SUMMARY_NONE)
+        return;
+
+    if ([m_packets count] > 0)
+        m_firstPacket = [[m_packets objectAtIndex:0] retain];
+
+    [self removeAllPackets]; /* clears TCPDecode back pointers */
+
+    [m_packets release];
+    [m_serverSegments release];
+    [m_clientSegments release];
+    segment_queue_free(m_clientQueue, NULL);
+    segment_queue_free(m_serverQueue, NULL);
+    m_packets = nil;
+    m_serverSegments = nil;
+    m_clientSegments = nil;
+    m_clientQueue = NULL;
+    m_serverQueue = NULL;
+
+    m_summary = reason;
+}
+
+- (BOOL)isSummarised
+{
+    return (m_summary != SUMMARY_NONE);
+}
+
 - (NSComparisonResult)compare:(PPTCPStream*)stream
                       atIndex:(unsigned int)fieldIndex
 {
@@ -1074,6 +819,24 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
 
     case PPSTREAM_SORT_STATUS:
         return [[self status] compare:[stream status]];
+
+    case PPSTREAM_SORT_HANDSHAKE_RTT:
+        return val_compare([self handshakeRTT], [stream handshakeRTT]);
+
+    case PPSTREAM_SORT_RTT:
+        return val_compare([self meanRTT], [stream meanRTT]);
+
+    case PPSTREAM_SORT_RETRANSMISSIONS:
+        return val_compare([self retransmissions], [stream retransmissions]);
+
+    case PPSTREAM_SORT_ZERO_WINDOWS:
+        return val_compare([self zeroWindows], [stream zeroWindows]);
+
+    case PPSTREAM_SORT_THROUGHPUT:
+        return val_compare([self throughput], [stream throughput]);
+
+    case PPSTREAM_SORT_PEAK_THROUGHPUT:
+        return val_compare([self peakThroughput], [stream peakThroughput]);
     }
     return NSOrderedSame;
 }
@@ -1090,17 +853,15 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     for (i = 0; i < [m_serverSegments count]; ++i)
         [[m_serverSegments objectAtIndex:i] setBackPointer:NULL];
 
-    for (i = 0; i < [m_clientQueue count]; ++i)
-        [[m_clientQueue objectAtIndex:i] setBackPointer:NULL];
-
-    for (i = 0; i < [m_serverQueue count]; ++i)
-        [[m_serverQueue objectAtIndex:i] setBackPointer:NULL];
-
     [m_packets removeAllObjects];
     [m_clientSegments removeAllObjects];
     [m_serverSegments removeAllObjects];
-    [m_clientQueue removeAllObjects];
-    [m_serverQueue removeAllObjects];
+
+    if (m_clientQueue != NULL)
+        segment_queue_clear(m_clientQueue, queued_segment_release);
+
+    if (m_serverQueue != NULL)
+        segment_queue_clear(m_serverQueue, queued_segment_release);
 }
 
 - (void)removePacketsAtIndexes:(NSIndexSet*)indexSet
@@ -1127,8 +888,7 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
                 [segment setBackPointer:NULL];
                 [m_serverSegments removeFirstObjectIdenticalTo:segment];
                 [m_clientSegments removeFirstObjectIdenticalTo:segment];
-                [m_clientQueue removeFirstObjectIdenticalTo:segment];
-                [m_serverQueue removeFirstObjectIdenticalTo:segment];
+                [self removeQueuedSegment:segment];
             }
         }
     }
@@ -1136,25 +896,30 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     [m_packets removeObjectsAtIndexes:indexSet];
 
     if (m_streamReassembler != nil)
-        [m_streamReassembler noteSegmentsDeleted];
+        [m_streamReassembler noteSegmentsDeletedFrom:[indexSet firstIndex]];
 }
 
 - (void)removePacket:(Packet*)packet
 {
     TCPDecode* segment;
+    NSUInteger index;
 
     if ((segment = [packet decoderForClass:[TCPDecode class]]) == nil)
         return;
 
     [segment setBackPointer:NULL];
-    [m_packets removeFirstObjectIdenticalTo:packet];
     [m_serverSegments removeFirstObjectIdenticalTo:segment];
     [m_clientSegments removeFirstObjectIdenticalTo:segment];
-    [m_clientQueue removeFirstObjectIdenticalTo:segment];
-    [m_serverQueue removeFirstObjectIdenticalTo:segment];
+    [self removeQueuedSegment:segment];
+
+    /* out of order segments were never reassembled */
+    if ((index = [m_packets indexOfObjectIdenticalTo:packet]) == NSNotFound)
+        return;
+
+    [m_packets removeObjectAtIndex:index];
 
     if (m_streamReassembler != nil)
-        [m_streamReassembler noteSegmentsDeleted];
+        [m_streamReassembler noteSegmentsDeletedFrom:index];
 }
 
 - (BOOL)containsPacket:(Packet*)packet
@@ -1168,8 +933,18 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
         [m_packets containsObject:packet] ||
         [m_serverSegments containsObject:segment] ||
         [m_clientSegments containsObject:segment] ||
-        [m_clientQueue containsObject:segment] ||
-        [m_serverQueue containsObject:segment]);
+        (m_clientQueue != NULL &&
+         segment_queue_contains(
+             m_clientQueue,
+             [segment seqNo],
+             TCPDECODE_SEQNO_NEXT(segment),
+             segment)) ||
+        (m_serverQueue != NULL &&
+         segment_queue_contains(
+             m_serverQueue,
+             [segment seqNo],
+             TCPDECODE_SEQNO_NEXT(segment),
+             segment)));
 }
 
 - (void)dealloc
@@ -1179,9 +954,30 @@ static SEL add_pkt_dispatch_table[STATUS_NELEMS];
     [m_packets release];
     [m_serverSegments release];
     [m_clientSegments release];
-    [m_clientQueue release];
-    [m_serverQueue release];
+    segment_queue_free(m_clientQueue, NULL);
+    segment_queue_free(m_serverQueue, NULL);
+    if (m_client_family == AF_INET6)
+        free(m_client_addr.v6);
+    [m_firstPacket release];
     [super dealloc];
 }
 
 @end
+
+static void queued_segment_release(void* segment)
+{
+    [(TCPDecode*)segment setBackPointer:NULL];
+    [(TCPDecode*)segment release];
+}
+
+/* fills in everything but is_client and is_stale */
+static void segment_info_init(TCPDecode* segment, struct tcp_segment_info* info)
+{
+    info->seq = [segment seqNo];
+    info->ack = [segment ackNo];
+    info->len = [segment size];
+    info->flags = [segment flags];
+    info->window = [segment window];
+    info->is_client = 0;
+    info->is_stale = 0;
+}
@@ -20,28 +20,35 @@
 #ifndef _PPTCPSTREAMCONTROLLER_H_
 #define _PPTCPSTREAMCONTROLLER_H_
 
-#include "../rb_tree.h"
+#include "PPTCPStream.h"
+#import <Foundation/NSDate.h>
 #import <Foundation/NSObject.h>
 #include <netinet/in.h>
 
-#define PPTCPSTREAMS_PORT_HASHMASK 0x7
-#define PPTCPSTREAMS_ADDR_HASHMASK 0xF
-
-#define PPTCPSTREAMS_HTABLE_SZ                \
-    (((PPTCPSTREAMS_PORT_HASHMASK + 1) * 2) + \
-     ((PPTCPSTREAMS_ADDR_HASHMASK + 1) * 2))
-
 @class NSMutableArray;
 @class NSIndexSet;
 @class TCPDecode;
 @class Packet;
 @class PPTCPStream;
 @class PPTCPStreamReassembler;
+@class PPTaskGroup;
+
+struct flow_table;
+struct stream_entry;
+struct stream_shard;
 
 @interface PPTCPStreamController : NSObject
 {
-    struct rb_node* htable[PPTCPSTREAMS_HTABLE_SZ];
+    struct flow_table* flows; /* stream_entry structures, keyed by 5-tuple */
     NSMutableArray* streams; /* array of PPTCPStream objects */
+    /* tracked streams, from most to least recently active */
+    struct stream_entry* lruHead;
+    struct stream_entry* lruTail;
+    size_t trackedPackets; /* packets held by tracked streams */
+    size_t maxStreams;     /* limits applied when aging, 0 for none */
+    size_t maxPackets;
+    NSTimeInterval latestTime; /* capture time of the newest packet seen */
+    BOOL agesStreams;
     unsigned int sortIndex;
     BOOL dropBadIPChecksums;
     BOOL dropBadTCPChecksums;
@@ -56,10 +63,21 @@
                      forStream:(PPTCPStream*)stream;
 - (void)removeStream:(PPTCPStream*)stream;
 - (void)removeStreamFromMap:(PPTCPStream*)stream; /* private method */
+- (void)retireStreamEntry:(struct stream_entry*)entry
+                   reason:(enum stream_summary)reason; /* private method */
+- (void)ageStreams;                                    /* private method */
 - (void)removeStreamAtIndex:(NSInteger)index;
 - (void)addPacket:(Packet*)packet;
 - (void)addPacketArray:(NSArray*)array;
+/* as addPacketArray:, stopping early once group is cancelled. Large arrays
+   added to an empty controller are shared out between threads by flow, see
+   mergeShards:count: */
+- (void)addPacketArray:(NSArray*)array group:(PPTaskGroup*)group;
+- (void)mergeShards:(struct stream_shard*)shards
+              count:(unsigned int)nshards; /* private method */
 - (void)flush;
+- (void)setAgesStreams:(BOOL)flag;
+- (BOOL)agesStreams;
 - (void)sortStreams:(unsigned int)index;
 - (void)setReversePacketOrder:(BOOL)reverse;
 - (BOOL)isReverseOrder;
@@ -19,48 +19,125 @@
 
 #include "PPTCPStreamController.h"
 #include "../../Shared/Decoding/IPV4Decode.h"
+#include "../../Shared/Decoding/IPV6Decode.h"
 #include "../../Shared/Decoding/Packet.h"
 #include "../../Shared/Decoding/TCPDecode.h"
 #include "../../Shared/PacketPeeper.h"
+#include "../PPTaskGroup.h"
 #include "../Categories/DateFormat.h"
 #include "../Categories/NSMutableArrayExtensions.h"
 #include "../UI Classes/OutlineViewItem.h"
 #include "../UI Classes/pkt_compare.h"
 #include "../UI Classes/stream_compare.h"
+#include "../flow_table.h"
 #include "PPTCPStream.h"
 #include "PPTCPStreamReassembler.h"
 #import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
 #import <Foundation/NSDate.h>
 #import <Foundation/NSString.h>
 #import <Foundation/NSUserDefaults.h>
+#include <libkern/OSAtomic.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 
-struct endpoint
+/*
+    Every tracked stream has an entry in the flow table, which also links it
+    into a list ordered by when the stream last saw a packet. During a live
+    capture the controller ages streams using that list: a stream idle for
+    longer than PPTCPSTREAM_MSL * 2 can't be added to (see PPTCPStream's
+    addPacket:), and past the configured limits the least recently active
+    streams go first. Retired streams are summarised, so they stay in the
+    streams window without holding on to their segments.
+
+    Ages are measured in capture time rather than wall clock time, so a
+    stalled capture doesn't expire anything.
+*/
+
+/* at most one shard per CPU, up to this many */
+#define PPTCPSTREAMCONTROLLER_MAX_SHARDS 64
+
+/* arrays with fewer packets than this aren't worth sharding */
+#define PPTCPSTREAMCONTROLLER_SHARD_MIN_PACKETS (16 * 1024)
+
+/* packets routed at a time, and added between autorelease pool drains */
+#define PPTCPSTREAMCONTROLLER_SHARD_CHUNK_SZ 1024
+
+/* route of a packet that can't be part of a stream */
+#define NO_SHARD 0xff
+
+/*
+    To add a large array of packets to an empty controller, each packet is
+    routed to a shard by a hash of its flow's 5-tuple, which is the same for
+    both directions. Each shard is a controller of its own, built on one
+    thread from its packets in their original order, so every stream sees
+    exactly the packets it would have serially. The shards' streams are then
+    merged back into the controller.
+
+    Streams age by looking at every stream at once, so controllers that age
+    streams are always added to serially.
+*/
+
+struct stream_shard
+{
+    PPTCPStreamController* controller;
+    /* index of the packet which made each of the shard's streams valid, so
+       the merged streams are in the order they'd have been found serially */
+    size_t* displayed;
+    size_t ndisplayed;
+    size_t capacity;
+    BOOL ordered; /* NO if displayed couldn't grow */
+};
+
+struct shard_job
 {
-    struct in_addr addr;
-    unsigned int port;
+    NSArray* packets;
+    uint8_t* routes; /* shard of each packet, or NO_SHARD */
+    struct stream_shard* shards;
+    unsigned int nshards;
+    PPTaskGroup* group; /* nil if it can't be cancelled */
+    volatile int64_t next_packet;
+    volatile int64_t next_shard;
 };
 
-/* red-black node key */
-struct stream_id
+struct stream_entry
 {
-    struct endpoint alpha;
-    struct endpoint beta;
+    struct flow_key key;
+    PPTCPStream* stream;
+    struct stream_entry* prev; /* more recently active */
+    struct stream_entry* next; /* less recently active */
+    NSTimeInterval lastSeen;   /* capture time of the newest packet */
+    size_t npackets;           /* [stream packetsCount] when last added to */
 };
 
-static unsigned int stream_hash(const struct stream_id* s_id);
-static int stream_comp(const void* key_a, const void* key_b);
-static void rb_node_free(struct rb_node* node);
-static void rb_key_copy(void* dst, const void* src);
+static void stream_key(
+    struct flow_key* key, IPV4Decode* ip, IPV6Decode* ip6, TCPDecode* tcp);
+static void stream_free(void* value);
+static void lru_unlink(
+    struct stream_entry** head,
+    struct stream_entry** tail,
+    struct stream_entry* entry);
+static void lru_push(
+    struct stream_entry** head,
+    struct stream_entry** tail,
+    struct stream_entry* entry);
+static size_t default_limit(NSString* key);
+static void
+run_shard_threads(void* (*start)(void*), struct shard_job* job);
+static void* route_thread(void* args);
+static void* shard_thread(void* args);
+static uint8_t packet_route(Packet* packet, unsigned int nshards);
+static uint64_t key_hash(const struct flow_key* key);
+static void shard_note_displayed(struct stream_shard* shard, size_t index);
 
 @implementation PPTCPStreamController
 
 - (id)init
 {
-    unsigned int i;
-
     if ((self = [super init]) != nil)
     {
         if ((streams = [[NSMutableArray alloc] init]) == nil)
@@ -69,9 +146,20 @@ static void rb_key_copy(void* dst, const void* src);
             return nil;
         }
 
-        for (i = 0; i < PPTCPSTREAMS_HTABLE_SZ; ++i)
-            htable[i] = NULL;
+        if ((flows = flow_table_create(0)) == NULL)
+        {
+            [streams release];
+            [super dealloc];
+            return nil;
+        }
 
+        lruHead = NULL;
+        lruTail = NULL;
+        trackedPackets = 0;
+        maxStreams = default_limit(PPTCPSTREAMCONTROLLER_MAX_STREAMS);
+        maxPackets = default_limit(PPTCPSTREAMCONTROLLER_MAX_PACKETS);
+        latestTime = 0.0;
+        agesStreams = NO;
         sortIndex = 0;
         dropBadIPChecksums = [[NSUserDefaults standardUserDefaults]
             boolForKey:PPTCPSTREAMCONTROLLER_IP_DROP_BAD_CHECKSUMS];
@@ -166,11 +254,11 @@ static void rb_key_copy(void* dst, const void* src);
 /* private method */
 - (void)removeStreamFromMap:(PPTCPStream*)stream
 {
+    struct stream_entry* entry;
     IPV4Decode* ip;
+    IPV6Decode* ip6;
     TCPDecode* tcp;
-    struct rb_node* node;
-    struct stream_id s_id;
-    unsigned int hash_index;
+    struct flow_key key;
 
     if (stream == nil)
         return;
@@ -178,23 +266,81 @@ static void rb_key_copy(void* dst, const void* src);
     if ((tcp = [stream segmentAtIndex:0]) == nil)
         return;
 
-    if ((ip = [[tcp parent] decoderForClass:[IPV4Decode class]]) == nil)
-        return;
+    ip6 = nil;
 
-    s_id.alpha.addr = [ip in_addrSrc];
-    s_id.alpha.port = [tcp srcPort];
-    s_id.beta.addr = [ip in_addrDst];
-    s_id.beta.port = [tcp dstPort];
+    if ((ip = [tcp ip]) == nil && (ip6 = [tcp ip6]) == nil)
+        return;
 
-    hash_index = stream_hash(&s_id);
+    stream_key(&key, ip, ip6, tcp);
 
-    if ((node = rb_search(htable[hash_index], &s_id, stream_comp)) == NULL)
+    /* a newer stream may have since taken the same 5-tuple */
+    if ((entry = flow_table_find(flows, &key)) == NULL ||
+        entry->stream != stream)
         return;
 
-    htable[hash_index] = rb_node_delete(htable[hash_index], node, rb_key_copy);
+    (void)flow_table_remove(flows, &key);
+    lru_unlink(&lruHead, &lruTail, entry);
+    trackedPackets -= entry->npackets;
+    free(entry);
+
+    [stream release];
+}
+
+/* private method, summarises the entry's stream, or drops it if it has never
+   been displayed, and forgets the entry */
+- (void)retireStreamEntry:(struct stream_entry*)entry
+                   reason:(enum stream_summary)reason
+{
+    PPTCPStream* stream;
+
+    stream = entry->stream;
+
+    (void)flow_table_remove(flows, &entry->key);
+    lru_unlink(&lruHead, &lruTail, entry);
+    trackedPackets -= entry->npackets;
+    free(entry);
+
+    if ([stream isDisplayed])
+        [stream summarise:reason];
+
     [stream release];
 }
 
+/* private method */
+- (void)ageStreams
+{
+    struct stream_entry* entry;
+    enum stream_summary reason;
+    size_t n;
+
+    /* each entry is looked at no more than once */
+    for (n = flow_table_count(flows); n > 0 && (entry = lruTail) != NULL; --n)
+    {
+        if (entry->lastSeen + PPTCPSTREAM_MSL * 2 < latestTime)
+            reason = SUMMARY_EXPIRED;
+        else if (
+            entry != lruHead &&
+            ((maxStreams > 0 && flow_table_count(flows) > maxStreams) ||
+             (maxPackets > 0 && trackedPackets > maxPackets)))
+            reason = SUMMARY_EVICTED;
+        else
+            break;
+
+        /* a stream open in a reassembly window is in use, so is kept. It
+           counts as seen now, so the list stays in lastSeen order and it
+           isn't expired as soon as it reaches the tail again */
+        if ([entry->stream streamReassembler] != nil)
+        {
+            entry->lastSeen = latestTime;
+            lru_unlink(&lruHead, &lruTail, entry);
+            lru_push(&lruHead, &lruTail, entry);
+            continue;
+        }
+
+        [self retireStreamEntry:entry reason:reason];
+    }
+}
+
 - (void)removeStreamAtIndex:(NSInteger)index
 {
     PPTCPStream* stream;
@@ -213,17 +359,22 @@ static void rb_key_copy(void* dst, const void* src);
 
 - (void)addPacket:(Packet*)packet
 {
-    struct rb_node* result;
+    struct stream_entry* entry;
     PPTCPStream* stream;
+    NSTimeInterval now;
     IPV4Decode* ip;
+    IPV6Decode* ip6;
     TCPDecode* tcp;
-    unsigned int i;
-    struct stream_id s_id;
+    struct flow_key key;
 
     if (packet == nil)
         return;
 
-    if ((ip = [packet decoderForClass:[IPV4Decode class]]) == nil)
+    ip6 = nil;
+
+    /* IPv4 is by far the common case, so is looked for first */
+    if ((ip = [packet decoderForClass:[IPV4Decode class]]) == nil &&
+        (ip6 = [packet decoderForClass:[IPV6Decode class]]) == nil)
         return;
 
     if ((tcp = [packet decoderForClass:[TCPDecode class]]) == nil)
@@ -233,9 +384,11 @@ static void rb_key_copy(void* dst, const void* src);
     if (((int)[tcp rstFlag] + (int)[tcp finFlag] + (int)[tcp synFlag]) > 1)
         return;
 
+    stream_key(&key, ip, ip6, tcp);
+
     /* ignore invalid ip/src combinations */
-    if ([tcp srcPort] == [tcp dstPort] &&
-        [ip in_addrSrc].s_addr == [ip in_addrDst].s_addr)
+    if (key.port[0] == key.port[1] &&
+        memcmp(key.addr[0], key.addr[1], FLOW_ADDR_LEN) == 0)
         return;
 
     /*
@@ -246,43 +399,59 @@ static void rb_key_copy(void* dst, const void* src);
 	*/
 
     /* ignore corrupt packets */
-    if (dropBadIPChecksums && ![ip isChecksumValid])
+    /* IPv6 has no header checksum */
+    if (dropBadIPChecksums && ip != nil && ![ip isChecksumValid])
         return;
 
     if (dropBadTCPChecksums && ![tcp isChecksumValid])
         return;
 
-    s_id.alpha.addr = [ip in_addrSrc];
-    s_id.alpha.port = [tcp srcPort];
-    s_id.beta.addr = [ip in_addrDst];
-    s_id.beta.port = [tcp dstPort];
+    now = [[packet date] timeIntervalSinceReferenceDate];
 
-    i = stream_hash(&s_id);
+    if (agesStreams)
+    {
+        if (now > latestTime)
+            latestTime = now;
+        [self ageStreams];
+    }
 
-    if ((result = rb_search(htable[i], &s_id, stream_comp)) == NULL)
+    if ((entry = flow_table_find(flows, &key)) == NULL)
     {
         /* don't bother making a new connection for a stray RST or FIN */
         if ([tcp rstFlag] || [tcp finFlag])
             return;
 
-        /* search failed, create and insert a new red-black node */
-        if ((result = malloc(
-                 sizeof(struct rb_node) + sizeof(struct stream_id))) == NULL)
+        if ((entry = malloc(sizeof(*entry))) == NULL)
             return;
 
         if ((stream = [[PPTCPStream alloc] init]) == nil)
         {
-            free(result);
+            free(entry);
             return;
         }
 
-        result->data = stream;
+        entry->key = key;
+        entry->stream = stream;
+        entry->lastSeen = now;
+        entry->npackets = 0;
 
-        *(struct stream_id*)result->key = s_id;
-        htable[i] = rb_insert(htable[i], result, stream_comp);
+        if (flow_table_insert(flows, &key, entry) == -1)
+        {
+            [stream release];
+            free(entry);
+            return;
+        }
     }
     else
-        stream = result->data;
+    {
+        stream = entry->stream;
+        lru_unlink(&lruHead, &lruTail, entry);
+    }
+
+    lru_push(&lruHead, &lruTail, entry);
+
+    if (now > entry->lastSeen)
+        entry->lastSeen = now;
 
     if ([stream addPacket:packet])
     {
@@ -293,29 +462,191 @@ static void rb_key_copy(void* dst, const void* src);
             [streams addObject:stream];
         }
     }
+
+    /* also catches up with any packets deleted since the stream was last
+       added to */
+    trackedPackets -= entry->npackets;
+    entry->npackets = [stream packetsCount];
+    trackedPackets += entry->npackets;
 }
 
 - (void)addPacketArray:(NSArray*)packets
 {
-    unsigned int i;
+    [self addPacketArray:packets group:nil];
+}
+
+- (void)addPacketArray:(NSArray*)packets group:(PPTaskGroup*)group
+{
+    struct stream_shard shards[PPTCPSTREAMCONTROLLER_MAX_SHARDS];
+    struct shard_job job;
+    NSUInteger i, count;
+    long ncpus;
+
+    count = [packets count];
+
+    if ((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        ncpus = 1;
+
+    if (ncpus > PPTCPSTREAMCONTROLLER_MAX_SHARDS)
+        ncpus = PPTCPSTREAMCONTROLLER_MAX_SHARDS;
+
+    /* existing streams would have to be shared out too */
+    if (agesStreams || flow_table_count(flows) > 0 || ncpus < 2 ||
+        count < PPTCPSTREAMCONTROLLER_SHARD_MIN_PACKETS ||
+        (job.routes = malloc(count)) == NULL)
+        goto serial;
+
+    job.packets = packets;
+    job.shards = shards;
+    job.group = group;
+    job.next_packet = 0;
+    job.next_shard = 0;
+
+    for (job.nshards = 0; job.nshards < (unsigned int)ncpus; ++job.nshards)
+    {
+        struct stream_shard* shard;
+
+        shard = &shards[job.nshards];
+
+        if ((shard->controller = [[PPTCPStreamController alloc] init]) == nil)
+            break;
+
+        shard->controller->dropBadIPChecksums = dropBadIPChecksums;
+        shard->controller->dropBadTCPChecksums = dropBadTCPChecksums;
+        shard->displayed = NULL;
+        shard->ndisplayed = 0;
+        shard->capacity = 0;
+        shard->ordered = YES;
+    }
+
+    if (job.nshards < 1)
+    {
+        free(job.routes);
+        goto serial;
+    }
+
+    run_shard_threads(route_thread, &job);
+
+    /* routes are incomplete if cancelled */
+    if (!PPTaskGroupIsCancelled(group))
+        run_shard_threads(shard_thread, &job);
+
+    [self mergeShards:shards count:job.nshards];
+    free(job.routes);
 
-    for (i = 0; i < [packets count]; ++i)
+    return;
+
+serial:
+    for (i = 0; i < count && !PPTaskGroupIsCancelled(group); ++i)
         [self addPacket:[packets objectAtIndex:i]];
 }
 
-- (void)flush
+/* private method, moves the streams of each shard into the controller and
+   releases the shards. The streams go in the order they'd have been found
+   adding the packets serially, and the tracked streams are interleaved by
+   when they were last active */
+- (void)mergeShards:(struct stream_shard*)shards count:(unsigned int)nshards
 {
-    unsigned int i;
+    PPTCPStreamController* shard;
+    struct stream_entry* entry;
+    size_t next[PPTCPSTREAMCONTROLLER_MAX_SHARDS];
+    unsigned int i, best;
+    BOOL ordered;
 
-    [streams removeAllObjects];
+    ordered = YES;
+
+    for (i = 0; i < nshards; ++i)
+    {
+        next[i] = 0;
+        if (!shards[i].ordered)
+            ordered = NO;
+    }
+
+    for (;;)
+    {
+        best = nshards;
+
+        for (i = 0; i < nshards; ++i)
+        {
+            if (next[i] >= [shards[i].controller->streams count])
+                continue;
+
+            if (best == nshards ||
+                (ordered && shards[i].displayed[next[i]] <
+                                shards[best].displayed[next[best]]))
+                best = i;
+        }
+
+        if (best == nshards)
+            break;
+
+        [streams
+            addObject:[shards[best].controller->streams
+                          objectAtIndex:next[best]++]];
+    }
+
+    for (;;)
+    {
+        best = nshards;
+
+        for (i = 0; i < nshards; ++i)
+        {
+            if (shards[i].controller->lruTail != NULL &&
+                (best == nshards ||
+                 shards[i].controller->lruTail->lastSeen <
+                     shards[best].controller->lruTail->lastSeen))
+                best = i;
+        }
+
+        if (best == nshards)
+            break;
+
+        shard = shards[best].controller;
+        entry = shard->lruTail;
+
+        (void)flow_table_remove(shard->flows, &entry->key);
+        lru_unlink(&shard->lruHead, &shard->lruTail, entry);
+        shard->trackedPackets -= entry->npackets;
+
+        /* the stream stays displayed, but untracked, as if retired */
+        if (flow_table_insert(flows, &entry->key, entry) == -1)
+        {
+            stream_free(entry);
+            continue;
+        }
+
+        lru_push(&lruHead, &lruTail, entry);
+        trackedPackets += entry->npackets;
+    }
 
-    for (i = 0; i < PPTCPSTREAMS_HTABLE_SZ; ++i)
+    for (i = 0; i < nshards; ++i)
     {
-        rb_free_tree(htable[i], rb_node_free);
-        htable[i] = NULL;
+        [shards[i].controller->streams removeAllObjects];
+        [shards[i].controller release];
+        free(shards[i].displayed);
     }
 }
 
+- (void)flush
+{
+    [streams removeAllObjects];
+    flow_table_clear(flows, stream_free);
+    lruHead = NULL;
+    lruTail = NULL;
+    trackedPackets = 0;
+    latestTime = 0.0;
+}
+
+- (void)setAgesStreams:(BOOL)flag
+{
+    agesStreams = flag;
+}
+
+- (BOOL)agesStreams
+{
+    return agesStreams;
+}
+
 - (void)sortStreams:(unsigned int)index
 {
     sortIndex = index;
@@ -429,91 +760,260 @@ static void rb_key_copy(void* dst, const void* src);
 - (void)dealloc
 {
     [self flush];
+    flow_table_free(flows);
     [streams release];
     [super dealloc];
 }
 
 @end
 
-static unsigned int stream_hash(const struct stream_id* s_id)
+static void stream_key(
+    struct flow_key* key, IPV4Decode* ip, IPV6Decode* ip6, TCPDecode* tcp)
 {
-    return (s_id->alpha.addr.s_addr & PPTCPSTREAMS_ADDR_HASHMASK) +
-           (s_id->alpha.port & PPTCPSTREAMS_PORT_HASHMASK) +
-           (s_id->beta.addr.s_addr & PPTCPSTREAMS_ADDR_HASHMASK) +
-           (s_id->beta.port & PPTCPSTREAMS_PORT_HASHMASK);
+    struct in_addr src, dst;
+    struct in6_addr src6, dst6;
+
+    if (ip != nil)
+    {
+        src = [ip in_addrSrc];
+        dst = [ip in_addrDst];
+
+        (void)flow_key_init(
+            key,
+            IPPROTO_TCP,
+            &src,
+            &dst,
+            sizeof(struct in_addr),
+            [tcp srcPort],
+            [tcp dstPort]);
+        return;
+    }
+
+    src6 = [ip6 in6_addrSrc];
+    dst6 = [ip6 in6_addrDst];
+
+    (void)flow_key_init(
+        key,
+        IPPROTO_TCP,
+        &src6,
+        &dst6,
+        sizeof(struct in6_addr),
+        [tcp srcPort],
+        [tcp dstPort]);
 }
 
-static int stream_comp(const void* key_a, const void* key_b)
+static void stream_free(void* value)
 {
-    struct stream_id *id_a, *id_b;
+    struct stream_entry* entry;
 
-    id_a = (struct stream_id*)key_a;
-    id_b = (struct stream_id*)key_b;
+    entry = value;
 
-    if (MAX(id_a->alpha.addr.s_addr, id_a->beta.addr.s_addr) <
-        MAX(id_b->alpha.addr.s_addr, id_b->beta.addr.s_addr))
-    {
-        return -1;
-    }
-    else if (
-        MAX(id_a->alpha.addr.s_addr, id_a->beta.addr.s_addr) >
-        MAX(id_b->alpha.addr.s_addr, id_b->beta.addr.s_addr))
-    {
-        return 1;
-    }
-    else if (
-        MIN(id_a->alpha.addr.s_addr, id_a->beta.addr.s_addr) <
-        MIN(id_b->alpha.addr.s_addr, id_b->beta.addr.s_addr))
-    {
-        return -1;
-    }
-    else if (
-        MIN(id_a->alpha.addr.s_addr, id_a->beta.addr.s_addr) >
-        MIN(id_b->alpha.addr.s_addr, id_b->beta.addr.s_addr))
-    {
-        return 1;
-    }
-    else if (
-        MAX(id_a->alpha.port, id_a->beta.port) <
-        MAX(id_b->alpha.port, id_b->beta.port))
-    {
-        return -1;
-    }
-    else if (
-        MAX(id_a->alpha.port, id_a->beta.port) >
-        MAX(id_b->alpha.port, id_b->beta.port))
+    [[entry->stream streamReassembler] invalidateStream];
+    [entry->stream release];
+    free(entry);
+}
+
+static void lru_unlink(
+    struct stream_entry** head,
+    struct stream_entry** tail,
+    struct stream_entry* entry)
+{
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        *head = entry->next;
+
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        *tail = entry->prev;
+}
+
+static void lru_push(
+    struct stream_entry** head,
+    struct stream_entry** tail,
+    struct stream_entry* entry)
+{
+    entry->prev = NULL;
+    entry->next = *head;
+
+    if (*head != NULL)
+        (*head)->prev = entry;
+    else
+        *tail = entry;
+
+    *head = entry;
+}
+
+static size_t default_limit(NSString* key)
+{
+    NSInteger n;
+
+    n = [[NSUserDefaults standardUserDefaults] integerForKey:key];
+
+    return (n > 0) ? (size_t)n : 0;
+}
+
+/* runs start on the calling thread and up to job->nshards - 1 more */
+static void
+run_shard_threads(void* (*start)(void*), struct shard_job* job)
+{
+    pthread_t threads[PPTCPSTREAMCONTROLLER_MAX_SHARDS];
+    unsigned int i, nthreads;
+
+    for (nthreads = 0; nthreads + 1 < job->nshards; ++nthreads)
     {
-        return 1;
+        if (pthread_create(&threads[nthreads], NULL, start, job) != 0)
+            break;
     }
-    else if (
-        MIN(id_a->alpha.port, id_a->beta.port) <
-        MIN(id_b->alpha.port, id_b->beta.port))
+
+    (void)start(job);
+
+    for (i = 0; i < nthreads; ++i)
+        (void)pthread_join(threads[i], NULL);
+}
+
+static void* route_thread(void* args)
+{
+    struct shard_job* job;
+    NSUInteger count;
+    int64_t start;
+
+    job = args;
+    count = [job->packets count];
+
+    /* packets are claimed a chunk at a time */
+    while (!PPTaskGroupIsCancelled(job->group) &&
+           (start = OSAtomicAdd64Barrier(
+                        PPTCPSTREAMCONTROLLER_SHARD_CHUNK_SZ,
+                        &job->next_packet) -
+                    PPTCPSTREAMCONTROLLER_SHARD_CHUNK_SZ) < (int64_t)count)
     {
-        return -1;
+        NSAutoreleasePool* autoreleasePool;
+        NSUInteger i, end;
+
+        autoreleasePool = [[NSAutoreleasePool alloc] init];
+        end = MIN(
+            count, (NSUInteger)start + PPTCPSTREAMCONTROLLER_SHARD_CHUNK_SZ);
+
+        for (i = start; i < end; ++i)
+            job->routes[i] =
+                packet_route([job->packets objectAtIndex:i], job->nshards);
+
+        [autoreleasePool release];
     }
-    else if (
-        MIN(id_a->alpha.port, id_a->beta.port) >
-        MIN(id_b->alpha.port, id_b->beta.port))
+
+    return NULL;
+}
+
+static void* shard_thread(void* args)
+{
+    struct shard_job* job;
+    struct stream_shard* shard;
+    NSUInteger count;
+    int64_t n;
+
+    job = args;
+    count = [job->packets count];
+
+    /* shards are claimed one at a time, each adding its packets in order */
+    while ((n = OSAtomicIncrement64Barrier(&job->next_shard) - 1) <
+           (int64_t)job->nshards)
     {
-        return 1;
+        NSAutoreleasePool* autoreleasePool;
+        NSUInteger i, nadded;
+        size_t nstreams;
+
+        shard = &job->shards[n];
+        autoreleasePool = [[NSAutoreleasePool alloc] init];
+
+        for (i = 0, nadded = 0;
+             i < count && !PPTaskGroupIsCancelled(job->group);
+             ++i)
+        {
+            if (job->routes[i] != n)
+                continue;
+
+            nstreams = [shard->controller numberOfStreams];
+            [shard->controller addPacket:[job->packets objectAtIndex:i]];
+
+            if ([shard->controller numberOfStreams] > nstreams)
+                shard_note_displayed(shard, i);
+
+            if (++nadded % PPTCPSTREAMCONTROLLER_SHARD_CHUNK_SZ == 0)
+            {
+                [autoreleasePool release];
+                autoreleasePool = [[NSAutoreleasePool alloc] init];
+            }
+        }
+
+        [autoreleasePool release];
     }
 
-    return 0;
+    return NULL;
 }
 
-static void rb_node_free(struct rb_node* node)
+static uint8_t packet_route(Packet* packet, unsigned int nshards)
 {
-    PPTCPStream* stream;
+    IPV4Decode* ip;
+    IPV6Decode* ip6;
+    TCPDecode* tcp;
+    struct flow_key key;
 
-    stream = node->data;
+    ip6 = nil;
 
-    [[stream streamReassembler] invalidateStream];
-    [stream release];
+    if ((ip = [packet decoderForClass:[IPV4Decode class]]) == nil &&
+        (ip6 = [packet decoderForClass:[IPV6Decode class]]) == nil)
+        return NO_SHARD;
 
-    free(node);
+    if ((tcp = [packet decoderForClass:[TCPDecode class]]) == nil)
+        return NO_SHARD;
+
+    stream_key(&key, ip, ip6, tcp);
+
+    return (uint8_t)(key_hash(&key) % nshards);
 }
 
-static void rb_key_copy(void* dst, const void* src)
+/* FNV-1a. Keys are canonical, so both directions of a flow hash the same */
+static uint64_t key_hash(const struct flow_key* key)
 {
-    *(struct stream_id*)dst = *(struct stream_id*)src;
+    const uint8_t* p;
+    uint64_t hash;
+    size_t i;
+
+    p = (const uint8_t*)key;
+    hash = 0xcbf29ce484222325ULL;
+
+    for (i = 0; i < sizeof(*key); ++i)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static void shard_note_displayed(struct stream_shard* shard, size_t index)
+{
+    size_t n;
+    size_t* p;
+
+    if (!shard->ordered)
+        return;
+
+    if (shard->ndisplayed == shard->capacity)
+    {
+        n = (shard->capacity > 0) ? shard->capacity * 2 : 64;
+
+        if ((p = realloc(shard->displayed, n * sizeof(*p))) == NULL)
+        {
+            shard->ordered = NO;
+            return;
+        }
+
+        shard->displayed = p;
+        shard->capacity = n;
+    }
+
+    shard->displayed[shard->ndisplayed++] = index;
 }
@@ -20,6 +20,8 @@
 #ifndef _PPTCPSTREAMREASSEMBLER_H_
 #define _PPTCPSTREAMREASSEMBLER_H_
 
+#include "reassembly.h"
+#include "reassembly_buffer.h"
 #import <Foundation/NSObject.h>
 
 #include <stdint.h>
@@ -33,52 +35,36 @@
 @class PPTCPStream;
 @class PPTCPStreamController;
 
-struct reassembly_queue
-{
-    NSMutableArray* segments;
-    uint32_t first_seq_no;
-    uint32_t next_seq_no;
-    unsigned int streamIndex;
-};
+struct reassembly_job;
 
 @protocol PPTCPStreamListener <NSObject>
 
-- (void)noteChunksDeleted;
+/* chunks from chunkIndex onwards have been replaced */
+- (void)noteChunksDeletedFrom:(unsigned int)chunkIndex;
 - (void)noteChunksAppended;
 - (void)close;
 
 @end
 
-@interface PPTCPStreamReassemblerChunk : NSObject
-{
-    const void* m_data;
-    size_t m_length;
-    BOOL m_isClient;
-}
-
-- (BOOL)isClient;
-- (BOOL)isServer;
-- (const void*)data;
-- (size_t)length;
-
-@end
-
+/* Reassembly runs as a background task on the shared pool, working from a
+   copy of the stream's segments which is brought up to date before each
+   run. Chunks are only ever changed, and listeners notified, on the main
+   thread. */
 @interface PPTCPStreamReassembler : NSObject
 {
     NSTimer* m_timer;
-    NSMutableArray* m_chunks;
+    struct reassembly_buffer m_buffer;
+    struct reassembly m_reassembly; /* owned by m_job while there is one */
+    struct reassembly_job* m_job;   /* reassembly in progress, or NULL */
     NSMutableArray* m_listeners;
     PPTCPStreamController*
         m_streamController; /* not retained to avoid retain-cycle */
     PPTCPStream* m_stream;  /* not retained to avoid retain-cycle */
 
-    unsigned int m_streamIndex;       /* data index */
-    unsigned int m_clientStreamIndex; /* ack index */
-    unsigned int m_serverStreamIndex; /* ack index */
-    uint32_t m_c_seq_no;
-    uint32_t m_s_seq_no;
-
-    BOOL m_segmentsDeleted;
+    size_t m_deletedFrom;  /* segments deleted during m_job, or SIZE_MAX */
+    size_t m_changedChunk; /* first chunk replaced since listeners were last
+                              notified, or SIZE_MAX */
+    BOOL m_reassembleAgain; /* segments were appended during m_job */
 }
 
 - (id)initWithStream:(PPTCPStream*)stream
@@ -87,15 +73,29 @@ struct reassembly_queue
 - (void)addListener:(id<PPTCPStreamListener>)aListener;
 - (void)removeListener:(id<PPTCPStreamListener>)aListener;
 - (void)reassemble;
+- (void)reassembleInBackground;
 - (size_t)numberOfChunks;
 - (NSData*)chunkDataAt:(unsigned int)chunkIndex;
+- (const void*)chunkBytesAt:(unsigned int)chunkIndex;
+- (size_t)chunkLengthAt:(unsigned int)chunkIndex;
+- (size_t)chunkOffsetAt:(unsigned int)chunkIndex;
+- (size_t)chunkPositionAt:(unsigned int)chunkIndex;
 - (BOOL)chunkIsClient:(unsigned int)chunkIndex;
 - (BOOL)chunkIsServer:(unsigned int)chunkIndex;
+- (BOOL)setBuffersData:(BOOL)flag forClient:(BOOL)isClient;
+- (BOOL)buffersDataForClient:(BOOL)isClient;
+- (size_t)lengthOfDataForClient:(BOOL)isClient;
+- (NSData*)dataForClient:(BOOL)isClient;
+- (BOOL)updateSegments;                               /* private method */
+- (void)applyOutput:(struct reassembly_output*)output; /* private method */
+- (void)truncateFromSegment:(size_t)segmentIndex;     /* private method */
+- (void)reassemblyCompleted;                          /* private method */
+- (void)notifyListeners;                              /* private method */
 - (void)reset;
 - (void)setTimer;                                  /* private method */
 - (void)updateListenersWithTimer:(NSTimer*)aTimer; /* private method */
 - (void)invalidateStream;
-- (void)noteSegmentsDeleted;
+- (void)noteSegmentsDeletedFrom:(size_t)segmentIndex;
 - (void)noteSegmentsAppended;
 
 @end
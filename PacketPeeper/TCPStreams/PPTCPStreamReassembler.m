@@ -21,53 +21,31 @@
 #include "../../Shared/Decoding/IPV4Decode.h"
 #include "../../Shared/Decoding/TCPDecode.h"
 #include "../../Shared/PacketPeeper.h"
+#include "../PPTaskGroup.h"
 #include "PPTCPStream.h"
 #include "PPTCPStreamController.h"
+#include "reassembly.h"
+#include "reassembly_buffer.h"
 #import <Foundation/NSArray.h>
 #import <Foundation/NSData.h>
 #import <Foundation/NSString.h>
+#import <Foundation/NSThread.h>
 #import <Foundation/NSTimer.h>
 #include <netinet/in.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
-@implementation PPTCPStreamReassemblerChunk
-
-- (id)initWithData:(const void*)data
-            length:(size_t)length
-          isClient:(BOOL)isClient
-{
-    if ((self = [super init]) != nil)
-    {
-        m_data = data;
-        m_length = length;
-        m_isClient = isClient;
-    }
-    return self;
-}
-
-- (BOOL)isClient
-{
-    return m_isClient;
-}
-
-- (BOOL)isServer
-{
-    return !m_isClient;
-}
-
-- (const void*)data
-{
-    return m_data;
-}
-
-- (size_t)length
+struct reassembly_job
 {
-    return m_length;
-}
+    PPTCPStreamReassembler* reassembler;
+    struct reassembly* reassembly; /* the reassembler's, not touched by the
+                                      main thread until the job is done */
+    struct reassembly_output output;
+};
 
-@end
+static void reassembly_task(struct reassembly_job* job);
+static void release_owner(void* owner);
 
 @implementation PPTCPStreamReassembler
 
@@ -77,11 +55,11 @@
     if ((self = [super init]) != nil)
     {
         m_timer = nil;
-        m_chunks = nil;
+        m_job = NULL;
         m_listeners = nil;
 
-        if ((m_chunks = [[NSMutableArray alloc] init]) == nil)
-            goto err;
+        reassembly_buffer_init(&m_buffer);
+        reassembly_init(&m_reassembly);
 
         if ((m_listeners = [[NSMutableArray alloc] init]) == nil)
             goto err;
@@ -89,19 +67,13 @@
         m_streamController = streamController;
         m_stream = stream;
 
-        m_streamIndex = 0;
-        m_clientStreamIndex = 0;
-        m_serverStreamIndex = 0;
-
-        m_segmentsDeleted = NO;
-
-        m_c_seq_no = [[m_stream clientSegmentAtIndex:0] seqNo];
-        m_s_seq_no = [[m_stream serverSegmentAtIndex:0] seqNo];
+        m_deletedFrom = SIZE_MAX;
+        m_changedChunk = SIZE_MAX;
+        m_reassembleAgain = NO;
     }
     return self;
 
 err:
-    [m_chunks release];
     [m_listeners release];
     [super dealloc];
     return nil;
@@ -135,201 +107,316 @@ err:
 
 - (void)reassemble
 {
-    PPTCPStreamReassemblerChunk* chunk;
-    unsigned int i;
-    BOOL checkClient;
-    BOOL checkServer;
+    struct reassembly_output output;
+
+    /* the running job will be followed by another */
+    if (m_job != NULL)
+    {
+        m_reassembleAgain = YES;
+        return;
+    }
 
-    checkClient = YES;
-    checkServer = YES;
+    if (m_stream != nil)
+        (void)[self updateSegments];
 
-    for (i = m_streamIndex;
-         i < [m_stream packetsCount] && (checkClient || checkServer);
-         ++i)
+    reassembly_output_init(&output);
+    (void)reassembly_run(&m_reassembly, &output);
+    [self applyOutput:&output];
+    reassembly_output_destroy(&output);
+}
+
+- (void)reassembleInBackground
+{
+    struct reassembly_job* job;
+    PPTaskGroup* group;
+    BOOL queued;
+
+    if (m_job != NULL)
     {
-        TCPDecode* segment;
-        size_t nbytes;
-        size_t offset;
+        m_reassembleAgain = YES;
+        return;
+    }
 
-        segment = [m_stream segmentAtIndex:i];
+    if (m_stream == nil)
+        return;
 
-        if ([segment size] < 1)
-            continue;
+    (void)[self updateSegments];
 
-        if ([m_stream segmentIsClient:segment])
-        {
-            if (checkClient)
-            {
-                if (TCP_SEQ_LE(TCPDECODE_SEQNO_NEXT(segment), m_c_seq_no))
-                    continue; /* no new data */
-
-                /* find a segment which ACKs the data in segmentAtIndex:i */
-                nbytes = 0;
-                offset = TCP_SEQ_GT(m_c_seq_no, [segment seqNo])
-                             ? TCP_SEQNO_DIFF(m_c_seq_no, [segment seqNo])
-                             : 0;
-                for (; m_serverStreamIndex < [m_stream serverSegmentsCount];
-                     ++m_serverStreamIndex)
-                {
-                    if (![[m_stream serverSegmentAtIndex:m_serverStreamIndex]
-                            ackFlag])
-                        continue;
-                    if (TCP_SEQ_GE(
-                            [[m_stream serverSegmentAtIndex:m_serverStreamIndex]
-                                ackNo],
-                            TCPDECODE_SEQNO_NEXT(segment)))
-                    {
-                        /* full ack */
-                        nbytes = SIZE_MAX;
-                        m_c_seq_no = TCPDECODE_SEQNO_NEXT(segment);
-                        break;
-                    }
-                    else if (TCP_SEQ_GT(
-                                 [[m_stream
-                                     serverSegmentAtIndex:m_serverStreamIndex]
-                                     ackNo],
-                                 m_c_seq_no))
-                    {
-                        /* partial ack */
-                        nbytes = TCP_SEQNO_DIFF(
-                            [[m_stream serverSegmentAtIndex:m_serverStreamIndex]
-                                ackNo],
-                            m_c_seq_no);
-                        m_c_seq_no += nbytes;
-                    }
-                }
-
-                if (nbytes < 1)
-                {
-                    checkClient = NO;
-                    continue;
-                }
-
-                /* this should *always* be true, but it doesn't hurt to check... */
-                if (offset < [[segment payload] length])
-                {
-                    chunk = [[PPTCPStreamReassemblerChunk alloc]
-                        initWithData:(uint8_t*)[[segment payload] bytes] +
-                                     offset
-                              length:MIN(nbytes,
-                                         [[segment payload] length] - offset)
-                            isClient:YES];
-                    [m_chunks addObject:chunk];
-                    [chunk release];
-                }
-
-                if (nbytes != SIZE_MAX)
-                    break; /* segment was only partially acked */
-            }
-        }
-        else
-        { /* server segment */
-            if (checkServer)
-            {
-                if (TCP_SEQ_LE(TCPDECODE_SEQNO_NEXT(segment), m_s_seq_no))
-                    continue; /* no new data */
-
-                /* find a segment which ACKs the data in segmentAtIndex:i */
-                nbytes = 0;
-                offset = TCP_SEQ_GT(m_s_seq_no, [segment seqNo])
-                             ? TCP_SEQNO_DIFF(m_s_seq_no, [segment seqNo])
-                             : 0;
-                for (; m_clientStreamIndex < [m_stream clientSegmentsCount];
-                     ++m_clientStreamIndex)
-                {
-                    if (![[m_stream clientSegmentAtIndex:m_clientStreamIndex]
-                            ackFlag])
-                        continue;
-                    if (TCP_SEQ_GE(
-                            [[m_stream clientSegmentAtIndex:m_clientStreamIndex]
-                                ackNo],
-                            TCPDECODE_SEQNO_NEXT(segment)))
-                    {
-                        /* full ack */
-                        nbytes = SIZE_MAX;
-                        m_s_seq_no = TCPDECODE_SEQNO_NEXT(segment);
-                        break;
-                    }
-                    else if (TCP_SEQ_GT(
-                                 [[m_stream
-                                     clientSegmentAtIndex:m_clientStreamIndex]
-                                     ackNo],
-                                 m_s_seq_no))
-                    {
-                        /* partial ack */
-                        nbytes = TCP_SEQNO_DIFF(
-                            [[m_stream clientSegmentAtIndex:m_clientStreamIndex]
-                                ackNo],
-                            m_s_seq_no);
-                        m_s_seq_no += nbytes;
-                    }
-                }
-
-                if (nbytes < 1)
-                {
-                    checkServer = NO;
-                    continue;
-                }
-
-                /* this should *always* be true, but it doesn't hurt to check... */
-                if (offset < [[segment payload] length])
-                {
-                    chunk = [[PPTCPStreamReassemblerChunk alloc]
-                        initWithData:(uint8_t*)[[segment payload] bytes] +
-                                     offset
-                              length:MIN(nbytes,
-                                         [[segment payload] length] - offset)
-                            isClient:NO];
-                    [m_chunks addObject:chunk];
-                    [chunk release];
-                }
-
-                if (nbytes != SIZE_MAX)
-                    break; /* segment was only partially acked */
-            }
-        }
+    if ((job = malloc(sizeof(*job))) == NULL)
+        goto err;
+
+    job->reassembler = [self retain]; /* released by reassemblyCompleted */
+    job->reassembly = &m_reassembly;
+    reassembly_output_init(&job->output);
+    m_job = job;
+
+    /* the reassembly has to be handed back, so this isn't cancelled */
+    group = [[PPTaskGroup alloc]
+        initWithPriority:PPTASKGROUP_PRIORITY_BACKGROUND];
+    queued = [group addTask:^(PPTaskGroup* unused) {
+        reassembly_task(job);
+    }];
+    [group release];
+
+    if (!queued)
+    {
+        m_job = NULL;
+        free(job);
+        [self release];
+        goto err;
     }
-    m_streamIndex = i;
+
+    return;
+
+err:
+    /* not queued, so reassemble on this thread */
+    [self reassemble];
+    [self notifyListeners];
 }
 
 - (size_t)numberOfChunks
 {
-    return [m_chunks count];
+    return m_buffer.nchunks;
 }
 
+/* the returned data doesn't copy the chunk, so is only valid until the
+   reassembler next changes */
 - (NSData*)chunkDataAt:(unsigned int)chunkIndex
 {
-    PPTCPStreamReassemblerChunk* chunk;
+    return [NSData dataWithBytesNoCopy:(void*)[self chunkBytesAt:chunkIndex]
+                                length:[self chunkLengthAt:chunkIndex]
+                          freeWhenDone:NO];
+}
 
-    chunk = [m_chunks objectAtIndex:chunkIndex];
+- (const void*)chunkBytesAt:(unsigned int)chunkIndex
+{
+    return reassembly_buffer_chunk_bytes(&m_buffer, chunkIndex);
+}
 
-    return [NSData dataWithBytesNoCopy:(void*)[chunk data]
-                                length:[chunk length]
-                          freeWhenDone:NO];
+- (size_t)chunkLengthAt:(unsigned int)chunkIndex
+{
+    return m_buffer.chunks[chunkIndex].length;
+}
+
+/* offset of the chunk within the data sent in its direction */
+- (size_t)chunkOffsetAt:(unsigned int)chunkIndex
+{
+    return m_buffer.chunks[chunkIndex].offset;
+}
+
+/* offset of the chunk within the data sent in both directions, or the
+   length of all of the data if chunkIndex is past the last chunk */
+- (size_t)chunkPositionAt:(unsigned int)chunkIndex
+{
+    if (chunkIndex >= m_buffer.nchunks)
+        return m_buffer.dir[0].length + m_buffer.dir[1].length;
+
+    return m_buffer.chunks[chunkIndex].position;
 }
 
 - (BOOL)chunkIsClient:(unsigned int)chunkIndex
 {
-    return [[m_chunks objectAtIndex:chunkIndex] isClient];
+    return m_buffer.chunks[chunkIndex].is_client;
 }
 
 - (BOOL)chunkIsServer:(unsigned int)chunkIndex
 {
-    return [[m_chunks objectAtIndex:chunkIndex] isServer];
+    return !m_buffer.chunks[chunkIndex].is_client;
+}
+
+/* keeps a contiguous copy of the data sent by the client or server, so that
+   consecutive chunks sent the same way are adjacent in memory. Returns NO if
+   the copy could not be made */
+- (BOOL)setBuffersData:(BOOL)flag forClient:(BOOL)isClient
+{
+    return (reassembly_buffer_set_buffered(&m_buffer, isClient, flag) == 0);
+}
+
+- (BOOL)buffersDataForClient:(BOOL)isClient
+{
+    return m_buffer.dir[isClient ? 1 : 0].buffered;
+}
+
+- (size_t)lengthOfDataForClient:(BOOL)isClient
+{
+    return m_buffer.dir[isClient ? 1 : 0].length;
+}
+
+/* all of the data reassembled so far in one direction. If the direction is
+   buffered the data isn't copied, so is only valid until the reassembler
+   next changes */
+- (NSData*)dataForClient:(BOOL)isClient
+{
+    const struct reassembly_direction* dir;
+    NSMutableData* data;
+    size_t i;
+
+    dir = &m_buffer.dir[isClient ? 1 : 0];
+
+    if (dir->buffered)
+        return [NSData dataWithBytesNoCopy:dir->bytes
+                                    length:dir->length
+                              freeWhenDone:NO];
+
+    if ((data = [NSMutableData dataWithCapacity:dir->length]) == nil)
+        return nil;
+
+    for (i = 0; i < m_buffer.nchunks; ++i)
+    {
+        if (m_buffer.chunks[i].is_client == (isClient ? 1 : 0))
+            [data appendBytes:m_buffer.chunks[i].data
+                       length:m_buffer.chunks[i].length];
+    }
+
+    return data;
+}
+
+/* private method, copies any segments added to the stream since the last
+   call. Returns NO if memory ran out, leaving the rest for next time */
+- (BOOL)updateSegments
+{
+    struct reassembly_segment desc;
+    TCPDecode* segment;
+    NSData* payload;
+    size_t i, n;
+
+    n = [m_stream packetsCount];
+
+    for (i = m_reassembly.nsegments; i < n; ++i)
+    {
+        segment = [m_stream segmentAtIndex:i];
+        payload = [segment payload];
+
+        desc.payload = [payload bytes];
+        desc.payload_length = [payload length];
+        desc.size = [segment size];
+        desc.seq = [segment seqNo];
+        desc.next = TCPDECODE_SEQNO_NEXT(segment);
+        desc.ack = [segment ackNo];
+        desc.ack_flag = [segment ackFlag];
+        desc.is_client = [m_stream segmentIsClient:segment];
+        /* the payload stays valid for as long as its packet is retained */
+        desc.owner = [m_stream packetAtIndex:i];
+
+        if (reassembly_append(&m_reassembly, &desc) == -1)
+            return NO;
+
+        [(id)desc.owner retain];
+    }
+
+    return YES;
+}
+
+/* private method */
+- (void)applyOutput:(struct reassembly_output*)output
+{
+    const struct reassembly_span* span;
+    size_t i, nchunks;
+
+    for (i = 0; i < output->nspans; ++i)
+    {
+        span = &output->spans[i];
+
+        if (reassembly_buffer_append(
+                &m_buffer,
+                span->is_client,
+                m_reassembly.segments[span->segment].payload + span->offset,
+                span->length) == -1)
+        {
+            /* go back to where the chunks kept are all there, so that the
+               rest are found again next time */
+            nchunks = reassembly_truncate(
+                &m_reassembly, SIZE_MAX, m_buffer.nchunks, release_owner);
+            if (nchunks < m_buffer.nchunks)
+            {
+                reassembly_buffer_truncate(&m_buffer, nchunks);
+                if (nchunks < m_changedChunk)
+                    m_changedChunk = nchunks;
+            }
+            break;
+        }
+    }
+}
+
+/* private method, forgets the segments from segmentIndex onwards and the
+   chunks that depend on them. Deferred until any running job finishes */
+- (void)truncateFromSegment:(size_t)segmentIndex
+{
+    size_t nchunks;
+
+    if (m_job != NULL)
+    {
+        if (segmentIndex < m_deletedFrom)
+            m_deletedFrom = segmentIndex;
+        return;
+    }
+
+    nchunks = reassembly_truncate(
+        &m_reassembly, segmentIndex, m_buffer.nchunks, release_owner);
+
+    if (nchunks < m_buffer.nchunks)
+    {
+        reassembly_buffer_truncate(&m_buffer, nchunks);
+        if (nchunks < m_changedChunk)
+            m_changedChunk = nchunks;
+    }
+}
+
+/* private method, performed on the main thread once m_job's task is done */
+- (void)reassemblyCompleted
+{
+    struct reassembly_job* job;
+
+    job = m_job;
+    m_job = NULL;
+
+    [self applyOutput:&job->output];
+    reassembly_output_destroy(&job->output);
+    free(job);
+
+    if (m_deletedFrom != SIZE_MAX)
+    {
+        [self truncateFromSegment:m_deletedFrom];
+        m_deletedFrom = SIZE_MAX;
+        m_reassembleAgain = YES;
+    }
+
+    if (m_stream != nil)
+    {
+        [self notifyListeners];
+
+        if (m_reassembleAgain)
+        {
+            m_reassembleAgain = NO;
+            [self reassembleInBackground];
+        }
+    }
+
+    [self release]; /* taken by reassembleInBackground */
+}
+
+/* private method */
+- (void)notifyListeners
+{
+    unsigned int i;
+    unsigned int chunkIndex;
+
+    if (m_changedChunk != SIZE_MAX)
+    {
+        chunkIndex = m_changedChunk;
+        m_changedChunk = SIZE_MAX;
+        for (i = 0; i < [m_listeners count]; ++i)
+            [[m_listeners objectAtIndex:i] noteChunksDeletedFrom:chunkIndex];
+    }
+    else
+        [m_listeners makeObjectsPerformSelector:@selector(noteChunksAppended)];
 }
 
 - (void)reset
 {
-    [m_chunks removeAllObjects];
+    [self truncateFromSegment:0];
     [m_timer release];
     m_timer = nil;
-
-    m_streamIndex = 0;
-    m_clientStreamIndex = 0;
-    m_serverStreamIndex = 0;
-
-    m_c_seq_no = [[m_stream clientSegmentAtIndex:0] seqNo];
-    m_s_seq_no = [[m_stream serverSegmentAtIndex:0] seqNo];
 }
 
 - (void)setTimer
@@ -351,15 +438,8 @@ err:
     if (m_stream == nil)
         return;
 
-    [self reassemble];
-
-    if (m_segmentsDeleted)
-    {
-        m_segmentsDeleted = NO;
-        [m_listeners makeObjectsPerformSelector:@selector(noteChunksDeleted)];
-    }
-    else
-        [m_listeners makeObjectsPerformSelector:@selector(noteChunksAppended)];
+    /* listeners are notified when it's done */
+    [self reassembleInBackground];
 }
 
 - (void)invalidateStream
@@ -368,14 +448,13 @@ err:
     [m_listeners makeObjectsPerformSelector:@selector(close)];
 }
 
-- (void)noteSegmentsDeleted
+/* segmentIndex is the index, in the stream, of the first packet removed */
+- (void)noteSegmentsDeletedFrom:(size_t)segmentIndex
 {
     if (m_stream == nil)
         return;
 
-    m_segmentsDeleted = YES;
-
-    [self reset];
+    [self truncateFromSegment:segmentIndex];
     [self setTimer];
 }
 
@@ -389,8 +468,10 @@ err:
 
 - (void)dealloc
 {
-    [self reset];
-    [m_chunks release];
+    /* there can't be a job running, as it keeps a reference */
+    [m_timer release];
+    reassembly_destroy(&m_reassembly, release_owner);
+    reassembly_buffer_destroy(&m_buffer);
     /* balance the release to be done by the m_listeners array */
     [m_listeners makeObjectsPerformSelector:@selector(retain)];
     [m_listeners release];
@@ -398,3 +479,17 @@ err:
 }
 
 @end
+
+static void reassembly_task(struct reassembly_job* job)
+{
+    (void)reassembly_run(job->reassembly, &job->output);
+
+    [job->reassembler performSelectorOnMainThread:@selector(reassemblyCompleted)
+                                       withObject:nil
+                                    waitUntilDone:NO];
+}
+
+static void release_owner(void* owner)
+{
+    [(id)owner release];
+}
@@ -0,0 +1,316 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "reassembly.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* chunks found between checkpoints */
+#define REASSEMBLY_CHECKPOINT_INTERVAL 1024
+
+/* difference between two sequence numbers, allowing for wrap around */
+#define RA_SEQ_DIFF(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))
+#define RA_SEQ_GT(a, b)   (RA_SEQ_DIFF(a, b) > 0)
+#define RA_SEQ_GE(a, b)   (RA_SEQ_DIFF(a, b) >= 0)
+#define RA_SEQ_LE(a, b)   (RA_SEQ_DIFF(a, b) <= 0)
+
+static int
+reserve(void** p, size_t* capacity, size_t needed, size_t size, size_t min);
+static int checkpoint(struct reassembly* r, size_t index);
+static void depend(struct reassembly_state* state, size_t i);
+static int state_is_valid(
+    const struct reassembly_state* state, size_t nsegments, size_t nchunks);
+
+void reassembly_init(struct reassembly* r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+void reassembly_destroy(struct reassembly* r, reassembly_owner_fptr owner_free)
+{
+    (void)reassembly_truncate(r, 0, 0, owner_free);
+    free(r->segments);
+    free(r->checkpoints);
+    reassembly_init(r);
+}
+
+int reassembly_append(
+    struct reassembly* r, const struct reassembly_segment* segment)
+{
+    if (reserve((void**)&r->segments,
+                &r->segments_capacity,
+                r->nsegments + 1,
+                sizeof(*r->segments),
+                64) == -1)
+        return -1;
+
+    r->segments[r->nsegments++] = *segment;
+
+    return 0;
+}
+
+/*
+    Each segment with data is reassembled once a segment from the other side
+    acknowledges it, possibly a bit at a time if it is only partially
+    acknowledged. The other side's segments are checked for ACKs in order,
+    from where the last ACK was found, so segments are never checked twice
+    unless the reassembly is rolled back.
+
+    When one direction runs out of ACKs, the other carries on, and the next
+    run starts again from the first segment still waiting for one.
+*/
+int reassembly_run(struct reassembly* r, struct reassembly_output* output)
+{
+    struct reassembly_state* state;
+    const struct reassembly_segment* segment;
+    const struct reassembly_segment* acker;
+    struct reassembly_span* span;
+    size_t i, stop, nbytes, offset;
+    uint32_t start;
+    int check[2];
+    int dir;
+    int ret;
+
+    state = &r->state;
+    check[0] = 1;
+    check[1] = 1;
+    stop = SIZE_MAX;
+    ret = 0;
+
+    for (i = state->index; i < r->nsegments && (check[0] || check[1]); ++i)
+    {
+        /* get memory first, so running out leaves the state consistent */
+        if (reserve((void**)&output->spans,
+                    &output->capacity,
+                    output->nspans + 1,
+                    sizeof(*output->spans),
+                    64) == -1 ||
+            checkpoint(r, (i < stop) ? i : stop) == -1)
+        {
+            ret = -1;
+            break;
+        }
+
+        segment = &r->segments[i];
+        dir = segment->is_client;
+
+        if (!state->started[dir])
+        {
+            state->seq[dir] = segment->seq;
+            state->started[dir] = 1;
+            depend(state, i);
+        }
+
+        if (segment->size < 1 || !check[dir])
+            continue;
+
+        if (RA_SEQ_LE(segment->next, state->seq[dir]))
+            continue; /* no new data */
+
+        /* find a segment which ACKs the data in this one */
+        nbytes = 0;
+        start = state->seq[dir];
+        offset = RA_SEQ_GT(start, segment->seq) ?
+                     (size_t)(uint32_t)(start - segment->seq) :
+                     0;
+
+        for (; state->ack_index[dir] < r->nsegments; ++state->ack_index[dir])
+        {
+            acker = &r->segments[state->ack_index[dir]];
+
+            if (acker->is_client == dir || !acker->ack_flag)
+                continue;
+
+            if (RA_SEQ_GE(acker->ack, segment->next))
+            {
+                /* full ack */
+                nbytes = SIZE_MAX;
+                state->seq[dir] = segment->next;
+                depend(state, state->ack_index[dir]);
+                break;
+            }
+            else if (RA_SEQ_GT(acker->ack, state->seq[dir]))
+            {
+                /* partial ack */
+                state->seq[dir] = acker->ack;
+                nbytes = (uint32_t)(acker->ack - start);
+                depend(state, state->ack_index[dir]);
+            }
+        }
+
+        if (nbytes < 1)
+        {
+            check[dir] = 0;
+            if (i < stop)
+                stop = i;
+            continue;
+        }
+
+        depend(state, i);
+
+        if (offset < segment->payload_length)
+        {
+            span = &output->spans[output->nspans++];
+            span->segment = i;
+            span->offset = offset;
+            span->length = segment->payload_length - offset;
+            if (nbytes < span->length)
+                span->length = nbytes;
+            span->is_client = dir;
+
+            ++state->nchunks;
+        }
+
+        if (nbytes != SIZE_MAX)
+            break; /* segment was only partially acked */
+    }
+
+    state->index = (i < stop) ? i : stop;
+
+    return ret;
+}
+
+size_t reassembly_truncate(
+    struct reassembly* r,
+    size_t nsegments,
+    size_t nchunks,
+    reassembly_owner_fptr owner_free)
+{
+    struct reassembly_state* state;
+    size_t i;
+
+    if (nsegments < r->nsegments)
+    {
+        if (owner_free != NULL)
+        {
+            for (i = nsegments; i < r->nsegments; ++i)
+                owner_free(r->segments[i].owner);
+        }
+        r->nsegments = nsegments;
+    }
+
+    state = &r->state;
+
+    if (!state_is_valid(state, nsegments, nchunks))
+    {
+        while (r->ncheckpoints > 0 &&
+               !state_is_valid(
+                   &r->checkpoints[r->ncheckpoints - 1], nsegments, nchunks))
+            --r->ncheckpoints;
+
+        if (r->ncheckpoints > 0)
+            *state = r->checkpoints[r->ncheckpoints - 1];
+        else
+            memset(state, 0, sizeof(*state));
+    }
+
+    /* segments after the ones forgotten are new, so have to be looked at
+       again, even if the ones they replace had nothing to offer */
+    if (state->index > r->nsegments)
+        state->index = r->nsegments;
+
+    for (i = 0; i < 2; ++i)
+    {
+        if (state->ack_index[i] > r->nsegments)
+            state->ack_index[i] = r->nsegments;
+    }
+
+    return state->nchunks;
+}
+
+void reassembly_output_init(struct reassembly_output* output)
+{
+    memset(output, 0, sizeof(*output));
+}
+
+void reassembly_output_destroy(struct reassembly_output* output)
+{
+    free(output->spans);
+    reassembly_output_init(output);
+}
+
+/* grows the array at *p, of *capacity elements of size bytes, to hold at
+   least needed elements */
+static int
+reserve(void** p, size_t* capacity, size_t needed, size_t size, size_t min)
+{
+    size_t n;
+    void* q;
+
+    if (needed <= *capacity)
+        return 0;
+
+    n = (*capacity > 0) ? *capacity : min;
+
+    while (n < needed)
+    {
+        if (n > SIZE_MAX / 2)
+            return -1;
+        n *= 2;
+    }
+
+    if (n > SIZE_MAX / size)
+        return -1;
+
+    if ((q = realloc(*p, n * size)) == NULL)
+        return -1;
+
+    *p = q;
+    *capacity = n;
+
+    return 0;
+}
+
+/* records the state, as if the run had stopped at index, if enough chunks
+   have been found since the last checkpoint */
+static int checkpoint(struct reassembly* r, size_t index)
+{
+    size_t last;
+
+    last = (r->ncheckpoints > 0) ? r->checkpoints[r->ncheckpoints - 1].nchunks
+                                 : 0;
+
+    if (r->state.nchunks - last < REASSEMBLY_CHECKPOINT_INTERVAL)
+        return 0;
+
+    if (reserve((void**)&r->checkpoints,
+                &r->checkpoints_capacity,
+                r->ncheckpoints + 1,
+                sizeof(*r->checkpoints),
+                16) == -1)
+        return -1;
+
+    r->checkpoints[r->ncheckpoints] = r->state;
+    r->checkpoints[r->ncheckpoints].index = index;
+    ++r->ncheckpoints;
+
+    return 0;
+}
+
+static void depend(struct reassembly_state* state, size_t i)
+{
+    if (i >= state->depends)
+        state->depends = i + 1;
+}
+
+static int state_is_valid(
+    const struct reassembly_state* state, size_t nsegments, size_t nchunks)
+{
+    return (state->depends <= nsegments && state->nchunks <= nchunks);
+}
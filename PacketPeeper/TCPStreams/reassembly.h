@@ -0,0 +1,120 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _REASSEMBLY_H_
+#define _REASSEMBLY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* works out which data of a TCP stream has been acknowledged, and in what
+   order, from a copy of the stream's segments. Only plain data is used, so
+   a reassembly can be run on a thread other than the one adding segments,
+   provided neither touches it while the other does.
+
+   Checkpoints of the reassembly's progress are kept as it goes, so that
+   when segments are removed it only has to go back as far as the last
+   checkpoint that didn't depend on them */
+
+struct reassembly_segment
+{
+    const uint8_t* payload;
+    size_t payload_length; /* less than size if the capture was cut short */
+    uint32_t size;         /* payload size according to the headers */
+    uint32_t seq;
+    uint32_t next; /* sequence number expected after the segment */
+    uint32_t ack;
+    int ack_flag;
+    int is_client;
+    void* owner; /* keeps payload valid, see reassembly_truncate */
+};
+
+struct reassembly_state
+{
+    size_t index;        /* first segment which may have more data */
+    size_t ack_index[2]; /* next segment to check for ACKs of each direction's
+                            data, indexed by is_client */
+    uint32_t seq[2];     /* next sequence number expected in each direction */
+    int started[2];      /* whether seq has been set */
+    size_t depends;      /* the chunks so far depend on the segments before
+                            this index */
+    size_t nchunks;      /* chunks reassembled so far */
+};
+
+/* a chunk of acknowledged data, from part of a segment's payload */
+struct reassembly_span
+{
+    size_t segment;
+    size_t offset;
+    size_t length;
+    int is_client;
+};
+
+struct reassembly
+{
+    struct reassembly_segment* segments; /* in the order the stream has them */
+    size_t nsegments;
+    size_t segments_capacity;
+    struct reassembly_state state;
+    struct reassembly_state* checkpoints;
+    size_t ncheckpoints;
+    size_t checkpoints_capacity;
+};
+
+/* spans found by a run of the reassembly */
+struct reassembly_output
+{
+    struct reassembly_span* spans;
+    size_t nspans;
+    size_t capacity;
+};
+
+typedef void (*reassembly_owner_fptr)(void* owner);
+
+void reassembly_init(struct reassembly* r);
+
+/* frees everything, calling owner_free, if not NULL, on each segment's
+   owner */
+void reassembly_destroy(struct reassembly* r, reassembly_owner_fptr owner_free);
+
+/* returns 0 on success or -1 if memory runs out */
+int reassembly_append(
+    struct reassembly* r, const struct reassembly_segment* segment);
+
+/* reassembles as much as the segments allow, adding a span to output for
+   each new chunk of data. Returns 0 on success, or -1 if memory runs out, in
+   which case output holds the spans found before it did and the reassembly
+   can carry on from there */
+int reassembly_run(struct reassembly* r, struct reassembly_output* output);
+
+/* forgets the segments from the nsegments'th onwards, calling owner_free,
+   if not NULL, on their owners, and the chunks from the nchunks'th
+   onwards. The reassembly goes back to the last checkpoint which depends
+   on neither, unless where it is now doesn't, and returns the number of
+   chunks found up to there, which are the ones to keep */
+size_t reassembly_truncate(
+    struct reassembly* r,
+    size_t nsegments,
+    size_t nchunks,
+    reassembly_owner_fptr owner_free);
+
+void reassembly_output_init(struct reassembly_output* output);
+void reassembly_output_destroy(struct reassembly_output* output);
+
+#endif
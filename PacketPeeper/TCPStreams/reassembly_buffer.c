@@ -0,0 +1,187 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "reassembly_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* initial sizes of the chunk index and contiguous copies */
+#define REASSEMBLY_CHUNKS_MIN 64
+#define REASSEMBLY_BYTES_MIN  (64 * 1024)
+
+static int grow(void** p, size_t* capacity, size_t needed, size_t size);
+
+void reassembly_buffer_init(struct reassembly_buffer* rb)
+{
+    memset(rb, 0, sizeof(*rb));
+}
+
+void reassembly_buffer_destroy(struct reassembly_buffer* rb)
+{
+    free(rb->chunks);
+    free(rb->dir[0].bytes);
+    free(rb->dir[1].bytes);
+    reassembly_buffer_init(rb);
+}
+
+void reassembly_buffer_reset(struct reassembly_buffer* rb)
+{
+    rb->nchunks = 0;
+    rb->dir[0].length = 0;
+    rb->dir[1].length = 0;
+}
+
+void reassembly_buffer_truncate(struct reassembly_buffer* rb, size_t nchunks)
+{
+    const struct reassembly_chunk* first;
+
+    if (nchunks >= rb->nchunks)
+        return;
+
+    /* the first chunk dropped says how much data comes before it, in its
+       own direction and in both */
+    first = &rb->chunks[nchunks];
+    rb->dir[first->is_client].length = first->offset;
+    rb->dir[!first->is_client].length = first->position - first->offset;
+    rb->nchunks = nchunks;
+}
+
+int reassembly_buffer_append(
+    struct reassembly_buffer* rb,
+    int is_client,
+    const void* data,
+    size_t length)
+{
+    struct reassembly_direction* dir;
+    struct reassembly_chunk* chunk;
+
+    dir = &rb->dir[is_client ? 1 : 0];
+
+    if (rb->nchunks == rb->capacity &&
+        grow((void**)&rb->chunks,
+             &rb->capacity,
+             rb->nchunks + 1,
+             sizeof(*rb->chunks)) == -1)
+        return -1;
+
+    if (dir->buffered)
+    {
+        /* without room for the copy, fall back to reading from the packets
+           rather than losing the chunk */
+        if (dir->length + length > dir->capacity &&
+            grow((void**)&dir->bytes,
+                 &dir->capacity,
+                 dir->length + length,
+                 1) == -1)
+            (void)reassembly_buffer_set_buffered(rb, is_client, 0);
+        else
+            memcpy(dir->bytes + dir->length, data, length);
+    }
+
+    chunk = &rb->chunks[rb->nchunks++];
+    chunk->data = data;
+    chunk->offset = dir->length;
+    chunk->position = rb->dir[0].length + rb->dir[1].length;
+    chunk->length = length;
+    chunk->is_client = is_client ? 1 : 0;
+
+    dir->length += length;
+
+    return 0;
+}
+
+int reassembly_buffer_set_buffered(
+    struct reassembly_buffer* rb, int is_client, int buffered)
+{
+    struct reassembly_direction* dir;
+    size_t i;
+
+    dir = &rb->dir[is_client ? 1 : 0];
+
+    if (!buffered)
+    {
+        free(dir->bytes);
+        dir->bytes = NULL;
+        dir->capacity = 0;
+        dir->buffered = 0;
+        return 0;
+    }
+
+    if (dir->buffered)
+        return 0;
+
+    if (dir->length > 0 &&
+        grow((void**)&dir->bytes, &dir->capacity, dir->length, 1) == -1)
+        return -1;
+
+    for (i = 0; i < rb->nchunks; ++i)
+    {
+        if (rb->chunks[i].is_client == (is_client ? 1 : 0))
+            memcpy(
+                dir->bytes + rb->chunks[i].offset,
+                rb->chunks[i].data,
+                rb->chunks[i].length);
+    }
+
+    dir->buffered = 1;
+
+    return 0;
+}
+
+const uint8_t*
+reassembly_buffer_chunk_bytes(const struct reassembly_buffer* rb, size_t i)
+{
+    const struct reassembly_chunk* chunk;
+    const struct reassembly_direction* dir;
+
+    chunk = &rb->chunks[i];
+    dir = &rb->dir[chunk->is_client];
+
+    return dir->buffered ? dir->bytes + chunk->offset : chunk->data;
+}
+
+/* grows the array at *p, of *capacity elements of size bytes, to hold at
+   least needed elements, at least doubling it so appends are amortised
+   O(1) */
+static int grow(void** p, size_t* capacity, size_t needed, size_t size)
+{
+    size_t n;
+    void* q;
+
+    n = (*capacity > 0) ? *capacity : ((size == 1) ? REASSEMBLY_BYTES_MIN :
+                                                     REASSEMBLY_CHUNKS_MIN);
+
+    while (n < needed)
+    {
+        if (n > SIZE_MAX / 2)
+            return -1;
+        n *= 2;
+    }
+
+    if (n > SIZE_MAX / size)
+        return -1;
+
+    if ((q = realloc(*p, n * size)) == NULL)
+        return -1;
+
+    *p = q;
+    *capacity = n;
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _REASSEMBLY_BUFFER_H_
+#define _REASSEMBLY_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* reassembled data of a TCP stream, as an index of chunks in the order they
+   were acknowledged. Chunks point into the packets they came from, and
+   either direction can also keep a contiguous copy of everything sent in
+   that direction, so it can be scanned without following the index */
+
+struct reassembly_chunk
+{
+    const uint8_t* data; /* in the packet the chunk came from */
+    size_t offset;       /* within the data sent in the chunk's direction */
+    size_t position;     /* within the data sent in both directions */
+    size_t length;
+    int is_client;
+};
+
+struct reassembly_direction
+{
+    uint8_t* bytes; /* contiguous copy, NULL unless buffered */
+    size_t length;  /* bytes sent in this direction so far */
+    size_t capacity;
+    int buffered;
+};
+
+struct reassembly_buffer
+{
+    struct reassembly_chunk* chunks;
+    size_t nchunks;
+    size_t capacity;
+    struct reassembly_direction dir[2]; /* indexed by is_client */
+};
+
+void reassembly_buffer_init(struct reassembly_buffer* rb);
+
+/* frees everything, leaving rb as if just initialised */
+void reassembly_buffer_destroy(struct reassembly_buffer* rb);
+
+/* drops every chunk, keeping the buffering settings */
+void reassembly_buffer_reset(struct reassembly_buffer* rb);
+
+/* drops every chunk from the nchunks'th onwards */
+void reassembly_buffer_truncate(struct reassembly_buffer* rb, size_t nchunks);
+
+/* appends a chunk of length bytes at data, which must stay valid for as long
+   as the chunk is kept. Returns 0 on success or -1 if memory runs out. If
+   only the contiguous copy can't grow, the direction stops being buffered */
+int reassembly_buffer_append(
+    struct reassembly_buffer* rb,
+    int is_client,
+    const void* data,
+    size_t length);
+
+/* starts or stops keeping a contiguous copy of the data sent in a direction,
+   copying in the data of the chunks already appended. Returns 0 on success
+   or -1 if memory runs out */
+int reassembly_buffer_set_buffered(
+    struct reassembly_buffer* rb, int is_client, int buffered);
+
+/* the bytes of chunk i, from the contiguous copy if there is one. Pointers
+   into a contiguous copy are only valid until the next append */
+const uint8_t*
+reassembly_buffer_chunk_bytes(const struct reassembly_buffer* rb, size_t i);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "segment_queue.h"
+#include <stdlib.h>
+
+/*
+    A skip list. Insertion, removal and lookup take expected O(log n) time,
+    while the first segment is always at the head of the bottom level, so
+    taking the next in order segment off the queue is O(1).
+
+    Segments are keyed by (seq, end, address), so that retransmissions of the
+    same sequence numbers are still distinct keys, and a given segment can be
+    found again for removal.
+*/
+
+/* each level holds about a quarter of the nodes of the level below, so this
+   is enough for 4^12 segments before lookups start to slow down */
+#define SQ_MAX_LEVEL 12
+
+/* most queued segments a new segment is checked against for coverage */
+#define SQ_COVER_SCAN_MAX 16
+
+/* difference between two sequence numbers, allowing for wrap around */
+#define SQ_SEQ_DIFF(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)))
+
+struct sq_node
+{
+    uint32_t seq;
+    uint32_t end;
+    void* segment;
+    struct sq_node* next[]; /* one per level the node is on */
+};
+
+struct segment_queue
+{
+    struct sq_node* head[SQ_MAX_LEVEL];
+    unsigned int level; /* number of levels in use */
+    size_t count;
+};
+
+static int sq_compare(
+    const struct sq_node* node,
+    uint32_t seq,
+    uint32_t end,
+    const void* segment);
+static void sq_find(
+    const struct segment_queue* sq,
+    uint32_t seq,
+    uint32_t end,
+    const void* segment,
+    struct sq_node** update);
+static struct sq_node**
+sq_link(struct segment_queue* sq, struct sq_node* node, unsigned int i);
+static unsigned int sq_random_level(void);
+static void sq_shrink(struct segment_queue* sq);
+
+struct segment_queue* segment_queue_create(void)
+{
+    return calloc(1, sizeof(struct segment_queue));
+}
+
+void segment_queue_free(struct segment_queue* sq, segment_fptr segment_free)
+{
+    if (sq == NULL)
+        return;
+
+    segment_queue_clear(sq, segment_free);
+    free(sq);
+}
+
+int segment_queue_insert(
+    struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment)
+{
+    struct sq_node* update[SQ_MAX_LEVEL];
+    struct sq_node* node;
+    unsigned int i, level;
+    uint32_t covered;
+
+    sq_find(sq, seq, end, segment, update);
+
+    node = *sq_link(sq, update[0], 0);
+
+    if (node != NULL && sq_compare(node, seq, end, segment) == 0)
+        return 0;
+
+    /* a retransmission is covered by the segments queued from the one before
+       it onwards, so there's no need to queue it again */
+    if (SQ_SEQ_DIFF(end, seq) > 0)
+    {
+        covered = seq;
+        node = (update[0] != NULL) ? update[0] : sq->head[0];
+
+        for (i = 0; node != NULL && i < SQ_COVER_SCAN_MAX &&
+                    SQ_SEQ_DIFF(node->seq, covered) <= 0;
+             node = node->next[0], ++i)
+        {
+            if (SQ_SEQ_DIFF(node->end, covered) > 0)
+                covered = node->end;
+
+            if (SQ_SEQ_DIFF(covered, end) >= 0)
+                return 0;
+        }
+    }
+
+    level = sq_random_level();
+
+    if ((node = malloc(sizeof(*node) + level * sizeof(node->next[0]))) ==
+        NULL)
+        return -1;
+
+    node->seq = seq;
+    node->end = end;
+    node->segment = segment;
+
+    for (; sq->level < level; ++sq->level)
+        update[sq->level] = NULL;
+
+    for (i = 0; i < level; ++i)
+    {
+        node->next[i] = *sq_link(sq, update[i], i);
+        *sq_link(sq, update[i], i) = node;
+    }
+
+    ++sq->count;
+
+    return 1;
+}
+
+void* segment_queue_first(const struct segment_queue* sq)
+{
+    return (sq->head[0] != NULL) ? sq->head[0]->segment : NULL;
+}
+
+void* segment_queue_pop(struct segment_queue* sq)
+{
+    struct sq_node* node;
+    void* segment;
+    unsigned int i;
+
+    if ((node = sq->head[0]) == NULL)
+        return NULL;
+
+    /* the first node is first on every level it is on */
+    for (i = 0; i < sq->level && sq->head[i] == node; ++i)
+        sq->head[i] = node->next[i];
+
+    segment = node->segment;
+    free(node);
+    --sq->count;
+    sq_shrink(sq);
+
+    return segment;
+}
+
+int segment_queue_remove(
+    struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment)
+{
+    struct sq_node* update[SQ_MAX_LEVEL];
+    struct sq_node* node;
+    unsigned int i;
+
+    sq_find(sq, seq, end, segment, update);
+
+    node = *sq_link(sq, update[0], 0);
+
+    if (node == NULL || sq_compare(node, seq, end, segment) != 0)
+        return 0;
+
+    for (i = 0; i < sq->level && *sq_link(sq, update[i], i) == node; ++i)
+        *sq_link(sq, update[i], i) = node->next[i];
+
+    free(node);
+    --sq->count;
+    sq_shrink(sq);
+
+    return 1;
+}
+
+int segment_queue_contains(
+    const struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment)
+{
+    struct sq_node* update[SQ_MAX_LEVEL];
+    struct sq_node* node;
+
+    sq_find(sq, seq, end, segment, update);
+
+    node = (update[0] != NULL) ? update[0]->next[0] : sq->head[0];
+
+    return (node != NULL && sq_compare(node, seq, end, segment) == 0);
+}
+
+size_t segment_queue_count(const struct segment_queue* sq)
+{
+    return sq->count;
+}
+
+void segment_queue_apply(const struct segment_queue* sq, segment_fptr fn)
+{
+    struct sq_node* node;
+
+    for (node = sq->head[0]; node != NULL; node = node->next[0])
+        fn(node->segment);
+}
+
+void segment_queue_clear(struct segment_queue* sq, segment_fptr segment_free)
+{
+    struct sq_node *node, *next;
+    unsigned int i;
+
+    for (node = sq->head[0]; node != NULL; node = next)
+    {
+        next = node->next[0];
+        if (segment_free != NULL)
+            segment_free(node->segment);
+        free(node);
+    }
+
+    for (i = 0; i < SQ_MAX_LEVEL; ++i)
+        sq->head[i] = NULL;
+
+    sq->level = 0;
+    sq->count = 0;
+}
+
+/* orders nodes by sequence number, then by end, then by address */
+static int sq_compare(
+    const struct sq_node* node,
+    uint32_t seq,
+    uint32_t end,
+    const void* segment)
+{
+    int32_t diff;
+
+    if ((diff = SQ_SEQ_DIFF(node->seq, seq)) != 0)
+        return (diff < 0) ? -1 : 1;
+
+    if ((diff = SQ_SEQ_DIFF(node->end, end)) != 0)
+        return (diff < 0) ? -1 : 1;
+
+    if (node->segment != segment)
+        return ((uintptr_t)node->segment < (uintptr_t)segment) ? -1 : 1;
+
+    return 0;
+}
+
+/* sets update[i] to the last node on level i which is before the key, or NULL
+   if there is none, for each level in use */
+static void sq_find(
+    const struct segment_queue* sq,
+    uint32_t seq,
+    uint32_t end,
+    const void* segment,
+    struct sq_node** update)
+{
+    struct sq_node *node, *next;
+    unsigned int i;
+
+    node = NULL;
+
+    for (i = sq->level; i > 0; --i)
+    {
+        for (;;)
+        {
+            next = (node != NULL) ? node->next[i - 1] : sq->head[i - 1];
+
+            if (next == NULL || sq_compare(next, seq, end, segment) >= 0)
+                break;
+
+            node = next;
+        }
+        update[i - 1] = node;
+    }
+
+    if (sq->level == 0)
+        update[0] = NULL;
+}
+
+/* the pointer to the node after node on level i, where a NULL node is the
+   head of the list */
+static struct sq_node**
+sq_link(struct segment_queue* sq, struct sq_node* node, unsigned int i)
+{
+    return (node != NULL) ? &node->next[i] : &sq->head[i];
+}
+
+static unsigned int sq_random_level(void)
+{
+    unsigned int level;
+    uint32_t r;
+
+    r = arc4random();
+
+    for (level = 1; level < SQ_MAX_LEVEL && (r & 3) == 0; ++level)
+        r >>= 2;
+
+    return level;
+}
+
+/* drops empty levels from the top */
+static void sq_shrink(struct segment_queue* sq)
+{
+    while (sq->level > 0 && sq->head[sq->level - 1] == NULL)
+        --sq->level;
+}
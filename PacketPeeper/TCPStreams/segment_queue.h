@@ -0,0 +1,70 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SEGMENT_QUEUE_H_
+#define _SEGMENT_QUEUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* queue of out of order segments, ordered by sequence number. Each segment
+   covers the sequence numbers [seq, end), where end is the sequence number
+   expected after it. Sequence numbers wrap, so every segment in a queue must
+   be within 2^31 of every other */
+
+struct segment_queue;
+
+typedef void (*segment_fptr)(void* segment);
+
+/* returns NULL if memory runs out */
+struct segment_queue* segment_queue_create(void);
+
+/* frees the queue, calling segment_free, if not NULL, on each segment */
+void segment_queue_free(struct segment_queue* sq, segment_fptr segment_free);
+
+/* queues segment, which must not be NULL. Returns 1 if queued, 0 if it is
+   already queued or the sequence numbers it covers are already covered by
+   queued segments (so it is a retransmission that would only be discarded),
+   or -1 if memory runs out. Empty segments are never treated as covered */
+int segment_queue_insert(
+    struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment);
+
+/* the queued segment with the lowest sequence number, or NULL */
+void* segment_queue_first(const struct segment_queue* sq);
+
+/* removes and returns the first segment, or NULL if the queue is empty */
+void* segment_queue_pop(struct segment_queue* sq);
+
+/* removes segment, queued with seq and end, returning 1 if it was found */
+int segment_queue_remove(
+    struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment);
+
+/* returns 1 if segment is queued with seq and end */
+int segment_queue_contains(
+    const struct segment_queue* sq, uint32_t seq, uint32_t end, void* segment);
+
+size_t segment_queue_count(const struct segment_queue* sq);
+
+/* calls fn on each segment in sequence number order */
+void segment_queue_apply(const struct segment_queue* sq, segment_fptr fn);
+
+/* removes every segment, calling segment_free, if not NULL, on each */
+void segment_queue_clear(struct segment_queue* sq, segment_fptr segment_free);
+
+#endif
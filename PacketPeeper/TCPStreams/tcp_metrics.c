@@ -0,0 +1,189 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "tcp_metrics.h"
+#include "tcp_state.h"
+#include <netinet/tcp.h>
+#include <string.h>
+
+static void rtt_add(struct tcp_metrics* metrics, double rtt);
+
+void tcp_metrics_init(struct tcp_metrics* metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+void tcp_metrics_add(
+    struct tcp_metrics* metrics,
+    const struct tcp_segment_info* segment,
+    double time)
+{
+    struct tcp_rtt_sample* sample;
+    uint32_t next;
+    int dir;
+
+    dir = segment->is_client ? 1 : 0;
+    next = tcp_segment_info_next(segment);
+
+    if (metrics->nsegments++ == 0)
+    {
+        metrics->first = time;
+        metrics->last = time;
+        metrics->interval_start = time;
+    }
+    else if (time > metrics->last)
+    {
+        metrics->last = time;
+    }
+
+    /* handshake */
+    if ((segment->flags & (TH_SYN | TH_ACK)) == TH_SYN)
+    {
+        if (segment->is_client && !metrics->syn_seen)
+        {
+            metrics->syn_time = time;
+            metrics->syn_seen = 1;
+        }
+    }
+    else if ((segment->flags & (TH_SYN | TH_ACK)) == (TH_SYN | TH_ACK))
+    {
+        if (!segment->is_client && metrics->syn_seen &&
+            !metrics->handshake_seen && time >= metrics->syn_time)
+        {
+            metrics->handshake_rtt = time - metrics->syn_time;
+            metrics->handshake_seen = 1;
+        }
+    }
+
+    /* segments taking up sequence space are retransmissions if they start
+       before the highest sequence number sent so far */
+    if (next != segment->seq)
+    {
+        sample = &metrics->sample[dir];
+
+        if (metrics->started[dir] &&
+            TCP_SEQ_GT(metrics->max_next[dir], segment->seq))
+        {
+            ++metrics->retransmissions[dir];
+
+            /* the ACK could be for either copy (Karn's algorithm) */
+            if (sample->pending && TCP_SEQ_GT(sample->next, segment->seq))
+                sample->pending = 0;
+        }
+        else if (!sample->pending)
+        {
+            sample->next = next;
+            sample->time = time;
+            sample->pending = 1;
+        }
+
+        if (!metrics->started[dir] ||
+            TCP_SEQ_GT(next, metrics->max_next[dir]))
+        {
+            metrics->max_next[dir] = next;
+            metrics->started[dir] = 1;
+        }
+    }
+
+    /* the other direction's timed segment */
+    sample = &metrics->sample[!dir];
+
+    if ((segment->flags & TH_ACK) && sample->pending &&
+        TCP_SEQ_GE(segment->ack, sample->next))
+    {
+        if (time >= sample->time)
+            rtt_add(metrics, time - sample->time);
+        sample->pending = 0;
+    }
+
+    if (segment->window == 0 &&
+        (segment->flags & (TH_SYN | TH_FIN | TH_RST)) == 0)
+        ++metrics->zero_windows[dir];
+
+    /* throughput */
+    metrics->nbytes += segment->len;
+
+    if (time >= metrics->interval_start + TCP_METRICS_INTERVAL)
+    {
+        if (metrics->interval_nbytes / TCP_METRICS_INTERVAL >
+            metrics->peak_throughput)
+            metrics->peak_throughput =
+                metrics->interval_nbytes / TCP_METRICS_INTERVAL;
+
+        metrics->interval_start = time;
+        metrics->interval_nbytes = 0;
+    }
+
+    metrics->interval_nbytes += segment->len;
+}
+
+double tcp_metrics_rtt(const struct tcp_metrics* metrics)
+{
+    if (metrics->rtt_count < 1)
+        return -1.0;
+
+    return metrics->rtt_sum / metrics->rtt_count;
+}
+
+double tcp_metrics_handshake_rtt(const struct tcp_metrics* metrics)
+{
+    return metrics->handshake_seen ? metrics->handshake_rtt : -1.0;
+}
+
+unsigned long tcp_metrics_retransmissions(const struct tcp_metrics* metrics)
+{
+    return metrics->retransmissions[0] + metrics->retransmissions[1];
+}
+
+unsigned long tcp_metrics_zero_windows(const struct tcp_metrics* metrics)
+{
+    return metrics->zero_windows[0] + metrics->zero_windows[1];
+}
+
+double tcp_metrics_throughput(const struct tcp_metrics* metrics)
+{
+    if (metrics->last <= metrics->first)
+        return 0.0;
+
+    return metrics->nbytes / (metrics->last - metrics->first);
+}
+
+double tcp_metrics_peak_throughput(const struct tcp_metrics* metrics)
+{
+    double current;
+
+    /* the current interval can only be part way through */
+    current = metrics->interval_nbytes / TCP_METRICS_INTERVAL;
+
+    return (current > metrics->peak_throughput) ? current :
+                                                  metrics->peak_throughput;
+}
+
+static void rtt_add(struct tcp_metrics* metrics, double rtt)
+{
+    if (metrics->rtt_count == 0 || rtt < metrics->rtt_min)
+        metrics->rtt_min = rtt;
+
+    if (metrics->rtt_count == 0 || rtt > metrics->rtt_max)
+        metrics->rtt_max = rtt;
+
+    metrics->rtt_sum += rtt;
+    ++metrics->rtt_count;
+}
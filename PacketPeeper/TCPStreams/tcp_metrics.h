@@ -0,0 +1,96 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _TCP_METRICS_H_
+#define _TCP_METRICS_H_
+
+#include "tcp_state.h"
+#include <stdint.h>
+
+/* performance metrics of a TCP stream, updated with O(1) work for each
+   segment as the stream is built. Directions are indexed by is_client, and
+   times are in seconds, on any clock the caller likes.
+
+   Round trip times are sampled as in RFC 6298, timing one segment at a time
+   in each direction until it is acknowledged, and ignoring any segment that
+   is retransmitted while being timed */
+
+/* interval over which peak throughput is measured */
+#define TCP_METRICS_INTERVAL 1.0
+
+struct tcp_rtt_sample
+{
+    uint32_t next; /* sequence number acknowledging the timed segment */
+    double time;   /* when the timed segment was sent */
+    int pending;
+};
+
+struct tcp_metrics
+{
+    unsigned long nsegments;
+    double first; /* time of the first segment */
+    double last;  /* time of the newest segment */
+
+    double syn_time;      /* time of the client's first SYN, if syn_seen */
+    double handshake_rtt; /* SYN to SYN/ACK, if handshake_seen */
+    int syn_seen;
+    int handshake_seen;
+
+    struct tcp_rtt_sample sample[2];
+    double rtt_min;
+    double rtt_max;
+    double rtt_sum;
+    unsigned long rtt_count;
+
+    uint32_t max_next[2]; /* highest sequence number sent so far */
+    int started[2];       /* whether max_next has been set */
+    unsigned long retransmissions[2];
+    unsigned long zero_windows[2];
+
+    unsigned long long nbytes; /* payload bytes, retransmissions included */
+    double interval_start;
+    unsigned long long interval_nbytes;
+    double peak_throughput; /* bytes per second over the busiest interval */
+};
+
+void tcp_metrics_init(struct tcp_metrics* metrics);
+
+/* counts segment, sent at time */
+void tcp_metrics_add(
+    struct tcp_metrics* metrics,
+    const struct tcp_segment_info* segment,
+    double time);
+
+/* mean round trip time, or -1.0 if there are no samples */
+double tcp_metrics_rtt(const struct tcp_metrics* metrics);
+
+/* SYN to SYN/ACK time, or -1.0 if the handshake wasn't seen */
+double tcp_metrics_handshake_rtt(const struct tcp_metrics* metrics);
+
+unsigned long tcp_metrics_retransmissions(const struct tcp_metrics* metrics);
+unsigned long tcp_metrics_zero_windows(const struct tcp_metrics* metrics);
+
+/* mean bytes per second between the first and newest segments */
+double tcp_metrics_throughput(const struct tcp_metrics* metrics);
+
+/* bytes per second over the busiest TCP_METRICS_INTERVAL so far */
+double tcp_metrics_peak_throughput(const struct tcp_metrics* metrics);
+
+#endif
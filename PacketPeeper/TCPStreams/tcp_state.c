@@ -0,0 +1,631 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "tcp_state.h"
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* a transition works from the perspective of the client, and only sets the
+   fields of transition that differ from doing nothing */
+typedef void (*tcp_state_fptr)(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+
+static void uninitialised(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void closed(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void syn_sent(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_open(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_syn_ack_wait_client(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_syn_ack_wait_server(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_syn_ack_wait_client_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_syn_ack_wait_server_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void syn_ack_recv(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void established(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void fin_wait_client_1(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void fin_wait_server_1(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void fin_wait_client_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void fin_wait_server_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void simultaneous_close(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void ack_wait_client(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void ack_wait_server(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static void time_wait(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+static enum segment_action out_of_order(
+    uint32_t expected,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition,
+    enum tcp_state_add add,
+    enum segment_action action);
+
+/* STATUS_CLOSING is never entered, it's handled as if closed */
+static const tcp_state_fptr transitions[STATUS_NELEMS] = {
+    [STATUS_UNINITIALISED] = uninitialised,
+    [STATUS_CLOSED] = closed,
+    [STATUS_SYN_SENT] = syn_sent,
+    [STATUS_SIMULTANEOUS_OPEN] = simultaneous_open,
+    [STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT] =
+        simultaneous_syn_ack_wait_client,
+    [STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER] =
+        simultaneous_syn_ack_wait_server,
+    [STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT_2] =
+        simultaneous_syn_ack_wait_client_2,
+    [STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER_2] =
+        simultaneous_syn_ack_wait_server_2,
+    [STATUS_SYN_ACK_RECV] = syn_ack_recv,
+    [STATUS_ESTABLISHED] = established,
+    [STATUS_FIN_WAIT_CLIENT_1] = fin_wait_client_1,
+    [STATUS_FIN_WAIT_SERVER_1] = fin_wait_server_1,
+    [STATUS_FIN_WAIT_CLIENT_2] = fin_wait_client_2,
+    [STATUS_FIN_WAIT_SERVER_2] = fin_wait_server_2,
+    [STATUS_CLOSING] = closed,
+    [STATUS_ACK_WAIT_CLIENT] = ack_wait_client,
+    [STATUS_ACK_WAIT_SERVER] = ack_wait_server,
+    [STATUS_TIME_WAIT] = time_wait,
+    [STATUS_SIMULTANEOUS_CLOSE] = simultaneous_close};
+
+void tcp_state_transition(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    transition->action = SEGMENT_ACCEPT;
+    transition->add = TCP_STATE_ADD_NONE;
+    transition->status = state->status;
+
+    if ((unsigned int)state->status < STATUS_NELEMS)
+        transitions[state->status](state, segment, transition);
+}
+
+uint32_t tcp_segment_info_next(const struct tcp_segment_info* segment)
+{
+    return segment->seq + segment->len +
+           ((segment->flags & (TH_SYN | TH_FIN)) ? 1 : 0);
+}
+
+static void uninitialised(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    (void)state;
+
+    if (segment->flags & TH_SYN)
+    {
+        transition->add = TCP_STATE_ADD_FIRST;
+        transition->status = STATUS_SYN_SENT;
+    }
+    else if (!(segment->flags & (TH_RST | TH_FIN)))
+    {
+        /* try to handle already open streams, next server segment
+           will be accepted without a sequence number check (as we
+           could only check using the ack number, which isn't 100%
+           reliable */
+        transition->add = TCP_STATE_ADD_FIRST;
+        transition->status = STATUS_ESTABLISHED;
+    }
+}
+
+static void closed(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    (void)state;
+
+    /* this check isnt strictly needed, but without it we'd go
+       to the uninitialised state in a new stream object */
+    if (!(segment->flags & (TH_RST | TH_FIN)))
+        transition->action = SEGMENT_REJECT;
+}
+
+static void syn_sent(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client)
+    {
+        if (segment->flags & TH_SYN) /* repeated syn */
+            transition->add = TCP_STATE_ADD_CLIENT;
+    }
+    else
+    { /* server segment */
+        if ((segment->flags & TH_SYN) && (segment->flags & TH_ACK))
+        { /* no isn available to verify */
+            if (segment->ack == state->c_seq_no)
+            { /* syn/ack reply */
+                transition->add = TCP_STATE_ADD_SERVER;
+                transition->status = STATUS_SYN_ACK_RECV;
+            }
+        }
+        else if (segment->flags & TH_SYN)
+        {
+            /* simultaneous open */
+            transition->add = TCP_STATE_ADD_SERVER;
+            transition->status = STATUS_SIMULTANEOUS_OPEN;
+        }
+
+        /* At some point I will add support for handing weird but technically valid
+         * handshakes, e.g. things like breaking the syn/ack reply into multiple
+         * packets. For now though, I don't care about this, Packet Peeper is not
+         * supposed to be an IDS, and there are easier ways to fool it.
+         */
+    }
+}
+
+static void simultaneous_open(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if ((segment->flags & TH_SYN) == 0 || (segment->flags & TH_ACK) == 0)
+        return;
+
+    if (segment->is_client)
+    {
+        if (segment->ack == state->s_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_CLIENT;
+            transition->status = STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER;
+        }
+    }
+    else
+    { /* server segment */
+        if (segment->ack == state->c_seq_no)
+        {
+            /* XXX added to the client, as it always has been */
+            transition->add = TCP_STATE_ADD_CLIENT;
+            transition->status = STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT;
+        }
+    }
+}
+
+static void simultaneous_syn_ack_wait_client(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client && (segment->flags & TH_SYN) &&
+        (segment->flags & TH_ACK) && segment->ack == state->s_seq_no)
+    {
+        transition->add = TCP_STATE_ADD_CLIENT;
+        transition->status = STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER_2;
+    }
+}
+
+static void simultaneous_syn_ack_wait_server(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (!segment->is_client && (segment->flags & TH_SYN) &&
+        (segment->flags & TH_ACK) && segment->ack == state->c_seq_no)
+    {
+        transition->add = TCP_STATE_ADD_SERVER;
+        transition->status = STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT_2;
+    }
+}
+
+static void simultaneous_syn_ack_wait_client_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client && (segment->flags & TH_SYN) &&
+        (segment->flags & TH_ACK) && segment->ack == state->s_seq_no)
+    {
+        transition->add = TCP_STATE_ADD_CLIENT;
+        transition->status = STATUS_ESTABLISHED;
+    }
+}
+
+static void simultaneous_syn_ack_wait_server_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* XXX compares against the server's own sequence number, as it always
+       has */
+    if (!segment->is_client && (segment->flags & TH_SYN) &&
+        (segment->flags & TH_ACK) && segment->ack == state->s_seq_no)
+    {
+        transition->add = TCP_STATE_ADD_SERVER;
+        transition->status = STATUS_ESTABLISHED;
+    }
+}
+
+static void syn_ack_recv(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no && (segment->flags & TH_ACK) &&
+            segment->ack == state->s_seq_no)
+        { /* ack reply */
+            transition->add = TCP_STATE_ADD_CLIENT;
+            transition->status = STATUS_ESTABLISHED;
+        }
+    }
+    else
+    { /* server segment */
+        if ((segment->flags & TH_SYN) && (segment->flags & TH_ACK) &&
+            segment->ack == state->c_seq_no)
+        { /* repeated syn/ack reply, no isn to verify */
+            transition->add = TCP_STATE_ADD_SERVER;
+        }
+    }
+}
+
+static void established(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    uint32_t s_seq_no;
+
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_CLIENT;
+            if (segment->flags & TH_FIN)
+                transition->status = STATUS_FIN_WAIT_SERVER_1;
+        }
+        else
+        {
+            /* otherwise discard the segment; I suppose its possible that this could have a
+               higher ack than seen before, but I would expect a TCP/IP stack to just throw
+               something with a bad sequence number away */
+            transition->action = out_of_order(
+                state->c_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_CLIENT,
+                SEGMENT_DISCARD);
+        }
+    }
+    else
+    { /* server segment */
+        /* without having seen a 3-way handshake, blindly accept whatever
+           server sequence number we see first */
+        s_seq_no = state->has_server_segments ? state->s_seq_no : segment->seq;
+
+        if (segment->seq == s_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_SERVER;
+            if (segment->flags & TH_FIN)
+                transition->status = STATUS_FIN_WAIT_CLIENT_1;
+        }
+        else
+        {
+            transition->action = out_of_order(
+                s_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_SERVER,
+                SEGMENT_DISCARD);
+        }
+    }
+}
+
+static void fin_wait_client_1(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* server sent fin, waiting for client fin */
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no && (segment->flags & TH_ACK) &&
+            TCP_SEQ_GE(segment->ack, state->s_seq_no))
+        {
+            transition->add = TCP_STATE_ADD_CLIENT;
+            transition->status = (segment->flags & TH_FIN) ?
+                                     STATUS_ACK_WAIT_SERVER :   /* fin,ack */
+                                     STATUS_FIN_WAIT_CLIENT_2; /* ack only */
+        }
+        else if (segment->seq == state->c_seq_no)
+        {
+            /* we still need to accept data in this half-closed state */
+            transition->add = TCP_STATE_ADD_CLIENT;
+            if (segment->flags & TH_FIN) /* simultaneous close */
+                transition->status = STATUS_SIMULTANEOUS_CLOSE;
+        }
+        else
+        {
+            transition->action = out_of_order(
+                state->c_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_CLIENT,
+                SEGMENT_ACCEPT);
+        }
+    }
+    else
+    { /* server segment */
+        /* if the client is still sending data, we need to accept ack sent in reply */
+        if (segment->seq == state->s_seq_no)
+            transition->add = TCP_STATE_ADD_SERVER;
+    }
+}
+
+static void fin_wait_server_1(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* client sent fin, waiting for server fin */
+    if (segment->is_client)
+    {
+        /* if the server is still sending data, we need to accept ack sent in reply */
+        if (segment->seq == state->c_seq_no)
+            transition->add = TCP_STATE_ADD_CLIENT;
+    }
+    else
+    { /* server segment */
+        if (segment->seq == state->s_seq_no && (segment->flags & TH_ACK) &&
+            TCP_SEQ_GE(segment->ack, state->c_seq_no))
+        {
+            transition->add = TCP_STATE_ADD_SERVER;
+            transition->status = (segment->flags & TH_FIN) ?
+                                     STATUS_ACK_WAIT_CLIENT :   /* fin,ack */
+                                     STATUS_FIN_WAIT_SERVER_2; /* ack only */
+        }
+        else if (segment->seq == state->s_seq_no)
+        {
+            /* we still need to accept data in this half-closed state */
+            transition->add = TCP_STATE_ADD_SERVER;
+            if (segment->flags & TH_FIN) /* simultaneous close */
+                transition->status = STATUS_SIMULTANEOUS_CLOSE;
+        }
+        else
+        {
+            transition->action = out_of_order(
+                state->s_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_SERVER,
+                SEGMENT_ACCEPT);
+        }
+    }
+}
+
+static void fin_wait_client_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* server sent fin, client ack'ed fin, waiting for client fin */
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_CLIENT;
+            if (segment->flags & TH_FIN)
+                transition->status = STATUS_ACK_WAIT_SERVER;
+        }
+        else
+        {
+            transition->action = out_of_order(
+                state->c_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_CLIENT,
+                SEGMENT_ACCEPT);
+        }
+    }
+    else
+    { /* server segment */
+        /* if the client is still sending data, we need to accept ack sent in reply */
+        if (segment->seq == state->s_seq_no)
+            transition->add = TCP_STATE_ADD_SERVER;
+    }
+}
+
+static void fin_wait_server_2(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* client sent fin, server ack'ed fin, waiting for server fin */
+    if (segment->is_client)
+    {
+        /* if the server is still sending data, we need to accept ack sent in reply */
+        if (segment->seq == state->c_seq_no)
+            transition->add = TCP_STATE_ADD_CLIENT;
+    }
+    else
+    { /* server segment */
+        if (segment->seq == state->s_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_SERVER;
+            if (segment->flags & TH_FIN)
+                transition->status = STATUS_ACK_WAIT_CLIENT;
+        }
+        else
+        {
+            transition->action = out_of_order(
+                state->s_seq_no,
+                segment,
+                transition,
+                TCP_STATE_ADD_SERVER,
+                SEGMENT_ACCEPT);
+        }
+    }
+}
+
+static void simultaneous_close(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_CLIENT;
+            if ((segment->flags & TH_ACK) &&
+                TCP_SEQ_GE(segment->ack, state->s_seq_no))
+                transition->status = STATUS_ACK_WAIT_SERVER;
+        }
+    }
+    else
+    { /* server segment */
+        if (segment->seq == state->s_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_SERVER;
+            if ((segment->flags & TH_ACK) &&
+                TCP_SEQ_GE(segment->ack, state->c_seq_no))
+                transition->status = STATUS_ACK_WAIT_CLIENT;
+        }
+    }
+}
+
+static void ack_wait_client(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no)
+            transition->add = TCP_STATE_ADD_CLIENT;
+        if ((segment->flags & TH_ACK) &&
+            TCP_SEQ_GE(segment->ack, state->s_seq_no))
+            transition->status = STATUS_TIME_WAIT;
+    }
+    else
+    { /* server segment */
+        if (segment->seq == state->s_seq_no)
+            transition->add = TCP_STATE_ADD_SERVER;
+    }
+}
+
+static void ack_wait_server(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    if (segment->is_client)
+    {
+        if (segment->seq == state->c_seq_no)
+            transition->add = TCP_STATE_ADD_CLIENT;
+    }
+    else
+    { /* server segment */
+        if (segment->seq == state->s_seq_no)
+        {
+            transition->add = TCP_STATE_ADD_SERVER;
+            if ((segment->flags & TH_ACK) &&
+                TCP_SEQ_GE(segment->ack, state->c_seq_no))
+                transition->status = STATUS_TIME_WAIT;
+        }
+    }
+}
+
+static void time_wait(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition)
+{
+    /* Assume (no justification for you) that SO_REUSEADDR and SO_REUSEPORT are not the common case */
+    if (!segment->is_stale)
+        return;
+
+    transition->status = STATUS_CLOSED;
+    closed(state, segment, transition);
+}
+
+/* handles a segment that doesn't start at the expected sequence number. One
+   from before it is added if it carries on past it, the max segment size
+   acting as a 'window size' here, and otherwise thrown away, returning
+   action in either case. One from after it is rejected to be queued */
+static enum segment_action out_of_order(
+    uint32_t expected,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition,
+    enum tcp_state_add add,
+    enum segment_action action)
+{
+    if (!TCP_SEQ_LT(segment->seq, expected))
+        return SEGMENT_REJECT;
+
+    if (tcp_segment_info_next(segment) > expected)
+        transition->add = add;
+
+    return action;
+}
@@ -0,0 +1,125 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _TCP_STATE_H_
+#define _TCP_STATE_H_
+
+#include <limits.h>
+#include <stdint.h>
+
+/* the TCP connection state machine used to build streams, as a table of
+   plain C transition functions indexed by the stream's status. A transition
+   only looks at a small descriptor of the segment and the sequence numbers
+   the stream expects next, and says what the stream should do with the
+   segment, so it can be run and checked without any Objective-C objects */
+
+#define TCP_SEQ_EQ(s1, s2) ((s1) == (s2))
+#define TCP_SEQ_GT(s1, s2)                                \
+    (((s1) > (s2) && (s1) - (s2) <= (UINT32_MAX / 2U)) || \
+     ((s2) > (s1) && (s2) - (s1) > (UINT32_MAX / 2U)))
+#define TCP_SEQ_LT(s1, s2) TCP_SEQ_GE(s2, s1)
+#define TCP_SEQ_GE(s1, s2) (TCP_SEQ_EQ(s1, s2) || TCP_SEQ_GT(s1, s2))
+#define TCP_SEQ_LE(s1, s2) (TCP_SEQ_EQ(s1, s2) || TCP_SEQ_LT(s1, s2))
+
+/* evaluates s1 - s2. pre-condition ==> TCP_SEQ_GT(s1, s2) == True */
+#define TCP_SEQNO_DIFF(s1, s2) \
+    ((s1) - (s2) <= (UINT32_MAX / 2U) ? (s1) - (s2) : ((s1) - (s2)) + UINT_MAX)
+
+enum segment_action
+{
+    SEGMENT_ACCEPT,
+    SEGMENT_REJECT,
+    SEGMENT_DISCARD
+};
+
+enum stream_status
+{
+    STATUS_UNINITIALISED,
+    STATUS_CLOSED,
+    STATUS_SYN_SENT,
+    STATUS_SIMULTANEOUS_OPEN,
+    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT,
+    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER,
+    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_CLIENT_2,
+    STATUS_SIMULTANEOUS_SYN_ACK_WAIT_SERVER_2,
+    STATUS_SYN_ACK_RECV,
+    STATUS_ESTABLISHED,
+    STATUS_FIN_WAIT_CLIENT_1,
+    STATUS_FIN_WAIT_SERVER_1,
+    STATUS_FIN_WAIT_CLIENT_2,
+    STATUS_FIN_WAIT_SERVER_2,
+    STATUS_CLOSING,
+    STATUS_ACK_WAIT_CLIENT, /* waiting for fin to be acked */
+    STATUS_ACK_WAIT_SERVER, /* waiting for fin to be acked */
+    STATUS_TIME_WAIT,
+    STATUS_SIMULTANEOUS_CLOSE,
+    STATUS_NELEMS
+};
+
+/* what a transition tells the stream to do with the segment, besides the
+   segment_action. Whichever side it's added to expects the segment's next
+   sequence number afterwards */
+enum tcp_state_add
+{
+    TCP_STATE_ADD_NONE,
+    TCP_STATE_ADD_CLIENT,
+    TCP_STATE_ADD_SERVER,
+    TCP_STATE_ADD_FIRST /* the first segment, whose sender is the client */
+};
+
+/* the parts of a segment the state machine looks at */
+struct tcp_segment_info
+{
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t len;      /* payload size according to the headers */
+    uint16_t window;   /* as advertised, without any scaling */
+    uint8_t flags;     /* TH_* bits */
+    uint8_t is_client; /* only looked at once the client is known */
+    uint8_t is_stale;  /* more than PPTCPSTREAM_MSL * 2 after the stream's last
+                          packet, only looked at in STATUS_TIME_WAIT */
+};
+
+/* the parts of a stream the state machine looks at */
+struct tcp_state
+{
+    enum stream_status status;
+    uint32_t c_seq_no; /* next sequence number expected from the client */
+    uint32_t s_seq_no; /* next sequence number expected from the server */
+    int has_server_segments;
+};
+
+struct tcp_transition
+{
+    enum segment_action action;
+    enum tcp_state_add add;
+    enum stream_status status; /* the stream's status afterwards */
+};
+
+/* works out what a stream in state does with segment */
+void tcp_state_transition(
+    const struct tcp_state* state,
+    const struct tcp_segment_info* segment,
+    struct tcp_transition* transition);
+
+/* sequence number expected after segment */
+uint32_t tcp_segment_info_next(const struct tcp_segment_info* segment);
+
+#endif
@@ -23,7 +23,6 @@
 #include "pkt_compare.h"
 #import <AppKit/NSAlert.h>
 #import <AppKit/NSDocument.h>
-#include <CoreFoundation/CFSocket.h>
 
 #define BPF_SMALLBUFSIZE  0x80
 #define BPF_MEDIUMBUFSIZE 0x400
@@ -31,6 +30,10 @@
 
 #define CAPTURE_FILE_LOADING_ARRAY_SZ 1024
 
+/* number of packets the filter thread runs the filter program over before
+   updating its progress and checking for cancellation */
+#define FILTER_THREAD_CHUNK_SZ 1024
+
 /* note that BS_HUGE is chosen as default,
    as the bpf device chooses the largest buffer
    itself if unspecified by the user */
@@ -61,37 +64,45 @@ typedef enum _bufsize bufsize;
 @class ObjectIO;
 @class Packet;
 @class PPTCPStreamController;
+@class PPFlowController;
 @class PPTCPStream;
 @class Interface;
 @class PPCaptureFilter;
 @class PPBPFProgram;
 @class PPStreamsWindowController;
+@class PPFlowsWindowController;
 @class PPArpSpoofingWindowController;
 @class ColumnIdentifier;
 @class HostCache;
+@class PPColumnStringCache;
 @class ErrorStack;
 
-struct thread_args;
+struct worker_args;
+struct ingest_args;
 
 @interface MyDocument : NSDocument
 {
     PacketCaptureWindowController* captureWindowController;
     PPStreamsWindowController* streamsWindowController;
+    PPFlowsWindowController* flowsWindowController;
     PPArpSpoofingWindowController* arpSpoofingWindowController;
     PPProgressWindowController* progressWindowController;
     ObjectIO* helperIO;
     PPTCPStreamController* streamController;
+    PPFlowController* flowController; /* UDP and ICMP flows */
     HostCache* hc;
+    PPColumnStringCache* columnStrings; /* packet table strings */
     NSMutableArray* packets;
     NSMutableArray* allPackets;
     NSTimer* timer;
     NSString* interface;
     ColumnIdentifier* sortColumn;
     PPBPFProgram* bpfProgram;
-    struct thread_args* thread_args;
+    struct worker_args* worker_args;
+    struct ingest_args* ingest_args; /* live capture ingest thread */
     size_t byteCount;
-    CFSocketRef sockref;
     unsigned long packetCount;
+    unsigned long long discardedCount; /* not forwarded by the helper */
     int sockfd;
     int linkType;
     BOOL live;         /* is the current document a live capture */
@@ -108,6 +119,7 @@ struct thread_args;
 - (void)workerThreadTimer;
 - (void)cancelWorkerThread;
 - (void)cancelCaptureFilterExecution;
+- (void)cancelPayloadSearch;
 - (void)cancelLoadingFile;
 - (void)closeProgressSheet;
 - (void)displayFileLoadingProgressSheet;
@@ -118,6 +130,7 @@ struct thread_args;
 - (void)displayIndividualWindow:(Packet*)aPacket;
 - (void)displayReassemblyWindowForPacket:(Packet*)aPacket;
 - (void)displayStreamsWindow;
+- (void)displayFlowsWindow;
 - (void)displayArpSpoofingWindow;
 
 - (PacketCaptureWindowController*)packetCaptureWindowController;
@@ -126,6 +139,7 @@ struct thread_args;
 - (int)linkType;
 - (void)setHostCache:(HostCache*)hostCache;
 - (HostCache*)hostCache;
+- (PPColumnStringCache*)columnStringCache;
 - (NSString*)interface;
 - (void)setInterface:(NSString*)anInterface;
 - (Packet*)packetAtIndex:(NSInteger)packetIndex;
@@ -148,6 +162,7 @@ struct thread_args;
 - (NSInteger)indexForPacket:(Packet*)packet;
 
 - (PPTCPStreamController*)tcpStreamController;
+- (PPFlowController*)flowController;
 
 - (void)displayErrorStack:(ErrorStack*)errorStack
                     close:(BOOL)closeDocument; // XXX perhaps move to PCWC
@@ -172,14 +187,23 @@ struct thread_args;
 - (void)flushHostnames;
 
 - (void)stopCapture;
+- (void)stopCaptureCollecting:(BOOL)collect; /* private method */
 
 - (void)updateControllerWithTimer:(NSTimer*)aTimer;
 - (void)endCaptureWithTimer:(NSTimer*)aTimer;
 - (void)cancelEndingConditions;
 
-- (void)readData;
+- (void)ingestWithTimer:(NSTimer*)aTimer;
+- (void)processIngestedPackets;
 - (void)clearFilterProgram:(BOOL)discardFilteredPackets;
 - (PPBPFProgram*)filterProgram;
+- (void)filterProgramDidChange;
+
+/* the number of packets captured but not received from the helper, because
+   they didn't match the display filter */
+- (unsigned long long)numberOfPacketsDiscarded;
+- (BOOL)isFiltered;
+- (void)searchPayloadsForString:(NSString*)searchString;
 - (void)setCaptureFilter:(PPCaptureFilter*)captureFilter;
 
 @end
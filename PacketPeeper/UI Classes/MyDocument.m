@@ -19,7 +19,6 @@
 
 #include "MyDocument.h"
 #include "../../Shared/Decoding/EthernetDecode.h"
-#include "../../Shared/Decoding/IPV4Decode.h"
 #include "../../Shared/Decoding/LoopbackDecode.h"
 #include "../../Shared/Decoding/PPPDecode.h"
 #include "../../Shared/Decoding/PPRVIDecode.h"
@@ -36,8 +35,11 @@
 #include "../Describe.h"
 #include "../Filters/PPBPFProgram.h"
 #include "../Filters/PPCaptureFilter.h"
+#include "../Filters/PPPayloadSearch.h"
 #include "../HostCache.hh"
 #include "../Interface.h"
+#include "../PPFlowController.h"
+#include "../PPTaskGroup.h"
 #include "../TCPStreams/PPTCPStream.h"
 #include "../TCPStreams/PPTCPStreamController.h"
 #include "../TCPStreams/PPTCPStreamReassembler.h"
@@ -46,6 +48,8 @@
 #include "MyDocumentController.h"
 #include "PPArpSpoofingWindowController.h"
 #include "PPCaptureFilterWindowController.h"
+#include "PPColumnStringCache.h"
+#include "PPFlowsWindowController.h"
 #include "PPPacketUIAdditions.h"
 #include "PPProgressWindowController.h"
 #include "PacketCaptureWindowController.h"
@@ -58,7 +62,6 @@
 #import <AppKit/NSPanel.h>
 #import <AppKit/NSWindowController.h>
 #import <AppKit/NSWindowRestoration.h>
-#include <CoreFoundation/CFSocket.h>
 #import <Foundation/NSArchiver.h>
 #import <Foundation/NSArray.h>
 #import <Foundation/NSAutoreleasePool.h>
@@ -77,44 +80,68 @@
 #import <Foundation/NSUserDefaults.h>
 #include <assert.h>
 #include <errno.h>
-#include <libkern/OSAtomic.h>
 #include <net/bpf.h>
 #include <pcap.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-static void socketCallBack(
-    CFSocketRef s,
-    CFSocketCallBackType callbackType,
-    CFDataRef address,
-    const void* data,
-    void* info);
-static void* read_from_url_thread(void* args);
-static void* filter_packets_thread(void* args);
-
-struct thread_args
+static void read_from_url_task(PPTaskGroup* group, struct worker_args* args);
+static void filter_packets_task(PPTaskGroup* group, struct worker_args* args);
+static void search_packets_task(PPTaskGroup* group, struct worker_args* args);
+static void worker_args_free(struct worker_args* args);
+static void* ingest_thread(void* args);
+static struct ingest_args* ingest_start(ObjectIO* io, int fd);
+static void ingest_stop(struct ingest_args* ingest);
+static void ingest_free(struct ingest_args* ingest);
+static void ingest_set_program(
+    struct ingest_args* ingest, PPBPFProgram* program);
+
+/* The document's one long running operation, as a task of group. The task
+   sets output and success, which the document reads once the group is
+   finished, and cancelling the group stops it */
+struct worker_args
 {
     enum
     {
-        THREAD_OP_DOC_READ,
-        THREAD_OP_DOC_FILTER
+        WORKER_OP_DOC_READ,
+        WORKER_OP_DOC_FILTER,
+        WORKER_OP_DOC_SEARCH
     } op;
+    PPTaskGroup* group;
     id input[3];
-    volatile id output[2];
+    id output[2];
     NSTimer* timer;
-    volatile int cancel;
-    volatile int failure;
-    volatile int success;
-    volatile unsigned long long units_current;
-    volatile unsigned long long units_total;
-    volatile size_t nbytes;
+    int success;
+    size_t nbytes;
+    volatile uint8_t* matched; /* search results, one per input[0] packet */
+};
+
+/* Packets received from the helper during a live capture are read, decoded
+   and run through the display filter on the ingest thread, then queued until
+   the main thread collects them at DEFAULT_UI_UPDATE_FREQUENCY. Everything
+   below lock is shared between the two threads. */
+struct ingest_args
+{
+    ObjectIO* io; /* owned by the document */
+    int fd;
+    int wakefd[2]; /* written to by ingest_stop */
     pthread_t thread_id;
+    pthread_mutex_t lock;
+    PPBPFProgram* program;   /* display filter, nil if none */
+    NSMutableArray* pending; /* packets not yet collected */
+    NSMutableData* accepted; /* BOOL per pending packet */
+    id error;                /* ErrorStack received from the helper */
+    unsigned int generation; /* incremented whenever program changes */
+    int stale;               /* program changed since pending was filtered */
+    int failure;
+    unsigned long long discarded; /* packets the helper didn't forward */
 };
 
 @implementation MyDocument
@@ -126,24 +153,28 @@ struct thread_args
         packets = [[NSMutableArray alloc] init];
         allPackets = nil;
         streamController = [[PPTCPStreamController alloc] init];
+        flowController = [[PPFlowController alloc] init];
         captureWindowController = nil;
         streamsWindowController = nil;
+        flowsWindowController = nil;
         progressWindowController = nil;
         helperIO = nil;
         timer = nil;
         hc = nil;
+        columnStrings = [[PPColumnStringCache alloc] init];
         interface = nil;
         sortColumn = nil; /* sort by packet number */
         bpfProgram = nil;
-        sockref = NULL;
         packetCount = 0;
         byteCount = 0;
+        discardedCount = 0;
         sockfd = -1;
         live = NO;
         reverseOrder = NO;
         endingTimer = nil;
         linkType = -1;
-        thread_args = NULL;
+        worker_args = NULL;
+        ingest_args = NULL;
     }
     return self;
 }
@@ -306,12 +337,12 @@ err:
 {
     NSString* errorString;
     NSDictionary* errDict;
-    int ret;
+    struct worker_args* args;
 
     if (outError != NULL)
         *outError = nil;
 
-    if (thread_args != NULL)
+    if (worker_args != NULL)
     {
         errorString = @"File loading or saving operation already in progress";
         goto err;
@@ -320,7 +351,7 @@ err:
     if (![typeName isEqualToString:@"tcpdump"] || ![absoluteURL isFileURL])
         return NO;
 
-    if ((thread_args = malloc(sizeof(struct thread_args))) == NULL)
+    if ((args = calloc(1, sizeof(struct worker_args))) == NULL)
     {
         errorString = [NSString
             stringWithFormat:@"Error: malloc failed: %s", strerror(errno)];
@@ -336,35 +367,27 @@ err:
     [hc release];
     hc = nil;
 
+    [columnStrings flush];
     [streamController flush];
+    [flowController flush];
+
+    args->op = WORKER_OP_DOC_READ;
+    args->group = [[PPTaskGroup alloc]
+        initWithPriority:PPTASKGROUP_PRIORITY_UI];
+    args->input[0] = [absoluteURL retain];
 
-    thread_args->op = THREAD_OP_DOC_READ;
-    thread_args->input[0] = [absoluteURL retain];
-    thread_args->input[1] = nil;
-    thread_args->input[2] = nil;
-    thread_args->output[0] = nil;
-    thread_args->output[1] = nil;
-    thread_args->cancel = 0;
-    thread_args->failure = 0;
-    thread_args->success = 0;
-    thread_args->units_current = 0;
-    thread_args->units_total = 0;
-
-    if ((ret = pthread_create(
-             &thread_args->thread_id,
-             NULL,
-             read_from_url_thread,
-             thread_args)) != 0)
+    if (![args->group addTask:^(PPTaskGroup* group) {
+            read_from_url_task(group, args);
+        }])
     {
-        errorString =
-            [NSString stringWithFormat:@"Error: failed to create thread: %s",
-                                       strerror(ret)];
-        [thread_args->input[0] release];
-        free(thread_args);
-        thread_args = NULL;
+        errorString = @"Error: failed to queue the file for loading";
+        [args->input[0] release];
+        worker_args_free(args);
         goto err;
     }
 
+    worker_args = args;
+
     [self makeWindowControllers];
     progressWindowController = [[PPProgressWindowController alloc]
         initWithLoadingMessage:@"Loading"
@@ -374,7 +397,7 @@ err:
                withObject:self
                afterDelay:0];
 
-    thread_args->timer = [[NSTimer
+    worker_args->timer = [[NSTimer
         scheduledTimerWithTimeInterval:DEFAULT_PROGRESSBAR_UPDATE_FREQUENCY
                                 target:self
                               selector:@selector(workerThreadTimer)
@@ -396,8 +419,8 @@ err:
 
 - (void)waitForWorkerThread
 {
-    /* we don't need to specify an expiry date because thread_args->timer will fire regularly */
-    while (thread_args != NULL)
+    /* we don't need to specify an expiry date because worker_args->timer will fire regularly */
+    while (worker_args != NULL)
         [NSApp nextEventMatchingMask:NSAnyEventMask
                            untilDate:nil
                               inMode:NSDefaultRunLoopMode
@@ -406,74 +429,68 @@ err:
 
 - (void)workerThreadTimer
 {
-    int ret;
+    double percentLoaded;
+    BOOL finished;
 
-    if (thread_args->units_total != 0)
-    {
-        const double percentLoaded =
-            thread_args->units_current / (double)thread_args->units_total;
+    finished = [worker_args->group isFinished];
+
+    if ((percentLoaded = [worker_args->group progress]) > 0.0)
         [progressWindowController setPercentLoaded:percentLoaded];
-    }
 
-    if (thread_args->success || thread_args->failure)
+    /* show matches as they're found, the search task only ever sets
+       entries of worker_args->matched */
+    if (worker_args->op == WORKER_OP_DOC_SEARCH && !finished)
     {
-        NSTimer* tempTimer;
-
-        tempTimer = thread_args->timer;
+        NSArray* searched;
+        NSUInteger i, count;
 
-        [thread_args->input[0] release];
-        [thread_args->input[1] release];
-        [thread_args->input[2] release];
+        searched = worker_args->input[0];
+        count = [searched count];
 
-        [self closeProgressSheet];
+        [packets removeAllObjects];
 
-        if ((ret = pthread_join(thread_args->thread_id, NULL)) != 0)
+        for (i = 0; i < count; ++i)
         {
-            NSString* errorString;
-            BOOL shouldClose;
+            if (worker_args->matched[i])
+                [packets addObject:[searched objectAtIndex:i]];
+        }
 
-            shouldClose = (thread_args->op == THREAD_OP_DOC_READ) ? YES : NO;
+        [self updateControllers];
+    }
 
-            errorString =
-                [NSString stringWithFormat:@"pthread_join(%p) failed",
-                                           (void*)thread_args->thread_id];
-            [[ErrorStack sharedErrorStack] pushError:errorString
-                                              lookup:[PosixError class]
-                                                code:ret
-                                            severity:ERRS_ERROR];
-            [thread_args->output[0] release];
-            [thread_args->output[1] release];
-            free(thread_args);
-            thread_args = NULL;
+    /* once the group is finished, the task's output can be read */
+    if (finished)
+    {
+        NSTimer* tempTimer;
 
-            [self displayErrorStack:nil close:shouldClose];
+        tempTimer = worker_args->timer;
 
-            [tempTimer invalidate];
-            [tempTimer release];
-            return;
-        }
+        [worker_args->input[0] release];
+        [worker_args->input[1] release];
+        [worker_args->input[2] release];
 
-        /* ensure thread_args->output is correct */
-        OSMemoryBarrier();
+        [self closeProgressSheet];
 
-        if (thread_args->success)
+        if (worker_args->success)
         {
             NSArray* windowControllers;
             NSWindowController* current;
             unsigned int i;
 
-            if (thread_args->op == THREAD_OP_DOC_READ)
+            if (worker_args->op == WORKER_OP_DOC_READ)
             {
                 [packets release];
-                packets = thread_args->output[0];
+                packets = worker_args->output[0];
 
                 [packets makeObjectsPerformSelector:@selector(setDocument:)
                                          withObject:self];
 
                 [streamController release];
-                streamController = thread_args->output[1];
+                streamController = worker_args->output[1];
+
+                [flowController addPacketArray:packets];
 
-                byteCount = thread_args->nbytes;
+                byteCount = worker_args->nbytes;
 
                 [streamsWindowController tableViewSelectionDidChange:nil];
                 [self updateControllers];
@@ -490,65 +507,74 @@ err:
                 [[captureWindowController window] makeKeyAndOrderFront:self];
                 [captureWindowController selectPacketAtIndex:0];
             }
-            else if (thread_args->op == THREAD_OP_DOC_FILTER)
+            else if (worker_args->op == WORKER_OP_DOC_FILTER)
             {
                 if (allPackets == nil)
                     allPackets = packets;
                 else
                     [packets release];
 
-                packets = thread_args->output[0];
-                streamController = thread_args->output[1];
+                packets = worker_args->output[0];
+                streamController = worker_args->output[1];
+                [streamController setAgesStreams:live];
+
+                [flowController flush];
+                [flowController addPacketArray:packets];
 
                 [streamsWindowController tableViewSelectionDidChange:nil];
                 [self updateControllers];
             }
+            else if (worker_args->op == WORKER_OP_DOC_SEARCH)
+            {
+                [packets release];
+                packets = worker_args->output[0];
 
-            free(thread_args);
-            thread_args = NULL;
+                [self updateControllers];
+            }
+
+            worker_args_free(worker_args);
+            worker_args = NULL;
             /* the timer needs to be released last, because it could be the last thing
 			   retaining the document; dealloc calls cancelWorkerThread, which would lead
 			   to a double free */
             [tempTimer invalidate];
             [tempTimer release];
         }
-        else if (thread_args->failure)
+        else
         {
-            if (thread_args->op == THREAD_OP_DOC_READ)
+            if (worker_args->op == WORKER_OP_DOC_READ)
             {
                 [[captureWindowController window] makeKeyAndOrderFront:self];
                 [[ErrorStack sharedErrorStack]
                     pushError:[NSString stringWithFormat:
                                             @"Loading capture file failed: %@",
-                                            thread_args->output[0]]
+                                            worker_args->output[0]]
                        lookup:Nil
                          code:0
                      severity:ERRS_ERROR];
                 [self displayErrorStack:nil close:YES];
             }
-            else if (thread_args->op == THREAD_OP_DOC_FILTER)
+            else if (worker_args->op == WORKER_OP_DOC_FILTER)
             {
-                unsigned int i;
-
                 /* restore released stream controller */
                 streamController = [[PPTCPStreamController alloc] init];
-                for (i = 0; i < [packets count]; ++i)
-                    [streamController addPacket:[packets objectAtIndex:i]];
+                [streamController setAgesStreams:live];
+                [streamController addPacketArray:packets];
 
                 [[ErrorStack sharedErrorStack]
                     pushError:[NSString stringWithFormat:
                                             @"Failed to apply filter: %@",
-                                            thread_args->output[0]]
+                                            worker_args->output[0]]
                        lookup:Nil
                          code:0
                      severity:ERRS_ERROR];
                 [self displayErrorStack:nil close:NO];
             }
 
-            [thread_args->output[0] release];
-            [thread_args->output[1] release];
-            free(thread_args);
-            thread_args = NULL;
+            [worker_args->output[0] release];
+            [worker_args->output[1] release];
+            worker_args_free(worker_args);
+            worker_args = NULL;
             [tempTimer invalidate];
             [tempTimer release];
         }
@@ -557,60 +583,57 @@ err:
 
 - (void)cancelWorkerThread
 {
-    int ret;
-    void* output;
-
-    if (thread_args == NULL)
+    if (worker_args == NULL)
         return;
 
-    [thread_args->timer invalidate];
-    [thread_args->timer release];
-    [thread_args->input[0] release];
-    [thread_args->input[1] release];
-    [thread_args->input[2] release];
+    [worker_args->timer invalidate];
+    [worker_args->timer release];
 
-    thread_args->cancel = 1;
+    /* the task returns early, or is skipped if it hadn't started, and has
+       to be done with the inputs before they're released */
+    [worker_args->group cancel];
+    [worker_args->group wait];
 
-    if ((ret = pthread_join(thread_args->thread_id, &output)) != 0)
-    {
-        NSString* errorString;
-        BOOL shouldClose;
+    [worker_args->input[0] release];
+    [worker_args->input[1] release];
+    [worker_args->input[2] release];
 
-        shouldClose = (thread_args->op == THREAD_OP_DOC_READ) ? YES : NO;
+    /* account for the task finishing by its own volition */
+    [worker_args->output[0] release];
+    [worker_args->output[1] release];
 
-        errorString = [NSString stringWithFormat:@"pthread_join(%p) failed",
-                                                 (void*)thread_args->thread_id];
-        [[ErrorStack sharedErrorStack] pushError:errorString
-                                          lookup:[PosixError class]
-                                            code:ret
-                                        severity:ERRS_ERROR];
-        [thread_args->output[0] autorelease];
-        [thread_args->output[1] autorelease];
-        free(thread_args);
-        thread_args = NULL;
-        [self displayErrorStack:nil close:shouldClose];
-        return;
-    }
-
-    /* account for thread exiting by its own volition */
-    if (output != NULL)
-        [(NSObject*)output release];
-
-    free(thread_args);
-    thread_args = NULL;
+    worker_args_free(worker_args);
+    worker_args = NULL;
 }
 
 - (void)cancelCaptureFilterExecution
 {
-    unsigned int i;
-
     [self closeProgressSheet];
     [self cancelWorkerThread];
 
     /* restore released stream controller */
     streamController = [[PPTCPStreamController alloc] init];
-    for (i = 0; i < [packets count]; ++i)
-        [streamController addPacket:[packets objectAtIndex:i]];
+    [streamController setAgesStreams:live];
+    [streamController addPacketArray:packets];
+}
+
+- (void)cancelPayloadSearch
+{
+    NSArray* searched;
+
+    [self closeProgressSheet];
+
+    if (worker_args == NULL)
+        return;
+
+    searched = [worker_args->input[0] retain];
+    [self cancelWorkerThread];
+
+    /* undo any partial results */
+    [packets setArray:searched];
+    [searched release];
+
+    [self updateControllers];
 }
 
 - (void)cancelLoadingFile
@@ -732,8 +755,7 @@ err:
     NSArray* controllersArray;
     unsigned int i;
 
-    if (aPacket == nil || [aPacket decoderForClass:[IPV4Decode class]] == nil ||
-        [aPacket decoderForClass:[TCPDecode class]] == nil)
+    if (aPacket == nil || [aPacket decoderForClass:[TCPDecode class]] == nil)
         return;
 
     controllersArray = [self windowControllers];
@@ -772,6 +794,17 @@ err:
     [streamsWindowController showWindow:self];
 }
 
+- (void)displayFlowsWindow
+{
+    if (flowsWindowController == nil)
+    {
+        flowsWindowController = [[PPFlowsWindowController alloc] init];
+        [self addWindowController:flowsWindowController];
+    }
+
+    [flowsWindowController showWindow:self];
+}
+
 - (void)displayArpSpoofingWindow
 {
     if (arpSpoofingWindowController == nil)
@@ -788,6 +821,9 @@ err:
     if ([windowController isMemberOfClass:[PPStreamsWindowController class]])
         streamsWindowController = nil;
 
+    if ([windowController isMemberOfClass:[PPFlowsWindowController class]])
+        flowsWindowController = nil;
+
     [super removeWindowController:windowController];
 }
 
@@ -806,6 +842,7 @@ err:
     [hostCache retain];
     [hc release];
     hc = hostCache;
+    [columnStrings invalidate];
 }
 
 - (HostCache*)hostCache
@@ -816,6 +853,11 @@ err:
     return hc;
 }
 
+- (PPColumnStringCache*)columnStringCache
+{
+    return columnStrings;
+}
+
 - (NSString*)interface
 {
     return interface;
@@ -858,6 +900,7 @@ err:
 {
     [captureWindowController update:NO];
     [streamsWindowController update:NO];
+    [flowsWindowController update];
 }
 
 - (void)addPacketArray:(NSArray*)packetArray
@@ -870,6 +913,7 @@ err:
         packet = [packetArray objectAtIndex:i];
         [packets addObject:packet];
         [streamController addPacket:packet];
+        [flowController addPacket:packet];
         [packet setNumber:++packetCount];
         [packet setDocument:self];
         byteCount += [packet captureLength];
@@ -885,6 +929,7 @@ err:
 {
     [packets addObject:packet];
     [streamController addPacket:packet];
+    [flowController addPacket:packet];
     [packet setNumber:++packetCount];
     [packet setDocument:self];
     byteCount += [packet captureLength];
@@ -899,8 +944,11 @@ err:
     if (packetIndex >= 0 && (NSUInteger)packetIndex < [packets count])
     {
         [streamController removePacket:[packets objectAtIndex:packetIndex]];
+        [flowController removePacket:[packets objectAtIndex:packetIndex]];
         byteCount -= [[packets objectAtIndex:packetIndex] captureLength];
         [packets removeObjectAtIndex:packetIndex];
+        /* the cache would keep the deleted packet alive */
+        [columnStrings flush];
         [self updateChangeCount:NSChangeDone];
     }
 }
@@ -911,7 +959,8 @@ err:
     [self deletePacketAtIndex:[self indexForPacket:packet]];
 }
 
-/* Note: does *NOT* update the documents streamController */
+/* Note: does *NOT* update the documents streamController, though it does
+   update its flowController */
 - (void)purgePacketsPendingDeletionWithHint:(size_t)count
 {
     Packet* packet;
@@ -925,6 +974,7 @@ err:
 
         if ([packet isPendingDeletion])
         {
+            [flowController removePacket:packet];
             [packets removeObjectAtIndex:i];
             byteCount -= [[packets objectAtIndex:i] captureLength];
             --count;
@@ -933,6 +983,8 @@ err:
             ++i;
     }
 
+    /* the cache would keep the purged packets alive */
+    [columnStrings flush];
     [self updateChangeCount:NSChangeDone];
 }
 
@@ -1075,6 +1127,11 @@ err:
     return streamController;
 }
 
+- (PPFlowController*)flowController
+{
+    return flowController;
+}
+
 /* display an error as a sheet and optionally close the document */
 - (void)displayErrorStack:(ErrorStack*)errorStack close:(BOOL)closeDocument
 {
@@ -1122,8 +1179,6 @@ err:
                 filter:(PPCaptureFilter*)filter
 {
     MsgSettings* settings;
-    CFSocketContext context;
-    CFRunLoopSourceRef source;
     unsigned int real_buflen;
 
     endingPackets = numberOfPackets;
@@ -1184,42 +1239,23 @@ err:
     if ([helperIO write:settings] == -1)
         goto err;
 
-    context.version = 0;
-    context.info = self;
-    context.retain = NULL;
-    context.release = NULL;
-    context.copyDescription = NULL;
-
-    if ((sockref = CFSocketCreateWithNative(
-             kCFAllocatorDefault,
-             sockfd,
-             kCFSocketReadCallBack,
-             socketCallBack,
-             &context)) == NULL)
-    {
-        [[ErrorStack sharedErrorStack]
-            pushError:@"Call to CFSocketCreateWithNative failed"
-               lookup:Nil
-                 code:0
-             severity:ERRS_ERROR];
+    if ((ingest_args = ingest_start(helperIO, sockfd)) == NULL)
         goto err;
-    }
 
-    if ((source = CFSocketCreateRunLoopSource(
-             kCFAllocatorDefault, sockref, 0)) == NULL)
-    {
-        [[ErrorStack sharedErrorStack]
-            pushError:@"Call to CFSocketCreateRunLoopSource failed"
-               lookup:Nil
-                 code:0
-             severity:ERRS_ERROR];
-        goto err;
-    }
+    [self filterProgramDidChange];
 
-    CFRunLoopAddSource(CFRunLoopGetCurrent(), source, kCFRunLoopDefaultMode);
+    timer = [[NSTimer
+        scheduledTimerWithTimeInterval:DEFAULT_UI_UPDATE_FREQUENCY
+                                target:self
+                              selector:@selector(ingestWithTimer:)
+                              userInfo:nil
+                               repeats:YES] retain];
 
     live = YES;
     linkType = [anInterface linkType];
+    /* a long capture would otherwise keep every stream it has seen */
+    [streamController setAgesStreams:YES];
+    [flowController setExpiresFlows:YES];
     [settings release];
     [captureWindowController synchronizeWindowTitleWithDocumentName];
     [captureWindowController update:NO];
@@ -1237,20 +1273,39 @@ err:
     if (hc != nil)
     {
         [hc flush];
+        [columnStrings invalidate];
         [self updateChangeCount:NSChangeDone];
     }
 }
 
 - (void)stopCapture
+{
+    [self stopCaptureCollecting:YES];
+}
+
+/* packets the ingest thread has queued are added to the document if collect
+   is YES, and dropped otherwise */
+- (void)stopCaptureCollecting:(BOOL)collect
 {
     if (live)
     {
-        if (sockref != NULL)
+        live = NO;
+        [streamController setAgesStreams:NO];
+        [flowController setExpiresFlows:NO];
+        if (timer != nil)
         {
-            /* invalidating the socket also invalidates the run loop source, so the callback is disabled */
-            CFSocketInvalidate(sockref);
-            CFRelease(sockref);
-            sockref = NULL;
+            [timer invalidate];
+            [timer release];
+            timer = nil;
+        }
+        if (ingest_args != NULL)
+        {
+            /* collect anything received before the ingest thread stopped */
+            ingest_stop(ingest_args);
+            if (collect)
+                [self processIngestedPackets];
+            ingest_free(ingest_args);
+            ingest_args = NULL;
         }
         if (helperIO != nil)
         {
@@ -1263,7 +1318,6 @@ err:
             (void)close(sockfd);
             sockfd = -1;
         }
-        live = NO;
         [captureWindowController update:NO];
         [captureWindowController cancelEndingButtonSetHidden:YES];
         [self cancelEndingConditions];
@@ -1274,6 +1328,7 @@ err:
 {
     [captureWindowController updateWithUserScrolling];
     [streamsWindowController updateWithUserScrolling];
+    [flowsWindowController update];
 }
 
 - (void)endCaptureWithTimer:(NSTimer*)aTimer
@@ -1291,84 +1346,119 @@ err:
     endingBytes = 0;
 }
 
-- (void)readData
+- (void)ingestWithTimer:(NSTimer*)aTimer
+{
+    [self processIngestedPackets];
+}
+
+- (void)processIngestedPackets
 {
-    id obj;
+    NSMutableArray* received;
+    NSMutableData* accepted;
+    const BOOL* results;
+    id error;
+    unsigned long long discarded;
+    NSUInteger i, count;
+    BOOL failed, stale, stop;
+
+    if (ingest_args == NULL)
+        return;
 
-    do
+    pthread_mutex_lock(&ingest_args->lock);
+    received = ingest_args->pending;
+    accepted = ingest_args->accepted;
+    ingest_args->pending = [[NSMutableArray alloc] init];
+    ingest_args->accepted = [[NSMutableData alloc] init];
+    stale = ingest_args->stale ? YES : NO;
+    ingest_args->stale = 0;
+    failed = ingest_args->failure ? YES : NO;
+    ingest_args->failure = 0;
+    error = ingest_args->error;
+    ingest_args->error = nil;
+    discarded = ingest_args->discarded;
+    pthread_mutex_unlock(&ingest_args->lock);
+
+    count = [received count];
+
+    /* the display filter was changed after these packets were filtered */
+    if (stale && count > 0 && bpfProgram != nil)
+        [Packet runFilterProgram:bpfProgram
+                       onPackets:received
+                           range:NSMakeRange(0, count)
+                         results:[accepted mutableBytes]];
+
+    results = [accepted bytes];
+    stop = NO;
+
+    for (i = 0; i < count && !stop; ++i)
     {
-        if ((obj = [helperIO read]) == nil)
-            goto err;
+        Packet* packet;
 
-        if ([obj isMemberOfClass:[Packet class]])
-        {
-            [(Packet*)obj setNumber:++packetCount];
-            [(Packet*)obj setDocument:self];
+        packet = [received objectAtIndex:i];
+        [packet setNumber:++packetCount];
+        [packet setDocument:self];
 
-            [allPackets addObject:obj];
+        [allPackets addObject:packet];
 
-            if (bpfProgram == nil || [(Packet*)obj runFilterProgram:bpfProgram])
-            {
-                [packets addObject:obj];
-                byteCount += [(Packet*)obj captureLength];
-            }
+        if (bpfProgram == nil || results[i])
+        {
+            [packets addObject:packet];
+            byteCount += [packet captureLength];
+        }
 
-            [streamController addPacket:obj];
+        [streamController addPacket:packet];
+        [flowController addPacket:packet];
 
-            if (endingBytes > 0)
-            {
-                if (endingBytes <= [obj actualLength])
-                {
-                    endingBytes = 0;
-                    if (!endingMatchAll ||
-                        (endingPackets == 0 && endingTimer != nil))
-                        [self stopCapture];
-                }
-                else
-                    endingBytes -= [obj actualLength];
-            }
-            if (endingPackets > 0 && packetCount >= endingPackets)
+        if (endingBytes > 0)
+        {
+            if (endingBytes <= [packet actualLength])
             {
-                if (!endingMatchAll || (endingBytes == 0 && endingTimer != nil))
-                    [self stopCapture];
+                endingBytes = 0;
+                if (!endingMatchAll ||
+                    (endingPackets == 0 && endingTimer != nil))
+                    stop = YES;
             }
+            else
+                endingBytes -= [packet actualLength];
         }
-        else
+        if (endingPackets > 0 && packetCount >= endingPackets)
         {
-            /* if we got some unknown object, push an error */
-            if (![obj isMemberOfClass:[ErrorStack class]])
-            {
-                [[ErrorStack sharedErrorStack]
-                    pushError:@"Received unknown object from helper tool"
-                       lookup:Nil
-                         code:0
-                     severity:ERRS_ERROR];
-                obj = nil;
-            }
-            goto err;
+            if (!endingMatchAll || (endingBytes == 0 && endingTimer != nil))
+                stop = YES;
         }
-    } while ([helperIO moreAvailable]);
+    }
 
-    if (timer == nil || ![timer isValid])
+    [received release];
+    [accepted release];
+
+    if (discarded != discardedCount)
     {
-        [timer release];
-        timer = [[NSTimer
-            scheduledTimerWithTimeInterval:DEFAULT_UI_UPDATE_FREQUENCY
-                                    target:self
-                                  selector:@selector(updateControllerWithTimer:)
-                                  userInfo:nil
-                                   repeats:NO] retain];
+        discardedCount = discarded;
+        if (count == 0)
+            [captureWindowController updateWithUserScrolling];
     }
 
-    [self updateChangeCount:NSChangeDone];
-    return;
+    if (count > 0)
+    {
+        [self updateControllerWithTimer:nil];
+        [self updateChangeCount:NSChangeDone];
+    }
 
-err:
-    [self stopCapture];
-    [self displayErrorStack:obj
-                      close:([packets count] == 0)
-                                ? YES
-                                : NO]; /* close if no packets received */
+    if (failed)
+    {
+        [self stopCapture];
+        [self displayErrorStack:error
+                          close:([packets count] == 0)
+                                    ? YES
+                                    : NO]; /* close if no packets received */
+        [error release];
+        return;
+    }
+
+    /* packets received after the ending condition was met are dropped,
+       including any the ingest thread queues before it has stopped */
+    if (stop)
+        [self stopCaptureCollecting:NO];
 }
 
 - (void)clearFilterProgram:(BOOL)discardFilteredPackets
@@ -1382,6 +1472,13 @@ err:
 
             [bpfProgram release];
             bpfProgram = nil;
+            [self filterProgramDidChange];
+
+            /* a payload search leaves the streams of every packet in place */
+            [streamController flush];
+            [streamController addPacketArray:packets];
+            [flowController flush];
+            [flowController addPacketArray:packets];
 
             [self updateChangeCount:NSChangeDone];
         }
@@ -1393,9 +1490,12 @@ err:
 
             [bpfProgram release];
             bpfProgram = nil;
+            [self filterProgramDidChange];
 
             [streamController flush];
             [streamController addPacketArray:packets];
+            [flowController flush];
+            [flowController addPacketArray:packets];
 
             [self updateControllers];
         }
@@ -1407,14 +1507,148 @@ err:
     return bpfProgram;
 }
 
+/* passes bpfProgram on to the ingest thread and, so that packets it rejects
+   aren't sent at all, to the helper */
+- (void)filterProgramDidChange
+{
+    MsgDisplayFilter* msg;
+
+    ingest_set_program(ingest_args, bpfProgram);
+
+    if (helperIO == nil)
+        return;
+
+    msg = [[MsgDisplayFilter alloc] initWithFilterProgram:bpfProgram];
+    (void)[helperIO write:msg]; /* the ingest thread sees any failure */
+    [msg release];
+}
+
+- (unsigned long long)numberOfPacketsDiscarded
+{
+    return discardedCount;
+}
+
+- (BOOL)isFiltered
+{
+    return (allPackets != nil);
+}
+
+- (void)searchPayloadsForString:(NSString*)searchString
+{
+    PPPayloadSearch* search;
+    NSMutableArray* streams;
+    struct worker_args* args;
+    size_t i, count;
+
+    if (live)
+    {
+        [[ErrorStack sharedErrorStack]
+            pushError:@"Packets can't be searched during a live capture"
+               lookup:Nil
+                 code:0
+             severity:ERRS_ERROR];
+        goto err;
+    }
+
+    if (worker_args != NULL)
+    {
+        [[ErrorStack sharedErrorStack]
+            pushError:@"File loading or saving operation already in progress"
+               lookup:Nil
+                 code:0
+             severity:ERRS_ERROR];
+        goto err;
+    }
+
+    if ((count = [packets count]) < 1)
+        return;
+
+    if ((search = [[PPPayloadSearch alloc] initWithString:searchString]) == nil)
+        goto err;
+
+    if ((args = calloc(1, sizeof(struct worker_args))) == NULL)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to allocate memory"
+                                          lookup:[PosixError class]
+                                            code:errno
+                                        severity:ERRS_ERROR];
+        [search release];
+        goto err;
+    }
+
+    if ((args->matched = calloc(count, sizeof(uint8_t))) == NULL)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to allocate memory"
+                                          lookup:[PosixError class]
+                                            code:errno
+                                        severity:ERRS_ERROR];
+        worker_args_free(args);
+        [search release];
+        goto err;
+    }
+
+    /* searching narrows the current view, like a filter, so that clearing the
+       filter brings every packet back */
+    if (allPackets == nil)
+        allPackets = [[NSMutableArray alloc] initWithArray:packets];
+
+    /* the stream controller isn't modified while the search runs, as the
+       document is busy, so the streams can be shared with the search task */
+    streams = [[NSMutableArray alloc]
+        initWithCapacity:[streamController numberOfStreams]];
+
+    for (i = 0; i < [streamController numberOfStreams]; ++i)
+        [streams addObject:[streamController streamAtIndex:i]];
+
+    args->op = WORKER_OP_DOC_SEARCH;
+    args->group = [[PPTaskGroup alloc]
+        initWithPriority:PPTASKGROUP_PRIORITY_UI];
+    args->input[0] = [[NSArray alloc] initWithArray:packets];
+    args->input[1] = search;
+    args->input[2] = streams;
+    [args->group setProgressTotal:count + [streams count]];
+
+    if (![args->group addTask:^(PPTaskGroup* group) {
+            search_packets_task(group, args);
+        }])
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to queue the search"
+                                          lookup:Nil
+                                            code:0
+                                        severity:ERRS_ERROR];
+        [args->input[0] release];
+        [args->input[1] release];
+        [args->input[2] release];
+        worker_args_free(args);
+        goto err;
+    }
+
+    worker_args = args;
+
+    [self displayProgressSheetWithMessage:@"Searching"
+                           cancelSelector:@selector(cancelPayloadSearch)];
+
+    worker_args->timer = [[NSTimer
+        scheduledTimerWithTimeInterval:DEFAULT_PROGRESSBAR_UPDATE_FREQUENCY
+                                target:self
+                              selector:@selector(workerThreadTimer)
+                              userInfo:nil
+                               repeats:YES] retain];
+
+    return;
+
+err:
+    [self displayErrorStack:nil close:NO];
+}
+
 - (void)setCaptureFilter:(PPCaptureFilter*)captureFilter
 {
-    int ret;
+    struct worker_args* args;
 
     if (captureFilter == nil)
         return;
 
-    if (thread_args != NULL)
+    if (worker_args != NULL)
     {
         [[ErrorStack sharedErrorStack]
             pushError:@"File loading or saving operation already in progress"
@@ -1430,7 +1664,7 @@ err:
     if (!live && [allPackets count] < 1)
         return;
 
-    if ((thread_args = malloc(sizeof(struct thread_args))) == NULL)
+    if ((args = calloc(1, sizeof(struct worker_args))) == NULL)
     {
         [[ErrorStack sharedErrorStack] pushError:@"Failed to allocate memory"
                                           lookup:[PosixError class]
@@ -1442,6 +1676,7 @@ err:
     [bpfProgram release];
     bpfProgram =
         [[captureFilter filterProgramForLinkType:[self linkType]] retain];
+    [self filterProgramDidChange];
 
     /* due to back pointers in TCPDecode->PPTCPStream, we can't maintain two stream controllers, because
 	   when the first one is released the back pointers will be incorrectly cleared, or if the user cancels */
@@ -1452,38 +1687,37 @@ err:
                            cancelSelector:@selector
                            (cancelCaptureFilterExecution)];
 
-    thread_args->op = THREAD_OP_DOC_FILTER;
-    thread_args->input[0] = [[NSArray alloc] initWithArray:allPackets];
-    thread_args->input[1] = [bpfProgram
+    args->op = WORKER_OP_DOC_FILTER;
+    args->group = [[PPTaskGroup alloc]
+        initWithPriority:PPTASKGROUP_PRIORITY_UI];
+    args->input[0] = [[NSArray alloc] initWithArray:allPackets];
+    args->input[1] = [bpfProgram
         retain]; /* this is kind of lame, as we've already retained above, but
 													it allows workerThreadTimer to be generic (in that it releases
-													thread inputs after the thread is done) */
-    thread_args->input[2] = nil;
-    thread_args->output[0] = nil;
-    thread_args->output[1] = nil;
-    thread_args->cancel = 0;
-    thread_args->failure = 0;
-    thread_args->success = 0;
-    thread_args->units_current = 0;
-    thread_args->units_total = 0;
-
-    if ((ret = pthread_create(
-             &thread_args->thread_id,
-             NULL,
-             filter_packets_thread,
-             thread_args)) != 0)
+													task inputs after the task is done) */
+
+    if (![args->group addTask:^(PPTaskGroup* group) {
+            filter_packets_task(group, args);
+        }])
     {
-        [[ErrorStack sharedErrorStack] pushError:@"Failed to create thread"
-                                          lookup:[PosixError class]
-                                            code:ret
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to queue the filter"
+                                          lookup:Nil
+                                            code:0
                                         severity:ERRS_ERROR];
-        [thread_args->input[0] release];
-        [thread_args->input[1] release];
-        free(thread_args);
-        thread_args = NULL;
+        [args->input[0] release];
+        [args->input[1] release];
+        worker_args_free(args);
+
+        /* restore released stream controller */
+        streamController = [[PPTCPStreamController alloc] init];
+        [streamController setAgesStreams:live];
+        [streamController addPacketArray:packets];
+        goto err;
     }
 
-    thread_args->timer = [[NSTimer
+    worker_args = args;
+
+    worker_args->timer = [[NSTimer
         scheduledTimerWithTimeInterval:DEFAULT_PROGRESSBAR_UPDATE_FREQUENCY
                                 target:self
                               selector:@selector(workerThreadTimer)
@@ -1497,6 +1731,17 @@ err:
     [self displayErrorStack:nil close:NO];
 }
 
+- (void)close
+{
+    /* the ingest timer retains the document, so stop it here rather than in
+       dealloc, and so does the worker timer, so the document's work is
+       cancelled here too rather than left running for a closed window */
+    [self closeProgressSheet];
+    [self cancelWorkerThread];
+    [self stopCapture];
+    [super close];
+}
+
 - (void)dealloc
 {
     [timer release];
@@ -1507,36 +1752,27 @@ err:
     [progressWindowController release];
     [captureWindowController release];
     [streamsWindowController release];
+    [flowsWindowController release];
     [helperIO release];
     [streamController release];
+    [flowController release];
     [allPackets release];
     [packets release];
     [hc release];
+    [columnStrings release];
     [interface release];
     [super dealloc];
 }
 
 @end
 
-static void socketCallBack(
-    CFSocketRef s,
-    CFSocketCallBackType callbackType,
-    CFDataRef address,
-    const void* data,
-    void* info)
+static void read_from_url_task(PPTaskGroup* group, struct worker_args* args)
 {
-    [(MyDocument*)info readData];
-}
-
-static void* read_from_url_thread(void* args)
-{
-    NSAutoreleasePool* autoreleasePool;
     NSMutableArray* packetArray;
     PPTCPStreamController* streamController;
     pcap_t* pcap;
     const uint8_t* bytes;
     struct pcap_pkthdr* hdr;
-    struct thread_args* thread_args;
     FILE* fp;
     Class linkType;
     size_t nbytes;
@@ -1547,32 +1783,27 @@ static void* read_from_url_thread(void* args)
     int ret;
 
     pcap = NULL;
-    thread_args = args;
 
-    autoreleasePool = [[NSAutoreleasePool alloc] init];
     packetArray = [[NSMutableArray alloc] init];
     streamController = [[PPTCPStreamController alloc] init];
 
     if ((pcap = pcap_open_offline(
-             [[(NSURL*)thread_args->input[0] path] UTF8String], errbuf)) ==
-        NULL)
+             [[(NSURL*)args->input[0] path] UTF8String], errbuf)) == NULL)
     {
-        thread_args->output[0] = [[NSString alloc] initWithUTF8String:errbuf];
+        args->output[0] = [[NSString alloc] initWithUTF8String:errbuf];
         goto err;
     }
 
     if ((linkType = dlt_lookup(pcap_datalink(pcap))) == Nil)
     {
-        thread_args->output[0] = @"Unsupported link-layer";
+        args->output[0] = @"Unsupported link-layer";
         goto err;
     }
 
     if ((fp = pcap_file(pcap)) != NULL && (fd = fileno(fp)) != -1 &&
         fstat(fd, &sb) == 0)
-        thread_args->units_total = sb.st_size - sizeof(struct pcap_file_header);
+        [group setProgressTotal:sb.st_size - sizeof(struct pcap_file_header)];
 
-    thread_args->output[0] = nil;
-    thread_args->output[1] = nil;
     nbytes = 0;
 
     for (packet_number = 1; (ret = pcap_next_ex(pcap, &hdr, &bytes)) == 1;
@@ -1592,15 +1823,14 @@ static void* read_from_url_thread(void* args)
         nbytes += [packet captureLength];
 
         [packetArray addObject:packet];
-        [streamController addPacket:packet];
 
         [packet release];
         [data release];
 
-        thread_args->units_current += hdr->caplen + sizeof(struct pcap_pkthdr);
+        PPTaskGroupAddProgress(group, hdr->caplen + sizeof(struct pcap_pkthdr));
 
         /* user cancelled file loading */
-        if (thread_args->cancel != 0)
+        if (PPTaskGroupIsCancelled(group))
         {
             [packetArray release];
             [streamController release];
@@ -1610,74 +1840,87 @@ static void* read_from_url_thread(void* args)
 
     if (ret != -2 && packet_number == 1)
     {
-        thread_args->output[0] = @"Error reading packet";
+        args->output[0] = @"Error reading packet";
         goto err;
     }
 
-    /* the document is responsible for releasing thread_args->output */
-    thread_args->output[0] = packetArray;
-    thread_args->output[1] = streamController;
-    thread_args->nbytes = nbytes;
+    /* streams are built once every packet is read, so that they can be
+       built in parallel */
+    [streamController addPacketArray:packetArray group:group];
 
-    OSMemoryBarrier();
-    thread_args->success = 1;
+    if (PPTaskGroupIsCancelled(group))
+    {
+        [packetArray release];
+        [streamController release];
+        goto cleanup;
+    }
+
+    /* the document is responsible for releasing args->output */
+    args->output[0] = packetArray;
+    args->output[1] = streamController;
+    args->nbytes = nbytes;
+    args->success = 1;
 
 cleanup:
-    [autoreleasePool release];
     pcap_close(pcap);
-
-    return thread_args->output[0];
+    return;
 
 err:
     [packetArray release];
     [streamController release];
-    [autoreleasePool release];
 
     if (pcap != NULL)
         pcap_close(pcap);
 
-    /* the document is responsible for releasing thread_args->output */
-
-    OSMemoryBarrier();
-    thread_args->failure = 1;
-
-    return thread_args->output[0];
+    /* the document is responsible for releasing args->output */
 }
 
-static void* filter_packets_thread(void* args)
+static void filter_packets_task(PPTaskGroup* group, struct worker_args* args)
 {
-    NSAutoreleasePool* autoreleasePool;
     NSMutableArray* filteredPackets;
     NSArray* tempPackets;
     PPTCPStreamController* streamController;
-    struct thread_args* thread_args;
+    BOOL results[FILTER_THREAD_CHUNK_SZ];
+    NSUInteger done, total;
     unsigned int i;
 
-    thread_args = args;
-
-    autoreleasePool = [[NSAutoreleasePool alloc] init];
     filteredPackets = [[NSMutableArray alloc] init];
 
-    thread_args->units_total = [(NSArray*)thread_args->input[0] count];
-    thread_args->output[0] = nil;
-    thread_args->output[1] = nil;
+    total = [(NSArray*)args->input[0] count];
+    [group setProgressTotal:total];
 
-    for (thread_args->units_current = 0;
-         thread_args->units_current < thread_args->units_total;
-         ++thread_args->units_current)
+    /* packets are filtered a chunk at a time, so that simple programs can
+       be evaluated over many packets at once */
+    for (done = 0; done < total;)
     {
-        Packet* packet;
+        NSRange range;
+
+        range.location = done;
+        range.length = total - range.location;
 
-        packet = [(NSArray*)thread_args->input[0]
-            objectAtIndex:thread_args->units_current];
+        if (range.length > FILTER_THREAD_CHUNK_SZ)
+            range.length = FILTER_THREAD_CHUNK_SZ;
 
-        if ([packet runFilterProgram:(PPBPFProgram*)thread_args->input[1]])
-            [filteredPackets addObject:packet];
+        [Packet runFilterProgram:(PPBPFProgram*)args->input[1]
+                       onPackets:(NSArray*)args->input[0]
+                           range:range
+                         results:results];
 
-        if (thread_args->cancel != 0)
+        for (i = 0; i < range.length; ++i)
+        {
+            if (results[i])
+                [filteredPackets
+                    addObject:[(NSArray*)args->input[0]
+                                  objectAtIndex:range.location + i]];
+        }
+
+        done += range.length;
+        PPTaskGroupAddProgress(group, range.length);
+
+        if (PPTaskGroupIsCancelled(group))
         {
             [filteredPackets release];
-            goto cleanup;
+            return;
         }
     }
 
@@ -1685,26 +1928,283 @@ static void* filter_packets_thread(void* args)
     tempPackets = [filteredPackets sortedArrayUsingFunction:pkt_compare
                                                     context:nil];
 
-    for (i = 0; i < [tempPackets count]; ++i)
+    [streamController addPacketArray:tempPackets group:group];
+
+    if (PPTaskGroupIsCancelled(group))
+    {
+        [filteredPackets release];
+        [streamController release];
+        return;
+    }
+
+    /* the document is responsible for releasing args->output */
+    args->output[0] = filteredPackets;
+    args->output[1] = streamController;
+    args->success = 1;
+}
+
+static void search_packets_task(PPTaskGroup* group, struct worker_args* args)
+{
+    NSMutableArray* matches;
+    NSArray* searched;
+    NSUInteger i, count;
+
+    searched = args->input[0];
+    count = [searched count];
+
+    [(PPPayloadSearch*)args->input[1] searchPackets:searched
+                                            streams:(NSArray*)args->input[2]
+                                            results:args->matched
+                                              group:group];
+
+    if (PPTaskGroupIsCancelled(group))
+        return;
+
+    matches = [[NSMutableArray alloc] init];
+
+    for (i = 0; i < count; ++i)
     {
-        [streamController addPacket:[tempPackets objectAtIndex:i]];
+        if (args->matched[i])
+            [matches addObject:[searched objectAtIndex:i]];
+    }
 
-        if (thread_args->cancel != 0)
+    /* the document is responsible for releasing args->output */
+    args->output[0] = matches;
+    args->success = 1;
+}
+
+static void worker_args_free(struct worker_args* args)
+{
+    [args->group release];
+    free((void*)args->matched);
+    free(args);
+}
+
+static struct ingest_args* ingest_start(ObjectIO* io, int fd)
+{
+    struct ingest_args* ingest;
+    int ret;
+
+    if ((ingest = calloc(1, sizeof(*ingest))) == NULL)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to allocate memory"
+                                          lookup:[PosixError class]
+                                            code:errno
+                                        severity:ERRS_ERROR];
+        return NULL;
+    }
+
+    ingest->io = io;
+    ingest->fd = fd;
+    ingest->pending = [[NSMutableArray alloc] init];
+    ingest->accepted = [[NSMutableData alloc] init];
+
+    if (pipe(ingest->wakefd) == -1)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to create pipe"
+                                          lookup:[PosixError class]
+                                            code:errno
+                                        severity:ERRS_ERROR];
+        goto err;
+    }
+
+    if ((ret = pthread_mutex_init(&ingest->lock, NULL)) != 0)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to create mutex"
+                                          lookup:[PosixError class]
+                                            code:ret
+                                        severity:ERRS_ERROR];
+        (void)close(ingest->wakefd[0]);
+        (void)close(ingest->wakefd[1]);
+        goto err;
+    }
+
+    if ((ret = pthread_create(&ingest->thread_id, NULL, ingest_thread, ingest)) !=
+        0)
+    {
+        [[ErrorStack sharedErrorStack] pushError:@"Failed to create thread"
+                                          lookup:[PosixError class]
+                                            code:ret
+                                        severity:ERRS_ERROR];
+        (void)pthread_mutex_destroy(&ingest->lock);
+        (void)close(ingest->wakefd[0]);
+        (void)close(ingest->wakefd[1]);
+        goto err;
+    }
+
+    return ingest;
+
+err:
+    [ingest->pending release];
+    [ingest->accepted release];
+    free(ingest);
+    return NULL;
+}
+
+/* wakes the ingest thread and waits for it to exit. Packets it has already
+   queued remain in ingest->pending */
+static void ingest_stop(struct ingest_args* ingest)
+{
+    char c;
+
+    c = 0;
+    (void)write(ingest->wakefd[1], &c, sizeof(c));
+    (void)pthread_join(ingest->thread_id, NULL);
+}
+
+/* only to be called once the ingest thread has been stopped */
+static void ingest_free(struct ingest_args* ingest)
+{
+    (void)close(ingest->wakefd[0]);
+    (void)close(ingest->wakefd[1]);
+    (void)pthread_mutex_destroy(&ingest->lock);
+    [ingest->program release];
+    [ingest->pending release];
+    [ingest->accepted release];
+    [ingest->error release];
+    free(ingest);
+}
+
+static void ingest_set_program(struct ingest_args* ingest, PPBPFProgram* program)
+{
+    if (ingest == NULL)
+        return;
+
+    pthread_mutex_lock(&ingest->lock);
+    [program retain];
+    [ingest->program release];
+    ingest->program = program;
+    ++ingest->generation;
+    if ([ingest->pending count] > 0)
+        ingest->stale = 1;
+    pthread_mutex_unlock(&ingest->lock);
+}
+
+static void* ingest_thread(void* args)
+{
+    struct ingest_args* ingest;
+    BOOL results[FILTER_THREAD_CHUNK_SZ];
+    fd_set fds;
+    int nfds;
+
+    ingest = args;
+    nfds = ((ingest->fd > ingest->wakefd[0]) ? ingest->fd : ingest->wakefd[0]) + 1;
+
+    for (;;)
+    {
+        NSAutoreleasePool* autoreleasePool;
+        NSMutableArray* received;
+        PPBPFProgram* program;
+        unsigned int generation;
+        id obj;
+        NSUInteger i;
+        NSRange range;
+        BOOL unexpected;
+
+        FD_ZERO(&fds);
+        FD_SET(ingest->fd, &fds);
+        FD_SET(ingest->wakefd[0], &fds);
+
+        if (select(nfds, &fds, NULL, NULL, NULL) == -1)
         {
-            [filteredPackets release];
-            [streamController release];
-            goto cleanup;
+            if (errno == EINTR)
+                continue;
+
+            pthread_mutex_lock(&ingest->lock);
+            ingest->failure = 1;
+            pthread_mutex_unlock(&ingest->lock);
+            break;
         }
-    }
 
-    /* the document is responsible for releasing thread_args->output */
-    thread_args->output[0] = filteredPackets;
-    thread_args->output[1] = streamController;
+        if (FD_ISSET(ingest->wakefd[0], &fds))
+            break;
 
-    OSMemoryBarrier();
-    thread_args->success = 1;
+        autoreleasePool = [[NSAutoreleasePool alloc] init];
+        received = [[NSMutableArray alloc] init];
+        obj = nil;
+        unexpected = NO;
 
-cleanup:
-    [autoreleasePool release];
-    return thread_args->output[0];
+        /* everything already buffered by the ObjectIO has to be read here, as
+           select won't report it */
+        do
+        {
+            if ((obj = [ingest->io read]) == nil)
+                break;
+
+            if ([obj isMemberOfClass:[MsgFilterStatistics class]])
+            {
+                pthread_mutex_lock(&ingest->lock);
+                ingest->discarded = [obj discarded];
+                pthread_mutex_unlock(&ingest->lock);
+                continue;
+            }
+
+            if (![obj isMemberOfClass:[Packet class]])
+            {
+                unexpected = YES;
+                break;
+            }
+
+            [received addObject:obj];
+        } while ([ingest->io moreAvailable]);
+
+        pthread_mutex_lock(&ingest->lock);
+        program = [ingest->program retain];
+        generation = ingest->generation;
+        pthread_mutex_unlock(&ingest->lock);
+
+        for (range.location = 0; range.location < [received count];
+             range.location += range.length)
+        {
+            range.length = [received count] - range.location;
+
+            if (range.length > FILTER_THREAD_CHUNK_SZ)
+                range.length = FILTER_THREAD_CHUNK_SZ;
+
+            if (program != nil)
+                [Packet runFilterProgram:program
+                               onPackets:received
+                                   range:range
+                                 results:results];
+            else
+                memset(results, YES, range.length * sizeof(results[0]));
+
+            pthread_mutex_lock(&ingest->lock);
+            if (generation != ingest->generation)
+                ingest->stale = 1;
+            for (i = 0; i < range.length; ++i)
+                [ingest->pending
+                    addObject:[received objectAtIndex:range.location + i]];
+            [ingest->accepted appendBytes:results
+                                   length:range.length * sizeof(results[0])];
+            pthread_mutex_unlock(&ingest->lock);
+        }
+
+        [program release];
+        [received release];
+
+        if (obj == nil || unexpected)
+        {
+            pthread_mutex_lock(&ingest->lock);
+            ingest->failure = 1;
+
+            /* if we got some unknown object, push an error */
+            if ([obj isMemberOfClass:[ErrorStack class]])
+                ingest->error = [obj retain];
+            else if (obj != nil)
+                [[ErrorStack sharedErrorStack]
+                    pushError:@"Received unknown object from helper tool"
+                       lookup:Nil
+                         code:0
+                     severity:ERRS_ERROR];
+            pthread_mutex_unlock(&ingest->lock);
+
+            [autoreleasePool release];
+            break;
+        }
+
+        [autoreleasePool release];
+    }
+
+    return NULL;
 }
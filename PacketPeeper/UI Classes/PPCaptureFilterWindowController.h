@@ -27,7 +27,15 @@
 
 @class NSArray;
 @class NSProgressIndicator;
+@class NSTextView;
+@class PPBPFProgram;
 @class PPCaptureFilter;
+@class PPTaskGroup;
+
+struct bpf_insn_profile;
+
+/* height of the program listing added below the sheet's controls */
+#define CAPTURE_FILTER_PROGRAM_VIEW_HEIGHT 200.0
 
 @interface PPCaptureFilterWindowController : NSWindowController <
                                                  NSTextFieldDelegate,
@@ -41,15 +49,30 @@
     IBOutlet NSTextField* filterNetmaskTextField;
     IBOutlet NSTextField* filterErrorTextField;
     IBOutlet NSButton* applyButton;
+    NSTextView* programTextView;
+    NSButton* profileButton;
+    PPTaskGroup* profileGroup; /* the profile running, if any */
 }
 
 - (PPCaptureFilter*)filter;
+- (void)setupProgramView;
+- (void)displayProgramWithProfile:(BOOL)shouldProfile;
+- (void)profileProgram:(PPBPFProgram*)program
+             onPackets:(NSArray*)packets
+                 group:(PPTaskGroup*)group; /* private method */
+- (void)profileDidFinish:(NSArray*)result;  /* private method */
+- (void)cancelProfile;                      /* private method */
++ (NSString*)listingForProgram:(PPBPFProgram*)program
+                       profile:(const struct bpf_insn_profile*)profile
+                      npackets:(NSUInteger)npackets
+                   nanoseconds:(uint64_t)nanoseconds; /* private method */
 - (void)sheetDidEnd:(NSWindow*)sheet
          returnCode:(NSModalResponse)returnCode
         contextInfo:(void*)contextInfo;
 - (IBAction)saveFilterButtonPressed:(id)sender;
 - (IBAction)deleteFilterButtonPressed:(id)sender;
 - (IBAction)applyButtonPressed:(id)sender;
+- (IBAction)profileButtonPressed:(id)sender;
 - (IBAction)cancelButtonPressed:(id)sender;
 
 @end
@@ -18,18 +18,31 @@
  */
 
 #include "PPCaptureFilterWindowController.h"
+#include "../Filters/PPBPFProgram.h"
 #include "../Filters/PPCaptureFilter.h"
 #include "../Filters/PPCaptureFilterFormatter.h"
 #include "../Filters/PPCaptureFilterManager.h"
 #include "../Filters/PPHexNumberFormatter.h"
+#include "../Filters/bpf_filter.h"
+#include "../PPTaskGroup.h"
 #include "MyDocument.h"
+#include "PPPacketUIAdditions.h"
 #import <AppKit/NSApplication.h>
 #import <AppKit/NSComboBox.h>
+#import <AppKit/NSFont.h>
+#import <AppKit/NSScrollView.h>
 #import <AppKit/NSTextField.h>
+#import <AppKit/NSTextView.h>
 #import <AppKit/NSWindow.h>
 #import <Foundation/NSArray.h>
 #import <Foundation/NSString.h>
 #import <Foundation/NSValue.h>
+#include <pcap.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+static NSString* insn_disassembly(
+    const struct bpf_program* program, unsigned int i);
 
 @implementation PPCaptureFilterWindowController
 
@@ -38,6 +51,9 @@
     if ((self = [super initWithWindowNibName:@"PPCaptureFilterSheet"]) != nil)
     {
         filters = nil;
+        programTextView = nil;
+        profileButton = nil;
+        profileGroup = nil;
     }
     return self;
 }
@@ -50,6 +66,255 @@
     return nil;
 }
 
+/* the sheet's nib has no room for the compiled program, so the window is
+   grown and the listing added beneath the existing controls */
+- (void)setupProgramView
+{
+    NSView* contentView;
+    NSScrollView* scrollView;
+    NSArray* subviews;
+    NSRect frame;
+    NSUInteger i;
+
+    contentView = [[self window] contentView];
+    subviews = [contentView subviews];
+
+    [contentView setAutoresizesSubviews:NO];
+
+    frame = [[self window] frame];
+    frame.size.height += CAPTURE_FILTER_PROGRAM_VIEW_HEIGHT;
+    frame.origin.y -= CAPTURE_FILTER_PROGRAM_VIEW_HEIGHT;
+    [[self window] setFrame:frame display:NO];
+
+    for (i = 0; i < [subviews count]; ++i)
+    {
+        NSView* view = [subviews objectAtIndex:i];
+
+        [view setFrameOrigin:NSMakePoint(
+                                 [view frame].origin.x,
+                                 [view frame].origin.y +
+                                     CAPTURE_FILTER_PROGRAM_VIEW_HEIGHT)];
+    }
+
+    [contentView setAutoresizesSubviews:YES];
+
+    frame = [contentView bounds];
+
+    profileButton =
+        [[NSButton alloc] initWithFrame:NSMakeRect(14.0, 12.0, 100.0, 32.0)];
+    [profileButton setBezelStyle:NSRoundedBezelStyle];
+    [profileButton setTitle:@"Profile"];
+    [profileButton setTarget:self];
+    [profileButton setAction:@selector(profileButtonPressed:)];
+    [profileButton setEnabled:NO];
+    [profileButton setToolTip:@"Run the filter over every packet in the "
+                              @"document, counting how often each "
+                              @"instruction executes"];
+    [contentView addSubview:profileButton];
+
+    scrollView = [[NSScrollView alloc]
+        initWithFrame:NSMakeRect(
+                          20.0,
+                          48.0,
+                          frame.size.width - 40.0,
+                          CAPTURE_FILTER_PROGRAM_VIEW_HEIGHT - 56.0)];
+    [scrollView setHasVerticalScroller:YES];
+    [scrollView setHasHorizontalScroller:YES];
+    [scrollView setBorderType:NSBezelBorder];
+    [scrollView setAutoresizingMask:NSViewWidthSizable];
+
+    programTextView = [[NSTextView alloc]
+        initWithFrame:NSMakeRect(
+                          0.0,
+                          0.0,
+                          [scrollView contentSize].width,
+                          [scrollView contentSize].height)];
+    [programTextView setEditable:NO];
+    [programTextView setRichText:NO];
+    [programTextView
+        setFont:[NSFont userFixedPitchFontOfSize:[NSFont smallSystemFontSize]]];
+    [programTextView setHorizontallyResizable:YES];
+    [[programTextView textContainer] setWidthTracksTextView:NO];
+    [[programTextView textContainer]
+        setContainerSize:NSMakeSize(CGFLOAT_MAX, CGFLOAT_MAX)];
+
+    [scrollView setDocumentView:programTextView];
+    [contentView addSubview:scrollView];
+    [scrollView release];
+}
+
+/* lists the program compiled for the document's link type. If shouldProfile
+   is set, the program is run over every packet in the document on the shared
+   thread pool, and once that's done, the listing is replaced by one with each
+   instruction annotated with how many times it ran and how many bytes of
+   packet data it loaded */
+- (void)displayProgramWithProfile:(BOOL)shouldProfile
+{
+    PPBPFProgram* program;
+    NSArray* packets;
+    PPTaskGroup* group;
+
+    /* a profile still running is of the program being replaced */
+    [self cancelProfile];
+
+    if ([self filter] == nil ||
+        (program = [[self filter]
+             filterProgramForLinkType:[[self document] linkType]]) == nil)
+    {
+        [programTextView setString:@""];
+        [profileButton setEnabled:NO];
+        return;
+    }
+
+    if (shouldProfile)
+    {
+        packets = [[self document] packetsSortedByNumber];
+        group = [[PPTaskGroup alloc] initWithPriority:PPTASKGROUP_PRIORITY_UI];
+
+        if ([group addTask:^(PPTaskGroup* taskGroup) {
+                [self profileProgram:program
+                           onPackets:packets
+                               group:taskGroup];
+            }])
+        {
+            profileGroup = group;
+            [programTextView
+                setString:[NSString
+                              stringWithFormat:@"Profiling %lu packets...\n",
+                                               (unsigned long)[packets count]]];
+            [profileButton setEnabled:NO];
+            return;
+        }
+
+        [group release];
+    }
+
+    [programTextView
+        setString:[PPCaptureFilterWindowController listingForProgram:program
+                                                             profile:NULL
+                                                            npackets:0
+                                                         nanoseconds:0]];
+    [profileButton setEnabled:YES];
+}
+
+/* runs on the shared thread pool, handing the listing back to the main
+   thread unless the profile is cancelled */
+- (void)profileProgram:(PPBPFProgram*)program
+             onPackets:(NSArray*)packets
+                 group:(PPTaskGroup*)group
+{
+    struct bpf_insn_profile* profile;
+    NSString* listing;
+    uint64_t nanoseconds;
+
+    profile = calloc([program program]->bf_len, sizeof(*profile));
+    nanoseconds = 0;
+
+    if (profile != NULL)
+        nanoseconds = [Packet profileFilterProgram:program
+                                         onPackets:packets
+                                           profile:profile
+                                             group:group];
+
+    if (PPTaskGroupIsCancelled(group))
+    {
+        free(profile);
+        return;
+    }
+
+    listing = [PPCaptureFilterWindowController
+        listingForProgram:program
+                  profile:profile
+                 npackets:[packets count]
+              nanoseconds:nanoseconds];
+    free(profile);
+
+    [self performSelectorOnMainThread:@selector(profileDidFinish:)
+                           withObject:[NSArray arrayWithObjects:group,
+                                                                listing,
+                                                                nil]
+                        waitUntilDone:NO];
+}
+
+/* result holds the profile's group and the listing */
+- (void)profileDidFinish:(NSArray*)result
+{
+    /* cancelled after it had finished */
+    if ([result objectAtIndex:0] != profileGroup)
+        return;
+
+    [programTextView setString:[result objectAtIndex:1]];
+    [profileButton setEnabled:YES];
+    [profileGroup release];
+    profileGroup = nil;
+}
+
+- (void)cancelProfile
+{
+    if (profileGroup != nil)
+    {
+        [profileGroup cancel];
+        [profileGroup release];
+        profileGroup = nil;
+    }
+}
+
+/* the program's listing, annotated with profile if it isn't NULL. Touches
+   no views, so is safe to call from any thread */
++ (NSString*)listingForProgram:(PPBPFProgram*)program
+                       profile:(const struct bpf_insn_profile*)profile
+                      npackets:(NSUInteger)npackets
+                   nanoseconds:(uint64_t)nanoseconds
+{
+    NSMutableString* listing;
+    unsigned long long totalBytes;
+    double divisor;
+    unsigned int i, len;
+
+    len = [program program]->bf_len;
+    listing = [NSMutableString string];
+
+    /* avoid dividing by zero below */
+    divisor = (npackets > 0) ? npackets : 1.0;
+
+    if (profile != NULL)
+    {
+        for (totalBytes = 0, i = 0; i < len; ++i)
+            totalBytes += profile[i].bytes;
+
+        [listing appendFormat:@"%lu packets, %.1f ns/packet, %.1f bytes "
+                              @"loaded/packet\n\n",
+                              (unsigned long)npackets,
+                              nanoseconds / divisor,
+                              totalBytes / divisor];
+        [listing appendFormat:@"%-40s %12s %7s %12s\n",
+                              "instruction",
+                              "executions",
+                              "%",
+                              "bytes"];
+    }
+
+    for (i = 0; i < len; ++i)
+    {
+        NSString* insn = insn_disassembly([program program], i);
+
+        if (profile != NULL)
+        {
+            [listing appendFormat:@"%-40s %12llu %6.1f%% %12llu\n",
+                                  [insn UTF8String],
+                                  profile[i].executions,
+                                  100.0 * profile[i].executions / divisor,
+                                  profile[i].bytes];
+        }
+        else
+        {
+            [listing appendFormat:@"%@\n", insn];
+        }
+    }
+
+    return listing;
+}
+
 - (void)windowDidLoad
 {
     PPCaptureFilterFormatter* filterFormatter;
@@ -80,12 +345,15 @@
     [filterNameComboBox setDelegate:self];
 
     [applyButton setEnabled:NO];
+
+    [self setupProgramView];
 }
 
 - (void)sheetDidEnd:(NSWindow*)sheet
          returnCode:(NSModalResponse)returnCode
         contextInfo:(void*)contextInfo
 {
+    [self cancelProfile];
     if (returnCode == NSModalResponseOK)
         [[self document] setCaptureFilter:[self filter]];
     [[self document] removeWindowController:self];
@@ -119,6 +387,8 @@
         [filterErrorTextField setStringValue:@"Filter OK"];
         [applyButton setEnabled:YES];
     }
+
+    [self displayProgramWithProfile:NO];
 }
 
 /* NSComboBox data source methods */
@@ -233,6 +503,11 @@
                                returnCode:NSModalResponseOK];
 }
 
+- (IBAction)profileButtonPressed:(id)sender
+{
+    [self displayProgramWithProfile:YES];
+}
+
 - (IBAction)cancelButtonPressed:(id)sender
 {
     [[[self window] sheetParent] endSheet:[self window]
@@ -242,7 +517,32 @@
 - (void)dealloc
 {
     [filters release];
+    [programTextView release];
+    [profileButton release];
+    [self cancelProfile];
     [super dealloc];
 }
 
 @end
+
+/* returns the tcpdump -d style disassembly of instruction i. This lives in
+   the application rather than in PPBPFProgram, as the helper, which shares
+   PPBPFProgram, doesn't link against libpcap */
+static NSString* insn_disassembly(
+    const struct bpf_program* program, unsigned int i)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    NSString* ret;
+
+    if (i >= program->bf_len)
+        return nil;
+
+    /* bpf_image returns a static buffer, and listings may be made on any
+       thread */
+    pthread_mutex_lock(&lock);
+    ret = [NSString
+        stringWithUTF8String:bpf_image(&program->bf_insns[i], (int)i)];
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
@@ -0,0 +1,75 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _PPCOLUMNSTRINGCACHE_H_
+#define _PPCOLUMNSTRINGCACHE_H_
+
+#include "../hash_map.h"
+#import <Foundation/NSObject.h>
+#include <stddef.h>
+
+/* most (packet, column) strings remembered. Once there are this many, they
+   are all forgotten when the current event is done with */
+#define PPCOLUMNSTRINGCACHE_CAPACITY (1 << 19)
+
+@class NSMutableSet;
+@class NSString;
+@class Packet;
+@class ColumnIdentifier;
+
+/* A document's packet table strings, remembered by (packet, column) so that
+   redrawing and sorting the table don't format them over again. Equal
+   strings are interned, so the many packets with the same protocols,
+   addresses or lengths share one copy.
+
+   Strings in columns showing host names are treated as stale once a host
+   name lookup completes, and are formatted again the next time they're
+   asked for. Remembered packets and columns are retained until the cache
+   is flushed. Only to be used on the main thread */
+@interface PPColumnStringCache : NSObject
+{
+    struct hash_map strings; /* column_key -> column_value */
+    NSMutableSet* interned;
+    unsigned int generation; /* of the strings not yet stale */
+    unsigned int hostGeneration; /* of the host name strings not yet stale */
+    BOOL flushScheduled;
+}
+
+/* the remembered string, or nil if there isn't one or it's stale */
+- (NSString*)stringForPacket:(Packet*)packet column:(ColumnIdentifier*)column;
+
+/* remembers string, returning the interned copy which should be used in
+   its place. Strings returned stay valid until the current event is done,
+   or flush is called */
+- (NSString*)setString:(NSString*)string
+             forPacket:(Packet*)packet
+                column:(ColumnIdentifier*)column;
+
+/* marks every string as stale */
+- (void)invalidate;
+
+/* forgets every string, and the packets and columns they're for */
+- (void)flush;
+
+- (size_t)count;
+
+@end
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "PPColumnStringCache.h"
+#include "../HostCache.hh"
+#include "ColumnIdentifier.h"
+#import <Foundation/NSNotification.h>
+#import <Foundation/NSRunLoop.h>
+#import <Foundation/NSSet.h>
+#import <Foundation/NSString.h>
+#include <stdlib.h>
+
+/* keys are hashed as bytes, and pointers leave no padding */
+struct column_key
+{
+    Packet* packet;
+    ColumnIdentifier* column;
+};
+
+struct column_value
+{
+    NSString* string;
+    unsigned int generation; /* of hostGeneration, if hostNames is set */
+    BOOL hostNames;
+};
+
+static void release_entry(const void* key, void* value, void* context);
+static BOOL shows_host_names(ColumnIdentifier* column);
+
+@implementation PPColumnStringCache
+
+- (id)init
+{
+    if ((self = [super init]) != nil)
+    {
+        if (hash_map_init(
+                &strings,
+                sizeof(struct column_key),
+                sizeof(struct column_value),
+                HASH_MAP_MIN_CAPACITY) != 0)
+        {
+            [super dealloc];
+            return nil;
+        }
+
+        interned = [[NSMutableSet alloc] init];
+        generation = 0;
+        hostGeneration = 0;
+        flushScheduled = NO;
+
+        [[NSNotificationCenter defaultCenter]
+            addObserver:self
+               selector:@selector(hostNameLookupCompletedNotification:)
+                   name:PPHostCacheHostNameLookupCompleteNotification
+                 object:nil];
+    }
+    return self;
+}
+
+- (NSString*)stringForPacket:(Packet*)packet column:(ColumnIdentifier*)column
+{
+    struct column_key key;
+    struct column_value* value;
+
+    key.packet = packet;
+    key.column = column;
+
+    if ((value = hash_map_find(&strings, &key)) == NULL ||
+        value->generation !=
+            (value->hostNames ? hostGeneration : generation))
+        return nil;
+
+    return value->string;
+}
+
+- (NSString*)setString:(NSString*)string
+             forPacket:(Packet*)packet
+                column:(ColumnIdentifier*)column
+{
+    struct column_key key;
+    struct column_value* value;
+    NSString* copy;
+    int existed;
+
+    if (string == nil)
+        return nil;
+
+    key.packet = packet;
+    key.column = column;
+
+    /* a stale string for the key is replaced in place, anything else needs
+       room for another entry. When there's none, the strings handed out
+       may still be in use, a sort may be part way through comparing them,
+       so they're only forgotten once the current event is done */
+    if (hash_map_find(&strings, &key) == NULL &&
+        hash_map_count(&strings) >= PPCOLUMNSTRINGCACHE_CAPACITY)
+    {
+        if (!flushScheduled)
+        {
+            flushScheduled = YES;
+            [self performSelector:@selector(flush) withObject:nil afterDelay:0];
+        }
+        return string;
+    }
+
+    if ((copy = [interned member:string]) == nil)
+    {
+        copy = [string copy];
+        [interned addObject:copy];
+        [copy release];
+    }
+
+    if ((value = hash_map_insert(&strings, &key, &existed)) == NULL)
+        return copy;
+
+    if (existed)
+    {
+        [value->string release];
+    }
+    else
+    {
+        [packet retain];
+        [column retain];
+    }
+
+    value->string = [copy retain];
+    value->hostNames = shows_host_names(column);
+    value->generation = value->hostNames ? hostGeneration : generation;
+
+    return copy;
+}
+
+- (void)invalidate
+{
+    ++generation;
+    ++hostGeneration;
+}
+
+- (void)flush
+{
+    hash_map_foreach(&strings, release_entry, NULL);
+    hash_map_clear(&strings);
+    [interned removeAllObjects];
+    flushScheduled = NO;
+}
+
+- (size_t)count
+{
+    return hash_map_count(&strings);
+}
+
+- (void)hostNameLookupCompletedNotification:(NSNotification*)note
+{
+    /* a resolved name only changes the columns showing host names */
+    ++hostGeneration;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self flush];
+    hash_map_destroy(&strings);
+    [interned release];
+    [super dealloc];
+}
+
+@end
+
+static void release_entry(const void* key, void* value, void* context)
+{
+    const struct column_key* k;
+    struct column_value* v;
+
+    k = key;
+    v = value;
+
+    [k->packet release];
+    [k->column release];
+    [v->string release];
+}
+
+/* built-in decoders name the columns which show host names "... Hostname" */
+static BOOL shows_host_names(ColumnIdentifier* column)
+{
+    return [[column longName] rangeOfString:@"Hostname"].location !=
+           NSNotFound;
+}
@@ -0,0 +1,53 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PPFLOWSWINDOWCONTROLLER_H_
+#define PPFLOWSWINDOWCONTROLLER_H_
+
+#import <AppKit/NSTableView.h>
+#import <AppKit/NSWindowController.h>
+#include <stddef.h>
+
+@class NSTableView;
+
+struct flow_stats;
+
+/* lists the document's UDP and ICMP flows, as counted by its flow
+   controller, from most to least recently active. The window is built in
+   code, there being no nib for it */
+@interface PPFlowsWindowController
+    : NSWindowController <NSTableViewDataSource>
+{
+    NSTableView* tableView;
+    struct flow_stats* flows; /* copied from the flow controller by update */
+    size_t nflows;
+    size_t flowsCapacity;
+}
+
+- (void)createTableView; /* private method */
+- (void)update;
+
+- (NSInteger)numberOfRowsInTableView:(NSTableView*)aTableView;
+- (id)tableView:(NSTableView*)aTableView
+    objectValueForTableColumn:(NSTableColumn*)tableColumn
+                          row:(NSInteger)rowIndex;
+
+@end
+
+#endif
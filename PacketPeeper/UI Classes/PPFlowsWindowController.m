@@ -0,0 +1,299 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "PPFlowsWindowController.h"
+#include "../PPFlowController.h"
+#include "../flow_table.h"
+#include "../flow_tracker.h"
+#include "MyDocument.h"
+#include "PPDataQuantityFormatter.h"
+#import <AppKit/NSScrollView.h>
+#import <AppKit/NSTableColumn.h>
+#import <AppKit/NSTableHeaderCell.h>
+#import <AppKit/NSWindow.h>
+#import <Foundation/NSString.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+
+#define FLOWS_WINDOW_WIDTH  760.0
+#define FLOWS_WINDOW_HEIGHT 320.0
+
+/* table column identifiers */
+#define FLOWS_TABLE_PROTOCOL      @"Protocol"
+#define FLOWS_TABLE_INITIATOR     @"Initiator"
+#define FLOWS_TABLE_RESPONDER     @"Responder"
+#define FLOWS_TABLE_PACKETS_SENT  @"PacketsSent"
+#define FLOWS_TABLE_PACKETS_RECV  @"PacketsRecv"
+#define FLOWS_TABLE_BYTES_SENT    @"BytesSent"
+#define FLOWS_TABLE_BYTES_RECV    @"BytesRecv"
+#define FLOWS_TABLE_DURATION      @"Duration"
+
+struct copy_flows_args
+{
+    struct flow_stats* flows;
+    size_t n;
+    size_t capacity;
+};
+
+static void copy_flow(const struct flow_stats* stats, void* context);
+static NSString* endpoint_str(const struct flow_stats* stats, int endpoint);
+
+@implementation PPFlowsWindowController
+
+- (id)init
+{
+    NSWindow* window;
+
+    window = [[NSWindow alloc]
+        initWithContentRect:NSMakeRect(
+                                0.0,
+                                0.0,
+                                FLOWS_WINDOW_WIDTH,
+                                FLOWS_WINDOW_HEIGHT)
+                  styleMask:NSTitledWindowMask | NSClosableWindowMask |
+                            NSMiniaturizableWindowMask |
+                            NSResizableWindowMask
+                    backing:NSBackingStoreBuffered
+                      defer:YES];
+
+    if ((self = [super initWithWindow:window]) != nil)
+    {
+        flows = NULL;
+        nflows = 0;
+        flowsCapacity = 0;
+        [self createTableView];
+        [window center];
+    }
+    [window release];
+    return self;
+}
+
+- (void)createTableView
+{
+    NSScrollView* scrollView;
+    NSTableColumn* column;
+    unsigned int i;
+    NSString* identifiers[] = {
+        FLOWS_TABLE_PROTOCOL,
+        FLOWS_TABLE_INITIATOR,
+        FLOWS_TABLE_RESPONDER,
+        FLOWS_TABLE_PACKETS_SENT,
+        FLOWS_TABLE_PACKETS_RECV,
+        FLOWS_TABLE_BYTES_SENT,
+        FLOWS_TABLE_BYTES_RECV,
+        FLOWS_TABLE_DURATION};
+    NSString* titles[] = {@"Protocol",
+                          @"Initiator",
+                          @"Responder",
+                          @"Packets Sent",
+                          @"Packets Received",
+                          @"Bytes Sent",
+                          @"Bytes Received",
+                          @"Duration"};
+    CGFloat widths[] = {100.0, 160.0, 160.0, 60.0, 60.0, 60.0, 60.0, 60.0};
+
+    scrollView = [[NSScrollView alloc]
+        initWithFrame:[[[self window] contentView] bounds]];
+    [scrollView setHasVerticalScroller:YES];
+    [scrollView setHasHorizontalScroller:YES];
+    [scrollView setAutoresizingMask:NSViewWidthSizable | NSViewHeightSizable];
+
+    tableView = [[NSTableView alloc]
+        initWithFrame:NSMakeRect(
+                          0.0,
+                          0.0,
+                          [scrollView contentSize].width,
+                          [scrollView contentSize].height)];
+    [tableView setUsesAlternatingRowBackgroundColors:YES];
+    [tableView setColumnAutoresizingStyle:NSTableViewNoColumnAutoresizing];
+
+    for (i = 0; i < (sizeof(titles) / sizeof(titles[0])); ++i)
+    {
+        column = [[NSTableColumn alloc] initWithIdentifier:identifiers[i]];
+        [[column headerCell] setStringValue:titles[i]];
+        [column setWidth:widths[i]];
+        [column setEditable:NO];
+        [tableView addTableColumn:column];
+        [column release];
+    }
+
+    [tableView setDataSource:self];
+    [scrollView setDocumentView:tableView];
+    [[[self window] contentView] addSubview:scrollView];
+    [scrollView release];
+}
+
+- (void)showWindow:(id)sender
+{
+    [self update];
+    [super showWindow:sender];
+}
+
+/* copies the flows out of the document's flow controller, rather than
+   keeping pointers into it, as they're freed when the flows are expired or
+   their packets deleted */
+- (void)update
+{
+    struct copy_flows_args args;
+    PPFlowController* flowController;
+    size_t count;
+    void* temp;
+
+    flowController = [[self document] flowController];
+
+    if ((count = [flowController numberOfFlows]) > flowsCapacity)
+    {
+        if ((temp = realloc(flows, count * sizeof(*flows))) == NULL)
+            return;
+
+        flows = temp;
+        flowsCapacity = count;
+    }
+
+    args.flows = flows;
+    args.n = 0;
+    args.capacity = flowsCapacity;
+    [flowController enumerateFlowsUsingFunction:copy_flow context:&args];
+    nflows = args.n;
+
+    [tableView reloadData];
+}
+
+- (NSString*)windowTitleForDocumentDisplayName:(NSString*)displayName
+{
+    return [NSString stringWithFormat:@"%@ - %@ - UDP and ICMP Flows",
+                                      displayName,
+                                      [[self document] interface]];
+}
+
+- (void)setDocumentEdited:(BOOL)flag
+{
+    return;
+}
+
+- (NSResponder*)nextResponder
+{
+    return [[self document] packetCaptureWindowController];
+}
+
+/* NSTableView data-source methods */
+
+- (NSInteger)numberOfRowsInTableView:(NSTableView*)aTableView
+{
+    return nflows;
+}
+
+- (id)tableView:(NSTableView*)aTableView
+    objectValueForTableColumn:(NSTableColumn*)tableColumn
+                          row:(NSInteger)rowIndex
+{
+    const struct flow_stats* stats;
+    NSString* identifier;
+
+    if (rowIndex < 0 || (size_t)rowIndex >= nflows)
+        return nil;
+
+    stats = &flows[rowIndex];
+    identifier = [tableColumn identifier];
+
+    if ([identifier isEqualToString:FLOWS_TABLE_PROTOCOL])
+    {
+        if (stats->key.protocol == IPPROTO_ICMP)
+            return [NSString
+                stringWithFormat:@"ICMP, ID %u", stats->key.port[0]];
+        return @"UDP";
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_INITIATOR])
+    {
+        return endpoint_str(stats, stats->initiator);
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_RESPONDER])
+    {
+        return endpoint_str(stats, !stats->initiator);
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_PACKETS_SENT])
+    {
+        return [NSString stringWithFormat:@"%llu", stats->packets[0]];
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_PACKETS_RECV])
+    {
+        return [NSString stringWithFormat:@"%llu", stats->packets[1]];
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_BYTES_SENT])
+    {
+        return data_quantity_str(stats->bytes[0]);
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_BYTES_RECV])
+    {
+        return data_quantity_str(stats->bytes[1]);
+    }
+    else if ([identifier isEqualToString:FLOWS_TABLE_DURATION])
+    {
+        return [NSString
+            stringWithFormat:@"%.3f s", stats->last - stats->first];
+    }
+
+    return nil;
+}
+
+- (void)dealloc
+{
+    [tableView release];
+    free(flows);
+    [super dealloc];
+}
+
+@end
+
+static void copy_flow(const struct flow_stats* stats, void* context)
+{
+    struct copy_flows_args* args;
+
+    args = context;
+
+    if (args->n < args->capacity)
+        args->flows[args->n++] = *stats;
+}
+
+/* the address of the given endpoint of the flow, with its port if it's a
+   UDP flow */
+static NSString* endpoint_str(const struct flow_stats* stats, int endpoint)
+{
+    char buf[INET6_ADDRSTRLEN];
+    const uint8_t* addr;
+    BOOL isV4;
+
+    addr = stats->key.addr[endpoint];
+    isV4 = IN6_IS_ADDR_V4MAPPED((const struct in6_addr*)addr);
+
+    if (inet_ntop(
+            isV4 ? AF_INET : AF_INET6,
+            isV4 ? &addr[12] : addr,
+            buf,
+            sizeof(buf)) == NULL)
+        return nil;
+
+    if (stats->key.protocol == IPPROTO_ICMP)
+        return [NSString stringWithUTF8String:buf];
+
+    return [NSString stringWithFormat:isV4 ? @"%s:%u" : @"[%s]:%u",
+                                      buf,
+                                      stats->key.port[endpoint]];
+}
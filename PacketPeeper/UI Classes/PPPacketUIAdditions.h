@@ -24,13 +24,18 @@
 #include "ColumnIdentifier.h"
 #include "OutlineViewItem.h"
 
-#define PACKET_COLUMN_INDEX_NUMBER 0
-#define PACKET_COLUMN_INDEX_DATE   1
+#define PACKET_COLUMN_INDEX_NUMBER    0
+#define PACKET_COLUMN_INDEX_DATE      1
+#define PACKET_COLUMN_INDEX_PROTOCOLS 2
+#define PACKET_COLUMN_INDEX_INFO      3
 
 @class Packet;
 @class PPBPFProgram;
+@class PPTaskGroup;
 @protocol PPDecoderPlugin;
 
+struct bpf_insn_profile;
+
 @interface Packet (PPPacketUIAdditions) <OutlineViewItem, ColumnIdentifier>
 
 - (void)processPlugins;
@@ -38,10 +43,31 @@
 - (NSString*)info;      /* information strings in reverse order */
 - (NSComparisonResult)compare:(Packet*)packet
                    withColumn:(ColumnIdentifier*)column;
+/* on the main thread, strings are remembered by the packet's document, see
+   PPColumnStringCache */
 - (NSString*)stringForColumn:(ColumnIdentifier*)columnIdentifier;
+- (NSString*)formatStringForColumn:
+    (ColumnIdentifier*)columnIdentifier; /* private method */
 - (id)decoderForPlugin:(id<PPDecoderPlugin>)plugin;
 - (BOOL)runFilterProgram:(PPBPFProgram*)filterProgram;
 
+/* runs filterProgram over the packets in range, storing whether each was
+   accepted in results, which must have room for range.length entries */
++ (void)runFilterProgram:(PPBPFProgram*)filterProgram
+               onPackets:(NSArray*)packets
+                   range:(NSRange)range
+                 results:(BOOL*)results;
+
+/* counts how often each instruction of filterProgram runs over packets, and
+   how many bytes of packet data each loads, adding to profile, which must
+   have an entry per instruction. Returns the time in nanoseconds taken to
+   run the uninstrumented program over packets. Stops early, leaving profile
+   incomplete, if group is cancelled */
++ (uint64_t)profileFilterProgram:(PPBPFProgram*)filterProgram
+                       onPackets:(NSArray*)packets
+                         profile:(struct bpf_insn_profile*)profile
+                           group:(PPTaskGroup*)group;
+
 @end
 
 #endif
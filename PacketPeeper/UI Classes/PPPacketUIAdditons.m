@@ -21,19 +21,28 @@
 #include "../../Shared/PacketPeeper.h"
 #include "../Categories/DateFormat.h"
 #include "../Filters/PPBPFProgram.h"
+#include "../Filters/bpf_batch.h"
 #include "../Filters/bpf_filter.h"
 #include "../Plugins/PPDecoderPlugin.h"
 #include "../Plugins/PPPluginManager.h"
 #include "../Plugins/PPPluginWrapper.h"
+#include "../PPTaskGroup.h"
+#include "MyDocument.h"
+#include "PPColumnStringCache.h"
 #include "PPPacketUIAdditions.h"
 #include "pkt_compare.h"
 #import <Foundation/NSArray.h>
 #import <Foundation/NSData.h>
 #import <Foundation/NSDate.h>
 #import <Foundation/NSString.h>
+#import <Foundation/NSThread.h>
+#include <mach/mach_time.h>
 #include <stdlib.h>
 #include <sys/types.h>
 
+/* packets profiled between checks for the profile being cancelled */
+#define PROFILE_CANCEL_INTERVAL 4096
+
 static NSString* names[][2] = {{@"Packet number", @"#"},
                                {@"Date received", @"Date received"},
                                {@"Protocols", @"Protocols"},
@@ -161,7 +170,16 @@ static NSString* names[][2] = {{@"Packet number", @"#"},
         return val_compare(number, (packet)->number);
 
     if ([column decoder] == [self class])
+    {
+        /* text columns are compared as the document remembers them, rather
+           than formatting both strings again for every comparison */
+        if ([column index] == PACKET_COLUMN_INDEX_PROTOCOLS ||
+            [column index] == PACKET_COLUMN_INDEX_INFO)
+            return [[self stringForColumn:column]
+                compare:[packet stringForColumn:column]];
+
         return [self compareWith:packet atIndex:[column index]];
+    }
 
     decoder_a = nil;
     decoder_b = nil;
@@ -318,6 +336,24 @@ static NSString* names[][2] = {{@"Packet number", @"#"},
 }
 
 - (NSString*)stringForColumn:(ColumnIdentifier*)column
+{
+    PPColumnStringCache* cache;
+    NSString* ret;
+
+    if ((cache = [document columnStringCache]) == nil ||
+        ![NSThread isMainThread])
+        return [self formatStringForColumn:column];
+
+    if ((ret = [cache stringForPacket:self column:column]) != nil)
+        return ret;
+
+    return [cache setString:[self formatStringForColumn:column]
+                  forPacket:self
+                     column:column];
+}
+
+/* private method */
+- (NSString*)formatStringForColumn:(ColumnIdentifier*)column
 {
     id<ColumnIdentifier> decoder;
 
@@ -370,4 +406,95 @@ static NSString* names[][2] = {{@"Packet number", @"#"},
                : NO;
 }
 
++ (void)runFilterProgram:(PPBPFProgram*)filterProgram
+               onPackets:(NSArray*)packets
+                   range:(NSRange)range
+                 results:(BOOL*)results
+{
+    const struct bpf_batch_prog* batch;
+    const u_char* pkts[BPF_BATCH_LANES];
+    u_int wirelens[BPF_BATCH_LANES];
+    u_int buflens[BPF_BATCH_LANES];
+    uint8_t accepted[BPF_BATCH_LANES];
+    NSUInteger i, j, n;
+
+    if ((batch = [filterProgram batchProgram]) == NULL)
+    {
+        for (i = 0; i < range.length; ++i)
+            results[i] = [[packets objectAtIndex:range.location + i]
+                runFilterProgram:filterProgram];
+        return;
+    }
+
+    for (i = 0; i < range.length; i += n)
+    {
+        n = range.length - i;
+
+        if (n > BPF_BATCH_LANES)
+            n = BPF_BATCH_LANES;
+
+        for (j = 0; j < n; ++j)
+        {
+            Packet* packet = [packets objectAtIndex:range.location + i + j];
+
+            pkts[j] = [[packet packetData] bytes];
+            wirelens[j] = [packet actualLength];
+            buflens[j] = [packet captureLength];
+        }
+
+        bpf_batch_filter(batch, pkts, wirelens, buflens, n, accepted);
+
+        for (j = 0; j < n; ++j)
+            results[i + j] = accepted[j] ? YES : NO;
+    }
+}
+
++ (uint64_t)profileFilterProgram:(PPBPFProgram*)filterProgram
+                       onPackets:(NSArray*)packets
+                         profile:(struct bpf_insn_profile*)profile
+                           group:(PPTaskGroup*)group
+{
+    const struct bpf_program* program;
+    mach_timebase_info_data_t timebase;
+    uint64_t start, elapsed;
+    NSUInteger i, count;
+
+    if ((program = [filterProgram program]) == NULL)
+        return 0;
+
+    count = [packets count];
+
+    /* time the plain interpreter first, as the counting slows it down */
+    start = mach_absolute_time();
+
+    for (i = 0; i < count; ++i)
+    {
+        if (i % PROFILE_CANCEL_INTERVAL == 0 && PPTaskGroupIsCancelled(group))
+            return 0;
+        (void)[[packets objectAtIndex:i] runFilterProgram:filterProgram];
+    }
+
+    elapsed = mach_absolute_time() - start;
+
+    for (i = 0; i < count; ++i)
+    {
+        Packet* packet = [packets objectAtIndex:i];
+
+        if (i % PROFILE_CANCEL_INTERVAL == 0 && PPTaskGroupIsCancelled(group))
+            return 0;
+
+        (void)bpf_filter2_profile(
+            program->bf_insns,
+            (unsigned char*)[[packet packetData] bytes],
+            (unsigned)[packet actualLength],
+            (unsigned)[packet captureLength],
+            profile);
+    }
+
+    if (mach_timebase_info(&timebase) != KERN_SUCCESS)
+        return 0;
+
+    return elapsed * timebase.numer / timebase.denom;
+}
+
 @end
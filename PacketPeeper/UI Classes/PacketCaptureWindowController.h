@@ -102,6 +102,7 @@
 - (IBAction)filterButton:(id)sender;
 - (IBAction)clearFilterButton:(id)sender;
 - (IBAction)discardPacketsAndClearFilterButton:(id)sender;
+- (IBAction)searchField:(id)sender;
 - (IBAction)deleteButton:(id)sender;
 - (IBAction)individualPacketButton:(id)sender;
 - (IBAction)flushHostnamesButton:(id)sender;
@@ -37,6 +37,7 @@
 #import <AppKit/NSEvent.h>
 #import <AppKit/NSImage.h>
 #import <AppKit/NSMenu.h>
+#import <AppKit/NSSearchField.h>
 #import <AppKit/NSTableColumn.h>
 #import <AppKit/NSTableHeaderCell.h>
 #import <AppKit/NSTableHeaderView.h>
@@ -68,6 +69,7 @@
 #define FILTER_TOOLBARITEM_ID @"FilterItem" /* ``filters'' button */
 #define CLEAR_FILTER_TOOLBARITEM_ID \
     @"ClearFilterItem" /* ``clear filters'' button */
+#define SEARCH_TOOLBARITEM_ID @"SearchItem" /* ``search payloads'' field */
 
 @implementation PacketCaptureWindowController
 
@@ -426,6 +428,27 @@
         [toolbarItem setTarget:self];
         [toolbarItem setAction:@selector(clearFilterButton:)];
     }
+    else if ([itemIdentifier isEqualToString:SEARCH_TOOLBARITEM_ID])
+    {
+        NSSearchField* searchField;
+
+        searchField =
+            [[NSSearchField alloc] initWithFrame:NSMakeRect(0, 0, 180, 22)];
+        [searchField setTarget:self];
+        [searchField setAction:@selector(searchField:)];
+        [[searchField cell] setSendsWholeSearchString:YES];
+        [[searchField cell] setPlaceholderString:@"Search payloads"];
+
+        [toolbarItem setLabel:@"Search"];
+        [toolbarItem setPaletteLabel:@"Search Payloads Field"];
+        [toolbarItem setToolTip:@"Show only packets whose data, or stream "
+                                @"data, contains any of the |-separated "
+                                @"strings or matches a /regex/"];
+        [toolbarItem setView:searchField];
+        [toolbarItem setMinSize:NSMakeSize(100, 22)];
+        [toolbarItem setMaxSize:NSMakeSize(300, 22)];
+        [searchField release];
+    }
     else
         return nil;
 
@@ -446,6 +469,7 @@
                                      STOP_TOOLBARITEM_ID,
                                      FILTER_TOOLBARITEM_ID,
                                      CLEAR_FILTER_TOOLBARITEM_ID,
+                                     SEARCH_TOOLBARITEM_ID,
                                      nil];
 }
 
@@ -463,6 +487,8 @@
                                      FILTER_TOOLBARITEM_ID,
                                      CLEAR_FILTER_TOOLBARITEM_ID,
                                      NSToolbarSeparatorItemIdentifier,
+                                     NSToolbarFlexibleSpaceItemIdentifier,
+                                     SEARCH_TOOLBARITEM_ID,
                                      nil];
 }
 
@@ -513,7 +539,10 @@
         return ([packetTableView selectedRow] != -1);
 
     if ([[theItem itemIdentifier] isEqualToString:CLEAR_FILTER_TOOLBARITEM_ID])
-        return ([[self document] filterProgram] != nil);
+        return [[self document] isFiltered];
+
+    if ([[theItem itemIdentifier] isEqualToString:SEARCH_TOOLBARITEM_ID])
+        return ![[self document] isLive];
 
     return YES;
 }
@@ -556,7 +585,7 @@
 
     if ([menuItem action] == @selector(clearFilterButton:) ||
         [menuItem action] == @selector(discardPacketsAndClearFilterButton:))
-        return ([[self document] filterProgram] != nil);
+        return [[self document] isFiltered];
 
     return YES;
 }
@@ -578,12 +607,26 @@
     }
 
     [packetTableView noteNumberOfRowsChanged];
-    [statusTextField
-        setStringValue:[NSString
-                           stringWithFormat:@"%zu packets, %@",
-                                            [[self document] numberOfPackets],
-                                            data_quantity_str([[self document]
-                                                numberOfBytes])]];
+
+    if ([[self document] numberOfPacketsDiscarded] > 0)
+        [statusTextField
+            setStringValue:[NSString
+                               stringWithFormat:
+                                   @"%zu packets, %@ (%llu not matching the "
+                                   @"filter discarded)",
+                                   [[self document] numberOfPackets],
+                                   data_quantity_str(
+                                       [[self document] numberOfBytes]),
+                                   [[self document] numberOfPacketsDiscarded]]];
+    else
+        [statusTextField
+            setStringValue:[NSString
+                               stringWithFormat:@"%zu packets, %@",
+                                                [[self document]
+                                                    numberOfPackets],
+                                                data_quantity_str(
+                                                    [[self document]
+                                                        numberOfBytes])]];
 
     if (shouldScroll)
         [packetTableView scrollRowToVisible:[packetTableView numberOfRows] - 1];
@@ -742,6 +785,18 @@
     [[self document] clearFilterProgram:YES];
 }
 
+- (IBAction)searchField:(id)sender
+{
+    NSString* searchString;
+
+    searchString = [sender stringValue];
+
+    if ([searchString length] == 0)
+        [[self document] clearFilterProgram:NO];
+    else
+        [[self document] searchPayloadsForString:searchString];
+}
+
 - (IBAction)deleteButton:(id)sender
 {
     NSIndexSet* indexSet;
@@ -76,6 +76,7 @@
 - (void)deleteSelectedStreams;
 - (IBAction)individualPacketButton:(id)sender;
 - (IBAction)reassembleStreamButton:(id)sender;
+- (IBAction)flowsButton:(id)sender;
 
 @end
 
@@ -49,6 +49,9 @@
 #import <Foundation/NSString.h>
 #import <Foundation/NSUserDefaults.h>
 
+static NSString* rtt_str(double rtt);
+static NSString* throughput_str(double bytes_per_sec);
+
 @implementation PPStreamsWindowController
 
 + (NSMenu*)createStreamTableMenu
@@ -68,7 +71,13 @@
         PPSTREAMSWINDOW_STREAMS_TABLE_BYTES_SENT,
         PPSTREAMSWINDOW_STREAMS_TABLE_BYTES_RECV,
         PPSTREAMSWINDOW_STREAMS_TABLE_BYTES_TOTAL,
-        PPSTREAMSWINDOW_STREAMS_TABLE_STATUS};
+        PPSTREAMSWINDOW_STREAMS_TABLE_STATUS,
+        PPSTREAMSWINDOW_STREAMS_TABLE_HANDSHAKE_RTT,
+        PPSTREAMSWINDOW_STREAMS_TABLE_RTT,
+        PPSTREAMSWINDOW_STREAMS_TABLE_RETRANSMISSIONS,
+        PPSTREAMSWINDOW_STREAMS_TABLE_ZERO_WINDOWS,
+        PPSTREAMSWINDOW_STREAMS_TABLE_THROUGHPUT,
+        PPSTREAMSWINDOW_STREAMS_TABLE_PEAK_THROUGHPUT};
     NSString* titles[] = {@"Source IP Address",
                           @"Destination IP Address",
                           @"Source Hostname",
@@ -80,7 +89,13 @@
                           @"Bytes Sent",
                           @"Bytes Received",
                           @"Bytes Total",
-                          @"Status"};
+                          @"Status",
+                          @"Handshake RTT",
+                          @"Mean RTT",
+                          @"Retransmissions",
+                          @"Zero Windows",
+                          @"Throughput",
+                          @"Peak Throughput"};
 
     menu = [[NSMenu alloc] init];
 
@@ -110,6 +125,8 @@
 
 - (void)windowDidLoad
 {
+    NSMenuItem* item;
+
     autoScrolling = [[NSUserDefaults standardUserDefaults]
         boolForKey:PPSTREAMSWINDOW_AUTOSCROLLING];
 
@@ -130,6 +147,16 @@
     [[streamTableView headerView]
         setMenu:[PPStreamsWindowController createStreamTableMenu]];
 
+    /* UDP and ICMP flows are listed in a window of their own, which the nib
+       knows nothing about */
+    item = [[NSMenuItem alloc] initWithTitle:@"Show UDP and ICMP Flows"
+                                      action:@selector(flowsButton:)
+                               keyEquivalent:@""];
+    [item setTarget:self];
+    [[streamTableView menu] addItem:[NSMenuItem separatorItem]];
+    [[streamTableView menu] addItem:item];
+    [item release];
+
     [self populateStreamTableView];
     [self populatePacketTableView];
 
@@ -425,6 +452,36 @@
     {
         return [stream status];
     }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_HANDSHAKE_RTT])
+    {
+        return rtt_str([stream handshakeRTT]);
+    }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_RTT])
+    {
+        return rtt_str([stream meanRTT]);
+    }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_RETRANSMISSIONS])
+    {
+        return [NSString stringWithFormat:@"%lu", [stream retransmissions]];
+    }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_ZERO_WINDOWS])
+    {
+        return [NSString stringWithFormat:@"%lu", [stream zeroWindows]];
+    }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_THROUGHPUT])
+    {
+        return throughput_str([stream throughput]);
+    }
+    else if ([[tableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_PEAK_THROUGHPUT])
+    {
+        return throughput_str([stream peakThroughput]);
+    }
 
     return nil;
 }
@@ -684,6 +741,30 @@
                  isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_STATUS])
         [[[self document] tcpStreamController]
             sortStreams:PPSTREAM_SORT_STATUS];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_HANDSHAKE_RTT])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_HANDSHAKE_RTT];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_RTT])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_RTT];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_RETRANSMISSIONS])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_RETRANSMISSIONS];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_ZERO_WINDOWS])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_ZERO_WINDOWS];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_THROUGHPUT])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_THROUGHPUT];
+    else if ([[lastStreamTableColumn identifier]
+                 isEqualToString:PPSTREAMSWINDOW_STREAMS_TABLE_PEAK_THROUGHPUT])
+        [[[self document] tcpStreamController]
+            sortStreams:PPSTREAM_SORT_PEAK_THROUGHPUT];
 }
 
 - (void)updateWithUserScrolling
@@ -958,6 +1039,11 @@
     }
 }
 
+- (IBAction)flowsButton:(id)sender
+{
+    [[self document] displayFlowsWindow];
+}
+
 - (IBAction)autoScrolling:(id)sender
 {
     if ([sender state] == NSOffState)
@@ -991,3 +1077,19 @@
 }
 
 @end
+
+/* in milliseconds, or empty if there were no samples */
+static NSString* rtt_str(double rtt)
+{
+    if (rtt < 0.0)
+        return @"";
+
+    return [NSString stringWithFormat:@"%.1f ms", rtt * 1000.0];
+}
+
+static NSString* throughput_str(double bytes_per_sec)
+{
+    return [NSString
+        stringWithFormat:@"%@/s",
+                         data_quantity_str((unsigned long long)bytes_per_sec)];
+}
@@ -121,6 +121,10 @@
     {
         textView = nil;
         reassembler = [aReassembler retain];
+        /* keep the data contiguous, so it's rendered a run at a time rather
+           than a segment at a time */
+        [reassembler setBuffersData:YES forClient:YES];
+        [reassembler setBuffersData:YES forClient:NO];
         lastChunk = 0;
         lastLocation = 0;
     }
@@ -244,8 +248,9 @@
 
 - (void)processStreamData
 {
-    [reassembler reassemble];
+    /* show what's been reassembled already, the rest follows as it's found */
     [self processStreamDataFromChunk:0];
+    [reassembler reassembleInBackground];
 }
 
 - (void)processStreamDataFromChunk:(unsigned int)chunk
@@ -273,7 +278,7 @@
 
     mutableAttributedString = [[NSMutableAttributedString alloc] init];
 
-    for (; chunk < [reassembler numberOfChunks]; ++chunk)
+    while (chunk < [reassembler numberOfChunks])
     {
         NSString* tempString;
         NSAttributedString* tempAttributedString;
@@ -284,9 +289,22 @@
         size_t nbytes;
         size_t nbytes_w;
         size_t i;
+        unsigned int end;
+        BOOL isClient;
 
-        nbytes = [[reassembler chunkDataAt:chunk] length];
-        chunk_bytes = [[reassembler chunkDataAt:chunk] bytes];
+        isClient = [reassembler chunkIsClient:chunk];
+        chunk_bytes = [reassembler chunkBytesAt:chunk];
+        nbytes = [reassembler chunkLengthAt:chunk];
+
+        /* with the data buffered, a run of chunks sent the same way is
+           contiguous, and can be rendered as one string */
+        for (end = chunk + 1; end < [reassembler numberOfChunks]; ++end)
+        {
+            if ([reassembler chunkIsClient:end] != isClient ||
+                [reassembler chunkBytesAt:end] != chunk_bytes + nbytes)
+                break;
+            nbytes += [reassembler chunkLengthAt:end];
+        }
 
         if ((temp = malloc(nbytes)) == NULL)
             break;
@@ -304,21 +322,20 @@
         for (; i < nbytes; ++i)
             temp[i] = byte_to_printable(chunk_bytes[i]);
 
-        tempString = [[NSString alloc]
-            initWithBytesNoCopy:temp
-                         length:[[reassembler chunkDataAt:chunk] length]
-                       encoding:NSASCIIStringEncoding
-                   freeWhenDone:YES];
+        tempString = [[NSString alloc] initWithBytesNoCopy:temp
+                                                    length:nbytes
+                                                  encoding:NSASCIIStringEncoding
+                                              freeWhenDone:YES];
 
         tempAttributedString = [[NSAttributedString alloc]
             initWithString:tempString
-                attributes:([reassembler chunkIsClient:chunk])
-                               ? redAttributes
-                               : blueAttributes];
+                attributes:isClient ? redAttributes : blueAttributes];
         [mutableAttributedString appendAttributedString:tempAttributedString];
 
         [tempString release];
         [tempAttributedString release];
+
+        chunk = end;
     }
 
     [[textView textStorage] appendAttributedString:mutableAttributedString];
@@ -326,10 +343,23 @@
     lastChunk = chunk;
 }
 
-- (void)noteChunksDeleted
+- (void)noteChunksDeletedFrom:(unsigned int)chunkIndex
 {
-    [self reset];
-    [self processStreamData];
+    NSTextStorage* textStorage;
+    NSRange range;
+
+    /* each byte of a chunk is shown as a character, so the text before the
+       chunk is as long as the data before it */
+    if (chunkIndex < lastChunk)
+    {
+        textStorage = [[textView layoutManager] textStorage];
+        range.location = [reassembler chunkPositionAt:chunkIndex];
+        range.length = [textStorage length] - range.location;
+        [textStorage deleteCharactersInRange:range];
+        lastChunk = chunkIndex;
+    }
+
+    [self processStreamDataFromChunk:lastChunk];
 }
 
 - (void)noteChunksAppended
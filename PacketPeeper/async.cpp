@@ -1,62 +1,385 @@
 #include "async.hpp"
 
-#include <functional>
 #include <iostream>
 #include <stdexcept>
 
+struct peep::detail::async_worker
+{
+    async_worker(peep::async& pool, std::size_t index)
+        : pool_(pool),
+          index_(index),
+          seed_(static_cast<std::uint32_t>(index) + 1)
+    {
+    }
+
+    void run();
+
+    // xorshift, for picking workers to steal from
+    std::uint32_t random()
+    {
+        seed_ ^= seed_ << 13;
+        seed_ ^= seed_ >> 17;
+        seed_ ^= seed_ << 5;
+        return seed_;
+    }
+
+    peep::async& pool_;
+    std::size_t index_;
+    std::uint32_t seed_;
+    async_deque deques_[peep::async::num_priorities];
+    std::thread thread_;
+};
+
 namespace
 {
-    void worker(peep::detail::async_func_queue& queue)
+    // rounds of looking for work a worker tries before going to sleep
+    const int spin_rounds = 64;
+
+    // the worker running on this thread, if any, so tasks it enqueues go on
+    // its own deque
+    thread_local peep::detail::async_worker* current_worker = nullptr;
+
+    void run_task(peep::detail::async_task* task)
     {
-        std::unique_lock<peep::detail::async_func_queue::mutex_type> lock(
-            queue.mutex_);
-        while (!queue.quit_)
+        std::unique_ptr<peep::detail::async_task> owner(task);
+
+        try
         {
-            while (!queue.callbacks_.empty())
-            {
-                const peep::detail::async_func_queue::callback_type callback =
-                    queue.callbacks_.front();
-                queue.callbacks_.pop_front();
-                lock.unlock();
-                try
-                {
-                    callback();
-                }
-                catch (const std::exception& e)
-                {
-                    std::cerr << "peep::async: Callback error: " << e.what()
-                              << "\n";
-                }
-                catch (...)
-                {
-                    std::cerr
-                        << "peep::async: Callback error: unknown exception\n";
-                }
-                lock.lock();
-            }
-            // might have been signalled to quit while invoking callbacks
-            if (queue.quit_)
-                break;
-            queue.cv_.wait(lock);
+            owner->run();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "peep::async: Callback error: " << e.what() << "\n";
+        }
+        catch (...)
+        {
+            std::cerr << "peep::async: Callback error: unknown exception\n";
+        }
+    }
+}
+
+peep::detail::async_deque::ring::ring(std::int64_t size)
+    : capacity(size), slots(new std::atomic<async_task*>[size])
+{
+}
+
+peep::detail::async_deque::async_deque() : top_(0), bottom_(0)
+{
+    rings_.push_back(std::unique_ptr<ring>(new ring(64)));
+    ring_.store(rings_.back().get(), std::memory_order_relaxed);
+}
+
+peep::detail::async_deque::~async_deque() noexcept
+{
+    async_task* task;
+
+    while ((task = pop()) != nullptr)
+        delete task;
+}
+
+void peep::detail::async_deque::push(async_task* task)
+{
+    std::int64_t bottom, top;
+    ring* r;
+
+    bottom = bottom_.load(std::memory_order_relaxed);
+    top = top_.load(std::memory_order_acquire);
+    r = ring_.load(std::memory_order_relaxed);
+
+    if (bottom - top > r->capacity - 1)
+        r = grow(r, top, bottom);
+
+    r->slots[bottom & (r->capacity - 1)].store(
+        task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+}
+
+peep::detail::async_task* peep::detail::async_deque::pop()
+{
+    std::int64_t bottom, top;
+    async_task* task;
+    ring* r;
+
+    bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    r = ring_.load(std::memory_order_relaxed);
+    bottom_.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    top = top_.load(std::memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        // empty
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    task = r->slots[bottom & (r->capacity - 1)].load(std::memory_order_relaxed);
+
+    if (top == bottom)
+    {
+        // the last task, which a thief may be taking too
+        if (!top_.compare_exchange_strong(
+                top,
+                top + 1,
+                std::memory_order_seq_cst,
+                std::memory_order_relaxed))
+            task = nullptr;
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    return task;
+}
+
+peep::detail::async_task* peep::detail::async_deque::steal()
+{
+    std::int64_t bottom, top;
+    async_task* task;
+    ring* r;
+
+    top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bottom = bottom_.load(std::memory_order_acquire);
+
+    if (top >= bottom)
+        return nullptr;
+
+    r = ring_.load(std::memory_order_acquire);
+    task = r->slots[top & (r->capacity - 1)].load(std::memory_order_relaxed);
+
+    // lost to the owner or another thief
+    if (!top_.compare_exchange_strong(
+            top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+
+    return task;
+}
+
+bool peep::detail::async_deque::empty() const
+{
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+}
+
+peep::detail::async_deque::ring*
+peep::detail::async_deque::grow(ring* r, std::int64_t top, std::int64_t bottom)
+{
+    std::unique_ptr<ring> bigger(new ring(r->capacity * 2));
+
+    for (std::int64_t i = top; i < bottom; ++i)
+        bigger->slots[i & (bigger->capacity - 1)].store(
+            r->slots[i & (r->capacity - 1)].load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+
+    rings_.push_back(std::move(bigger));
+    r = rings_.back().get();
+    ring_.store(r, std::memory_order_release);
+
+    return r;
+}
+
+void peep::detail::async_worker::run()
+{
+    async_task* task;
+
+    current_worker = this;
+
+    for (;;)
+    {
+        if ((task = pool_.find(index_)) != nullptr)
+        {
+            run_task(task);
+            continue;
         }
+
+        // everything enqueued before quitting has been run
+        if (pool_.quit_.load() && pool_.idle())
+            break;
+
+        pool_.sleep();
     }
+
+    current_worker = nullptr;
 }
 
 peep::async::async(std::size_t num_threads)
+    : nshared_(0), nsleeping_(0), nsearching_(0), quit_(false)
 {
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+    if (num_threads == 0)
+        num_threads = 1;
+
+    // every worker has to exist before any of them can steal
     workers_.reserve(num_threads);
     for (std::size_t i = 0; i < num_threads; ++i)
-        workers_.push_back(std::thread(worker, std::ref(queue_)));
+        workers_.push_back(std::unique_ptr<detail::async_worker>(
+            new detail::async_worker(*this, i)));
+
+    try
+    {
+        for (auto it = workers_.begin(); it != workers_.end(); ++it)
+            (*it)->thread_ =
+                std::thread(&detail::async_worker::run, it->get());
+    }
+    catch (...)
+    {
+        quit_ = true;
+        wake();
+        for (auto it = workers_.begin(); it != workers_.end(); ++it)
+        {
+            if ((*it)->thread_.joinable())
+                (*it)->thread_.join();
+        }
+        throw;
+    }
 }
 
 peep::async::~async() noexcept
 {
+    assert(!quit_);
+    quit_ = true;
+    wake();
+    for (auto it = workers_.begin(); it != workers_.end(); ++it)
+        (*it)->thread_.join();
+}
+
+void peep::async::push(detail::async_task* task, priority prio)
+{
+    assert(!quit_);
+    assert(prio >= 0 && prio < num_priorities);
+
+    if (current_worker != nullptr && &current_worker->pool_ == this)
+    {
+        current_worker->deques_[prio].push(task);
+    }
+    else
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        shared_[prio].push_back(task);
+        ++nshared_;
+    }
+
+    wake();
+}
+
+// the next task for worker self, or nullptr if there's none to be found
+peep::detail::async_task* peep::async::find(std::size_t self)
+{
+    detail::async_task* task;
+
+    if ((task = take(self)) != nullptr)
+        return task;
+
+    // While any worker is searching, pushes leave the sleepers be. One which
+    // finds a task wakes another in its place, so more workers are woken only
+    // as long as they find work
+    ++nsearching_;
+
+    for (int round = 0; round < spin_rounds && !quit_.load(); ++round)
+    {
+        if ((task = take(self)) != nullptr)
+        {
+            if (--nsearching_ == 0)
+                wake();
+            return task;
+        }
+
+        std::this_thread::yield();
+    }
+
+    --nsearching_;
+
+    return nullptr;
+}
+
+// one look for a task, the highest priority first, in worker self's own
+// deque, then the shared queue, then the other workers' deques
+peep::detail::async_task* peep::async::take(std::size_t self)
+{
+    detail::async_worker& worker = *workers_[self];
+    detail::async_task* task;
+    std::size_t n, victim;
+
+    n = workers_.size();
+
+    // deques are checked with empty() first, as it doesn't need the fences
+    // pop() and steal() do
+    for (int prio = high; prio < num_priorities; ++prio)
     {
-        std::lock_guard<mutex_type> lock(queue_.mutex_);
-        assert(!queue_.quit_);
-        queue_.quit_ = true;
+        if (!worker.deques_[prio].empty() &&
+            (task = worker.deques_[prio].pop()) != nullptr)
+            return task;
+
+        if (nshared_.load() > 0)
+        {
+            std::lock_guard<mutex_type> lock(mutex_);
+            if (!shared_[prio].empty())
+            {
+                task = shared_[prio].front();
+                shared_[prio].pop_front();
+                --nshared_;
+                return task;
+            }
+        }
+
+        // starting somewhere random so thieves spread out
+        victim = worker.random();
+        for (std::size_t i = 0; i < n; ++i, ++victim)
+        {
+            detail::async_deque& deque = workers_[victim % n]->deques_[prio];
+
+            if (victim % n != self && !deque.empty() &&
+                (task = deque.steal()) != nullptr)
+                return task;
+        }
     }
-    queue_.cv_.notify_all();
+
+    return nullptr;
+}
+
+bool peep::async::idle() const
+{
+    if (nshared_.load() > 0)
+        return false;
+
     for (auto it = workers_.begin(); it != workers_.end(); ++it)
-        it->join();
+    {
+        for (int prio = high; prio < num_priorities; ++prio)
+        {
+            if (!(*it)->deques_[prio].empty())
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Sleeps until woken, unless there is work. A task pushed while going to
+// sleep is either seen by idle(), or its push sees nsleeping_, and no
+// searchers, and takes the lock to wake the worker, which it can only get
+// once the worker is waiting
+void peep::async::sleep()
+{
+    std::unique_lock<mutex_type> lock(mutex_);
+
+    ++nsleeping_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle() && !quit_.load())
+        cv_.wait(lock);
+    --nsleeping_;
+}
+
+void peep::async::wake()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (nsleeping_.load() > 0 && (nsearching_.load() == 0 || quit_.load()))
+    {
+        std::lock_guard<mutex_type> lock(mutex_);
+        if (quit_.load())
+            cv_.notify_all();
+        else
+            cv_.notify_one();
+    }
 }
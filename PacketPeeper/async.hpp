@@ -1,12 +1,18 @@
 #ifndef PACKETPEEPER_ASYNC_HPP
 #define PACKETPEEPER_ASYNC_HPP
 
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <deque>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace peep
@@ -15,51 +21,161 @@ namespace peep
 
     namespace detail
     {
-        struct async_func_queue
+        // Tasks are type erased by hand rather than with std::function, so
+        // they only have to be movable and are never copied
+        struct async_task
         {
-            typedef std::mutex mutex_type;
-            typedef std::condition_variable condition_variable_type;
-            typedef std::function<void()> callback_type;
+            virtual ~async_task()
+            {
+            }
+
+            virtual void run() = 0;
+        };
+
+        template<typename Function>
+        struct async_task_impl : async_task
+        {
+            explicit async_task_impl(Function&& function)
+                : function_(std::move(function))
+            {
+            }
+
+            explicit async_task_impl(const Function& function)
+                : function_(function)
+            {
+            }
 
-            async_func_queue() : quit_(false)
+            void run() override
             {
+                function_();
             }
 
-            async_func_queue(const async_func_queue&) = delete;
+            Function function_;
+        };
+
+        // Chase-Lev work-stealing deque, as in "Correct and Efficient
+        // Work-Stealing for Weak Memory Models" (Le et al, 2013). Only the
+        // owning worker pushes and pops, at the bottom; other workers steal
+        // from the top. None of them take a lock.
+        class async_deque
+        {
+          public:
+            async_deque();
+            ~async_deque() noexcept;
 
-            mutex_type mutex_;
-            condition_variable_type cv_;
-            bool quit_;
-            std::deque<callback_type> callbacks_;
+            async_deque(const async_deque&) = delete;
+            async_deque& operator=(const async_deque&) = delete;
+
+            void push(async_task* task); // owner only
+            async_task* pop();           // owner only
+            async_task* steal();
+            bool empty() const;
+
+          private:
+            struct ring
+            {
+                explicit ring(std::int64_t size);
+
+                std::int64_t capacity; // a power of 2
+                std::unique_ptr<std::atomic<async_task*>[]> slots;
+            };
+
+            ring* grow(ring* r, std::int64_t top, std::int64_t bottom);
+
+            std::atomic<std::int64_t> top_;
+            std::atomic<std::int64_t> bottom_;
+            std::atomic<ring*> ring_;
+            // rings grown out of, which thieves may still be reading
+            std::vector<std::unique_ptr<ring>> rings_;
         };
+
+        struct async_worker;
     }
 }
 
 // Not using std::async because I want to limit the number of threads spawned
 // which AFAIK you can't do with std::async.
+//
+// Each worker has a deque per priority, which tasks enqueued from that
+// worker go on, and which idle workers steal from. Tasks enqueued from other
+// threads go on a shared queue per priority. Workers run the highest priority
+// task they can find, looking in their own deque, then the shared queue, then
+// the other workers' deques, and sleep when there is nothing to find.
 class peep::async
 {
-  private:
-    typedef detail::async_func_queue::mutex_type mutex_type;
-    typedef std::thread thread_type;
-
   public:
-    explicit async(std::size_t num_threads = 5);
+    enum priority
+    {
+        high,
+        normal,
+        low,
+        num_priorities
+    };
+
+    // 0 for one thread per CPU
+    explicit async(std::size_t num_threads = 0);
+
+    // runs every task enqueued before returning
     ~async() noexcept;
 
+    async(const async&) = delete;
+    async& operator=(const async&) = delete;
+
+    // Function is called with no arguments, and may throw, though the
+    // exception is only logged
     template<typename Function>
-    void enqueue(const Function& function)
+    void enqueue(Function&& function, priority prio = normal)
     {
-        {
-            std::lock_guard<mutex_type> lock(queue_.mutex_);
-            assert(!queue_.quit_);
-            queue_.callbacks_.push_back(function);
-        }
-        queue_.cv_.notify_one();
+        typedef typename std::decay<Function>::type function_type;
+
+        std::unique_ptr<detail::async_task> task(
+            new detail::async_task_impl<function_type>(
+                std::forward<Function>(function)));
+
+        push(task.get(), prio);
+        task.release();
     }
 
-    detail::async_func_queue queue_;
-    std::vector<thread_type> workers_;
+    // as enqueue, but the result, or exception, is passed on to the future
+    template<typename Function,
+             typename Result = typename std::result_of<
+                 typename std::decay<Function>::type()>::type>
+    std::future<Result> submit(Function&& function, priority prio = normal)
+    {
+        std::packaged_task<Result()> task(std::forward<Function>(function));
+        std::future<Result> future(task.get_future());
+
+        enqueue(std::move(task), prio);
+
+        return future;
+    }
+
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+
+  private:
+    friend struct detail::async_worker;
+
+    typedef std::mutex mutex_type;
+
+    void push(detail::async_task* task, priority prio);
+    detail::async_task* find(std::size_t self);
+    detail::async_task* take(std::size_t self);
+    bool idle() const;
+    void sleep();
+    void wake();
+
+    std::vector<std::unique_ptr<detail::async_worker>> workers_;
+
+    mutex_type mutex_; // guards shared_ and sleeping on cv_
+    std::condition_variable cv_;
+    std::deque<detail::async_task*> shared_[num_priorities];
+    std::atomic<std::size_t> nshared_; // tasks in shared_
+    std::atomic<std::size_t> nsleeping_;
+    std::atomic<std::size_t> nsearching_; // workers looking for tasks
+    std::atomic<bool> quit_;
 };
 
 #endif
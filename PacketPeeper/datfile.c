@@ -0,0 +1,60 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "datfile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+const uint8_t* map_datfile(const char* path, size_t* len)
+{
+    struct stat sb;
+    void* base;
+    int fd;
+
+    if (path == NULL)
+        return NULL;
+
+    if ((fd = open(path, O_RDONLY, 0)) == -1)
+        return NULL;
+
+    if (fstat(fd, &sb) == -1 || sb.st_size < 1)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+        return NULL;
+
+    *len = (size_t)sb.st_size;
+
+    return base;
+}
+
+void unmap_datfile(const uint8_t* base, size_t len)
+{
+    munmap((void*)base, len);
+}
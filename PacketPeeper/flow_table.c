@@ -0,0 +1,169 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "flow_table.h"
+#include "hash_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* flows are kept in a hash map of keys to value pointers */
+struct flow_table
+{
+    struct hash_map map;
+};
+
+/* arguments to call_value_free */
+struct value_free_args
+{
+    flow_value_free_fptr value_free;
+};
+
+static void call_value_free(const void* key, void* value, void* context);
+
+int flow_key_init(
+    struct flow_key* key,
+    uint8_t protocol,
+    const void* src,
+    const void* dst,
+    size_t addrlen,
+    uint16_t sport,
+    uint16_t dport)
+{
+    uint8_t a[FLOW_ADDR_LEN], b[FLOW_ADDR_LEN];
+    int ret;
+
+    memset(a, 0, sizeof(a));
+    memset(b, 0, sizeof(b));
+
+    if (addrlen == 4)
+    {
+        /* ::ffff:a.b.c.d */
+        a[10] = a[11] = b[10] = b[11] = 0xff;
+        memcpy(&a[12], src, 4);
+        memcpy(&b[12], dst, 4);
+    }
+    else
+    {
+        memcpy(a, src, FLOW_ADDR_LEN);
+        memcpy(b, dst, FLOW_ADDR_LEN);
+    }
+
+    if ((ret = memcmp(a, b, FLOW_ADDR_LEN)) == 0)
+        ret = (sport < dport) ? -1 : (sport > dport);
+
+    memset(key, 0, sizeof(*key));
+    key->protocol = protocol;
+
+    if (ret <= 0)
+    {
+        memcpy(key->addr[0], a, FLOW_ADDR_LEN);
+        memcpy(key->addr[1], b, FLOW_ADDR_LEN);
+        key->port[0] = sport;
+        key->port[1] = dport;
+        return 0;
+    }
+
+    memcpy(key->addr[0], b, FLOW_ADDR_LEN);
+    memcpy(key->addr[1], a, FLOW_ADDR_LEN);
+    key->port[0] = dport;
+    key->port[1] = sport;
+    return 1;
+}
+
+struct flow_table* flow_table_create(size_t capacity)
+{
+    struct flow_table* ft;
+
+    if ((ft = malloc(sizeof(*ft))) == NULL)
+        return NULL;
+
+    if (capacity < FLOW_TABLE_MIN_CAPACITY)
+        capacity = FLOW_TABLE_MIN_CAPACITY;
+
+    if (hash_map_init(
+            &ft->map, sizeof(struct flow_key), sizeof(void*), capacity) == -1)
+    {
+        free(ft);
+        return NULL;
+    }
+
+    return ft;
+}
+
+void flow_table_free(struct flow_table* ft)
+{
+    if (ft == NULL)
+        return;
+
+    hash_map_destroy(&ft->map);
+    free(ft);
+}
+
+void* flow_table_find(const struct flow_table* ft, const struct flow_key* key)
+{
+    void** value;
+
+    value = hash_map_find(&ft->map, key);
+
+    return (value != NULL) ? *value : NULL;
+}
+
+int flow_table_insert(
+    struct flow_table* ft, const struct flow_key* key, void* value)
+{
+    void** slot;
+
+    if ((slot = hash_map_insert(&ft->map, key, NULL)) == NULL)
+        return -1;
+
+    *slot = value;
+
+    return 0;
+}
+
+void* flow_table_remove(struct flow_table* ft, const struct flow_key* key)
+{
+    void* value;
+
+    return (hash_map_remove(&ft->map, key, &value) == 1) ? value : NULL;
+}
+
+size_t flow_table_count(const struct flow_table* ft)
+{
+    return hash_map_count(&ft->map);
+}
+
+void flow_table_clear(struct flow_table* ft, flow_value_free_fptr value_free)
+{
+    struct value_free_args args;
+
+    if (value_free != NULL)
+    {
+        args.value_free = value_free;
+        hash_map_foreach(&ft->map, call_value_free, &args);
+    }
+
+    hash_map_clear(&ft->map);
+}
+
+static void call_value_free(const void* key, void* value, void* context)
+{
+    (void)key;
+    ((struct value_free_args*)context)->value_free(*(void**)value);
+}
@@ -0,0 +1,84 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _FLOW_TABLE_H_
+#define _FLOW_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* IPv4 addresses are stored as IPv4-mapped IPv6 addresses */
+#define FLOW_ADDR_LEN 16
+
+/* number of flows a new table has room for, at least */
+#define FLOW_TABLE_MIN_CAPACITY 64
+
+/* a flow's 5-tuple, canonicalised so that both directions of a flow have the
+   same key. Keys are hashed and compared as bytes, so must be set up with
+   flow_key_init */
+struct flow_key
+{
+    uint8_t addr[2][FLOW_ADDR_LEN]; /* endpoint 0 is the lesser endpoint */
+    uint16_t port[2];
+    uint8_t protocol;
+    uint8_t pad[3];
+};
+
+struct flow_table;
+
+typedef void (*flow_value_free_fptr)(void* value);
+
+/* sets up key for a packet from src:sport to dst:dport, addresses being
+   addrlen (4 or 16) bytes in network byte order. Returns 0 if the source is
+   endpoint 0 of the key, or 1 if the endpoints were swapped */
+int flow_key_init(
+    struct flow_key* key,
+    uint8_t protocol,
+    const void* src,
+    const void* dst,
+    size_t addrlen,
+    uint16_t sport,
+    uint16_t dport);
+
+/* creates an empty table, with room for at least capacity flows before it
+   has to grow. Returns NULL if memory runs out */
+struct flow_table* flow_table_create(size_t capacity);
+
+/* frees the table, but not the values stored in it, see flow_table_clear */
+void flow_table_free(struct flow_table* ft);
+
+/* returns the value stored for key, or NULL */
+void* flow_table_find(const struct flow_table* ft, const struct flow_key* key);
+
+/* stores value, which must not be NULL, for key, which must not already be
+   in the table. Returns 0 on success, or -1 if the table couldn't grow */
+int flow_table_insert(
+    struct flow_table* ft, const struct flow_key* key, void* value);
+
+/* removes key from the table, returning the value that was stored for it,
+   or NULL if there was none */
+void* flow_table_remove(struct flow_table* ft, const struct flow_key* key);
+
+/* number of flows in the table */
+size_t flow_table_count(const struct flow_table* ft);
+
+/* removes every flow, calling value_free, if not NULL, on each value */
+void flow_table_clear(struct flow_table* ft, flow_value_free_fptr value_free);
+
+#endif
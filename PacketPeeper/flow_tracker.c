@@ -0,0 +1,221 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "flow_tracker.h"
+#include "flow_table.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void lru_unlink(struct flow_tracker* ft, struct flow_stats* stats);
+static void lru_push(struct flow_tracker* ft, struct flow_stats* stats);
+
+struct flow_tracker* flow_tracker_create(double idle_timeout)
+{
+    struct flow_tracker* ft;
+
+    if ((ft = malloc(sizeof(*ft))) == NULL)
+        return NULL;
+
+    if ((ft->table = flow_table_create(0)) == NULL)
+    {
+        free(ft);
+        return NULL;
+    }
+
+    ft->head = NULL;
+    ft->tail = NULL;
+    ft->idle_timeout = idle_timeout;
+    ft->latest = 0.0;
+    ft->expired = 0;
+
+    return ft;
+}
+
+void flow_tracker_free(struct flow_tracker* ft)
+{
+    if (ft == NULL)
+        return;
+
+    flow_tracker_clear(ft);
+    flow_table_free(ft->table);
+    free(ft);
+}
+
+const struct flow_stats* flow_tracker_add(
+    struct flow_tracker* ft,
+    const struct flow_key* key,
+    int endpoint,
+    size_t length,
+    double time)
+{
+    struct flow_stats* stats;
+    int dir;
+
+    flow_tracker_expire(ft, time);
+
+    if ((stats = flow_table_find(ft->table, key)) == NULL)
+    {
+        if ((stats = malloc(sizeof(*stats))) == NULL)
+            return NULL;
+
+        memset(stats, 0, sizeof(*stats));
+        stats->key = *key;
+        stats->first = time;
+        stats->last = time;
+        stats->initiator = endpoint;
+
+        if (flow_table_insert(ft->table, key, stats) == -1)
+        {
+            free(stats);
+            return NULL;
+        }
+    }
+    else
+    {
+        lru_unlink(ft, stats);
+    }
+
+    lru_push(ft, stats);
+
+    dir = (endpoint == stats->initiator) ? 0 : 1;
+    ++stats->packets[dir];
+    stats->bytes[dir] += length;
+
+    if (time > stats->last)
+        stats->last = time;
+
+    return stats;
+}
+
+void flow_tracker_remove(
+    struct flow_tracker* ft,
+    const struct flow_key* key,
+    int endpoint,
+    size_t length,
+    double time)
+{
+    struct flow_stats* stats;
+    int dir;
+
+    if ((stats = flow_table_find(ft->table, key)) == NULL)
+        return;
+
+    /* a packet older than the flow was counted in one since expired */
+    if (time < stats->first)
+        return;
+
+    dir = (endpoint == stats->initiator) ? 0 : 1;
+
+    if (stats->packets[dir] == 0)
+        return;
+
+    --stats->packets[dir];
+    stats->bytes[dir] -=
+        (length < stats->bytes[dir]) ? length : stats->bytes[dir];
+
+    if (stats->packets[0] == 0 && stats->packets[1] == 0)
+    {
+        (void)flow_table_remove(ft->table, &stats->key);
+        lru_unlink(ft, stats);
+        free(stats);
+    }
+}
+
+void flow_tracker_expire(struct flow_tracker* ft, double time)
+{
+    struct flow_stats* stats;
+
+    if (time > ft->latest)
+        ft->latest = time;
+
+    if (ft->idle_timeout <= 0.0)
+        return;
+
+    /* ages are measured against the newest packet, so packets arriving out
+       of order don't expire anything early */
+    while ((stats = ft->tail) != NULL &&
+           stats->last + ft->idle_timeout < ft->latest)
+    {
+        (void)flow_table_remove(ft->table, &stats->key);
+        lru_unlink(ft, stats);
+        free(stats);
+        ++ft->expired;
+    }
+}
+
+void flow_tracker_set_idle_timeout(struct flow_tracker* ft, double timeout)
+{
+    ft->idle_timeout = timeout;
+}
+
+const struct flow_stats*
+flow_tracker_find(const struct flow_tracker* ft, const struct flow_key* key)
+{
+    return flow_table_find(ft->table, key);
+}
+
+size_t flow_tracker_count(const struct flow_tracker* ft)
+{
+    return flow_table_count(ft->table);
+}
+
+void flow_tracker_foreach(
+    const struct flow_tracker* ft, flow_stats_fptr fptr, void* context)
+{
+    const struct flow_stats* stats;
+
+    for (stats = ft->head; stats != NULL; stats = stats->next)
+        fptr(stats, context);
+}
+
+void flow_tracker_clear(struct flow_tracker* ft)
+{
+    flow_table_clear(ft->table, free);
+    ft->head = NULL;
+    ft->tail = NULL;
+    ft->latest = 0.0;
+    ft->expired = 0;
+}
+
+static void lru_unlink(struct flow_tracker* ft, struct flow_stats* stats)
+{
+    if (stats->prev != NULL)
+        stats->prev->next = stats->next;
+    else
+        ft->head = stats->next;
+
+    if (stats->next != NULL)
+        stats->next->prev = stats->prev;
+    else
+        ft->tail = stats->prev;
+}
+
+static void lru_push(struct flow_tracker* ft, struct flow_stats* stats)
+{
+    stats->prev = NULL;
+    stats->next = ft->head;
+
+    if (ft->head != NULL)
+        ft->head->prev = stats;
+    else
+        ft->tail = stats;
+
+    ft->head = stats;
+}
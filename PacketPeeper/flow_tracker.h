@@ -0,0 +1,103 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _FLOW_TRACKER_H_
+#define _FLOW_TRACKER_H_
+
+#include "flow_table.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* counts the packets and bytes of connectionless flows, such as UDP 5-tuples
+   or ICMP queries, keyed by flow_key. Flows are kept in a list ordered by
+   when they last saw a packet, so idle ones can be expired from its tail in
+   O(1) each, keeping the cost of a packet constant however many flows there
+   are. Times are in seconds, on any clock the caller likes */
+
+struct flow_stats
+{
+    struct flow_key key;
+    /* by direction, 0 being from the endpoint that sent the first packet */
+    unsigned long long packets[2];
+    unsigned long long bytes[2];
+    double first; /* time of the first packet */
+    double last;  /* time of the newest packet */
+    int initiator; /* endpoint of key which sent the first packet */
+    struct flow_stats* prev; /* more recently active */
+    struct flow_stats* next; /* less recently active */
+};
+
+struct flow_tracker
+{
+    struct flow_table* table;
+    struct flow_stats* head; /* most recently active */
+    struct flow_stats* tail;
+    double idle_timeout; /* 0 never to expire flows */
+    double latest;       /* time of the newest packet seen */
+    unsigned long long expired; /* flows expired so far */
+};
+
+typedef void (*flow_stats_fptr)(const struct flow_stats* stats, void* context);
+
+/* returns NULL if memory runs out */
+struct flow_tracker* flow_tracker_create(double idle_timeout);
+void flow_tracker_free(struct flow_tracker* ft);
+
+/* counts a packet of length bytes, sent at time by the endpoint given by
+   endpoint, as returned by flow_key_init. Flows idle for longer than the
+   timeout are expired first. Returns the packet's flow, or NULL if memory
+   runs out */
+const struct flow_stats* flow_tracker_add(
+    struct flow_tracker* ft,
+    const struct flow_key* key,
+    int endpoint,
+    size_t length,
+    double time);
+
+/* takes back a packet counted by flow_tracker_add, with the same arguments,
+   forgetting its flow once none of the flow's packets are left. The flow's
+   times are left alone, as the times of its other packets aren't kept */
+void flow_tracker_remove(
+    struct flow_tracker* ft,
+    const struct flow_key* key,
+    int endpoint,
+    size_t length,
+    double time);
+
+/* expires every flow idle for longer than the timeout at time */
+void flow_tracker_expire(struct flow_tracker* ft, double time);
+
+/* changes the idle timeout, 0 never to expire flows */
+void flow_tracker_set_idle_timeout(struct flow_tracker* ft, double timeout);
+
+/* returns the flow for key, or NULL */
+const struct flow_stats*
+flow_tracker_find(const struct flow_tracker* ft, const struct flow_key* key);
+
+size_t flow_tracker_count(const struct flow_tracker* ft);
+
+/* calls fptr on every flow, from most to least recently active */
+void flow_tracker_foreach(
+    const struct flow_tracker* ft, flow_stats_fptr fptr, void* context);
+
+/* forgets every flow */
+void flow_tracker_clear(struct flow_tracker* ft);
+
+#endif
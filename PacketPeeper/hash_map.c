@@ -0,0 +1,388 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "hash_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Open addressing with Robin Hood linear probing, over a power of two
+    number of slots. An entry being inserted takes the slot of any entry it
+    meets which is closer to its home slot, so probe sequences stay short
+    and even at high load, and a lookup can stop as soon as it meets an
+    entry closer to home than the key would be. Removal shifts the rest of
+    the probe sequence back a slot, so no tombstones are left behind.
+
+    Each slot is the key's 64-bit hash, 0 if the slot is empty, then the key,
+    then the value. Hashes are kept so that growing never rehashes keys.
+
+    Keys are hashed with SipHash-1-3 under a random key chosen per map, as
+    most keys come from untrusted capture files and a predictable hash would
+    let one be crafted to degrade every lookup to a linear scan.
+*/
+
+/* grow once more than 7/8 of the slots are in use */
+#define HASH_MAP_LOAD_NUM 7
+#define HASH_MAP_LOAD_DEN 8
+
+/* set in every stored hash, so that 0 can mark an empty slot */
+#define HASH_MAP_USED ((uint64_t)1 << 63)
+
+#define SLOT(map, i)          ((map)->slots + (i) * (map)->stride)
+#define SLOT_HASH(slot)       (*(uint64_t*)(slot))
+#define SLOT_KEY(slot)        ((slot) + sizeof(uint64_t))
+#define SLOT_VALUE(map, slot) ((slot) + (map)->value_offset)
+
+/* how far the entry with hash is from its home slot, when it is at slot i */
+#define PROBE_DISTANCE(map, hash, i) \
+    (((i) - ((hash) & (map)->mask)) & (map)->mask)
+
+static size_t
+find_slot(const struct hash_map* map, const void* key, uint64_t hash);
+static uint8_t* place_entry(
+    struct hash_map* map, const uint8_t* entry, size_t i, size_t dist);
+static int resize(struct hash_map* map, size_t nslots);
+static uint64_t
+siphash(const uint64_t seed[2], const void* data, size_t length);
+
+int hash_map_init(
+    struct hash_map* map, size_t key_size, size_t value_size, size_t capacity)
+{
+    size_t nslots;
+
+    memset(map, 0, sizeof(*map));
+
+    map->key_size = key_size;
+    map->value_size = value_size;
+
+    /* keep hashes and values 8 byte aligned */
+    map->value_offset = (sizeof(uint64_t) + key_size + 7) & ~(size_t)7;
+    map->stride = (map->value_offset + value_size + 7) & ~(size_t)7;
+
+    for (nslots = HASH_MAP_MIN_CAPACITY;
+         nslots / HASH_MAP_LOAD_DEN * HASH_MAP_LOAD_NUM < capacity;
+         nslots *= 2)
+        ;
+
+    if ((map->scratch = malloc(map->stride * 2)) == NULL)
+        return -1;
+
+    if ((map->slots = calloc(nslots, map->stride)) == NULL)
+    {
+        free(map->scratch);
+        map->scratch = NULL;
+        return -1;
+    }
+
+    map->mask = nslots - 1;
+    arc4random_buf(map->seed, sizeof(map->seed));
+
+    return 0;
+}
+
+void hash_map_destroy(struct hash_map* map)
+{
+    free(map->slots);
+    free(map->scratch);
+    memset(map, 0, sizeof(*map));
+}
+
+void* hash_map_find(const struct hash_map* map, const void* key)
+{
+    size_t i;
+
+    i = find_slot(map, key, siphash(map->seed, key, map->key_size));
+
+    return (i != SIZE_MAX) ? SLOT_VALUE(map, SLOT(map, i)) : NULL;
+}
+
+void* hash_map_insert(struct hash_map* map, const void* key, int* existed)
+{
+    uint8_t* slot;
+    uint8_t* entry;
+    uint64_t hash, slot_hash;
+    size_t i, dist;
+
+    hash = siphash(map->seed, key, map->key_size);
+
+    /* look for the key up to where it would be placed */
+    for (i = hash & map->mask, dist = 0;; i = (i + 1) & map->mask, ++dist)
+    {
+        slot = SLOT(map, i);
+        slot_hash = SLOT_HASH(slot);
+
+        if (slot_hash == 0 || PROBE_DISTANCE(map, slot_hash, i) < dist)
+            break;
+
+        if (slot_hash == hash &&
+            memcmp(SLOT_KEY(slot), key, map->key_size) == 0)
+        {
+            if (existed != NULL)
+                *existed = 1;
+            return SLOT_VALUE(map, slot);
+        }
+    }
+
+    if ((map->count + 1) * HASH_MAP_LOAD_DEN >
+        (map->mask + 1) * HASH_MAP_LOAD_NUM)
+    {
+        /* the key's place moves, so start again from its home slot */
+        if (resize(map, (map->mask + 1) * 2) == -1)
+            return NULL;
+        i = hash & map->mask;
+        dist = 0;
+    }
+
+    entry = map->scratch;
+    memset(entry, 0, map->stride);
+    SLOT_HASH(entry) = hash;
+    memcpy(SLOT_KEY(entry), key, map->key_size);
+
+    if (existed != NULL)
+        *existed = 0;
+    ++map->count;
+
+    return SLOT_VALUE(map, place_entry(map, entry, i, dist));
+}
+
+int hash_map_remove(struct hash_map* map, const void* key, void* value)
+{
+    uint8_t* slot;
+    uint8_t* next;
+    uint64_t hash;
+    size_t i, j;
+
+    if ((i = find_slot(map, key, siphash(map->seed, key, map->key_size))) ==
+        SIZE_MAX)
+        return 0;
+
+    if (value != NULL)
+        memcpy(value, SLOT_VALUE(map, SLOT(map, i)), map->value_size);
+
+    /* shift back the entries after it, up to an empty slot or one already
+       in its home slot */
+    for (j = (i + 1) & map->mask;; i = j, j = (j + 1) & map->mask)
+    {
+        slot = SLOT(map, i);
+        next = SLOT(map, j);
+        hash = SLOT_HASH(next);
+
+        if (hash == 0 || PROBE_DISTANCE(map, hash, j) == 0)
+            break;
+
+        memcpy(slot, next, map->stride);
+    }
+
+    SLOT_HASH(slot) = 0;
+    --map->count;
+
+    return 1;
+}
+
+size_t hash_map_count(const struct hash_map* map)
+{
+    return map->count;
+}
+
+void hash_map_foreach(
+    const struct hash_map* map, hash_map_entry_fptr fn, void* context)
+{
+    uint8_t* slot;
+    size_t i;
+
+    for (i = 0; i <= map->mask; ++i)
+    {
+        slot = SLOT(map, i);
+
+        if (SLOT_HASH(slot) != 0)
+            fn(SLOT_KEY(slot), SLOT_VALUE(map, slot), context);
+    }
+}
+
+void hash_map_clear(struct hash_map* map)
+{
+    size_t i;
+
+    for (i = 0; i <= map->mask; ++i)
+        SLOT_HASH(SLOT(map, i)) = 0;
+
+    map->count = 0;
+}
+
+/* returns the index of the slot holding key, or SIZE_MAX */
+static size_t
+find_slot(const struct hash_map* map, const void* key, uint64_t hash)
+{
+    const uint8_t* slot;
+    uint64_t slot_hash;
+    size_t i, dist;
+
+    for (i = hash & map->mask, dist = 0;; i = (i + 1) & map->mask, ++dist)
+    {
+        slot = SLOT(map, i);
+        slot_hash = SLOT_HASH(slot);
+
+        /* key would have taken the slot of any entry closer to home */
+        if (slot_hash == 0 || PROBE_DISTANCE(map, slot_hash, i) < dist)
+            return SIZE_MAX;
+
+        if (slot_hash == hash &&
+            memcmp(SLOT_KEY(slot), key, map->key_size) == 0)
+            return i;
+    }
+    /* NOTREACHED */
+}
+
+/* stores a copy of entry, which must not already be in the map, probing
+   from slot i, dist slots from its home slot, and returns the slot it ends
+   up in. The entries it displaces are carried along in the scratch space,
+   which entry may be the first half of */
+static uint8_t* place_entry(
+    struct hash_map* map, const uint8_t* entry, size_t i, size_t dist)
+{
+    uint8_t* slot;
+    uint8_t* result;
+    uint8_t* other;
+    size_t slot_dist;
+
+    result = NULL;
+    other = (entry == map->scratch) ? map->scratch + map->stride :
+                                      map->scratch;
+
+    for (;; i = (i + 1) & map->mask, ++dist)
+    {
+        slot = SLOT(map, i);
+
+        if (SLOT_HASH(slot) == 0)
+        {
+            memcpy(slot, entry, map->stride);
+            return (result != NULL) ? result : slot;
+        }
+
+        slot_dist = PROBE_DISTANCE(map, SLOT_HASH(slot), i);
+
+        if (slot_dist < dist)
+        {
+            /* take the slot, and carry on placing its old entry */
+            memcpy(other, slot, map->stride);
+            memcpy(slot, entry, map->stride);
+
+            if (result == NULL)
+                result = slot;
+
+            entry = other;
+            other = (entry == map->scratch) ? map->scratch + map->stride :
+                                              map->scratch;
+            dist = slot_dist;
+        }
+    }
+    /* NOTREACHED */
+}
+
+static int resize(struct hash_map* map, size_t nslots)
+{
+    uint8_t* old;
+    uint8_t* entry;
+    size_t i, oldslots;
+
+    old = map->slots;
+    oldslots = map->mask + 1;
+
+    if ((map->slots = calloc(nslots, map->stride)) == NULL)
+    {
+        map->slots = old;
+        return -1;
+    }
+
+    map->mask = nslots - 1;
+
+    for (i = 0; i < oldslots; ++i)
+    {
+        entry = old + i * map->stride;
+
+        if (SLOT_HASH(entry) != 0)
+            (void)place_entry(map, entry, SLOT_HASH(entry) & map->mask, 0);
+    }
+
+    free(old);
+    return 0;
+}
+
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                \
+    do                          \
+    {                           \
+        v0 += v1;               \
+        v1 = ROTL64(v1, 13);    \
+        v1 ^= v0;               \
+        v0 = ROTL64(v0, 32);    \
+        v2 += v3;               \
+        v3 = ROTL64(v3, 16);    \
+        v3 ^= v2;               \
+        v0 += v3;               \
+        v3 = ROTL64(v3, 21);    \
+        v3 ^= v0;               \
+        v2 += v1;               \
+        v1 = ROTL64(v1, 17);    \
+        v1 ^= v2;               \
+        v2 = ROTL64(v2, 32);    \
+    } while (0)
+
+/* SipHash-1-3 of length bytes at data, with HASH_MAP_USED set */
+static uint64_t
+siphash(const uint64_t seed[2], const void* data, size_t length)
+{
+    uint64_t v0, v1, v2, v3, m;
+    const uint8_t* p;
+    size_t i, left;
+
+    v0 = seed[0] ^ 0x736f6d6570736575ULL;
+    v1 = seed[1] ^ 0x646f72616e646f6dULL;
+    v2 = seed[0] ^ 0x6c7967656e657261ULL;
+    v3 = seed[1] ^ 0x7465646279746573ULL;
+
+    p = data;
+
+    for (i = 0; i + sizeof(m) <= length; i += sizeof(m))
+    {
+        memcpy(&m, p + i, sizeof(m));
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    /* the last few bytes, little endian, with the length in the top byte */
+    m = (uint64_t)length << 56;
+
+    for (left = length - i; left > 0; --left)
+        m |= (uint64_t)p[i + left - 1] << (8 * (left - 1));
+
+    v3 ^= m;
+    SIPROUND;
+    v0 ^= m;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+
+    return (v0 ^ v1 ^ v2 ^ v3) | HASH_MAP_USED;
+}
@@ -0,0 +1,85 @@
+/*
+ * Packet Peeper
+ * Copyright 2006, 2007, 2008, 2014 Chris E. Holloway
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#ifndef _HASH_MAP_H_
+#define _HASH_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* a resizable hash map of fixed size keys to fixed size values, both stored
+   inline in the map's slots. Keys are hashed and compared as bytes, so any
+   padding in them must be zeroed.
+
+   Pointers to values returned by the map are only valid until the next
+   insert or remove, either of which may move entries around */
+
+/* initial number of slots in a map */
+#define HASH_MAP_MIN_CAPACITY 16
+
+struct hash_map
+{
+    uint8_t* slots;
+    uint8_t* scratch; /* room for two entries, used while inserting */
+    size_t stride;    /* size of a slot */
+    size_t key_size;
+    size_t value_size;
+    size_t value_offset; /* of the value within a slot */
+    size_t mask;         /* number of slots - 1 */
+    size_t count;
+    uint64_t seed[2];
+};
+
+/* called on each entry by hash_map_foreach */
+typedef void (*hash_map_entry_fptr)(
+    const void* key, void* value, void* context);
+
+/* sets up an empty map, with room for at least capacity entries before it
+   has to grow. Returns 0 on success, or -1 if memory runs out */
+int hash_map_init(
+    struct hash_map* map, size_t key_size, size_t value_size, size_t capacity);
+
+/* frees the map's memory, but not anything its values point to */
+void hash_map_destroy(struct hash_map* map);
+
+/* returns a pointer to the value stored for key, or NULL */
+void* hash_map_find(const struct hash_map* map, const void* key);
+
+/* returns a pointer to the value stored for key, adding key with a zeroed
+   value if it isn't in the map yet. If existed is not NULL, it is set to 1
+   if key was already in the map or 0 if it was added. Returns NULL if the
+   map couldn't grow */
+void* hash_map_insert(struct hash_map* map, const void* key, int* existed);
+
+/* removes key from the map, copying its value to value if value is not
+   NULL. Returns 1 if key was removed, or 0 if it wasn't in the map */
+int hash_map_remove(struct hash_map* map, const void* key, void* value);
+
+/* number of entries in the map */
+size_t hash_map_count(const struct hash_map* map);
+
+/* calls fn on every entry. fn must not insert or remove entries */
+void hash_map_foreach(
+    const struct hash_map* map, hash_map_entry_fptr fn, void* context);
+
+/* removes every entry, keeping the slots allocated */
+void hash_map_clear(struct hash_map* map);
+
+#endif
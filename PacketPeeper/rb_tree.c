@@ -21,441 +21,388 @@
 #include <inttypes.h>
 #include <stdlib.h>
 
-/* colours node red and attaches it to the tree at root, only to be used by
-   insert. root may not be NULL */
-static void rb_attach(
-    struct rb_node* root, struct rb_node* node, rb_key_comp_fptr rb_key_comp);
+/* makes new the child of parent that old was, or the root if parent is NULL */
+static void rb_change_child(struct rb_link** root,
+                            struct rb_link* parent,
+                            struct rb_link* old,
+                            struct rb_link* new);
 
-/* fixes the red-black property of the tree at root, returning the new root of
-   the tree */
-static struct rb_node*
-rb_insert_fixup(struct rb_node* root, struct rb_node* node);
+/* left rotates node, node->right is not NULL */
+static void rb_rotate_left(struct rb_link** root, struct rb_link* node);
 
-/* only called by fixup, left rotates node */
-static struct rb_node*
-rb_rotate_left(struct rb_node* root, struct rb_node* node);
+/* right rotates node, node->left is not NULL */
+static void rb_rotate_right(struct rb_link** root, struct rb_link* node);
 
-/* only called by fixup, right rotates node */
-static struct rb_node*
-rb_rotate_right(struct rb_node* root, struct rb_node* node);
+/* fixes the red-black property of the tree at root, after a black node was
+   removed from above node, the (maybe NULL) child of parent */
+static void rb_erase_fixup(struct rb_link** root,
+                           struct rb_link* node,
+                           struct rb_link* parent);
 
-/* fixes the red-black property of the tree at root, returning the new root of
-   the tree */
-static struct rb_node*
-rb_delete_fixup(struct rb_node* root, struct rb_node* node);
-
-static struct rb_node* rb_tree_successor(struct rb_node* node);
-
-static struct rb_node* rb_tree_minimum(struct rb_node* node);
-
-struct rb_node*
-rb_search(struct rb_node* root, const void* key, rb_key_comp_fptr key_comp)
+static inline int rb_is_black(const struct rb_link* node)
 {
-    int ret;
+    /* NULL leaves are black */
+    return (node == NULL || node->colour == RB_NODE_BLACK);
+}
 
-    if (root == NULL)
-        return NULL;
+void rb_link_insert(struct rb_link** root,
+                    struct rb_link* node,
+                    struct rb_link* parent,
+                    struct rb_link** child)
+{
+    struct rb_link *gparent, *uncle;
 
-    ret = key_comp(root->key, key);
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->colour = RB_NODE_RED;
+    *child = node;
 
-    if (ret > 0) /* root is greater than key */
-        return rb_search(root->left, key, key_comp);
+    /* while property 4 is violated (a red node cannot have a red child), the
+       red parent is never the root so always has a parent */
+    while ((parent = node->parent) != NULL && parent->colour == RB_NODE_RED)
+    {
+        gparent = parent->parent;
 
-    if (ret < 0) /* root is less than key */
-        return rb_search(root->right, key, key_comp);
+        if (parent == gparent->left)
+        {
+            uncle = gparent->right;
+            if (!rb_is_black(uncle))
+            { /* case 1 */
+                parent->colour = RB_NODE_BLACK;
+                uncle->colour = RB_NODE_BLACK;
+                gparent->colour = RB_NODE_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right)
+            { /* case 2 */
+                rb_rotate_left(root, parent);
+                parent = node;
+            }
+            /* case 3 */
+            parent->colour = RB_NODE_BLACK;
+            gparent->colour = RB_NODE_RED;
+            rb_rotate_right(root, gparent);
+        }
+        else
+        {
+            uncle = gparent->left;
+            if (!rb_is_black(uncle))
+            { /* case 1 */
+                parent->colour = RB_NODE_BLACK;
+                uncle->colour = RB_NODE_BLACK;
+                gparent->colour = RB_NODE_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left)
+            { /* case 2 */
+                rb_rotate_right(root, parent);
+                parent = node;
+            }
+            /* case 3 */
+            parent->colour = RB_NODE_BLACK;
+            gparent->colour = RB_NODE_RED;
+            rb_rotate_left(root, gparent);
+        }
+        /* the rotated subtree's root is black, so the tree is fixed */
+        break;
+    }
 
-    /* if it isnt greater or less than, then we found a match, so return it */
-    return root;
+    (*root)->colour = RB_NODE_BLACK;
 }
 
-/* inserts node into the tree at root, and returns the (maybe new) root of the tree
-   Assumptions: node is not NULL. */
-struct rb_node*
-rb_insert(struct rb_node* root, struct rb_node* node, rb_key_comp_fptr key_comp)
+void rb_link_erase(struct rb_link** root, struct rb_link* node)
 {
-    if (root == NULL)
+    struct rb_link *child, *parent, *next;
+    int colour;
+
+    if (node->left == NULL || node->right == NULL)
     {
-        node->colour = RB_NODE_BLACK;
-        node->left = NULL;
-        node->right = NULL;
-        node->parent = NULL;
-        return node;
+        /* node is replaced by its only child, if any */
+        child = (node->left != NULL) ? node->left : node->right;
+        parent = node->parent;
+        colour = node->colour;
+
+        if (child != NULL)
+            child->parent = parent;
+        rb_change_child(root, parent, node, child);
     }
-    rb_attach(root, node, key_comp);
-    return rb_insert_fixup(root, node);
-}
-
-/*
-    Assumptions: root and node are not NULL, node does not already
-    exist in root.
-*/
-static void
-rb_attach(struct rb_node* root, struct rb_node* node, rb_key_comp_fptr key_comp)
-{
-    /* if the root element is less than the node */
-    if (key_comp(root->key, node->key) < 0)
+    else
     {
-        if (root->right == NULL)
+        /* node is replaced by its successor, which is moved up from the
+           leftmost node of its right subtree, where its right child takes its
+           place */
+        next = node->right;
+        while (next->left != NULL)
+            next = next->left;
+
+        child = next->right;
+        colour = next->colour;
+
+        if (next->parent == node)
         {
-            node->colour = RB_NODE_RED;
-            node->right = NULL;
-            node->left = NULL;
-            node->parent = root;
-            root->right = node;
+            parent = next;
         }
         else
-            rb_attach(root->right, node, key_comp);
-    }
-    else
-    { /* else the root element is greater than the node, equality is not a possiblity */
-        if (root->left == NULL)
         {
-            node->colour = RB_NODE_RED;
-            node->right = NULL;
-            node->left = NULL;
-            node->parent = root;
-            root->left = node;
+            parent = next->parent;
+            parent->left = child;
+            if (child != NULL)
+                child->parent = parent;
+            next->right = node->right;
+            next->right->parent = next;
         }
-        else
-            rb_attach(root->left, node, key_comp);
+
+        next->left = node->left;
+        next->left->parent = next;
+        next->parent = node->parent;
+        next->colour = node->colour;
+        rb_change_child(root, node->parent, node, next);
     }
+
+    if (colour == RB_NODE_BLACK)
+        rb_erase_fixup(root, child, parent);
 }
 
-/*
-    We assume:
-        root is non-null, node is non-null and has a valid parent (i.e
-        is not the root)
-*/
-static struct rb_node*
-rb_insert_fixup(struct rb_node* root, struct rb_node* node)
+struct rb_link* rb_link_first(struct rb_link* root)
 {
-    struct rb_node* nnephew; /* nodes 'nephew' */
+    if (root == NULL)
+        return NULL;
 
-    /* while property 4 is violated (a red node cannot have a red child) */
-    while (node->parent != NULL && node->parent->parent != NULL &&
-           node->parent->colour == RB_NODE_RED)
-    {
-        if (node->parent == node->parent->parent->left)
-        { /* if our parent is the left child */
-            nnephew = node->parent->parent->right;
-            if (nnephew != NULL && nnephew->colour == RB_NODE_RED)
-            { /* case 1 */
-                node->parent->colour = RB_NODE_BLACK;
-                nnephew->colour = RB_NODE_BLACK;
-                node->parent->parent->colour = RB_NODE_RED;
-                node = node->parent->parent;
-            }
-            else
-            {
-                if (node == node->parent->right)
-                { /* case 2 */
-                    node = node->parent;
-                    root = rb_rotate_left(root, node);
-                    /* note that node is now a level lower in the tree after the rotation,
-                      so is at the same overall level as before the node = node->parent */
-                }
-                /* case 3 */
-                node->parent->colour = RB_NODE_BLACK;
-                node->parent->parent->colour = RB_NODE_RED;
-                root = rb_rotate_right(root, node->parent->parent);
-            }
-        }
-        else
-        { /* else our parent is the right */
-            nnephew = node->parent->parent->left;
-            if (nnephew != NULL && nnephew->colour == RB_NODE_RED)
-            { /* case 1 */
-                node->parent->colour = RB_NODE_BLACK;
-                nnephew->colour = RB_NODE_BLACK;
-                node->parent->parent->colour = RB_NODE_RED;
-                node = node->parent->parent;
-            }
-            else
-            {
-                if (node == node->parent->left)
-                { /* case 2 */
-                    node = node->parent;
-                    root = rb_rotate_right(root, node);
-                    /* note that node is now a level lower in the tree after the rotation,
-                       so is at the same overall level as before the node = node->parent */
-                }
-                /* case 3 */
-                node->parent->colour = RB_NODE_BLACK;
-                node->parent->parent->colour = RB_NODE_RED;
-                root = rb_rotate_left(root, node->parent->parent);
-            }
-        }
-    }
+    while (root->left != NULL)
+        root = root->left;
 
-    root->colour = RB_NODE_BLACK;
     return root;
 }
 
-/*
-    Assumptions; root is not null, node is not null, node->right is not null.
-*/
-static struct rb_node*
-rb_rotate_left(struct rb_node* root, struct rb_node* node)
+struct rb_link* rb_link_next(struct rb_link* node)
 {
-    struct rb_node* nrchild; /* right-hand child of node */
+    struct rb_link* parent;
+
+    if (node->right != NULL)
+        return rb_link_first(node->right);
+
+    while ((parent = node->parent) != NULL && node == parent->right)
+        node = parent;
+
+    return parent;
+}
+
+static void rb_change_child(struct rb_link** root,
+                            struct rb_link* parent,
+                            struct rb_link* old,
+                            struct rb_link* new)
+{
+    if (parent == NULL)
+        *root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rb_rotate_left(struct rb_link** root, struct rb_link* node)
+{
+    struct rb_link* nrchild; /* right-hand child of node */
 
-    /* init nrchild */
     nrchild = node->right;
 
     /* move nrchild's left child to be node's right child */
     node->right = nrchild->left;
-
-    /* if the new right child is a real node, update its parent */
     if (node->right != NULL)
         node->right->parent = node;
 
-    /* node becomes nrchild's left child */
-    nrchild->left = node;
-
-    /* update parents */
+    /* nrchild takes node's place, with node as its left child */
     nrchild->parent = node->parent;
+    rb_change_child(root, node->parent, node, nrchild);
+    nrchild->left = node;
     node->parent = nrchild;
-
-    /* update parents pointers to children */
-    if (nrchild->parent == NULL)
-    {
-        root = nrchild; /* node was the root, so nrchild is the new root */
-    }
-    else if (nrchild->parent->left == node)
-    { /* is nrchild its parents left child? */
-        nrchild->parent->left = nrchild;
-    }
-    else
-    { /* else nrchild must be its parents right child */
-        nrchild->parent->right = nrchild;
-    }
-
-    return root;
 }
 
-/*
-    Assumptions; root is not null, node is not null, node->left is not null.
-*/
-static struct rb_node*
-rb_rotate_right(struct rb_node* root, struct rb_node* node)
+static void rb_rotate_right(struct rb_link** root, struct rb_link* node)
 {
-    struct rb_node* nlchild; /* left-hand child of node */
+    struct rb_link* nlchild; /* left-hand child of node */
 
-    /* init nlchild */
     nlchild = node->left;
 
     /* move nlchild's right child to be node's left child */
     node->left = nlchild->right;
-
-    /* if the new left child is a real node, update its parent */
     if (node->left != NULL)
         node->left->parent = node;
 
-    /* node becomes nlchild's right child */
-    nlchild->right = node;
-
-    /* update parents */
+    /* nlchild takes node's place, with node as its right child */
     nlchild->parent = node->parent;
+    rb_change_child(root, node->parent, node, nlchild);
+    nlchild->right = node;
     node->parent = nlchild;
-
-    /* update parents pointers to children */
-    if (nlchild->parent == NULL)
-    {
-        root = nlchild; /* node was the root, so nlchild is the new root */
-    }
-    else if (nlchild->parent->left == node)
-    { /* is nlchild is its parents left child? */
-        nlchild->parent->left = nlchild;
-    }
-    else
-    { /* else nlchild must be its parents right child */
-        nlchild->parent->right = nlchild;
-    }
-
-    return root;
-}
-
-unsigned int rb_count_tree(struct rb_node* root)
-{
-    if (root == NULL)
-        return 0;
-
-    return (1 + rb_count_tree(root->left) + rb_count_tree(root->right));
 }
 
 /*
-    Assumptions: none.
+    node is one black short of the black height of its sibling, which as a
+    result is never NULL.
 */
-void rb_free_tree(struct rb_node* root, rb_node_free_fptr node_free)
-{
-    if (root == NULL)
-        return;
-
-    rb_free_tree(root->left, node_free);
-    rb_free_tree(root->right, node_free);
-
-    node_free(root);
-}
-
-/*
-    Assumptions: node is not NULL.
-*/
-struct rb_node* rb_node_delete(
-    struct rb_node* root, struct rb_node* node, rb_key_copy_fptr rb_key_copy)
-{
-    struct rb_node *x, *y;
-
-    /* if node does not have two children, y = 'node' */
-    if (node->left == NULL || node->right == NULL)
-        y = node;
-    else /* otherwise y is 'node's successor (node with smallest key greater than 'node') */
-        y = rb_tree_successor(node);
-
-    if (y->left != NULL)
-        x = y->left;
-    else
-        x = y->right;
-
-    if (x != NULL)
-        x->parent = y->parent;
-
-    if (y->parent == NULL)
-        root = x;
-    else if (y == y->parent->left)
-        y->parent->left = x;
-    else
-        y->parent->right = x;
-
-    /* if y is the successor of node */
-    if (y != node)
-    {
-        rb_key_copy(node->key, y->key);
-        node->data = y->data;
-        free(y);
-    }
-    else
-        free(node);
-
-    if (x != NULL && y->colour == RB_NODE_BLACK)
-        root = rb_delete_fixup(root, x);
-
-    return root;
-}
-
-static struct rb_node*
-rb_delete_fixup(struct rb_node* root, struct rb_node* node)
+static void rb_erase_fixup(struct rb_link** root,
+                           struct rb_link* node,
+                           struct rb_link* parent)
 {
-    struct rb_node* w;
+    struct rb_link* w; /* node's sibling */
 
-    while (node != root && node->colour == RB_NODE_BLACK)
+    while (node != *root && rb_is_black(node))
     {
-        if (node == node->parent->left)
+        if (node == parent->left)
         {
-            w = node->parent->right;
-            if (w != NULL && w->colour == RB_NODE_RED)
+            w = parent->right;
+            if (w->colour == RB_NODE_RED)
             {
                 w->colour = RB_NODE_BLACK;
-                node->parent->colour = RB_NODE_RED;
-                root = rb_rotate_left(root, node->parent);
-                w = node->parent->right;
+                parent->colour = RB_NODE_RED;
+                rb_rotate_left(root, parent);
+                w = parent->right;
             }
-            if (w != NULL && w->left != NULL && w->right != NULL &&
-                w->left->colour == RB_NODE_BLACK &&
-                w->right->colour == RB_NODE_BLACK)
+            if (rb_is_black(w->left) && rb_is_black(w->right))
             {
                 w->colour = RB_NODE_RED;
-                node = node->parent;
+                node = parent;
+                parent = node->parent;
+                continue;
             }
-            else
+            if (rb_is_black(w->right))
             {
-                if (w != NULL && w->right != NULL &&
-                    w->right->colour == RB_NODE_BLACK)
-                {
-                    if (w->left != NULL)
-                    {
-                        w->left->colour = RB_NODE_BLACK;
-                        root = rb_rotate_right(root, w);
-                    }
-                    w = node->parent->right;
-                }
-                if (w != NULL)
-                    w->colour = node->parent->colour;
-                node->parent->colour = RB_NODE_BLACK;
-                if (w != NULL && w->right != NULL)
-                    w->right->colour = RB_NODE_BLACK;
-                if (node->parent->right != NULL)
-                    root = rb_rotate_left(root, node->parent);
-                node = root;
+                w->left->colour = RB_NODE_BLACK;
+                w->colour = RB_NODE_RED;
+                rb_rotate_right(root, w);
+                w = parent->right;
             }
+            w->colour = parent->colour;
+            parent->colour = RB_NODE_BLACK;
+            w->right->colour = RB_NODE_BLACK;
+            rb_rotate_left(root, parent);
         }
         else
         {
-            w = node->parent->left;
-            if (w != NULL && w->colour == RB_NODE_RED)
+            w = parent->left;
+            if (w->colour == RB_NODE_RED)
             {
                 w->colour = RB_NODE_BLACK;
-                node->parent->colour = RB_NODE_RED;
-                root = rb_rotate_right(root, node->parent);
-                w = node->parent->left;
+                parent->colour = RB_NODE_RED;
+                rb_rotate_right(root, parent);
+                w = parent->left;
             }
-            if (w != NULL && w->right != NULL && w->left != NULL &&
-                w->right->colour == RB_NODE_BLACK &&
-                w->left->colour == RB_NODE_BLACK)
+            if (rb_is_black(w->right) && rb_is_black(w->left))
             {
                 w->colour = RB_NODE_RED;
-                node = node->parent;
+                node = parent;
+                parent = node->parent;
+                continue;
             }
-            else
+            if (rb_is_black(w->left))
             {
-                if (w != NULL && w->left != NULL &&
-                    w->left->colour == RB_NODE_BLACK)
-                {
-                    if (w->right != NULL)
-                    {
-                        w->right->colour = RB_NODE_BLACK;
-                        root = rb_rotate_left(root, w);
-                    }
-                    w = node->parent->left;
-                }
-                if (w != NULL)
-                    w->colour = node->parent->colour;
-                node->parent->colour = RB_NODE_BLACK;
-                if (w != NULL && w->left != NULL)
-                    w->left->colour = RB_NODE_BLACK;
-                if (node->parent->left != NULL)
-                    root = rb_rotate_right(root, node->parent);
-                node = root;
+                w->right->colour = RB_NODE_BLACK;
+                w->colour = RB_NODE_RED;
+                rb_rotate_left(root, w);
+                w = parent->left;
             }
+            w->colour = parent->colour;
+            parent->colour = RB_NODE_BLACK;
+            w->left->colour = RB_NODE_BLACK;
+            rb_rotate_right(root, parent);
         }
+        node = *root;
     }
 
-    node->colour = RB_NODE_BLACK;
+    if (node != NULL)
+        node->colour = RB_NODE_BLACK;
+}
 
-    return root;
+static inline struct rb_node* rb_node_of(struct rb_link* link)
+{
+    return (link != NULL) ? RB_ENTRY(link, struct rb_node, link) : NULL;
 }
 
-static struct rb_node* rb_tree_successor(struct rb_node* node)
+struct rb_node*
+rb_search(struct rb_node* root, const void* key, rb_key_comp_fptr key_comp)
 {
-    struct rb_node* x;
+    struct rb_link* link;
+    int ret;
 
-    if (node->right != NULL)
-        return rb_tree_minimum(node->right);
+    link = (root != NULL) ? &root->link : NULL;
 
-    x = node->parent;
+    while (link != NULL)
+    {
+        ret = key_comp(rb_node_of(link)->key, key);
+
+        if (ret > 0) /* link is greater than key */
+            link = link->left;
+        else if (ret < 0) /* link is less than key */
+            link = link->right;
+        else /* if it isnt greater or less than, then we found a match */
+            return rb_node_of(link);
+    }
 
-    while (x != NULL && node == x->right)
+    return NULL;
+}
+
+/*
+    Assumptions: node is not NULL, and does not already exist in root.
+*/
+struct rb_node*
+rb_insert(struct rb_node* root, struct rb_node* node, rb_key_comp_fptr key_comp)
+{
+    struct rb_link *tree, *parent, **child;
+
+    tree = (root != NULL) ? &root->link : NULL;
+    parent = NULL;
+    child = &tree;
+
+    while (*child != NULL)
     {
-        node = x;
-        x = x->parent;
+        parent = *child;
+        if (key_comp(rb_node_of(parent)->key, node->key) < 0)
+            child = &parent->right;
+        else
+            child = &parent->left;
     }
 
-    return x;
+    rb_link_insert(&tree, &node->link, parent, child);
+
+    return rb_node_of(tree);
 }
 
-static struct rb_node* rb_tree_minimum(struct rb_node* node)
+unsigned int rb_count_tree(struct rb_node* root)
+{
+    if (root == NULL)
+        return 0;
+
+    return (1 + rb_count_tree(rb_node_of(root->link.left)) +
+            rb_count_tree(rb_node_of(root->link.right)));
+}
+
+/*
+    Assumptions: none.
+*/
+void rb_free_tree(struct rb_node* root, rb_node_free_fptr node_free)
 {
-    while (node->left != NULL)
-        node = node->left;
+    if (root == NULL)
+        return;
+
+    rb_free_tree(rb_node_of(root->link.left), node_free);
+    rb_free_tree(rb_node_of(root->link.right), node_free);
+
+    node_free(root);
+}
+
+/*
+    Assumptions: root and node are not NULL.
+*/
+struct rb_node* rb_node_delete(struct rb_node* root, struct rb_node* node)
+{
+    struct rb_link* tree;
+
+    tree = &root->link;
+    rb_link_erase(&tree, &node->link);
+    free(node);
 
-    return node;
+    return rb_node_of(tree);
 }
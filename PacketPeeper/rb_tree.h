@@ -20,18 +20,101 @@
 #ifndef _RB_TREE_H_
 #define _RB_TREE_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define RB_NODE_RED   1
 #define RB_NODE_BLACK 0
 
+/* An intrusive tree links structs through an rb_link embedded in each of them,
+   so inserting and deleting never allocates, and deleting relinks nodes
+   rather than copying keys. The tree is a pointer to the root link, NULL when
+   empty. */
+struct rb_link
+{
+    struct rb_link* parent;
+    struct rb_link* left;
+    struct rb_link* right;
+    int colour;
+};
+
+/* the struct of type containing link, as its field member */
+#define RB_ENTRY(link, type, member) \
+    ((type*)((char*)(link) - offsetof(type, member)))
+
+/* links node into the tree at root, as the child of parent found at *child,
+   where *child was NULL (or as the root if parent is NULL), and rebalances
+   the tree */
+void rb_link_insert(struct rb_link** root,
+                    struct rb_link* node,
+                    struct rb_link* parent,
+                    struct rb_link** child);
+
+/* unlinks node from the tree at root and rebalances the tree */
+void rb_link_erase(struct rb_link** root, struct rb_link* node);
+
+/* the first and next links in order, or NULL */
+struct rb_link* rb_link_first(struct rb_link* root);
+struct rb_link* rb_link_next(struct rb_link* node);
+
+/* Defines static functions to find and insert structs of type, linked through
+   their member field and ordered by cmp, which is given two const type*
+   and returns less than, equal to or greater than 0, as memcmp does. Unlike
+   the rb_node functions, the comparisons can be inlined.
+
+   type* name_find(struct rb_link* root, const type* key)
+        returns the node comparing equal to key, or NULL.
+   type* name_insert(struct rb_link** root, type* node)
+        inserts node, unless a node comparing equal to it is already in the
+        tree, in which case that node is returned instead of NULL. */
+#define RB_GENERATE_STATIC(name, type, member, cmp)                         \
+    static inline type* name##_find(struct rb_link* root, const type* key)  \
+    {                                                                       \
+        int ret;                                                            \
+                                                                            \
+        while (root != NULL)                                                \
+        {                                                                   \
+            ret = cmp(RB_ENTRY(root, type, member), key);                   \
+            if (ret > 0)                                                    \
+                root = root->left;                                          \
+            else if (ret < 0)                                               \
+                root = root->right;                                         \
+            else                                                            \
+                return RB_ENTRY(root, type, member);                        \
+        }                                                                   \
+                                                                            \
+        return NULL;                                                        \
+    }                                                                       \
+                                                                            \
+    static inline type* name##_insert(struct rb_link** root, type* node)    \
+    {                                                                       \
+        struct rb_link *parent, **child;                                    \
+        int ret;                                                            \
+                                                                            \
+        parent = NULL;                                                      \
+        child = root;                                                       \
+        while (*child != NULL)                                              \
+        {                                                                   \
+            parent = *child;                                                \
+            ret = cmp(RB_ENTRY(parent, type, member), node);                \
+            if (ret > 0)                                                    \
+                child = &parent->left;                                      \
+            else if (ret < 0)                                               \
+                child = &parent->right;                                     \
+            else                                                            \
+                return RB_ENTRY(parent, type, member);                      \
+        }                                                                   \
+                                                                            \
+        rb_link_insert(root, &node->member, parent, child);                 \
+        return NULL;                                                        \
+    }
+
+/* A tree of malloc'd nodes holding a copy of their key, compared through a
+   function pointer, built on the intrusive tree above. */
 struct rb_node
 {
-    struct rb_node* parent;
-    struct rb_node* left;
-    struct rb_node* right;
+    struct rb_link link;
     void* data;
-    int colour;
     /* the key field is variable sized */
     uint8_t key[];
 };
@@ -40,8 +123,6 @@ typedef int (*rb_key_comp_fptr)(const void* key_a, const void* key_b);
 
 typedef void (*rb_node_free_fptr)(struct rb_node* node);
 
-typedef void (*rb_key_copy_fptr)(void* dst, const void* src);
-
 /* searches tree at root for node containing key */
 struct rb_node*
 rb_search(struct rb_node* root, const void* key, rb_key_comp_fptr rb_key_comp);
@@ -57,9 +138,8 @@ unsigned int rb_count_tree(struct rb_node* root);
 /* deletes the tree at root */
 void rb_free_tree(struct rb_node* root, rb_node_free_fptr node_free);
 
-/* deletes a node from the tree, and returns the (maybe new) root of the tree,
-   maintains the red-black tree property. */
-struct rb_node* rb_node_delete(
-    struct rb_node* root, struct rb_node* node, rb_key_copy_fptr rb_key_copy);
+/* deletes and frees a node from the tree, and returns the (maybe new) root of
+   the tree, maintains the red-black tree property. */
+struct rb_node* rb_node_delete(struct rb_node* root, struct rb_node* node);
 
 #endif
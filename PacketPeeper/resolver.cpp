@@ -0,0 +1,788 @@
+#include "resolver.hpp"
+
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace
+{
+    typedef std::chrono::steady_clock clock_type;
+
+    const char* const default_port = "53";
+
+    // PTR queries are sent again if there is no answer within the timeout,
+    // until they have been sent max_attempts times
+    const std::chrono::milliseconds query_timeout(2000);
+    const int max_attempts = 3;
+
+    const std::uint16_t dns_type_ptr = 12;
+    const std::uint16_t dns_class_in = 1;
+    const unsigned int dns_rcode_nxdomain = 3;
+
+    // a response which isn't to the query it appears to answer
+    const int not_an_answer = -1;
+
+    // Needed because sockaddr_in/sockaddr_in6 still have pre-C89 style prefixes
+    // to their struct member names :l
+    void sockaddr_helper(sockaddr_in& sin, const peep::resolver::address& addr)
+    {
+        std::memset(&sin, 0, sizeof(sin));
+        sin.sin_len = sizeof(sin);
+        sin.sin_family = AF_INET;
+        std::memcpy(&sin.sin_addr, addr.bytes, sizeof(sin.sin_addr));
+    }
+
+    void sockaddr_helper(sockaddr_in6& sin, const peep::resolver::address& addr)
+    {
+        std::memset(&sin, 0, sizeof(sin));
+        sin.sin6_len = sizeof(sin);
+        sin.sin6_family = AF_INET6;
+        std::memcpy(&sin.sin6_addr, addr.bytes, sizeof(sin.sin6_addr));
+    }
+
+    template<typename SockAddrType>
+    peep::resolver::result getnameinfo_helper(
+        const peep::resolver::address& addr, std::string& name)
+    {
+        int ret;
+        SockAddrType sin; // sockaddr_in or sockaddr_in6
+        char host[NI_MAXHOST];
+
+        sockaddr_helper(sin, addr);
+
+        if ((ret = ::getnameinfo(
+                 reinterpret_cast<struct sockaddr*>(&sin),
+                 sizeof(sin),
+                 host,
+                 sizeof(host),
+                 NULL,
+                 0,
+                 NI_NAMEREQD)) != 0)
+            return (ret == EAI_NONAME) ? peep::resolver::noname
+                                       : peep::resolver::error;
+
+        name = host;
+        return peep::resolver::success;
+    }
+
+    peep::resolver::result
+    lookup_system(const peep::resolver::address& addr, std::string& name)
+    {
+        if (addr.family == AF_INET6)
+            return getnameinfo_helper<sockaddr_in6>(addr, name);
+        return getnameinfo_helper<sockaddr_in>(addr, name);
+    }
+
+    // the name PTR records for addr are kept under, without the trailing dot
+    std::string ptr_name(const peep::resolver::address& addr)
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string name;
+        char label[8];
+
+        if (addr.family == AF_INET6)
+        {
+            for (int i = 15; i >= 0; --i)
+            {
+                name += hex[addr.bytes[i] & 0xf];
+                name += '.';
+                name += hex[addr.bytes[i] >> 4];
+                name += '.';
+            }
+            name += "ip6.arpa";
+        }
+        else
+        {
+            for (int i = 3; i >= 0; --i)
+            {
+                std::snprintf(label, sizeof(label), "%u.", addr.bytes[i]);
+                name += label;
+            }
+            name += "in-addr.arpa";
+        }
+
+        return name;
+    }
+
+    void put16(std::vector<unsigned char>& msg, unsigned int n)
+    {
+        msg.push_back((n >> 8) & 0xff);
+        msg.push_back(n & 0xff);
+    }
+
+    unsigned int get16(const unsigned char* p)
+    {
+        return (static_cast<unsigned int>(p[0]) << 8) | p[1];
+    }
+
+    // a recursive query for the PTR records of qname, as in RFC 1035 4.1
+    void encode_query(
+        std::uint16_t id,
+        const std::string& qname,
+        std::vector<unsigned char>& msg)
+    {
+        std::size_t start, end;
+
+        msg.clear();
+        put16(msg, id);
+        put16(msg, 0x0100); // RD
+        put16(msg, 1);      // QDCOUNT
+        put16(msg, 0);      // ANCOUNT
+        put16(msg, 0);      // NSCOUNT
+        put16(msg, 0);      // ARCOUNT
+
+        for (start = 0; start < qname.size(); start = end + 1)
+        {
+            if ((end = qname.find('.', start)) == std::string::npos)
+                end = qname.size();
+            msg.push_back(static_cast<unsigned char>(end - start));
+            msg.insert(msg.end(), qname.begin() + start, qname.begin() + end);
+        }
+        msg.push_back(0);
+
+        put16(msg, dns_type_ptr);
+        put16(msg, dns_class_in);
+    }
+
+    // reads the possibly compressed name at *pos into name, leaving *pos just
+    // past it. Returns false if the name is malformed
+    bool decode_name(
+        const unsigned char* msg,
+        std::size_t len,
+        std::size_t* pos,
+        std::string& name)
+    {
+        std::size_t p, jumps;
+        unsigned int n;
+        char escaped[8];
+
+        name.clear();
+        p = *pos;
+        jumps = 0;
+
+        for (;;)
+        {
+            if (p >= len)
+                return false;
+
+            n = msg[p];
+
+            if ((n & 0xc0) == 0xc0)
+            {
+                // a pointer, which has to point backwards so it can't loop
+                if (p + 1 >= len || (((n & 0x3f) << 8) | msg[p + 1]) >= p)
+                    return false;
+                if (jumps++ == 0)
+                    *pos = p + 2;
+                p = ((n & 0x3f) << 8) | msg[p + 1];
+                continue;
+            }
+
+            if ((n & 0xc0) != 0)
+                return false;
+
+            ++p;
+
+            if (n == 0)
+                break;
+
+            if (p + n > len)
+                return false;
+
+            if (!name.empty())
+                name += '.';
+
+            for (; n > 0; --n, ++p)
+            {
+                if (msg[p] > ' ' && msg[p] < 0x7f && msg[p] != '.' &&
+                    msg[p] != '\\')
+                {
+                    name += static_cast<char>(msg[p]);
+                }
+                else
+                {
+                    std::snprintf(escaped, sizeof(escaped), "\\%03u", msg[p]);
+                    name += escaped;
+                }
+            }
+        }
+
+        if (jumps == 0)
+            *pos = p;
+
+        return true;
+    }
+
+    bool same_name(const std::string& a, const std::string& b)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        for (std::size_t i = 0; i < a.size(); ++i)
+        {
+            if (std::tolower(static_cast<unsigned char>(a[i])) !=
+                std::tolower(static_cast<unsigned char>(b[i])))
+                return false;
+        }
+
+        return true;
+    }
+
+    // the result a response to a PTR query for qname gives, or not_an_answer
+    int parse_response(
+        const unsigned char* msg,
+        std::size_t len,
+        const std::string& qname,
+        std::string& name)
+    {
+        std::size_t pos;
+        unsigned int flags, ancount, type, rclass, rdlength;
+        std::string owner;
+
+        if (len < 12)
+            return not_an_answer;
+
+        flags = get16(msg + 2);
+
+        // QR set, a standard query, and the one question
+        if (!(flags & 0x8000) || (flags & 0x7800) != 0 || get16(msg + 4) != 1)
+            return not_an_answer;
+
+        pos = 12;
+        if (!decode_name(msg, len, &pos, owner) || pos + 4 > len ||
+            !same_name(owner, qname) || get16(msg + pos) != dns_type_ptr ||
+            get16(msg + pos + 2) != dns_class_in)
+            return not_an_answer;
+        pos += 4;
+
+        if ((flags & 0x000f) == dns_rcode_nxdomain)
+            return peep::resolver::noname;
+
+        // truncated answers would need TCP, so let getnameinfo have them
+        // another time
+        if ((flags & 0x000f) != 0 || (flags & 0x0200))
+            return peep::resolver::error;
+
+        // the first PTR record in the answer, which may follow CNAMEs for
+        // classless delegations
+        for (ancount = get16(msg + 6); ancount > 0; --ancount)
+        {
+            if (!decode_name(msg, len, &pos, owner) || pos + 10 > len)
+                return peep::resolver::error;
+
+            type = get16(msg + pos);
+            rclass = get16(msg + pos + 2);
+            rdlength = get16(msg + pos + 8);
+            pos += 10;
+
+            if (pos + rdlength > len)
+                return peep::resolver::error;
+
+            if (type == dns_type_ptr && rclass == dns_class_in)
+            {
+                if (!decode_name(msg, len, &pos, name) || name.empty())
+                    return peep::resolver::error;
+                return peep::resolver::success;
+            }
+
+            pos += rdlength;
+        }
+
+        return peep::resolver::noname;
+    }
+
+    // server is an IPv4 or IPv6 address, optionally followed by @port
+    void parse_server(
+        const std::string& server, sockaddr_storage& ss, socklen_t& sslen)
+    {
+        std::string host, port;
+        std::size_t at;
+        struct addrinfo hints;
+        struct addrinfo* res;
+
+        if ((at = server.rfind('@')) != std::string::npos)
+        {
+            host = server.substr(0, at);
+            port = server.substr(at + 1);
+        }
+        else
+        {
+            host = server;
+            port = default_port;
+        }
+
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+        if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+            throw std::invalid_argument("peep::resolver: Bad DNS server: " +
+                                        server);
+
+        std::memcpy(&ss, res->ai_addr, res->ai_addrlen);
+        sslen = res->ai_addrlen;
+        ::freeaddrinfo(res);
+    }
+
+    std::system_error socket_error(const char* what)
+    {
+        return std::system_error(errno, std::system_category(), what);
+    }
+}
+
+// PTR queries sent straight to a DNS server from a thread of its own. Only
+// the thread touches queries_, the rest is shared with the resolver under its
+// mutex.
+struct peep::detail::resolver_backend
+{
+    struct query
+    {
+        resolver::address addr;
+        std::string qname;
+        std::vector<unsigned char> message;
+        clock_type::time_point deadline;
+        int attempts;
+    };
+
+    resolver_backend(resolver& r, const std::string& server);
+    ~resolver_backend() noexcept;
+
+    void wake();
+    void run();
+    void send_queries();
+    void receive_answers();
+    void retry_queries();
+    int poll_timeout() const;
+
+    resolver& resolver_;
+    int socket_;
+    int wake_[2]; // pipe written to wake the thread up
+    std::atomic<bool> woken_;
+    std::map<std::uint16_t, query> queries_; // by DNS ID
+    std::thread thread_;
+};
+
+peep::detail::resolver_backend::resolver_backend(
+    resolver& r, const std::string& server)
+    : resolver_(r), socket_(-1), woken_(false)
+{
+    sockaddr_storage ss;
+    socklen_t sslen;
+
+    parse_server(server, ss, sslen);
+
+    wake_[0] = -1;
+    wake_[1] = -1;
+
+    try
+    {
+        if ((socket_ = ::socket(ss.ss_family, SOCK_DGRAM, 0)) == -1)
+            throw socket_error("peep::resolver: socket");
+
+        if (::connect(
+                socket_, reinterpret_cast<struct sockaddr*>(&ss), sslen) == -1)
+            throw socket_error("peep::resolver: connect");
+
+        if (::pipe(wake_) == -1)
+            throw socket_error("peep::resolver: pipe");
+
+        if (::fcntl(socket_, F_SETFL, O_NONBLOCK) == -1 ||
+            ::fcntl(wake_[0], F_SETFL, O_NONBLOCK) == -1 ||
+            ::fcntl(wake_[1], F_SETFL, O_NONBLOCK) == -1)
+            throw socket_error("peep::resolver: fcntl");
+
+        thread_ = std::thread(&resolver_backend::run, this);
+    }
+    catch (...)
+    {
+        ::close(socket_);
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+        throw;
+    }
+}
+
+// the resolver has already been told to quit
+peep::detail::resolver_backend::~resolver_backend() noexcept
+{
+    woken_ = false;
+    wake();
+    thread_.join();
+    ::close(socket_);
+    ::close(wake_[0]);
+    ::close(wake_[1]);
+}
+
+void peep::detail::resolver_backend::wake()
+{
+    static const char c = 0;
+
+    // if the pipe is full the thread will wake up anyway
+    if (!woken_.exchange(true))
+        (void)::write(wake_[1], &c, sizeof(c));
+}
+
+void peep::detail::resolver_backend::run()
+{
+    struct pollfd fds[2];
+    char buf[64];
+
+    fds[0].fd = socket_;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_[0];
+    fds[1].events = POLLIN;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(resolver_.mutex_);
+            if (resolver_.quit_)
+                break;
+        }
+
+        send_queries();
+
+        if (::poll(fds, 2, poll_timeout()) == -1 && errno != EINTR)
+        {
+            std::cerr << "peep::resolver: poll: " << std::strerror(errno)
+                      << "\n";
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            // cleared first, so a wake after this is never missed
+            woken_ = false;
+            while (::read(wake_[0], buf, sizeof(buf)) > 0)
+                continue;
+        }
+
+        if (fds[0].revents & POLLIN)
+            receive_answers();
+
+        retry_queries();
+    }
+}
+
+// sends queries for addresses waiting, while there is room for them
+void peep::detail::resolver_backend::send_queries()
+{
+    std::vector<resolver::address> addrs;
+    resolver::address addr;
+    std::uint16_t id;
+
+    {
+        std::lock_guard<std::mutex> lock(resolver_.mutex_);
+        while (queries_.size() + addrs.size() < resolver_.max_outstanding_ &&
+               resolver_.pop(addr))
+            addrs.push_back(addr);
+    }
+
+    for (auto it = addrs.begin(); it != addrs.end(); ++it)
+    {
+        do
+        {
+            id = static_cast<std::uint16_t>(::arc4random_uniform(0x10000));
+        } while (queries_.count(id) != 0);
+
+        query& q(queries_[id]);
+
+        q.addr = *it;
+        q.qname = ptr_name(*it);
+        encode_query(id, q.qname, q.message);
+        q.deadline = clock_type::now() + query_timeout;
+        q.attempts = 1;
+
+        // a lost query is no different to a lost answer, so errors are left
+        // to the timeout
+        (void)::send(socket_, q.message.data(), q.message.size(), 0);
+    }
+}
+
+void peep::detail::resolver_backend::receive_answers()
+{
+    unsigned char msg[65536];
+    std::string name;
+    ssize_t n;
+    int res;
+
+    while ((n = ::recv(socket_, msg, sizeof(msg), 0)) != -1 ||
+           errno == EINTR || errno == ECONNREFUSED)
+    {
+        if (n < 2)
+            continue;
+
+        auto it = queries_.find(static_cast<std::uint16_t>(get16(msg)));
+
+        if (it == queries_.end())
+            continue;
+
+        name.clear();
+        res = parse_response(
+            msg, static_cast<std::size_t>(n), it->second.qname, name);
+
+        if (res == not_an_answer)
+            continue;
+
+        const resolver::address addr(it->second.addr);
+        queries_.erase(it);
+        resolver_.finish(addr, static_cast<resolver::result>(res), name);
+    }
+}
+
+void peep::detail::resolver_backend::retry_queries()
+{
+    clock_type::time_point now;
+
+    now = clock_type::now();
+
+    for (auto it = queries_.begin(); it != queries_.end();)
+    {
+        query& q(it->second);
+
+        if (now < q.deadline)
+        {
+            ++it;
+        }
+        else if (q.attempts < max_attempts)
+        {
+            (void)::send(socket_, q.message.data(), q.message.size(), 0);
+            q.deadline = now + query_timeout;
+            ++q.attempts;
+            ++it;
+        }
+        else
+        {
+            const resolver::address addr(q.addr);
+            it = queries_.erase(it);
+            resolver_.finish(addr, resolver::error, std::string());
+        }
+    }
+}
+
+// milliseconds until the next query times out, or -1 to wait for ever
+int peep::detail::resolver_backend::poll_timeout() const
+{
+    clock_type::time_point first;
+
+    if (queries_.empty())
+        return -1;
+
+    first = queries_.begin()->second.deadline;
+    for (auto it = queries_.begin(); it != queries_.end(); ++it)
+    {
+        if (it->second.deadline < first)
+            first = it->second.deadline;
+    }
+
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        first - clock_type::now());
+
+    // rounded up, so the query has timed out when poll returns
+    return (wait.count() < 0) ? 0 : static_cast<int>(wait.count()) + 1;
+}
+
+std::size_t
+peep::resolver::address_hash::operator()(const address& addr) const
+{
+    std::uint64_t hash;
+
+    // 64-bit FNV-1a
+    hash = 14695981039346656037ull ^ static_cast<unsigned int>(addr.family);
+    for (std::size_t i = 0; i < sizeof(addr.bytes); ++i)
+        hash = (hash ^ addr.bytes[i]) * 1099511628211ull;
+
+    return hash;
+}
+
+bool peep::resolver::address_equal::operator()(
+    const address& a, const address& b) const
+{
+    return a.family == b.family &&
+           std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+}
+
+peep::resolver::resolver(
+    async& async, const callback_type& callback, const options& opts)
+    : callback_(callback),
+      max_outstanding_(opts.max_outstanding > 0 ? opts.max_outstanding : 1),
+      max_waiting_(opts.max_waiting > 0 ? opts.max_waiting : 1),
+      quit_(false),
+      workers_(0),
+      async_(async)
+{
+    if (!opts.server.empty())
+        backend_.reset(new detail::resolver_backend(*this, opts.server));
+}
+
+peep::resolver::~resolver() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+        waiting_.clear();
+        waiting_index_.clear();
+    }
+
+    backend_.reset();
+
+    // drain() calls still queued on async_ will see quit_ and return
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this]() { return workers_ == 0; });
+}
+
+void peep::resolver::request(const address& addr)
+{
+    std::vector<address> expired;
+    bool start;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (quit_ || outstanding_.count(addr) != 0)
+            return;
+
+        auto it = waiting_index_.find(addr);
+
+        if (it != waiting_index_.end())
+        {
+            // asked for again, so most likely still on screen
+            waiting_.splice(waiting_.begin(), waiting_, it->second);
+            return;
+        }
+
+        waiting_.push_front(addr);
+
+        try
+        {
+            waiting_index_.insert(std::make_pair(addr, waiting_.begin()));
+        }
+        catch (...)
+        {
+            waiting_.pop_front();
+            throw;
+        }
+
+        while (waiting_.size() > max_waiting_)
+        {
+            expired.push_back(waiting_.back());
+            waiting_index_.erase(waiting_.back());
+            waiting_.pop_back();
+        }
+
+        start = (backend_ == nullptr && workers_ < max_outstanding_);
+        if (start)
+            ++workers_;
+    }
+
+    if (start)
+    {
+        try
+        {
+            async_.enqueue([this]() { drain(); });
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --workers_;
+            throw;
+        }
+    }
+    else if (backend_ != nullptr)
+    {
+        backend_->wake();
+    }
+
+    for (auto it = expired.begin(); it != expired.end(); ++it)
+        callback_(*it, resolver::dropped, std::string());
+}
+
+void peep::resolver::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    waiting_.clear();
+    waiting_index_.clear();
+}
+
+// looks up waiting addresses with getnameinfo until there are none left
+void peep::resolver::drain()
+{
+    address addr;
+    std::string name;
+    result res;
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!pop(addr))
+            {
+                --workers_;
+                cv_.notify_all();
+                return;
+            }
+        }
+
+        name.clear();
+        res = lookup_system(addr, name);
+        finish(addr, res, name);
+    }
+}
+
+bool peep::resolver::pop(address& addr)
+{
+    if (quit_ || waiting_.empty())
+        return false;
+
+    addr = waiting_.front();
+    outstanding_.insert(addr);
+    waiting_index_.erase(addr);
+    waiting_.pop_front();
+
+    return true;
+}
+
+void peep::resolver::finish(
+    const address& addr, result res, const std::string& name)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_.erase(addr);
+        if (quit_)
+            return;
+    }
+
+    try
+    {
+        callback_(addr, res, name);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "peep::resolver: Callback error: " << e.what() << "\n";
+    }
+    catch (...)
+    {
+        std::cerr << "peep::resolver: Callback error: unknown exception\n";
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef PACKETPEEPER_RESOLVER_HPP
+#define PACKETPEEPER_RESOLVER_HPP
+
+#include "async.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace peep
+{
+    class resolver;
+
+    namespace detail
+    {
+        struct resolver_backend;
+    }
+}
+
+// Reverse lookups of IP addresses, between HostCache and the threads doing the
+// lookups. Requests for an address already waiting or being looked up are
+// coalesced, and only so many lookups are outstanding at once, the rest wait,
+// most recently requested first. Table views ask for the names of the rows
+// they draw, so the most recent requests are the ones on screen.
+//
+// Lookups go through getnameinfo on an async's threads, or, if a server is
+// given, as PTR queries sent straight to it, pipelined over one UDP socket.
+class peep::resolver
+{
+  public:
+    struct address
+    {
+        int family;              // AF_INET or AF_INET6
+        unsigned char bytes[16]; // only the first 4 for AF_INET
+    };
+
+    enum result
+    {
+        success,
+        noname,
+        error,
+        dropped // waited too long, so forgotten without being looked up
+    };
+
+    typedef std::function<void(const address&, result, const std::string&)>
+        callback_type;
+
+    struct options
+    {
+        options() : max_outstanding(4), max_waiting(4096)
+        {
+        }
+
+        std::size_t max_outstanding;
+        std::size_t max_waiting; // beyond which the oldest requests are dropped
+        std::string server; // "address" or "address@port", or empty
+    };
+
+    // callback is called on the resolver's threads, once for each address
+    // requested, unless cleared or destroyed first. Throws
+    // std::invalid_argument if the server can't be parsed and
+    // std::system_error if a socket can't be set up for it.
+    resolver(async& async, const callback_type& callback, const options& opts);
+    ~resolver() noexcept;
+
+    resolver(const resolver&) = delete;
+    resolver& operator=(const resolver&) = delete;
+
+    void request(const address& addr);
+
+    // forgets the requests waiting, lookups in progress still complete
+    void clear();
+
+    struct address_hash
+    {
+        std::size_t operator()(const address& addr) const;
+    };
+
+    struct address_equal
+    {
+        bool operator()(const address& a, const address& b) const;
+    };
+
+  private:
+    typedef std::list<address> waiting_list;
+
+    friend struct detail::resolver_backend;
+
+    void drain();
+    bool pop(address& addr); // with mutex_ held
+    void finish(const address& addr, result res, const std::string& name);
+
+    callback_type callback_;
+    std::size_t max_outstanding_;
+    std::size_t max_waiting_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool quit_;
+    std::size_t workers_; // drain() calls queued or running on async_
+    waiting_list waiting_; // most recently requested first
+    std::unordered_map<address,
+                       waiting_list::iterator,
+                       address_hash,
+                       address_equal>
+        waiting_index_;
+    std::unordered_set<address, address_hash, address_equal> outstanding_;
+
+    async& async_;
+    std::unique_ptr<detail::resolver_backend> backend_; // only with a server
+};
+
+#endif
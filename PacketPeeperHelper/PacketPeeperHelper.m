@@ -23,6 +23,8 @@
 #include "../Shared/ObjectIO/Messages.h"
 #include "../Shared/ObjectIO/ObjectIO.h"
 #include "../Shared/ObjectIO/socketpath.h"
+#include "../PacketPeeper/Filters/PPBPFProgram.h"
+#include "../PacketPeeper/Filters/bpf_filter.h"
 #include "../Shared/PacketPeeper.h"
 #include "Bpf.h"
 #import <Foundation/NSArray.h>
@@ -65,6 +67,9 @@ int main(void)
     struct fd_set rset;      /* select read fd's */
     Bpf* bpf;                /* bpf object (see bpf(4)) */
     id obj;                  /* stores object read from fd_out */
+    PPBPFProgram* displayProgram; /* packets it rejects aren't forwarded */
+    unsigned long long discarded; /* packets rejected by displayProgram */
+    unsigned long long reported;  /* last value of discarded sent */
     ObjectIO* objio;
     NSAutoreleasePool* pool;
 
@@ -114,6 +119,9 @@ int main(void)
     FD_SET(sock_fd, &rset);
 
     poolcount = 0;
+    displayProgram = nil;
+    discarded = 0;
+    reported = 0;
 
     while ((n = select(bpf_fd + 1, &rset, NULL, NULL, timeout)) > 0)
     {
@@ -134,6 +142,11 @@ int main(void)
                     if ([obj filterProgram] != nil)
                         [bpf setFilterProgram:[obj filterProgram]];
                 }
+                else if ([obj isMemberOfClass:[MsgDisplayFilter class]])
+                {
+                    [displayProgram release];
+                    displayProgram = [[obj filterProgram] retain];
+                }
                 else if ([obj isMemberOfClass:[MsgQuit class]])
                 {
                     exit(EXIT_SUCCESS);
@@ -170,6 +183,7 @@ int main(void)
                     struct bpf_hdr* hdr;
                     NSData* data;
                     NSData* tempData;
+                    u_int buflen;
 
                     data = [parray objectAtIndex:i];
 
@@ -183,6 +197,25 @@ int main(void)
                     if (hdr->bh_hdrlen > [data length])
                         continue;
 
+                    /* run the display filter before going to the expense of
+                       archiving the packet and sending it to the app */
+                    if (displayProgram != nil)
+                    {
+                        buflen = [data length] - hdr->bh_hdrlen;
+                        if (buflen > hdr->bh_caplen)
+                            buflen = hdr->bh_caplen;
+
+                        if (bpf_filter2(
+                                [displayProgram program]->bf_insns,
+                                (u_char*)[data bytes] + hdr->bh_hdrlen,
+                                hdr->bh_datalen,
+                                buflen) == 0)
+                        {
+                            ++discarded;
+                            continue;
+                        }
+                    }
+
                     /* remove the bpf header from data */
                     if ((tempData = [[NSData alloc]
                              initWithBytesNoCopy:(uint8_t*)[data bytes] +
@@ -209,6 +242,18 @@ int main(void)
                     [pkt release];
                 }
                 [parray release];
+
+                if (discarded != reported)
+                {
+                    MsgFilterStatistics* stats;
+
+                    stats = [[MsgFilterStatistics alloc]
+                        initWithDiscarded:discarded];
+                    if ([objio write:stats] <= 0)
+                        err_exit(objio);
+                    [stats release];
+                    reported = discarded;
+                }
             }
         }
 
@@ -235,6 +280,7 @@ int main(void)
     }
 
     (void)close(sock_fd);
+    [displayProgram release];
     [bpf release];
     [objio release];
     [pool release];
@@ -108,6 +108,12 @@
 - (NSString*)codeString;
 - (NSString*)gateway;
 - (NSString*)resolvGateway;
+/* queries and their replies share an identifier, and each query has its own
+   sequence number. Both are in network byte order, and are 0 unless
+   hasIdentifier */
+- (BOOL)hasIdentifier;
+- (uint16_t)identifier;
+- (uint16_t)sequenceNumber;
 
 /* private methods */
 - (id<OutlineViewItem>)resolvCallback:(void*)data;
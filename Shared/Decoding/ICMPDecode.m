@@ -393,6 +393,21 @@ err:
     return nil;
 }
 
+- (BOOL)hasIdentifier
+{
+    return ((fields & ICMPDECODE_UPPERMASK) == ICMPDECODE_IDSEQ);
+}
+
+- (uint16_t)identifier
+{
+    return [self hasIdentifier] ? cont.upper.idseq.ident : 0;
+}
+
+- (uint16_t)sequenceNumber
+{
+    return [self hasIdentifier] ? cont.upper.idseq.seq : 0;
+}
+
 - (id<OutlineViewItem>)resolvCallback:(void*)data
 {
     OutlineViewItem* ret;
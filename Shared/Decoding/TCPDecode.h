@@ -34,6 +34,7 @@
 @class NSString;
 @class Packet;
 @class IPV4Decode;
+@class IPV6Decode;
 
 @interface TCPDecode
     : NSObject <Decode, Describe, NSCoding, OutlineViewItem, ColumnIdentifier>
@@ -61,6 +62,7 @@
 - (uint16_t)computedChecksum;
 - (uint32_t)seqNo;
 - (uint32_t)ackNo;
+- (uint16_t)window; /* as advertised, without any scaling */
 - (unsigned int)srcPort;
 - (unsigned int)dstPort;
 - (uint8_t)flags;
@@ -75,6 +77,7 @@
 - (uint32_t)size;
 - (NSData*)payload;
 - (IPV4Decode*)ip;
+- (IPV6Decode*)ip6;
 - (id<PPDecoderParent>)parent;
 - (NSDate*)date;
 - (BOOL)isInOrder;
@@ -47,6 +47,14 @@ static NSString* names[][2] = {{@"Source Port", @"TCP Src Port"},
                                {@"Destination Port Name", @"TCP Dst Port *"},
                                {@"Flags Meaning", @"TCP Flags *"}};
 
+/* the IP length bounds the segment, so trailers from lower layers aren't
+   counted as payload */
+static inline BOOL is_ip_decoder(id decoder)
+{
+    return ([decoder isMemberOfClass:[IPV4Decode class]] ||
+            [decoder isMemberOfClass:[IPV6Decode class]]);
+}
+
 @implementation TCPDecode
 
 - (id)initWithData:(NSData*)dataVal parent:(id<PPDecoderParent>)parentVal
@@ -309,6 +317,11 @@ err:
     return ack_no;
 }
 
+- (uint16_t)window
+{
+    return win_sz;
+}
+
 - (unsigned int)srcPort
 {
     return sport;
@@ -386,7 +399,7 @@ err:
     {
         /* we need to find the ip length so that we do not incorrectly count trailers from other protocols */
         if (iplen == 0 &&
-            [[decoders objectAtIndex:i] isMemberOfClass:[IPV4Decode class]])
+            is_ip_decoder([decoders objectAtIndex:i]))
         {
             iplen = [[decoders objectAtIndex:i] length];
 
@@ -435,7 +448,7 @@ err:
         htotal += [[decoders objectAtIndex:i] frontSize];
 
         if (iplen == 0 &&
-            [[decoders objectAtIndex:i] isMemberOfClass:[IPV4Decode class]])
+            is_ip_decoder([decoders objectAtIndex:i]))
         {
             iplen = [[decoders objectAtIndex:i] length];
 
@@ -474,6 +487,11 @@ err:
     return [parent decoderForClass:[IPV4Decode class]];
 }
 
+- (IPV6Decode*)ip6
+{
+    return [parent decoderForClass:[IPV6Decode class]];
+}
+
 - (id<PPDecoderParent>)parent
 {
     return parent;
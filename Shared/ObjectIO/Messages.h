@@ -58,4 +58,29 @@
 
 @end
 
+/* sent to the helper to set the display filter, which it runs over each
+   packet before forwarding it, so packets the document would hide aren't
+   sent at all. May be sent at any time during a capture. */
+@interface MsgDisplayFilter : NSObject <NSCoding>
+{
+    PPBPFProgram* filterProgram; /* nil to forward every packet */
+}
+
+- (id)initWithFilterProgram:(PPBPFProgram*)aFilterProgram;
+- (PPBPFProgram*)filterProgram;
+
+@end
+
+/* sent by the helper whenever it has discarded more packets */
+@interface MsgFilterStatistics : NSObject <NSCoding>
+{
+    unsigned long long discarded; /* total packets rejected by the display
+                                     filter since the capture started */
+}
+
+- (id)initWithDiscarded:(unsigned long long)discardedVal;
+- (unsigned long long)discarded;
+
+@end
+
 #endif /* _MESSAGES_H_ */
@@ -137,3 +137,84 @@
 }
 
 @end
+
+@implementation MsgDisplayFilter
+
+- (void)encodeWithCoder:(NSCoder*)coder
+{
+    [coder encodeObject:filterProgram];
+}
+
+- (id)initWithCoder:(NSCoder*)coder
+{
+    if ((self = [super init]) != nil)
+    {
+        filterProgram = [[coder decodeObject] retain];
+    }
+    return self;
+}
+
+- (id)initWithFilterProgram:(PPBPFProgram*)aFilterProgram
+{
+    if ((self = [super init]) != nil)
+    {
+        filterProgram = [aFilterProgram retain];
+    }
+    return self;
+}
+
+- (id)init
+{
+    return [self initWithFilterProgram:nil];
+}
+
+- (PPBPFProgram*)filterProgram
+{
+    return filterProgram;
+}
+
+- (void)dealloc
+{
+    [filterProgram release];
+    [super dealloc];
+}
+
+@end
+
+@implementation MsgFilterStatistics
+
+- (void)encodeWithCoder:(NSCoder*)coder
+{
+    [coder encodeValueOfObjCType:@encode(unsigned long long) at:&discarded];
+}
+
+- (id)initWithCoder:(NSCoder*)coder
+{
+    if ((self = [super init]) != nil)
+    {
+        [coder decodeValueOfObjCType:@encode(unsigned long long)
+                                  at:&discarded];
+    }
+    return self;
+}
+
+- (id)initWithDiscarded:(unsigned long long)discardedVal
+{
+    if ((self = [super init]) != nil)
+    {
+        discarded = discardedVal;
+    }
+    return self;
+}
+
+- (id)init
+{
+    return [self initWithDiscarded:0];
+}
+
+- (unsigned long long)discarded
+{
+    return discarded;
+}
+
+@end
@@ -55,6 +55,13 @@
     @"PPTCPStreamControllerIPDropBadChecksums"
 #define PPTCPSTREAMCONTROLLER_TCP_DROP_BAD_CHECKSUMS \
     @"PPTCPStreamControllerTCPDropBadChecksums"
+#define PPTCPSTREAMCONTROLLER_MAX_STREAMS @"PPTCPStreamControllerMaxStreams"
+#define PPTCPSTREAMCONTROLLER_MAX_PACKETS @"PPTCPStreamControllerMaxPackets"
+#define PPHOSTCACHE_CAPACITY              @"PPHostCacheCapacity"
+#define PPHOSTCACHE_POSITIVE_TTL          @"PPHostCachePositiveTTL"
+#define PPHOSTCACHE_NEGATIVE_TTL          @"PPHostCacheNegativeTTL"
+#define PPHOSTCACHE_MAX_QUERIES           @"PPHostCacheMaxQueries"
+#define PPHOSTCACHE_DNS_SERVER            @"PPHostCacheDNSServer"
 #define PPHEXVIEW_LINECOLUMN_MODE @"PPHexView.LineColumnMode"
 
 /* how often to update progress bars, in seconds */
@@ -63,6 +70,22 @@
 /* how often to update the user interface, in seconds */
 #define DEFAULT_UI_UPDATE_FREQUENCY 1.0f
 
+/* limits on the streams tracked during a live capture, beyond which the
+   least recently active streams are summarised */
+#define DEFAULT_TCPSTREAM_MAX_STREAMS 65536
+#define DEFAULT_TCPSTREAM_MAX_PACKETS (4 * 1024 * 1024)
+
+/* limits on the host names cached, and how long names and failed lookups
+   are kept, in seconds */
+#define DEFAULT_HOSTCACHE_CAPACITY     (256 * 1024)
+#define DEFAULT_HOSTCACHE_POSITIVE_TTL 3600.0
+#define DEFAULT_HOSTCACHE_NEGATIVE_TTL 300.0
+
+/* host name lookups outstanding at once, and where to send them, as
+   "address" or "address@port", or empty to use the system's resolver */
+#define DEFAULT_HOSTCACHE_MAX_QUERIES 4
+#define DEFAULT_HOSTCACHE_DNS_SERVER  @""
+
 #define OUTLINEVIEW_DATE_FORMAT @"EEEE, dd MMMM yyyy, HH:mm:ss.SSS"
 #define TABLEVIEW_DATE_FORMAT   @"yyyy-MM-dd HH:mm:ss.SSS"
 
@@ -91,6 +114,13 @@
 #define PPSTREAMSWINDOW_STREAMS_TABLE_BYTES_TOTAL    @"Total"
 #define PPSTREAMSWINDOW_STREAMS_TABLE_STATUS         @"Status"
 
+#define PPSTREAMSWINDOW_STREAMS_TABLE_HANDSHAKE_RTT   @"HandshakeRTT"
+#define PPSTREAMSWINDOW_STREAMS_TABLE_RTT             @"RTT"
+#define PPSTREAMSWINDOW_STREAMS_TABLE_RETRANSMISSIONS @"Retransmissions"
+#define PPSTREAMSWINDOW_STREAMS_TABLE_ZERO_WINDOWS    @"ZeroWindows"
+#define PPSTREAMSWINDOW_STREAMS_TABLE_THROUGHPUT      @"Throughput"
+#define PPSTREAMSWINDOW_STREAMS_TABLE_PEAK_THROUGHPUT @"PeakThroughput"
+
 #define PPSTREAMSWINDOW_STREAMS_TABLE_SRC_IP_ADDRESS_TAG 1
 #define PPSTREAMSWINDOW_STREAMS_TABLE_DST_IP_ADDRESS_TAG 2
 #define PPSTREAMSWINDOW_STREAMS_TABLE_SRC_HOSTNAME_TAG   3
@@ -104,6 +134,13 @@
 #define PPSTREAMSWINDOW_STREAMS_TABLE_BYTES_TOTAL_TAG    11
 #define PPSTREAMSWINDOW_STREAMS_TABLE_STATUS_TAG         12
 
+#define PPSTREAMSWINDOW_STREAMS_TABLE_HANDSHAKE_RTT_TAG   13
+#define PPSTREAMSWINDOW_STREAMS_TABLE_RTT_TAG             14
+#define PPSTREAMSWINDOW_STREAMS_TABLE_RETRANSMISSIONS_TAG 15
+#define PPSTREAMSWINDOW_STREAMS_TABLE_ZERO_WINDOWS_TAG    16
+#define PPSTREAMSWINDOW_STREAMS_TABLE_THROUGHPUT_TAG      17
+#define PPSTREAMSWINDOW_STREAMS_TABLE_PEAK_THROUGHPUT_TAG 18
+
 /* tags used to (easily) traverse the app menu, set in MainMenu.nib */
 #define APPMENU_ITEM_VIEW_TAG           1
 #define APPMENU_ITEM_COLUMNS_TAG        2